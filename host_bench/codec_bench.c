@@ -0,0 +1,220 @@
+/**
+ * @file codec_bench.c
+ * @brief Host benchmark of the JSON / CBOR codecs (bytes and time per message)
+ *
+ * Builds the firmware codec sources (json_writer.c, cbor_codec.c,
+ * json_decoder.c, command_decoder.c) with the host compiler and
+ * reports, for each message in both encodings:
+ *  - payload size in bytes
+ *  - encode time (telemetry) or decode time (command) in ns
+ *
+ *   make -C host_bench run
+ *
+ * The telemetry builder writes the same fields in the same order as
+ * create_valve_telemetry() (mqtt_state_fn.c); keep the two in step.
+ * start_cbor_benchmark() in test_process.c measures the same on the
+ * device, in CPU cycles.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "codec_fn/command_decoder.h"
+#include "codec_fn/json_decoder.h"
+#include "codec_fn/json_writer.h"
+
+#define BENCH_ITERATIONS    100000
+#define BENCH_ROUNDS        7           // Fastest round is reported (less scheduler noise)
+#define BENCH_BUFFER_SIZE   1280        // MQTT_TX_BUFFER_SIZE
+#define BENCH_DEVICE_ID     "VA202601001"
+
+// Representative control_data message with a full schedule (test_process.c)
+static const char control_sample[] =
+    "{\"event\":\"set_valve_control\",\"device_id\":\"" BENCH_DEVICE_ID "\","
+    "\"set_controllerdata\":{\"schedule\":true,\"sensor\":false},"
+    "\"set_scheduledata\":{\"set_schedule\":true,\"schedule_info\":["
+    "{\"day\":\"Monday\",\"open\":\"06:00\",\"close\":\"06:30\"},"
+    "{\"day\":\"Monday\",\"open\":\"18:00\",\"close\":\"18:30\"},"
+    "{\"day\":\"Tuesday\",\"open\":\"06:00\",\"close\":\"06:30\"},"
+    "{\"day\":\"Wednesday\",\"open\":\"06:00\",\"close\":\"06:30\"},"
+    "{\"day\":\"Thursday\",\"open\":\"06:00\",\"close\":\"06:30\"},"
+    "{\"day\":\"Friday\",\"open\":\"06:00\",\"close\":\"06:30\"},"
+    "{\"day\":\"Friday\",\"open\":\"18:00\",\"close\":\"18:30\"},"
+    "{\"day\":\"Saturday\",\"open\":\"07:00\",\"close\":\"07:45\"},"
+    "{\"day\":\"Sunday\",\"open\":\"07:00\",\"close\":\"07:45\"},"
+    "{\"day\":\"Sunday\",\"open\":\"19:00\",\"close\":\"19:15\"}]},"
+    "\"set_sensordata\":{\"upper_limit\":80,\"lower_limit\":20}}";
+
+static char bench_buf[2][BENCH_BUFFER_SIZE];
+static JsonToken tokens[JSON_DECODER_MAX_TOKENS];
+static ValveCommand cmd;
+
+// Keeps the compiler from dropping the measured calls
+static volatile int bench_sink;
+
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/**
+ * Telemetry as create_valve_telemetry() writes it (header, state, error)
+ */
+static int bench_telemetry(char *buf, size_t size, PayloadFormat format, bool moving)
+{
+    JsonWriter w;
+    jw_init_format(&w, buf, size, format);
+
+    jw_object_begin(&w);
+    jw_key_string(&w, "event", "valve_telemetry");
+    jw_key_string(&w, "timestamp", "2026-10-18T10:00:00Z");
+    jw_key_string(&w, "device_id", BENCH_DEVICE_ID);
+    jw_key_int(&w, "seq", 48213);
+    jw_key_int(&w, "boot_id", 2738139586u);
+    jw_key_int(&w, "mono_us", 86400123456);
+
+    jw_key_object_begin(&w, "get_controller");
+    jw_key_bool(&w, "schedule", true);
+    jw_key_bool(&w, "sensor", false);
+    jw_object_end(&w);
+
+    jw_key_object_begin(&w, "get_valvedata");
+    jw_key_int(&w, "angle", moving ? 35 : 90);
+    jw_key_bool(&w, "is_open", !moving);
+    jw_key_bool(&w, "is_close", false);
+    jw_key_bool(&w, "is_moving", moving);
+    if (moving) {
+        jw_key_int(&w, "motion_ms", 2150);
+    }
+    jw_object_end(&w);
+
+    jw_key_object_begin(&w, "get_limitdata");
+    jw_key_bool(&w, "is_open_limit", true);
+    jw_key_bool(&w, "open_limit", !moving);
+    jw_key_bool(&w, "is_close_limit", true);
+    jw_key_bool(&w, "close_limit", false);
+    jw_object_end(&w);
+
+    jw_key_string(&w, "error", "");
+    jw_object_end(&w);
+
+    return jw_finish(&w);
+}
+
+
+/**
+ * Re-encode a decoded control command (same writer, either format)
+ */
+static int bench_command(const ValveCommand *c, char *buf, size_t size, PayloadFormat format)
+{
+    JsonWriter w;
+    jw_init_format(&w, buf, size, format);
+
+    jw_object_begin(&w);
+    jw_key_string(&w, "event", c->event);
+    jw_key_string(&w, "device_id", c->device_id);
+
+    jw_key_object_begin(&w, "set_controllerdata");
+    jw_key_bool(&w, "schedule", c->schedule_control);
+    jw_key_bool(&w, "sensor", c->sensor_control);
+    jw_object_end(&w);
+
+    jw_key_object_begin(&w, "set_scheduledata");
+    jw_key_bool(&w, "set_schedule", c->set_schedule);
+    jw_key_array_begin(&w, "schedule_info");
+    for (size_t i = 0; i < c->schedule_count; i++) {
+        jw_object_begin(&w);
+        jw_key_string(&w, "day", c->schedule_info[i].day);
+        jw_key_string(&w, "open", c->schedule_info[i].open);
+        jw_key_string(&w, "close", c->schedule_info[i].close);
+        jw_object_end(&w);
+    }
+    jw_array_end(&w);
+    jw_object_end(&w);
+
+    jw_key_object_begin(&w, "set_sensordata");
+    jw_key_int(&w, "upper_limit", c->sensor_upper_limit);
+    jw_key_int(&w, "lower_limit", c->sensor_lower_limit);
+    jw_object_end(&w);
+    jw_object_end(&w);
+
+    return jw_finish(&w);
+}
+
+
+static void bench_encode(const char *name, bool moving)
+{
+    int len[2];
+    double ns[2];
+
+    for (int f = PAYLOAD_JSON; f <= PAYLOAD_CBOR; f++) {
+        ns[f] = 1e12;
+        for (int r = 0; r < BENCH_ROUNDS; r++) {
+            double t0 = now_ns();
+            for (int i = 0; i < BENCH_ITERATIONS; i++) {
+                len[f] = bench_telemetry(bench_buf[f], BENCH_BUFFER_SIZE, (PayloadFormat)f, moving);
+                bench_sink = bench_buf[f][0];
+            }
+            double t = (now_ns() - t0) / BENCH_ITERATIONS;
+            if (t < ns[f]) ns[f] = t;
+        }
+    }
+
+    printf("| %-34s | %4d B | %4d B | encode %4.0f ns | encode %4.0f ns |\n",
+           name, len[PAYLOAD_JSON], len[PAYLOAD_CBOR], ns[PAYLOAD_JSON], ns[PAYLOAD_CBOR]);
+}
+
+
+static int bench_decode(const char *name)
+{
+    int len[2];
+    double ns[2];
+
+    if (command_decode(control_sample, sizeof(control_sample) - 1, PAYLOAD_JSON,
+                       tokens, JSON_DECODER_MAX_TOKENS, &cmd) != ESP_OK) {
+        fprintf(stderr, "control sample does not decode\n");
+        return 1;
+    }
+    len[PAYLOAD_JSON] = bench_command(&cmd, bench_buf[PAYLOAD_JSON], BENCH_BUFFER_SIZE, PAYLOAD_JSON);
+    len[PAYLOAD_CBOR] = bench_command(&cmd, bench_buf[PAYLOAD_CBOR], BENCH_BUFFER_SIZE, PAYLOAD_CBOR);
+
+    for (int f = PAYLOAD_JSON; f <= PAYLOAD_CBOR; f++) {
+        ns[f] = 1e12;
+        for (int r = 0; r < BENCH_ROUNDS; r++) {
+            double t0 = now_ns();
+            for (int i = 0; i < BENCH_ITERATIONS; i++) {
+                esp_err_t err = command_decode(bench_buf[f], len[f], (PayloadFormat)f,
+                                               tokens, JSON_DECODER_MAX_TOKENS, &cmd);
+                bench_sink = err;
+            }
+            double t = (now_ns() - t0) / BENCH_ITERATIONS;
+            if (t < ns[f]) ns[f] = t;
+        }
+
+        // Both encodings must carry the whole command
+        if (cmd.schedule_count != 10 || cmd.sensor_upper_limit != 80) {
+            fprintf(stderr, "%s: decoded command is incomplete\n", f ? "CBOR" : "JSON");
+            return 1;
+        }
+    }
+
+    printf("| %-34s | %4d B | %4d B | decode %4.0f ns | decode %4.0f ns |\n",
+           name, len[PAYLOAD_JSON], len[PAYLOAD_CBOR], ns[PAYLOAD_JSON], ns[PAYLOAD_CBOR]);
+    return 0;
+}
+
+
+int main(void)
+{
+    printf("| %-34s | %6s | %6s | %-15s | %-15s |\n", "Message", "JSON", "CBOR", "JSON time", "CBOR time");
+    printf("|%s|--------|--------|-----------------|-----------------|\n", "------------------------------------");
+
+    bench_encode("`telemetry` (idle)", false);
+    bench_encode("`telemetry` (moving)", true);
+    return bench_decode("`control_data` with 10 schedules");
+}
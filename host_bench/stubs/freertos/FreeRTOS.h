@@ -0,0 +1,5 @@
+/* Host stand-in for the FreeRTOS header (codec benchmark only) */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
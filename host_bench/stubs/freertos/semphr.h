@@ -0,0 +1,4 @@
+/* Host stand-in for the FreeRTOS header (codec benchmark only) */
+#pragma once
+
+typedef void *SemaphoreHandle_t;
@@ -0,0 +1,262 @@
+/**
+ * @file cbor_codec.c
+ * @brief Shared CBOR primitives and the integer key dictionary
+ *
+ * The JSON writer and decoder use these helpers for their CBOR
+ * mode, so every payload builder and command schema works for both
+ * encodings without a second code path.
+ *
+ * Map keys found in the dictionary are sent as small unsigned
+ * integers (1 byte for IDs 0..23) instead of text, which is where
+ * most of the size saving comes from. Keys not in the dictionary
+ * are sent as text strings, and decoders accept either form.
+ */
+
+#include <string.h>
+
+#include "cbor_codec.h"
+
+
+
+/* ======================================================================== */
+/* ============================ KEY DICTIONARY ============================ */
+/* ======================================================================== */
+
+/*
+ * Wire protocol: IDs are the array index. Append new keys at the
+ * end only; never reorder or remove entries.
+ *
+ * The first 24 entries encode in one byte, so they hold the keys
+ * repeated in every telemetry message.
+ */
+static const char *const cbor_keys[] = {
+    /*  0 */ "event",
+    /*  1 */ "timestamp",
+    /*  2 */ "device_id",
+    /*  3 */ "get_controller",
+    /*  4 */ "schedule",
+    /*  5 */ "sensor",
+    /*  6 */ "get_valvedata",
+    /*  7 */ "angle",
+    /*  8 */ "is_open",
+    /*  9 */ "is_close",
+    /* 10 */ "get_limitdata",
+    /* 11 */ "is_open_limit",
+    /* 12 */ "open_limit",
+    /* 13 */ "is_close_limit",
+    /* 14 */ "close_limit",
+    /* 15 */ "error",
+    /* 16 */ "publish_stats",
+    /* 17 */ "sent",
+    /* 18 */ "sent_on_change",
+    /* 19 */ "suppressed",
+    /* 20 */ "status",
+    /* 21 */ "set_controller",
+    /* 22 */ "valve_data",
+    /* 23 */ "set_angle",
+    /* 24 */ "set_controllerdata",
+    /* 25 */ "set_scheduledata",
+    /* 26 */ "set_schedule",
+    /* 27 */ "schedule_info",
+    /* 28 */ "day",
+    /* 29 */ "open",
+    /* 30 */ "close",
+    /* 31 */ "set_sensordata",
+    /* 32 */ "upper_limit",
+    /* 33 */ "lower_limit",
+    /* 34 */ "wifi_data",
+    /* 35 */ "ssid",
+    /* 36 */ "password",
+    /* 37 */ "set_telemetry",
+    /* 38 */ "format",
+    /* 39 */ "encoding",
+    /* 40 */ "data",
+    /* 41 */ "user_id",
+    /* 42 */ "passkey",
+    /* 43 */ "rx_stats",
+    /* 44 */ "messages",
+    /* 45 */ "fragmented",
+    /* 46 */ "dropped",
+    /* 47 */ "queue",
+    /* 48 */ "depth",
+    /* 49 */ "cmd_id",
+    /* 50 */ "timing",
+    /* 51 */ "start_ms",
+    /* 52 */ "run_ms",
+    /* 53 */ "total_ms",
+    /* 54 */ "version",
+    /* 55 */ "desired",
+    /* 56 */ "reported",
+    /* 57 */ "is_moving",
+    /* 58 */ "motion_ms",
+    /* 59 */ "period_ms",
+    /* 60 */ "deferred",
+    /* 61 */ "rssi",
+    /* 62 */ "tls",
+    /* 63 */ "handshake_ms",
+    /* 64 */ "resumed",
+    /* 65 */ "resumptions",
+    /* 66 */ "ready_ms",
+    /* 67 */ "bytes_per_msg",
+    /* 68 */ "link",
+    /* 69 */ "pauses",
+    /* 70 */ "offline_ms",
+    /* 71 */ "outbox",
+    /* 72 */ "bytes",
+    /* 73 */ "enq_us",
+    /* 74 */ "enq_max_us",
+    /* 75 */ "diverted",
+    /* 76 */ "reconnect",
+    /* 77 */ "wifi",
+    /* 78 */ "mqtt",
+    /* 79 */ "attempts",
+    /* 80 */ "max_streak",
+    /* 81 */ "delay_ms",
+    /* 82 */ "outage_ms",
+    /* 83 */ "hints",
+    /* 84 */ "broker",
+    /* 85 */ "active",
+    /* 86 */ "rtt_ms",
+    /* 87 */ "failovers",
+    /* 88 */ "returns",
+    /* 89 */ "failover_ms",
+    /* 90 */ "groups",
+    /* 91 */ "count",
+    /* 92 */ "stagger_ms",
+    /* 93 */ "group_cmds",
+    /* 94 */ "staggered",
+    /* 95 */ "set_groups",
+    /* 96 */ "method",
+    /* 97 */ "correlation_id",
+    /* 98 */ "result",
+    /* 99 */ "shed",
+    /* 100 */ "queue_hw",
+    /* 101 */ "seq",
+    /* 102 */ "boot_id",
+    /* 103 */ "mono_us",
+    /* 104 */ "schedule_hash",
+    /* 105 */ "sched_cache",
+    /* 106 */ "hits",
+    /* 107 */ "misses",
+    /* 108 */ "fetched",
+    /* 109 */ "rejected",
+};
+
+#define CBOR_KEY_COUNT  (int)(sizeof(cbor_keys) / sizeof(cbor_keys[0]))
+
+
+/**
+ * @brief Look up the dictionary ID of a map key
+ *
+ * @return Key ID, or -1 if the key is sent as text
+ */
+int cbor_key_id(const char *key)
+{
+    for (int i = 0; i < CBOR_KEY_COUNT; i++) {
+        // Cheap first-character reject before the full compare
+        if (cbor_keys[i][0] == key[0] && strcmp(cbor_keys[i], key) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Reverse lookup for logging and tools
+ *
+ * @return Key name, or NULL for an unknown ID
+ */
+const char *cbor_key_name(int id)
+{
+    if (id < 0 || id >= CBOR_KEY_COUNT) return NULL;
+    return cbor_keys[id];
+}
+
+
+
+/* ======================================================================== */
+/* ================================ HEADS ================================= */
+/* ======================================================================== */
+
+/**
+ * @brief Encode a data item head in its shortest form
+ *
+ * @param out    At least CBOR_MAX_HEAD bytes
+ * @param major  CBOR_MAJOR_*
+ * @param value  Argument (integer, length or count)
+ *
+ * @return Number of bytes written (1, 2, 3, 5 or 9)
+ */
+size_t cbor_put_head(uint8_t *out, uint8_t major, uint64_t value)
+{
+    uint8_t mt = (uint8_t)(major << 5);
+
+    if (value < 24) {
+        out[0] = mt | (uint8_t)value;
+        return 1;
+    }
+
+    size_t n;
+    if (value <= UINT8_MAX) {
+        out[0] = mt | 24;
+        n = 1;
+    } else if (value <= UINT16_MAX) {
+        out[0] = mt | 25;
+        n = 2;
+    } else if (value <= UINT32_MAX) {
+        out[0] = mt | 26;
+        n = 4;
+    } else {
+        out[0] = mt | 27;
+        n = 8;
+    }
+
+    // Big-endian argument
+    for (size_t i = 0; i < n; i++) {
+        out[n - i] = (uint8_t)(value >> (8 * i));
+    }
+
+    return n + 1;
+}
+
+/**
+ * @brief Decode a data item head
+ *
+ * For major type 7, info 20..27 are simple values / floats and the
+ * argument holds the raw float bits.
+ *
+ * @return false if the head is truncated or uses a reserved value
+ */
+bool cbor_read_head(const uint8_t *p, size_t avail, CborHead *head)
+{
+    if (avail == 0) return false;
+
+    head->major = p[0] >> 5;
+    head->info = p[0] & 0x1F;
+    head->value = 0;
+
+    if (head->info < 24) {
+        head->value = head->info;
+        head->len = 1;
+        return true;
+    }
+
+    if (head->info == CBOR_INFO_INDEFINITE) {
+        head->len = 1;
+        return true;
+    }
+
+    if (head->info > 27) {
+        return false;       // Reserved (28..30)
+    }
+
+    size_t n = (size_t)1 << (head->info - 24);
+    if (avail < n + 1) return false;
+
+    for (size_t i = 0; i < n; i++) {
+        head->value = (head->value << 8) | p[1 + i];
+    }
+
+    head->len = (uint8_t)(n + 1);
+    return true;
+}
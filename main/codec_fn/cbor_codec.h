@@ -0,0 +1,47 @@
+#ifndef CBOR_CODEC_H
+#define CBOR_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// CBOR major types (RFC 8949 §3.1)
+#define CBOR_MAJOR_UINT         0
+#define CBOR_MAJOR_NINT         1
+#define CBOR_MAJOR_BYTES        2
+#define CBOR_MAJOR_TEXT         3
+#define CBOR_MAJOR_ARRAY        4
+#define CBOR_MAJOR_MAP          5
+#define CBOR_MAJOR_TAG          6
+#define CBOR_MAJOR_SIMPLE       7
+
+#define CBOR_FALSE              0xF4
+#define CBOR_TRUE               0xF5
+#define CBOR_NULL               0xF6
+#define CBOR_BREAK              0xFF
+#define CBOR_INDEF_ARRAY        0x9F
+#define CBOR_INDEF_MAP          0xBF
+
+// Additional info value for indefinite-length items
+#define CBOR_INFO_INDEFINITE    31
+
+// Longest possible head (initial byte + 8 byte argument)
+#define CBOR_MAX_HEAD           9
+
+/**
+ * @brief Decoded head of one CBOR data item
+ */
+typedef struct {
+    uint8_t major;
+    uint8_t info;       // Low 5 bits of the initial byte
+    uint64_t value;     // Argument (length, count or integer)
+    uint8_t len;        // Head size in bytes
+} CborHead;
+
+size_t cbor_put_head(uint8_t *out, uint8_t major, uint64_t value);
+bool   cbor_read_head(const uint8_t *p, size_t avail, CborHead *head);
+
+int         cbor_key_id(const char *key);
+const char *cbor_key_name(int id);
+
+#endif // CBOR_CODEC_H
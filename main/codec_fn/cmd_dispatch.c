@@ -0,0 +1,179 @@
+/**
+ * @file cmd_dispatch.c
+ * @brief Perfect-hash dispatch of decoded commands (MQTT and WebSocket)
+ *
+ * Each transport registers a small table of routes (event names or
+ * topic suffixes). At init a seed is searched so that the seeded
+ * FNV-1a hash maps every name of the table to its own slot, i.e. a
+ * perfect hash for that table. A lookup is then one hash, one slot
+ * read and one compare, whatever the number of routes.
+ *
+ * Adding a command is one CmdRoute entry in the transport's table;
+ * a table whose names cannot be separated (or that has duplicate
+ * names) is reported by cmd_dispatch_init() at startup.
+ */
+
+#include <string.h>
+#include "esp_log.h"
+
+#include "cmd_dispatch.h"
+
+
+#define CMD_DISPATCH_MASK       (CMD_DISPATCH_SLOTS - 1)
+#define CMD_DISPATCH_MAX_SEED   1024
+
+#define FNV_OFFSET_BASIS        2166136261u
+#define FNV_PRIME               16777619u
+
+_Static_assert((CMD_DISPATCH_SLOTS & CMD_DISPATCH_MASK) == 0,
+               "CMD_DISPATCH_SLOTS must be a power of two");
+
+static const char *TAG = "CMD_DISPATCH";
+
+
+
+/* ======================================================================== */
+/* ================================ HASH ================================== */
+/* ======================================================================== */
+
+static inline uint32_t slot_of(uint32_t seed, const char *key, size_t len)
+{
+    uint32_t h = FNV_OFFSET_BASIS ^ seed;
+
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)key[i];
+        h *= FNV_PRIME;
+    }
+
+    // Fold the high bits in; FNV-1a low bits alone separate short keys poorly
+    h ^= h >> 16;
+
+    return h & CMD_DISPATCH_MASK;
+}
+
+
+/**
+ * @brief Try one seed; true if every route gets its own slot
+ */
+static bool place_routes(CmdDispatchTable *table, uint32_t seed)
+{
+    memset(table->slots, 0, sizeof(table->slots));
+
+    for (size_t i = 0; i < table->count; i++) {
+        const char *name = table->routes[i].name;
+        uint32_t slot = slot_of(seed, name, strlen(name));
+
+        if (table->slots[slot] != 0) {
+            return false;
+        }
+        table->slots[slot] = (uint8_t)(i + 1);
+    }
+
+    table->seed = seed;
+    return true;
+}
+
+
+
+/* ======================================================================== */
+/* ============================== PUBLIC API ============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Build the perfect hash for a route table
+ *
+ * @param table   Table to fill (usually static)
+ * @param label   Name used in logs
+ * @param routes  Route array; must outlive the table
+ * @param count   Number of routes (< CMD_DISPATCH_SLOTS)
+ *
+ * @return ESP_OK,
+ *         ESP_ERR_INVALID_ARG for duplicate / missing names or handlers,
+ *         ESP_ERR_INVALID_SIZE if the table is too large,
+ *         ESP_ERR_NOT_FOUND if no collision-free seed exists
+ */
+esp_err_t cmd_dispatch_init(CmdDispatchTable *table, const char *label,
+                            const CmdRoute *routes, size_t count)
+{
+    memset(table, 0, sizeof(*table));
+    table->label = label;
+    table->routes = routes;
+
+    if (count >= CMD_DISPATCH_SLOTS) {
+        ESP_LOGE(TAG, "%s: %u routes, at most %d", label, (unsigned)count, CMD_DISPATCH_SLOTS - 1);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (routes[i].name == NULL || routes[i].handler == NULL) {
+            ESP_LOGE(TAG, "%s: route %u incomplete", label, (unsigned)i);
+            return ESP_ERR_INVALID_ARG;
+        }
+        for (size_t j = 0; j < i; j++) {
+            if (strcmp(routes[i].name, routes[j].name) == 0) {
+                ESP_LOGE(TAG, "%s: duplicate route \"%s\"", label, routes[i].name);
+                return ESP_ERR_INVALID_ARG;
+            }
+        }
+    }
+
+    table->count = count;
+
+    for (uint32_t seed = 0; seed < CMD_DISPATCH_MAX_SEED; seed++) {
+        if (place_routes(table, seed)) {
+            ESP_LOGI(TAG, "%s: %u routes, seed %lu", label, (unsigned)count, (unsigned long)seed);
+            return ESP_OK;
+        }
+    }
+
+    // Leave the table empty so lookups fail instead of misrouting
+    memset(table->slots, 0, sizeof(table->slots));
+    ESP_LOGE(TAG, "%s: no collision-free seed", label);
+    return ESP_ERR_NOT_FOUND;
+}
+
+
+/**
+ * @brief Look up a route by name
+ *
+ * @param key      Event name or topic suffix (need not be NUL-terminated)
+ * @param key_len  Length of key
+ *
+ * @return Matching route, or NULL
+ */
+const CmdRoute *cmd_dispatch_find(const CmdDispatchTable *table, const char *key, size_t key_len)
+{
+    if (key == NULL) return NULL;
+
+    uint8_t idx = table->slots[slot_of(table->seed, key, key_len)];
+    if (idx == 0) return NULL;
+
+    const CmdRoute *route = &table->routes[idx - 1];
+
+    // One compare rejects names that hash into an occupied slot
+    if (strncmp(route->name, key, key_len) != 0 || route->name[key_len] != '\0') {
+        return NULL;
+    }
+
+    return route;
+}
+
+
+/**
+ * @brief Route a decoded command to the handler registered for key
+ *
+ * @return true if a handler was called
+ */
+bool cmd_dispatch(const CmdDispatchTable *table, const char *key,
+                  const ValveCommand *cmd, void *arg)
+{
+    const CmdRoute *route = cmd_dispatch_find(table, key, (key != NULL) ? strlen(key) : 0);
+
+    if (route == NULL) {
+        ESP_LOGW(TAG, "%s: no handler for \"%s\"", table->label, (key != NULL) ? key : "");
+        return false;
+    }
+
+    route->handler(cmd, arg);
+    return true;
+}
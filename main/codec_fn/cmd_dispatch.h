@@ -0,0 +1,38 @@
+#ifndef CMD_DISPATCH_H
+#define CMD_DISPATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#include "command_decoder.h"
+
+// Hash slots per table (power of two, > number of routes)
+#define CMD_DISPATCH_SLOTS      16
+
+// Handlers receive the decoded command and the transport's context
+// (e.g. payload format for MQTT, auth flag for WebSocket)
+typedef void (*cmd_handler_t)(const ValveCommand *cmd, void *arg);
+
+// One table entry: event name or topic suffix → handler
+typedef struct {
+    const char *name;
+    cmd_handler_t handler;
+} CmdRoute;
+
+typedef struct {
+    const char *label;                      // For logs
+    const CmdRoute *routes;
+    size_t count;
+    uint32_t seed;                          // Makes the hash collision-free for this table
+    uint8_t slots[CMD_DISPATCH_SLOTS];      // Route index + 1, 0 = empty
+} CmdDispatchTable;
+
+esp_err_t cmd_dispatch_init(CmdDispatchTable *table, const char *label,
+                            const CmdRoute *routes, size_t count);
+const CmdRoute *cmd_dispatch_find(const CmdDispatchTable *table, const char *key, size_t key_len);
+bool cmd_dispatch(const CmdDispatchTable *table, const char *key,
+                  const ValveCommand *cmd, void *arg);
+
+#endif // CMD_DISPATCH_H
@@ -0,0 +1,150 @@
+/**
+ * @file cmd_pipeline.c
+ * @brief Receive → decode → validate → dispatch for inbound commands
+ *
+ * Every message is parsed exactly once (command_decode into the
+ * pipeline's ValveCommand). Decode errors, malformed blocks and
+ * failed semantic checks stop the message before dispatch, so no
+ * handler — and therefore no shared state — ever sees a partial
+ * command. Each stage is timed with esp_timer and counted.
+ */
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "cmd_pipeline.h"
+
+
+static const char *TAG = "CMD_PIPELINE";
+
+static const char *const stage_names[CMD_STAGE_COUNT] = {
+    "receive", "decode", "validate", "dispatch",
+};
+
+
+
+/* ======================================================================== */
+/* ============================ STAGE TIMING ============================== */
+/* ======================================================================== */
+
+static void stage_done(CmdPipelineStats *stats, CmdStage stage, uint32_t us)
+{
+    stats->last_us[stage] = us;
+    stats->total_us[stage] += us;
+    stats->passed[stage]++;
+    if (us > stats->max_us[stage]) {
+        stats->max_us[stage] = us;
+    }
+}
+
+static esp_err_t stage_reject(CmdPipeline *pipe, CmdStage stage, esp_err_t err)
+{
+    pipe->stats.rejected[stage]++;
+    ESP_LOGW(TAG, "%s: rejected at %s (%s)", pipe->label, stage_names[stage], esp_err_to_name(err));
+    return err;
+}
+
+
+/**
+ * @brief Checks every command must pass, whatever the transport
+ */
+static esp_err_t validate_structure(const ValveCommand *cmd)
+{
+    if (cmd->malformed != 0) {
+        ESP_LOGW(TAG, "Malformed blocks: 0x%02lx", (unsigned long)cmd->malformed);
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+
+
+/* ======================================================================== */
+/* ============================== PUBLIC API ============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Run one complete message through the pipeline
+ *
+ * @param pipe     Pipeline of the calling transport
+ * @param msg      Message bytes, format and receive time
+ * @param handler  Handler chosen by the transport (e.g. by topic),
+ *                 or NULL to route by "event" through pipe->events
+ * @param arg      Passed to the handler
+ *
+ * @return ESP_OK if a handler ran,
+ *         the decoder error for unparsable input,
+ *         ESP_ERR_INVALID_ARG if validation failed,
+ *         ESP_ERR_NOT_FOUND if no route matched
+ */
+esp_err_t cmd_pipeline_run(CmdPipeline *pipe, const CmdMessage *msg,
+                           cmd_handler_t handler, void *arg)
+{
+    CmdPipelineStats *stats = &pipe->stats;
+    esp_err_t err;
+
+    stats->runs++;
+
+    /*----------------- Receive (measured by the transport) -----------------*/
+    stage_done(stats, CMD_STAGE_RECEIVE, msg->receive_us);
+
+    /*----------------- Decode: the only parse of this message -----------------*/
+    int64_t t0 = esp_timer_get_time();
+    err = command_decode(msg->data, msg->len, msg->format,
+                         pipe->tokens, pipe->max_tokens, pipe->cmd);
+    int64_t t1 = esp_timer_get_time();
+    if (err != ESP_OK) {
+        return stage_reject(pipe, CMD_STAGE_DECODE, err);
+    }
+    stage_done(stats, CMD_STAGE_DECODE, (uint32_t)(t1 - t0));
+
+    /*----------------- Validate before anything is applied -----------------*/
+    err = validate_structure(pipe->cmd);
+    if (err == ESP_OK && handler == NULL && pipe->cmd->event[0] == '\0') {
+        ESP_LOGW(TAG, "Event field missing or not a string");
+        err = ESP_ERR_INVALID_ARG;
+    }
+    if (err == ESP_OK && pipe->validate != NULL) {
+        err = pipe->validate(pipe->cmd);
+    }
+    int64_t t2 = esp_timer_get_time();
+    if (err != ESP_OK) {
+        return stage_reject(pipe, CMD_STAGE_VALIDATE, err);
+    }
+    stage_done(stats, CMD_STAGE_VALIDATE, (uint32_t)(t2 - t1));
+
+    /*----------------- Dispatch the typed command -----------------*/
+    if (handler == NULL) {
+        const CmdRoute *route = cmd_dispatch_find(pipe->events, pipe->cmd->event,
+                                                  strlen(pipe->cmd->event));
+        if (route == NULL) {
+            ESP_LOGW(TAG, "%s: unknown event %s", pipe->label, pipe->cmd->event);
+            return stage_reject(pipe, CMD_STAGE_DISPATCH, ESP_ERR_NOT_FOUND);
+        }
+        handler = route->handler;
+    }
+
+    handler(pipe->cmd, arg);
+    int64_t t3 = esp_timer_get_time();
+    stage_done(stats, CMD_STAGE_DISPATCH, (uint32_t)(t3 - t2));
+
+    ESP_LOGD(TAG, "%s: rx %lu us, decode %lu us, validate %lu us, dispatch %lu us", pipe->label,
+             (unsigned long)msg->receive_us, (unsigned long)(t1 - t0),
+             (unsigned long)(t2 - t1), (unsigned long)(t3 - t2));
+
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Copy the pipeline counters
+ *
+ * @note Read without a lock from other tasks; a copy may be one
+ *       message behind, which is fine for diagnostics.
+ */
+void cmd_pipeline_get_stats(const CmdPipeline *pipe, CmdPipelineStats *stats)
+{
+    if (stats == NULL) return;
+    *stats = pipe->stats;
+}
@@ -0,0 +1,57 @@
+#ifndef CMD_PIPELINE_H
+#define CMD_PIPELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#include "command_decoder.h"
+#include "cmd_dispatch.h"
+#include "payload_format.h"
+
+// Inbound stages, in order
+typedef enum {
+    CMD_STAGE_RECEIVE = 0,      // Transport: first fragment → complete message
+    CMD_STAGE_DECODE,           // Bytes → ValveCommand (the only parse)
+    CMD_STAGE_VALIDATE,         // Structural and semantic checks
+    CMD_STAGE_DISPATCH,         // Route lookup + handler
+    CMD_STAGE_COUNT
+} CmdStage;
+
+// Per-stage counters and timing (microseconds)
+typedef struct {
+    uint32_t runs;                          // Messages entering the pipeline
+    uint32_t rejected[CMD_STAGE_COUNT];     // Messages stopped at each stage
+    uint32_t last_us[CMD_STAGE_COUNT];
+    uint32_t max_us[CMD_STAGE_COUNT];
+    uint64_t total_us[CMD_STAGE_COUNT];     // For averages (total / passed)
+    uint32_t passed[CMD_STAGE_COUNT];       // Messages that completed each stage
+} CmdPipelineStats;
+
+// Semantic checks; anything but ESP_OK rejects the command
+typedef esp_err_t (*cmd_validate_fn)(const ValveCommand *cmd);
+
+// One complete inbound message
+typedef struct {
+    const char *data;
+    size_t len;
+    PayloadFormat format;
+    uint32_t receive_us;                    // Time spent in the transport
+} CmdMessage;
+
+// Pipeline instance (one per transport task; not shared between tasks)
+typedef struct {
+    const char *label;
+    JsonToken *tokens;
+    uint16_t max_tokens;
+    ValveCommand *cmd;
+    cmd_validate_fn validate;               // NULL = structural checks only
+    const CmdDispatchTable *events;         // Routing by "event" when no handler is given
+    CmdPipelineStats stats;
+} CmdPipeline;
+
+esp_err_t cmd_pipeline_run(CmdPipeline *pipe, const CmdMessage *msg,
+                           cmd_handler_t handler, void *arg);
+void cmd_pipeline_get_stats(const CmdPipeline *pipe, CmdPipelineStats *stats);
+
+#endif // CMD_PIPELINE_H
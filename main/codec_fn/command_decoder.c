@@ -0,0 +1,406 @@
+/**
+ * @file command_decoder.c
+ * @brief Map inbound command JSON / CBOR straight into a ValveCommand
+ *
+ * Uses the in-place tokenizer from json_decoder.c, so decoding a
+ * command needs only the caller's token array and ValveCommand —
+ * no heap. Blocks that are missing or malformed leave their has_*
+ * flag false; the rest of the message is still decoded. Blocks that
+ * were present but malformed are also flagged in cmd->malformed.
+ */
+
+#include <string.h>
+#include "esp_log.h"
+
+#include "command_decoder.h"
+
+
+static const char *TAG = "CMD_DECODER";
+
+
+
+/* ======================================================================== */
+/* ============================ SCHEMA BLOCKS ============================= */
+/* ======================================================================== */
+
+/**
+ * @brief Copy a string field only if it fits without truncation
+ *
+ * Used for credentials and IDs, where a truncated value could
+ * compare equal to a shorter secret.
+ */
+static bool copy_exact(const JsonDoc *doc, int idx, char *out, size_t size)
+{
+    if (!jd_is_string(doc, idx)) return false;
+
+    // Unescaped length is never longer than the raw token
+    const JsonToken *t = &doc->tokens[idx];
+    if ((size_t)(t->end - t->start) >= size) return false;
+
+    return jd_copy_string(doc, idx, out, size) >= 0;
+}
+
+// set_controller (cmd_data) and set_controllerdata (control_data)
+static void decode_controller(const JsonDoc *doc, int obj, ValveCommand *cmd)
+{
+    bool schedule, sensor;
+
+    if (jd_get_bool(doc, jd_find(doc, obj, "schedule"), &schedule) &&
+        jd_get_bool(doc, jd_find(doc, obj, "sensor"), &sensor)) {
+        cmd->has_controller = true;
+        cmd->schedule_control = schedule;
+        cmd->sensor_control = sensor;
+    }
+}
+
+static void decode_valve_data(const JsonDoc *doc, int obj, ValveCommand *cmd)
+{
+    cmd->has_valve_data = true;
+    cmd->has_set_angle = jd_get_bool(doc, jd_find(doc, obj, "set_angle"), &cmd->set_angle);
+    cmd->has_angle = jd_get_int(doc, jd_find(doc, obj, "angle"), &cmd->angle);
+}
+
+/**
+ * @brief Decode a schedule_info array into info / count
+ *
+ * @return false if any entry is malformed
+ */
+static bool decode_schedule_list(const JsonDoc *doc, int list,
+                                 ScheduleInfo *info, size_t *count)
+{
+    bool ok = true;
+
+    // Slots keep their array position, like the cJSON handler did
+    for (int i = 0; i < CMD_MAX_SCHEDULES; i++) {
+        int item = jd_array_item(doc, list, i);
+        if (item < 0) break;
+
+        *count = i + 1;
+
+        int day = jd_find(doc, item, "day");
+        int open = jd_find(doc, item, "open");
+        int close = jd_find(doc, item, "close");
+
+        if (jd_is_string(doc, day) && jd_is_string(doc, open) && jd_is_string(doc, close)) {
+            ScheduleInfo *s = &info[i];
+            jd_copy_string(doc, day, s->day, sizeof(s->day));
+            jd_copy_string(doc, open, s->open, sizeof(s->open));
+            jd_copy_string(doc, close, s->close, sizeof(s->close));
+        } else {
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+static void decode_schedule(const JsonDoc *doc, int obj, ValveCommand *cmd)
+{
+    cmd->has_schedule = true;
+    cmd->has_set_schedule = jd_get_bool(doc, jd_find(doc, obj, "set_schedule"), &cmd->set_schedule);
+
+    // Program by content hash (mqtt_schedule_ref.c), with or without the list
+    int hash = jd_find(doc, obj, "schedule_hash");
+    if (hash >= 0) {
+        cmd->has_schedule_hash = copy_exact(doc, hash, cmd->schedule_hash, sizeof(cmd->schedule_hash));
+        if (!cmd->has_schedule_hash) cmd->malformed |= CMD_BLOCK_SCHEDULE;
+    }
+
+    int list = jd_find(doc, obj, "schedule_info");
+    if (!jd_is_array(doc, list)) {
+        if (list >= 0) cmd->malformed |= CMD_BLOCK_SCHEDULE;
+        return;
+    }
+
+    cmd->has_schedule_info = true;
+    if (!decode_schedule_list(doc, list, cmd->schedule_info, &cmd->schedule_count)) {
+        cmd->malformed |= CMD_BLOCK_SCHEDULE;
+    }
+}
+
+static void decode_sensor_limits(const JsonDoc *doc, int obj, ValveCommand *cmd)
+{
+    int upper, lower;
+
+    if (jd_get_int(doc, jd_find(doc, obj, "upper_limit"), &upper) &&
+        jd_get_int(doc, jd_find(doc, obj, "lower_limit"), &lower)) {
+        cmd->has_sensor_limits = true;
+        cmd->sensor_upper_limit = upper;
+        cmd->sensor_lower_limit = lower;
+    }
+}
+
+static void decode_wifi(const JsonDoc *doc, int obj, ValveCommand *cmd)
+{
+    if (copy_exact(doc, jd_find(doc, obj, "ssid"), cmd->ssid, sizeof(cmd->ssid)) &&
+        copy_exact(doc, jd_find(doc, obj, "password"), cmd->password, sizeof(cmd->password))) {
+        cmd->has_wifi = true;
+    }
+}
+
+static void decode_telemetry(const JsonDoc *doc, int obj, ValveCommand *cmd)
+{
+    int encoding = jd_find(doc, obj, "encoding");
+    if (jd_string_eq(doc, encoding, "json")) {
+        cmd->has_encoding = true;
+        cmd->encoding = PAYLOAD_JSON;
+    } else if (jd_string_eq(doc, encoding, "cbor")) {
+        cmd->has_encoding = true;
+        cmd->encoding = PAYLOAD_CBOR;
+    }
+
+    int format = jd_find(doc, obj, "format");
+    if (!jd_is_string(doc, format)) return;
+
+    if (jd_string_eq(doc, format, "legacy")) {
+        cmd->telemetry_format = CMD_TELEMETRY_LEGACY;
+    } else if (jd_string_eq(doc, format, "consolidated")) {
+        cmd->telemetry_format = CMD_TELEMETRY_CONSOLIDATED;
+    } else if (jd_string_eq(doc, format, "both")) {
+        cmd->telemetry_format = CMD_TELEMETRY_BOTH;
+    } else {
+        cmd->telemetry_format = CMD_TELEMETRY_UNKNOWN;
+    }
+}
+
+/**
+ * @brief Decode set_groups; the group list replaces the stored one
+ *
+ * Names are checked for length only here; the MQTT layer checks
+ * that they are usable as a topic level.
+ */
+static void decode_groups(const JsonDoc *doc, int obj, ValveCommand *cmd)
+{
+    int list = jd_find(doc, obj, "groups");
+    if (!jd_is_array(doc, list)) return;
+
+    for (int i = 0; ; i++) {
+        int item = jd_array_item(doc, list, i);
+        if (item < 0) break;
+
+        if (i >= CMD_MAX_GROUPS ||
+            !copy_exact(doc, item, cmd->groups[i], sizeof(cmd->groups[i]))) {
+            return;
+        }
+        cmd->group_count = i + 1;
+    }
+
+    int stagger = jd_find(doc, obj, "stagger_ms");
+    if (stagger >= 0) {
+        if (!jd_get_int(doc, stagger, &cmd->stagger_ms) || cmd->stagger_ms < 0) return;
+        cmd->has_stagger = true;
+    }
+
+    cmd->has_groups = true;
+}
+
+
+
+/**
+ * @brief Decode a sparse "desired" object into a ShadowPatch
+ *
+ * Any subset of keys may be present; a key with the wrong type
+ * marks the whole block malformed.
+ *
+ *   { "schedule": bool, "sensor": bool, "angle": int, "set_angle": bool,
+ *     "schedule_info": [...], "upper_limit": int, "lower_limit": int }
+ *
+ * "set_angle" is only valid together with "angle".
+ */
+static void decode_desired(const JsonDoc *doc, int obj, ValveCommand *cmd)
+{
+    ShadowPatch *p = &cmd->desired;
+    bool ok = true;
+    int idx;
+
+    if ((idx = jd_find(doc, obj, "schedule")) >= 0) {
+        ok &= jd_get_bool(doc, idx, &p->schedule_control);
+        p->fields |= SHADOW_F_SCHEDULE_CONTROL;
+    }
+
+    if ((idx = jd_find(doc, obj, "sensor")) >= 0) {
+        ok &= jd_get_bool(doc, idx, &p->sensor_control);
+        p->fields |= SHADOW_F_SENSOR_CONTROL;
+    }
+
+    // "angle" implies set_angle unless it is given explicitly; a bare
+    // "set_angle" would move the valve to the zeroed angle
+    int set_angle = jd_find(doc, obj, "set_angle");
+    p->set_angle = true;
+    if ((idx = jd_find(doc, obj, "angle")) >= 0) {
+        ok &= jd_get_int(doc, idx, &p->angle);
+        if (set_angle >= 0) {
+            ok &= jd_get_bool(doc, set_angle, &p->set_angle);
+        }
+        p->fields |= SHADOW_F_ANGLE;
+    } else if (set_angle >= 0) {
+        ok = false;
+    }
+
+    if ((idx = jd_find(doc, obj, "schedule_info")) >= 0) {
+        ok &= jd_is_array(doc, idx) &&
+              decode_schedule_list(doc, idx, p->schedule_info, &p->schedule_count);
+        p->set_schedule = true;
+        p->fields |= SHADOW_F_SCHEDULE;
+    }
+
+    int upper = jd_find(doc, obj, "upper_limit");
+    int lower = jd_find(doc, obj, "lower_limit");
+    if (upper >= 0 || lower >= 0) {
+        // Limits are only meaningful as a pair
+        ok &= jd_get_int(doc, upper, &p->sensor_upper_limit) &&
+              jd_get_int(doc, lower, &p->sensor_lower_limit);
+        p->fields |= SHADOW_F_SENSOR_LIMITS;
+    }
+
+    cmd->has_desired = ok;
+    if (!ok) {
+        cmd->malformed |= CMD_BLOCK_DESIRED;
+    }
+}
+
+
+
+/* ======================================================================== */
+/* ============================== ENTRY POINT ============================= */
+/* ======================================================================== */
+
+/**
+ * @brief Decode one command message into cmd
+ *
+ * @param data        Receive buffer (used in place)
+ * @param len         Payload length
+ * @param format      PAYLOAD_JSON or PAYLOAD_CBOR (from the topic suffix)
+ * @param tokens      Token scratch array (caller-owned, usually static)
+ * @param max_tokens  Size of tokens
+ * @param cmd         Output; always cleared first
+ *
+ * @return ESP_OK, or the parser error for malformed / oversize input
+ */
+esp_err_t command_decode(const char *data, size_t len, PayloadFormat format,
+                         JsonToken *tokens, uint16_t max_tokens,
+                         ValveCommand *cmd)
+{
+    memset(cmd, 0, sizeof(*cmd));
+
+    JsonDoc doc;
+    esp_err_t err;
+    if (format == PAYLOAD_CBOR) {
+        err = jd_parse_cbor(&doc, (const uint8_t *)data, len, tokens, max_tokens);
+    } else {
+        err = jd_parse(&doc, data, len, tokens, max_tokens);
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid %s received (%s)",
+                 (format == PAYLOAD_CBOR) ? "CBOR" : "JSON", esp_err_to_name(err));
+        return err;
+    }
+
+    if (!jd_is_object(&doc, 0)) {
+        ESP_LOGE(TAG, "Command root is not an object");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    jd_copy_string(&doc, jd_find(&doc, 0, "event"), cmd->event, sizeof(cmd->event));
+    jd_copy_string(&doc, jd_find(&doc, 0, "device_id"), cmd->device_id, sizeof(cmd->device_id));
+
+    // A cmd_id that does not fit cannot be deduplicated reliably
+    int cmd_id = jd_find(&doc, 0, "cmd_id");
+    if (cmd_id >= 0) {
+        cmd->has_cmd_id = copy_exact(&doc, cmd_id, cmd->cmd_id, sizeof(cmd->cmd_id));
+        if (!cmd->has_cmd_id) {
+            ESP_LOGE(TAG, "Invalid cmd_id");
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    jd_copy_string(&doc, jd_find(&doc, 0, "method"), cmd->method, sizeof(cmd->method));
+
+    // Echoed in the response: must come back exactly as sent
+    int correlation_id = jd_find(&doc, 0, "correlation_id");
+    if (correlation_id >= 0) {
+        cmd->has_correlation_id = copy_exact(&doc, correlation_id, cmd->correlation_id,
+                                             sizeof(cmd->correlation_id));
+        if (!cmd->has_correlation_id) {
+            ESP_LOGE(TAG, "Invalid correlation_id");
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    cmd->has_passkey = copy_exact(&doc, jd_find(&doc, 0, "passkey"),
+                                  cmd->passkey, sizeof(cmd->passkey));
+
+    int data_obj = jd_find(&doc, 0, "data");
+    if (jd_is_object(&doc, data_obj)) {
+        cmd->has_data = true;
+        jd_copy_string(&doc, jd_find(&doc, data_obj, "user_id"), cmd->data_user_id, sizeof(cmd->data_user_id));
+        copy_exact(&doc, jd_find(&doc, data_obj, "device_id"), cmd->data_device_id, sizeof(cmd->data_device_id));
+    } else if (data_obj >= 0) {
+        cmd->malformed |= CMD_BLOCK_DATA;
+    }
+
+    int block = jd_find(&doc, 0, "set_controller");
+    if (!jd_is_object(&doc, block)) {
+        block = jd_find(&doc, 0, "set_controllerdata");
+    }
+    if (jd_is_object(&doc, block)) {
+        decode_controller(&doc, block, cmd);
+    }
+    if (block >= 0 && !cmd->has_controller) cmd->malformed |= CMD_BLOCK_CONTROLLER;
+
+    block = jd_find(&doc, 0, "valve_data");
+    if (jd_is_object(&doc, block)) {
+        decode_valve_data(&doc, block, cmd);
+    }
+    if (block >= 0 && !cmd->has_valve_data) cmd->malformed |= CMD_BLOCK_VALVE_DATA;
+
+    block = jd_find(&doc, 0, "set_scheduledata");
+    if (jd_is_object(&doc, block)) {
+        decode_schedule(&doc, block, cmd);
+    }
+    if (block >= 0 && !cmd->has_schedule) cmd->malformed |= CMD_BLOCK_SCHEDULE;
+
+    block = jd_find(&doc, 0, "set_sensordata");
+    if (jd_is_object(&doc, block)) {
+        decode_sensor_limits(&doc, block, cmd);
+    }
+    if (block >= 0 && !cmd->has_sensor_limits) cmd->malformed |= CMD_BLOCK_SENSOR;
+
+    block = jd_find(&doc, 0, "wifi_data");
+    if (jd_is_object(&doc, block)) {
+        decode_wifi(&doc, block, cmd);
+    }
+    if (block >= 0 && !cmd->has_wifi) cmd->malformed |= CMD_BLOCK_WIFI;
+
+    int version;
+    int version_idx = jd_find(&doc, 0, "version");
+    if (jd_get_int(&doc, version_idx, &version) && version >= 0) {
+        cmd->has_version = true;
+        cmd->version = (uint32_t)version;
+    } else if (version_idx >= 0) {
+        cmd->malformed |= CMD_BLOCK_DESIRED;
+    }
+
+    block = jd_find(&doc, 0, "desired");
+    if (jd_is_object(&doc, block)) {
+        decode_desired(&doc, block, cmd);
+    } else if (block >= 0) {
+        cmd->malformed |= CMD_BLOCK_DESIRED;
+    }
+
+    block = jd_find(&doc, 0, "set_groups");
+    if (jd_is_object(&doc, block)) {
+        decode_groups(&doc, block, cmd);
+    }
+    if (block >= 0 && !cmd->has_groups) cmd->malformed |= CMD_BLOCK_GROUPS;
+
+    block = jd_find(&doc, 0, "set_telemetry");
+    if (jd_is_object(&doc, block)) {
+        decode_telemetry(&doc, block, cmd);
+    } else if (block >= 0) {
+        cmd->malformed |= CMD_BLOCK_TELEMETRY;
+    }
+
+    return ESP_OK;
+}
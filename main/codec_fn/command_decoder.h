@@ -0,0 +1,153 @@
+#ifndef COMMAND_DECODER_H
+#define COMMAND_DECODER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#include "global_var.h"
+#include "json_decoder.h"
+#include "payload_format.h"
+
+#define CMD_EVENT_SIZE          32
+#define CMD_ID_SIZE             32
+#define CMD_MAX_SCHEDULES       10
+#define CMD_REQUEST_ID_SIZE     40      // UUID (36) + null
+#define CMD_MAX_GROUPS          8
+#define CMD_GROUP_NAME_SIZE     24
+#define CMD_SCHEDULE_HASH_SIZE  65      // SHA-256 in hex + null
+
+typedef enum {
+    CMD_TELEMETRY_UNSET = 0,
+    CMD_TELEMETRY_LEGACY,
+    CMD_TELEMETRY_CONSOLIDATED,
+    CMD_TELEMETRY_BOTH,
+    CMD_TELEMETRY_UNKNOWN
+} CmdTelemetryFormat;
+
+// Fields present in a ShadowPatch
+#define SHADOW_F_SCHEDULE_CONTROL   (1u << 0)
+#define SHADOW_F_SENSOR_CONTROL     (1u << 1)
+#define SHADOW_F_ANGLE              (1u << 2)   // set_angle + angle
+#define SHADOW_F_SCHEDULE           (1u << 3)   // schedule list (replaced as a whole)
+#define SHADOW_F_SENSOR_LIMITS      (1u << 4)   // upper + lower limit
+
+/**
+ * @brief Sparse desired-state change
+ *
+ * Only fields whose SHADOW_F_* bit is set are merged into the
+ * device shadow; everything else keeps its current value.
+ */
+typedef struct {
+    uint32_t fields;
+    bool schedule_control;
+    bool sensor_control;
+    bool set_angle;
+    int angle;
+    bool set_schedule;
+    size_t schedule_count;
+    ScheduleInfo schedule_info[CMD_MAX_SCHEDULES];
+    int sensor_upper_limit;
+    int sensor_lower_limit;
+} ShadowPatch;
+
+// Blocks that were present but not well-formed (ValveCommand.malformed)
+#define CMD_BLOCK_CONTROLLER    (1u << 0)
+#define CMD_BLOCK_VALVE_DATA    (1u << 1)
+#define CMD_BLOCK_SCHEDULE      (1u << 2)
+#define CMD_BLOCK_SENSOR        (1u << 3)
+#define CMD_BLOCK_WIFI          (1u << 4)
+#define CMD_BLOCK_TELEMETRY     (1u << 5)
+#define CMD_BLOCK_DATA          (1u << 6)
+#define CMD_BLOCK_DESIRED       (1u << 7)
+#define CMD_BLOCK_GROUPS        (1u << 8)
+
+/**
+ * @brief Typed view of one inbound command (MQTT or WebSocket)
+ *
+ * Every optional block has a has_* flag that is only set when the
+ * block was present AND well-formed, so handlers never need to look
+ * at raw JSON.
+ */
+typedef struct {
+    char event[CMD_EVENT_SIZE];
+    char device_id[CMD_ID_SIZE];
+
+    // "cmd_id": optional idempotency key (ack / dedup, MQTT)
+    bool has_cmd_id;
+    char cmd_id[CMD_REQUEST_ID_SIZE];
+
+    // "method" + "correlation_id": diagnostics request (MQTT rpc_request)
+    char method[CMD_EVENT_SIZE];
+    bool has_correlation_id;
+    char correlation_id[CMD_REQUEST_ID_SIZE];
+
+    // "data": { "user_id", "device_id" } (WebSocket device_basic_info)
+    bool has_data;
+    char data_user_id[CMD_ID_SIZE];
+    char data_device_id[CMD_ID_SIZE];
+
+    // "passkey" (WebSocket authentication)
+    bool has_passkey;
+    char passkey[CMD_ID_SIZE];
+
+    // "set_controller" / "set_controllerdata": { "schedule", "sensor" }
+    bool has_controller;
+    bool schedule_control;
+    bool sensor_control;
+
+    // "valve_data": { "set_angle", "angle" }
+    bool has_valve_data;
+    bool has_set_angle;
+    bool set_angle;
+    bool has_angle;
+    int angle;
+
+    // "set_scheduledata": { "set_schedule", "schedule_info": [...], "schedule_hash" }
+    bool has_schedule;
+    bool has_set_schedule;
+    bool set_schedule;
+    bool has_schedule_info;
+    size_t schedule_count;
+    ScheduleInfo schedule_info[CMD_MAX_SCHEDULES];
+    bool has_schedule_hash;
+    char schedule_hash[CMD_SCHEDULE_HASH_SIZE];
+
+    // "set_sensordata": { "upper_limit", "lower_limit" }
+    bool has_sensor_limits;
+    int sensor_upper_limit;
+    int sensor_lower_limit;
+
+    // "wifi_data": { "ssid", "password" }
+    bool has_wifi;
+    char ssid[32];
+    char password[64];
+
+    // "set_telemetry": { "format", "encoding" }
+    CmdTelemetryFormat telemetry_format;
+    bool has_encoding;
+    PayloadFormat encoding;
+
+    // "set_groups": { "groups": ["zone_a", ...], "stagger_ms" }
+    bool has_groups;
+    size_t group_count;
+    char groups[CMD_MAX_GROUPS][CMD_GROUP_NAME_SIZE];
+    bool has_stagger;
+    int stagger_ms;
+
+    // "version" + "desired": { ... } (device shadow patch)
+    bool has_version;
+    uint32_t version;
+    bool has_desired;
+    ShadowPatch desired;
+
+    // CMD_BLOCK_* bits; lets a caller reject partial commands
+    uint32_t malformed;
+} ValveCommand;
+
+esp_err_t command_decode(const char *data, size_t len, PayloadFormat format,
+                         JsonToken *tokens, uint16_t max_tokens,
+                         ValveCommand *cmd);
+
+#endif // COMMAND_DECODER_H
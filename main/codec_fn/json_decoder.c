@@ -0,0 +1,721 @@
+/**
+ * @file json_decoder.c
+ * @brief In-place, non-allocating JSON tokenizer
+ *
+ * Parses a JSON document into a caller-supplied, fixed-size token
+ * array. Tokens only store offsets into the receive buffer, so
+ * nothing is copied or allocated while parsing; values are copied
+ * out (and unescaped) only when mapped into typed structs.
+ *
+ *   JsonToken tokens[JSON_DECODER_MAX_TOKENS];
+ *   JsonDoc doc;
+ *   if (jd_parse(&doc, data, len, tokens, JSON_DECODER_MAX_TOKENS) == ESP_OK) {
+ *       int angle_tok = jd_find(&doc, jd_find(&doc, 0, "valve_data"), "angle");
+ *       int angle;
+ *       if (jd_get_int(&doc, angle_tok, &angle)) { ... }
+ *   }
+ *
+ * Accessors accept -1 as "missing" and simply fail, so lookups can
+ * be chained without intermediate checks.
+ *
+ * jd_parse_cbor() builds the same token layout from a CBOR item, so
+ * schema code written against the accessors handles both encodings.
+ * CBOR map keys may be text or dictionary IDs (cbor_codec.c).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cbor_codec.h"
+#include "json_decoder.h"
+
+// Longest JSON number jd_get_int() converts
+#define JD_NUMBER_MAX_LEN   32
+
+
+typedef struct {
+    JsonDoc *doc;
+    size_t pos;
+} JsonParser;
+
+
+
+/* ======================================================================== */
+/* ============================== TOKENIZER =============================== */
+/* ======================================================================== */
+
+static void jd_skip_ws(JsonParser *p)
+{
+    const char *s = p->doc->json;
+
+    while (p->pos < p->doc->len) {
+        char c = s[p->pos];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') break;
+        p->pos++;
+    }
+}
+
+static int jd_alloc(JsonParser *p, jd_type_t type, size_t start)
+{
+    JsonDoc *doc = p->doc;
+
+    if (doc->count >= doc->max_tokens) {
+        return -1;
+    }
+
+    int idx = doc->count++;
+    JsonToken *t = &doc->tokens[idx];
+    t->type = (uint8_t)type;
+    t->start = (uint16_t)start;
+    t->end = (uint16_t)start;
+    t->size = 0;
+    t->next = (uint16_t)(idx + 1);
+    return idx;
+}
+
+static int jd_parse_string(JsonParser *p)
+{
+    const char *s = p->doc->json;
+    size_t start = ++p->pos;    // Skip opening quote
+
+    while (p->pos < p->doc->len) {
+        unsigned char c = (unsigned char)s[p->pos];
+
+        if (c == '"') {
+            int idx = jd_alloc(p, JD_STRING, start);
+            if (idx < 0) return -1;
+            p->doc->tokens[idx].end = (uint16_t)p->pos;
+            p->pos++;
+            return idx;
+        }
+
+        if (c < 0x20) {
+            return -1;      // Raw control character
+        }
+
+        if (c == '\\') {
+            p->pos++;       // Escaped char is validated on copy
+        }
+
+        p->pos++;
+    }
+
+    return -1;              // Unterminated string
+}
+
+static int jd_parse_primitive(JsonParser *p)
+{
+    const char *s = p->doc->json;
+    size_t start = p->pos;
+
+    while (p->pos < p->doc->len) {
+        char c = s[p->pos];
+        if (c == ',' || c == ']' || c == '}' ||
+            c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            break;
+        }
+        if (c == '\0') break;
+        p->pos++;
+    }
+
+    size_t n = p->pos - start;
+    const char *v = s + start;
+
+    bool literal = (n == 4 && memcmp(v, "true", 4) == 0) ||
+                   (n == 5 && memcmp(v, "false", 5) == 0) ||
+                   (n == 4 && memcmp(v, "null", 4) == 0);
+
+    if (!literal) {
+        if (n == 0) return -1;
+        for (size_t i = 0; i < n; i++) {
+            char c = v[i];
+            if (!((c >= '0' && c <= '9') || c == '-' || c == '+' ||
+                  c == '.' || c == 'e' || c == 'E')) {
+                return -1;
+            }
+        }
+    }
+
+    int idx = jd_alloc(p, JD_PRIMITIVE, start);
+    if (idx < 0) return -1;
+    p->doc->tokens[idx].end = (uint16_t)p->pos;
+    return idx;
+}
+
+static int jd_parse_value(JsonParser *p, int depth);
+
+static int jd_parse_container(JsonParser *p, int depth, bool is_object)
+{
+    const char *s = p->doc->json;
+    char close = is_object ? '}' : ']';
+
+    if (depth >= JSON_DECODER_MAX_DEPTH) return -1;
+
+    int idx = jd_alloc(p, is_object ? JD_OBJECT : JD_ARRAY, p->pos);
+    if (idx < 0) return -1;
+    p->pos++;
+
+    jd_skip_ws(p);
+    if (p->pos < p->doc->len && s[p->pos] == close) {
+        p->pos++;
+    } else {
+        while (1) {
+            jd_skip_ws(p);
+            if (p->pos >= p->doc->len) return -1;
+
+            if (is_object) {
+                if (s[p->pos] != '"') return -1;
+                if (jd_parse_string(p) < 0) return -1;
+
+                jd_skip_ws(p);
+                if (p->pos >= p->doc->len || s[p->pos] != ':') return -1;
+                p->pos++;
+            }
+
+            if (jd_parse_value(p, depth + 1) < 0) return -1;
+            p->doc->tokens[idx].size++;
+
+            jd_skip_ws(p);
+            if (p->pos >= p->doc->len) return -1;
+
+            if (s[p->pos] == ',') {
+                p->pos++;
+                continue;
+            }
+            if (s[p->pos] == close) {
+                p->pos++;
+                break;
+            }
+            return -1;
+        }
+    }
+
+    p->doc->tokens[idx].end = (uint16_t)p->pos;
+    p->doc->tokens[idx].next = p->doc->count;
+    return idx;
+}
+
+static int jd_parse_value(JsonParser *p, int depth)
+{
+    jd_skip_ws(p);
+    if (p->pos >= p->doc->len) return -1;
+
+    switch (p->doc->json[p->pos]) {
+        case '{': return jd_parse_container(p, depth, true);
+        case '[': return jd_parse_container(p, depth, false);
+        case '"': return jd_parse_string(p);
+        default:  return jd_parse_primitive(p);
+    }
+}
+
+
+/**
+ * @brief Tokenize a JSON document in place
+ *
+ * @param doc         Output document (references json and tokens)
+ * @param json        Receive buffer (not modified, need not be NUL-terminated)
+ * @param len         Length of json in bytes
+ * @param tokens      Caller-supplied token array
+ * @param max_tokens  Token budget
+ *
+ * @return
+ *   - ESP_OK on success (token 0 is the root value)
+ *   - ESP_ERR_INVALID_SIZE if the buffer is larger than 64 KB
+ *   - ESP_ERR_NO_MEM if the token budget was exceeded
+ *   - ESP_ERR_INVALID_ARG on malformed JSON
+ */
+esp_err_t jd_parse(JsonDoc *doc, const char *json, size_t len,
+                   JsonToken *tokens, uint16_t max_tokens)
+{
+    doc->format = PAYLOAD_JSON;
+    doc->json = json;
+    doc->len = len;
+    doc->tokens = tokens;
+    doc->max_tokens = max_tokens;
+    doc->count = 0;
+
+    if (json == NULL || tokens == NULL) return ESP_ERR_INVALID_ARG;
+    if (len >= UINT16_MAX) return ESP_ERR_INVALID_SIZE;
+
+    JsonParser p = { .doc = doc, .pos = 0 };
+
+    if (jd_parse_value(&p, 0) < 0) {
+        bool out_of_tokens = (doc->count >= max_tokens);
+        doc->count = 0;
+        return out_of_tokens ? ESP_ERR_NO_MEM : ESP_ERR_INVALID_ARG;
+    }
+
+    // Only whitespace (or a terminating NUL) may follow the root
+    jd_skip_ws(&p);
+    if (p.pos < len && json[p.pos] != '\0') {
+        doc->count = 0;
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+
+
+/* ======================================================================== */
+/* =========================== CBOR TOKENIZER ============================= */
+/* ======================================================================== */
+
+static int cb_parse_item(JsonParser *p, int depth);
+
+static int cb_parse_container(JsonParser *p, int depth, const CborHead *h)
+{
+    const uint8_t *s = (const uint8_t *)p->doc->json;
+    bool is_map = (h->major == CBOR_MAJOR_MAP);
+    bool indefinite = (h->info == CBOR_INFO_INDEFINITE);
+
+    if (depth >= JSON_DECODER_MAX_DEPTH) return -1;
+
+    int idx = jd_alloc(p, is_map ? JD_OBJECT : JD_ARRAY, p->pos);
+    if (idx < 0) return -1;
+    p->pos += h->len;
+
+    // Every member takes at least one byte, so larger counts are bogus
+    if (!indefinite && h->value > p->doc->len - p->pos) return -1;
+
+    for (uint64_t n = 0; indefinite || n < h->value; n++) {
+        if (p->pos >= p->doc->len) return -1;
+
+        if (indefinite && s[p->pos] == CBOR_BREAK) {
+            p->pos++;
+            break;
+        }
+
+        if (is_map) {
+            // Keys are text or dictionary IDs
+            int key = cb_parse_item(p, depth + 1);
+            if (key < 0) return -1;
+
+            const JsonToken *k = &p->doc->tokens[key];
+            if (k->type != JD_STRING &&
+                (k->type != JD_PRIMITIVE || (s[k->start] >> 5) != CBOR_MAJOR_UINT)) {
+                return -1;
+            }
+        }
+
+        if (cb_parse_item(p, depth + 1) < 0) return -1;
+        p->doc->tokens[idx].size++;
+    }
+
+    p->doc->tokens[idx].end = (uint16_t)p->pos;
+    p->doc->tokens[idx].next = p->doc->count;
+    return idx;
+}
+
+static int cb_parse_item(JsonParser *p, int depth)
+{
+    const uint8_t *s = (const uint8_t *)p->doc->json;
+    size_t start = p->pos;
+    CborHead h;
+    int idx;
+
+    if (!cbor_read_head(s + p->pos, p->doc->len - p->pos, &h)) return -1;
+
+    switch (h.major) {
+        case CBOR_MAJOR_UINT:
+        case CBOR_MAJOR_NINT:
+            if (h.info == CBOR_INFO_INDEFINITE) return -1;
+            p->pos += h.len;
+            break;
+
+        case CBOR_MAJOR_BYTES:
+        case CBOR_MAJOR_TEXT:
+            // Chunked (indefinite-length) strings are not supported
+            if (h.info == CBOR_INFO_INDEFINITE) return -1;
+            p->pos += h.len;
+            if (h.value > p->doc->len - p->pos) return -1;
+
+            if (h.major == CBOR_MAJOR_TEXT) {
+                idx = jd_alloc(p, JD_STRING, p->pos);
+                if (idx < 0) return -1;
+                p->pos += (size_t)h.value;
+                p->doc->tokens[idx].end = (uint16_t)p->pos;
+                return idx;
+            }
+            p->pos += (size_t)h.value;      // Opaque primitive
+            break;
+
+        case CBOR_MAJOR_ARRAY:
+        case CBOR_MAJOR_MAP:
+            return cb_parse_container(p, depth, &h);
+
+        case CBOR_MAJOR_SIMPLE:
+            // false, true, null, undefined and half/single/double floats
+            if (!((h.info >= 20 && h.info <= 23) || (h.info >= 25 && h.info <= 27))) {
+                return -1;
+            }
+            p->pos += h.len;
+            break;
+
+        default:
+            return -1;      // Tags are not used by the command schema
+    }
+
+    idx = jd_alloc(p, JD_PRIMITIVE, start);
+    if (idx < 0) return -1;
+    p->doc->tokens[idx].end = (uint16_t)p->pos;
+    return idx;
+}
+
+
+/**
+ * @brief Tokenize one CBOR data item in place
+ *
+ * Same contract as jd_parse(). Exactly one item must fill the
+ * buffer; trailing bytes are rejected.
+ */
+esp_err_t jd_parse_cbor(JsonDoc *doc, const uint8_t *data, size_t len,
+                        JsonToken *tokens, uint16_t max_tokens)
+{
+    doc->format = PAYLOAD_CBOR;
+    doc->json = (const char *)data;
+    doc->len = len;
+    doc->tokens = tokens;
+    doc->max_tokens = max_tokens;
+    doc->count = 0;
+
+    if (data == NULL || tokens == NULL) return ESP_ERR_INVALID_ARG;
+    if (len >= UINT16_MAX) return ESP_ERR_INVALID_SIZE;
+
+    JsonParser p = { .doc = doc, .pos = 0 };
+
+    if (cb_parse_item(&p, 0) < 0 || p.pos != len) {
+        bool out_of_tokens = (doc->count >= max_tokens);
+        doc->count = 0;
+        return out_of_tokens ? ESP_ERR_NO_MEM : ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Read a CBOR float (half, single or double) as double
+ */
+static double cb_float(const CborHead *h)
+{
+    if (h->info == 25) {
+        // Half precision (RFC 8949 Appendix D)
+        int exp = (h->value >> 10) & 0x1F;
+        int mant = h->value & 0x3FF;
+        double v;
+        if (exp == 0) {
+            v = mant / 16777216.0;                          // 2^-24
+        } else if (exp != 31) {
+            v = (mant + 1024) * (double)(1u << exp) / 33554432.0;   // 2^-25
+        } else {
+            v = 0.0;                                        // inf / NaN
+        }
+        return (h->value & 0x8000) ? -v : v;
+    }
+
+    if (h->info == 26) {
+        uint32_t bits = (uint32_t)h->value;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    double d;
+    memcpy(&d, &h->value, sizeof(d));
+    return d;
+}
+
+
+
+/* ======================================================================== */
+/* ============================== ACCESSORS =============================== */
+/* ======================================================================== */
+
+static const JsonToken *jd_tok(const JsonDoc *doc, int idx)
+{
+    if (idx < 0 || idx >= doc->count) return NULL;
+    return &doc->tokens[idx];
+}
+
+/**
+ * @brief Find the value token of key inside object obj
+ *
+ * @return Token index, or -1 if obj is not an object or key is missing
+ */
+int jd_find(const JsonDoc *doc, int obj, const char *key)
+{
+    const JsonToken *t = jd_tok(doc, obj);
+    if (t == NULL || t->type != JD_OBJECT) return -1;
+
+    size_t key_len = strlen(key);
+    int i = obj + 1;
+
+    for (uint16_t n = 0; n < t->size; n++) {
+        const JsonToken *k = &doc->tokens[i];
+        int val = i + 1;
+
+        if (k->type == JD_STRING) {
+            if ((size_t)(k->end - k->start) == key_len &&
+                memcmp(doc->json + k->start, key, key_len) == 0) {
+                return val;
+            }
+        } else {
+            // CBOR dictionary key
+            CborHead h;
+            if (cbor_read_head((const uint8_t *)doc->json + k->start, k->end - k->start, &h) &&
+                h.value <= INT32_MAX) {
+                const char *name = cbor_key_name((int)h.value);
+                if (name != NULL && strcmp(name, key) == 0) {
+                    return val;
+                }
+            }
+        }
+
+        i = doc->tokens[val].next;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Get the n-th element of array arr
+ *
+ * @return Token index, or -1 if out of range
+ */
+int jd_array_item(const JsonDoc *doc, int arr, int n)
+{
+    const JsonToken *t = jd_tok(doc, arr);
+    if (t == NULL || t->type != JD_ARRAY || n < 0 || n >= t->size) return -1;
+
+    int i = arr + 1;
+    while (n-- > 0) {
+        i = doc->tokens[i].next;
+    }
+    return i;
+}
+
+bool jd_is_object(const JsonDoc *doc, int idx)
+{
+    const JsonToken *t = jd_tok(doc, idx);
+    return t != NULL && t->type == JD_OBJECT;
+}
+
+bool jd_is_array(const JsonDoc *doc, int idx)
+{
+    const JsonToken *t = jd_tok(doc, idx);
+    return t != NULL && t->type == JD_ARRAY;
+}
+
+bool jd_is_string(const JsonDoc *doc, int idx)
+{
+    const JsonToken *t = jd_tok(doc, idx);
+    return t != NULL && t->type == JD_STRING;
+}
+
+bool jd_is_bool(const JsonDoc *doc, int idx)
+{
+    bool unused;
+    return jd_get_bool(doc, idx, &unused);
+}
+
+bool jd_is_number(const JsonDoc *doc, int idx)
+{
+    const JsonToken *t = jd_tok(doc, idx);
+    if (t == NULL || t->type != JD_PRIMITIVE) return false;
+
+    if (doc->format == PAYLOAD_CBOR) {
+        uint8_t ib = (uint8_t)doc->json[t->start];
+        uint8_t major = ib >> 5;
+        uint8_t info = ib & 0x1F;
+        return major == CBOR_MAJOR_UINT || major == CBOR_MAJOR_NINT ||
+               (major == CBOR_MAJOR_SIMPLE && info >= 25 && info <= 27);
+    }
+
+    char c = doc->json[t->start];
+    return c == '-' || (c >= '0' && c <= '9');
+}
+
+bool jd_get_bool(const JsonDoc *doc, int idx, bool *out)
+{
+    const JsonToken *t = jd_tok(doc, idx);
+    if (t == NULL || t->type != JD_PRIMITIVE) return false;
+
+    if (doc->format == PAYLOAD_CBOR) {
+        uint8_t ib = (uint8_t)doc->json[t->start];
+        if (ib != CBOR_TRUE && ib != CBOR_FALSE) return false;
+        *out = (ib == CBOR_TRUE);
+        return true;
+    }
+
+    const char *v = doc->json + t->start;
+    size_t n = t->end - t->start;
+
+    if (n == 4 && memcmp(v, "true", 4) == 0) {
+        *out = true;
+        return true;
+    }
+    if (n == 5 && memcmp(v, "false", 5) == 0) {
+        *out = false;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Read a number as int (fraction truncated, like cJSON valueint)
+ *
+ * Any JSON number is accepted ("1.5e3" reads as 1500); values out of
+ * the int32 range saturate like cJSON.
+ */
+bool jd_get_int(const JsonDoc *doc, int idx, int *out)
+{
+    if (!jd_is_number(doc, idx)) return false;
+
+    const JsonToken *t = &doc->tokens[idx];
+    double v;
+
+    if (doc->format == PAYLOAD_CBOR) {
+        CborHead h;
+        if (!cbor_read_head((const uint8_t *)doc->json + t->start, t->end - t->start, &h)) {
+            return false;
+        }
+
+        if (h.major == CBOR_MAJOR_UINT) {
+            v = (h.value > INT32_MAX) ? INT32_MAX : (double)h.value;
+        } else if (h.major == CBOR_MAJOR_NINT) {
+            v = (h.value > INT32_MAX) ? INT32_MIN : -1.0 - (double)h.value;
+        } else {
+            v = cb_float(&h);
+            if (v != v) v = 0;          // NaN
+        }
+    } else {
+        // Token is not NUL-terminated: strtod() on a bounded copy
+        char num[JD_NUMBER_MAX_LEN + 1];
+        size_t n = t->end - t->start;
+        if (n == 0 || n > JD_NUMBER_MAX_LEN) return false;
+
+        memcpy(num, doc->json + t->start, n);
+        num[n] = '\0';
+
+        char *end;
+        v = strtod(num, &end);
+        if (end != &num[n]) return false;
+    }
+
+    if (v > INT32_MAX) v = INT32_MAX;
+    if (v < INT32_MIN) v = INT32_MIN;
+    *out = (int)v;                      // Truncates like cJSON valueint
+    return true;
+}
+
+static int jd_hex(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief Copy and unescape a string token into out
+ *
+ * Like snprintf, the result is always NUL-terminated and silently
+ * truncated to size - 1 bytes.
+ *
+ * @return Copied length, or -1 if idx is not a valid string
+ */
+int jd_copy_string(const JsonDoc *doc, int idx, char *out, size_t size)
+{
+    const JsonToken *t = jd_tok(doc, idx);
+    if (t == NULL || t->type != JD_STRING || out == NULL || size == 0) return -1;
+
+    const char *s = doc->json + t->start;
+    const char *end = doc->json + t->end;
+    size_t n = 0;
+
+    // CBOR text is raw UTF-8, nothing to unescape
+    if (doc->format == PAYLOAD_CBOR) {
+        n = (size_t)(end - s);
+        if (n >= size) n = size - 1;
+        memcpy(out, s, n);
+        out[n] = '\0';
+        return (int)n;
+    }
+
+    while (s < end) {
+        char c = *s++;
+
+        if (c == '\\') {
+            if (s >= end) return -1;
+            char e = *s++;
+
+            switch (e) {
+                case '"':  c = '"';  break;
+                case '\\': c = '\\'; break;
+                case '/':  c = '/';  break;
+                case 'b':  c = '\b'; break;
+                case 'f':  c = '\f'; break;
+                case 'n':  c = '\n'; break;
+                case 'r':  c = '\r'; break;
+                case 't':  c = '\t'; break;
+                case 'u': {
+                    if (end - s < 4) return -1;
+                    int cp = 0;
+                    for (int i = 0; i < 4; i++) {
+                        int h = jd_hex(s[i]);
+                        if (h < 0) return -1;
+                        cp = (cp << 4) | h;
+                    }
+                    s += 4;
+
+                    // Encode as UTF-8 (surrogates are replaced)
+                    char utf8[3];
+                    size_t ulen;
+                    if (cp < 0x80) {
+                        utf8[0] = (char)cp;
+                        ulen = 1;
+                    } else if (cp < 0x800) {
+                        utf8[0] = (char)(0xC0 | (cp >> 6));
+                        utf8[1] = (char)(0x80 | (cp & 0x3F));
+                        ulen = 2;
+                    } else if (cp >= 0xD800 && cp <= 0xDFFF) {
+                        utf8[0] = '?';
+                        ulen = 1;
+                    } else {
+                        utf8[0] = (char)(0xE0 | (cp >> 12));
+                        utf8[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                        utf8[2] = (char)(0x80 | (cp & 0x3F));
+                        ulen = 3;
+                    }
+
+                    for (size_t i = 0; i < ulen && n + 1 < size; i++) {
+                        out[n++] = utf8[i];
+                    }
+                    continue;
+                }
+                default:
+                    return -1;
+            }
+        }
+
+        if (n + 1 < size) {
+            out[n++] = c;
+        }
+    }
+
+    out[n] = '\0';
+    return (int)n;
+}
+
+/**
+ * @brief Compare a string token with s (JSON: raw, without unescaping)
+ */
+bool jd_string_eq(const JsonDoc *doc, int idx, const char *s)
+{
+    const JsonToken *t = jd_tok(doc, idx);
+    if (t == NULL || t->type != JD_STRING) return false;
+
+    size_t n = strlen(s);
+    return (size_t)(t->end - t->start) == n &&
+           memcmp(doc->json + t->start, s, n) == 0;
+}
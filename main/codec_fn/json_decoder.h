@@ -0,0 +1,67 @@
+#ifndef JSON_DECODER_H
+#define JSON_DECODER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#include "payload_format.h"
+
+// Token budget for one inbound message (a full 10-entry control_data uses ~95)
+#define JSON_DECODER_MAX_TOKENS     128
+#define JSON_DECODER_MAX_DEPTH      8
+
+typedef enum {
+    JD_UNDEFINED = 0,
+    JD_OBJECT,
+    JD_ARRAY,
+    JD_STRING,
+    JD_PRIMITIVE        // number, true, false, null
+} jd_type_t;
+
+/**
+ * @brief One token referencing the receive buffer in place
+ *
+ * For strings, start/end exclude the quotes (CBOR: the head). For
+ * CBOR primitives, start is the item's initial byte. `next` is the index of
+ * the first token after this token's subtree, so siblings can be
+ * skipped in O(1).
+ */
+typedef struct {
+    uint8_t type;
+    uint16_t start;
+    uint16_t end;
+    uint16_t size;      // Members (object) or elements (array)
+    uint16_t next;
+} JsonToken;
+
+typedef struct {
+    PayloadFormat format;
+    const char *json;
+    size_t len;
+    JsonToken *tokens;
+    uint16_t max_tokens;
+    uint16_t count;
+} JsonDoc;
+
+esp_err_t jd_parse(JsonDoc *doc, const char *json, size_t len,
+                   JsonToken *tokens, uint16_t max_tokens);
+esp_err_t jd_parse_cbor(JsonDoc *doc, const uint8_t *data, size_t len,
+                        JsonToken *tokens, uint16_t max_tokens);
+
+int  jd_find(const JsonDoc *doc, int obj, const char *key);
+int  jd_array_item(const JsonDoc *doc, int arr, int n);
+
+bool jd_is_object(const JsonDoc *doc, int idx);
+bool jd_is_array(const JsonDoc *doc, int idx);
+bool jd_is_string(const JsonDoc *doc, int idx);
+bool jd_is_bool(const JsonDoc *doc, int idx);
+bool jd_is_number(const JsonDoc *doc, int idx);
+
+bool jd_get_bool(const JsonDoc *doc, int idx, bool *out);
+bool jd_get_int(const JsonDoc *doc, int idx, int *out);
+int  jd_copy_string(const JsonDoc *doc, int idx, char *out, size_t size);
+bool jd_string_eq(const JsonDoc *doc, int idx, const char *s);
+
+#endif // JSON_DECODER_H
@@ -0,0 +1,340 @@
+/**
+ * @file json_writer.c
+ * @brief Zero-allocation streaming JSON writer
+ *
+ * Replaces the cJSON build → cJSON_PrintUnformatted → free cycle
+ * for outbound payloads. Values are written straight into a
+ * caller-supplied (usually static) buffer:
+ *
+ *   JsonWriter w;
+ *   jw_init(&w, buf, sizeof(buf));
+ *   jw_object_begin(&w);
+ *   jw_key_string(&w, "event", "valve_status");
+ *   jw_key_bool(&w, "online", true);
+ *   jw_object_end(&w);
+ *   int len = jw_finish(&w);     // -1 on overflow
+ *
+ * Output is compact (same format as cJSON_PrintUnformatted).
+ *
+ * Initialised with jw_init_format(..., PAYLOAD_CBOR) the same calls
+ * emit CBOR instead: containers are indefinite-length, dictionary
+ * keys become small integers (cbor_codec.c) and integers/booleans
+ * are binary. Builders therefore serve both encodings unchanged.
+ */
+
+#include <string.h>
+
+#include "cbor_codec.h"
+#include "json_writer.h"
+
+
+/* ======================================================================== */
+/* ========================== LOW LEVEL OUTPUT ============================ */
+/* ======================================================================== */
+
+static void jw_put(JsonWriter *w, const char *data, size_t n)
+{
+    if (w->overflow) return;
+
+    // Keep one byte for the terminating NUL
+    if (w->len + n >= w->size) {
+        w->overflow = true;
+        return;
+    }
+
+    memcpy(w->buf + w->len, data, n);
+    w->len += n;
+}
+
+static void jw_putc(JsonWriter *w, char c)
+{
+    if (w->overflow) return;
+
+    if (w->len + 1 >= w->size) {
+        w->overflow = true;
+        return;
+    }
+
+    w->buf[w->len++] = c;
+}
+
+
+static void jw_put_head(JsonWriter *w, uint8_t major, uint64_t value)
+{
+    uint8_t head[CBOR_MAX_HEAD];
+    size_t n = cbor_put_head(head, major, value);
+    jw_put(w, (const char *)head, n);
+}
+
+
+/**
+ * @brief Write a quoted, escaped JSON string (or CBOR text string)
+ */
+static void jw_put_string(JsonWriter *w, const char *s)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    if (s == NULL) s = "";
+
+    if (w->format == PAYLOAD_CBOR) {
+        size_t n = strlen(s);
+        jw_put_head(w, CBOR_MAJOR_TEXT, n);
+        jw_put(w, s, n);
+        return;
+    }
+
+    jw_putc(w, '"');
+
+    const char *run = s;
+    for (; *s != '\0'; s++) {
+        unsigned char c = (unsigned char)*s;
+
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        // Flush unescaped run
+        jw_put(w, run, (size_t)(s - run));
+        run = s + 1;
+
+        switch (c) {
+            case '"':  jw_put(w, "\\\"", 2); break;
+            case '\\': jw_put(w, "\\\\", 2); break;
+            case '\n': jw_put(w, "\\n", 2);  break;
+            case '\r': jw_put(w, "\\r", 2);  break;
+            case '\t': jw_put(w, "\\t", 2);  break;
+            default: {
+                char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0x0F] };
+                jw_put(w, esc, sizeof(esc));
+                break;
+            }
+        }
+    }
+    jw_put(w, run, (size_t)(s - run));
+
+    jw_putc(w, '"');
+}
+
+
+/**
+ * @brief Write a signed integer without snprintf
+ */
+static void jw_put_int(JsonWriter *w, int64_t value)
+{
+    if (w->format == PAYLOAD_CBOR) {
+        if (value >= 0) {
+            jw_put_head(w, CBOR_MAJOR_UINT, (uint64_t)value);
+        } else {
+            jw_put_head(w, CBOR_MAJOR_NINT, (uint64_t)(-(value + 1)));
+        }
+        return;
+    }
+
+    char tmp[21];
+    size_t pos = sizeof(tmp);
+    uint64_t mag = (value < 0) ? (uint64_t)(-(value + 1)) + 1 : (uint64_t)value;
+
+    do {
+        tmp[--pos] = (char)('0' + (mag % 10));
+        mag /= 10;
+    } while (mag != 0);
+
+    if (value < 0) {
+        tmp[--pos] = '-';
+    }
+
+    jw_put(w, &tmp[pos], sizeof(tmp) - pos);
+}
+
+
+/**
+ * @brief Emit the separator before a new value or member
+ */
+static void jw_separator(JsonWriter *w)
+{
+    if (w->format == PAYLOAD_CBOR) return;
+
+    if (w->need_comma[w->depth]) {
+        jw_putc(w, ',');
+    }
+    w->need_comma[w->depth] = true;
+}
+
+static void jw_key(JsonWriter *w, const char *key)
+{
+    if (w->format == PAYLOAD_CBOR) {
+        int id = cbor_key_id(key);
+        if (id >= 0) {
+            jw_put_head(w, CBOR_MAJOR_UINT, (uint64_t)id);
+        } else {
+            jw_put_string(w, key);
+        }
+        return;
+    }
+
+    jw_separator(w);
+    jw_put_string(w, key);
+    jw_putc(w, ':');
+}
+
+static void jw_put_bool(JsonWriter *w, bool value)
+{
+    if (w->format == PAYLOAD_CBOR) {
+        jw_putc(w, (char)(value ? CBOR_TRUE : CBOR_FALSE));
+    } else if (value) {
+        jw_put(w, "true", 4);
+    } else {
+        jw_put(w, "false", 5);
+    }
+}
+
+static void jw_open(JsonWriter *w, char c)
+{
+    if (w->format == PAYLOAD_CBOR) {
+        c = (char)(c == '{' ? CBOR_INDEF_MAP : CBOR_INDEF_ARRAY);
+    }
+    jw_putc(w, c);
+
+    if (w->depth >= JSON_WRITER_MAX_DEPTH) {
+        w->overflow = true;
+        return;
+    }
+
+    w->depth++;
+    w->need_comma[w->depth] = false;
+}
+
+static void jw_close(JsonWriter *w, char c)
+{
+    if (w->depth == 0) {
+        w->overflow = true;
+        return;
+    }
+
+    w->depth--;
+    jw_putc(w, (w->format == PAYLOAD_CBOR) ? (char)CBOR_BREAK : c);
+}
+
+
+
+/* ======================================================================== */
+/* ============================== PUBLIC API ============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Start writing into buf
+ *
+ * @param w     Writer state
+ * @param buf   Output buffer (static or stack)
+ * @param size  Buffer size including terminating NUL
+ */
+void jw_init(JsonWriter *w, char *buf, size_t size)
+{
+    jw_init_format(w, buf, size, PAYLOAD_JSON);
+}
+
+/**
+ * @brief Start writing into buf in the given encoding
+ *
+ * In CBOR mode buf holds binary data; use the length returned by
+ * jw_finish() rather than strlen().
+ */
+void jw_init_format(JsonWriter *w, char *buf, size_t size, PayloadFormat format)
+{
+    w->format = format;
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->overflow = (buf == NULL || size == 0);
+    w->depth = 0;
+    w->need_comma[0] = false;
+}
+
+/**
+ * @brief Terminate the output
+ *
+ * @return Length of the output (excluding NUL), or -1 if the
+ *         buffer was too small or containers are unbalanced
+ */
+int jw_finish(JsonWriter *w)
+{
+    if (w->overflow || w->depth != 0) {
+        if (w->buf != NULL && w->size > 0) {
+            w->buf[0] = '\0';
+        }
+        return -1;
+    }
+
+    w->buf[w->len] = '\0';
+    return (int)w->len;
+}
+
+void jw_object_begin(JsonWriter *w)
+{
+    jw_separator(w);
+    jw_open(w, '{');
+}
+
+void jw_object_end(JsonWriter *w)
+{
+    jw_close(w, '}');
+}
+
+void jw_array_begin(JsonWriter *w)
+{
+    jw_separator(w);
+    jw_open(w, '[');
+}
+
+void jw_array_end(JsonWriter *w)
+{
+    jw_close(w, ']');
+}
+
+void jw_key_object_begin(JsonWriter *w, const char *key)
+{
+    jw_key(w, key);
+    jw_open(w, '{');
+}
+
+void jw_key_array_begin(JsonWriter *w, const char *key)
+{
+    jw_key(w, key);
+    jw_open(w, '[');
+}
+
+void jw_key_string(JsonWriter *w, const char *key, const char *value)
+{
+    jw_key(w, key);
+    jw_put_string(w, value);
+}
+
+void jw_key_int(JsonWriter *w, const char *key, int64_t value)
+{
+    jw_key(w, key);
+    jw_put_int(w, value);
+}
+
+void jw_key_bool(JsonWriter *w, const char *key, bool value)
+{
+    jw_key(w, key);
+    jw_put_bool(w, value);
+}
+
+void jw_string(JsonWriter *w, const char *value)
+{
+    jw_separator(w);
+    jw_put_string(w, value);
+}
+
+void jw_int(JsonWriter *w, int64_t value)
+{
+    jw_separator(w);
+    jw_put_int(w, value);
+}
+
+void jw_bool(JsonWriter *w, bool value)
+{
+    jw_separator(w);
+    jw_put_bool(w, value);
+}
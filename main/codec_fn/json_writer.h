@@ -0,0 +1,51 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "payload_format.h"
+
+#define JSON_WRITER_MAX_DEPTH   8
+
+/**
+ * @brief Streaming JSON writer state
+ *
+ * Emits JSON text (or CBOR, see jw_init_format) directly into a
+ * caller-supplied buffer. No heap is used; on overflow the writer
+ * stops and jw_finish() reports the error.
+ */
+typedef struct {
+    PayloadFormat format;
+    char *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+    uint8_t depth;
+    bool need_comma[JSON_WRITER_MAX_DEPTH + 1];
+} JsonWriter;
+
+void jw_init(JsonWriter *w, char *buf, size_t size);
+void jw_init_format(JsonWriter *w, char *buf, size_t size, PayloadFormat format);
+int  jw_finish(JsonWriter *w);
+
+// Containers
+void jw_object_begin(JsonWriter *w);
+void jw_object_end(JsonWriter *w);
+void jw_array_begin(JsonWriter *w);
+void jw_array_end(JsonWriter *w);
+void jw_key_object_begin(JsonWriter *w, const char *key);
+void jw_key_array_begin(JsonWriter *w, const char *key);
+
+// Object members
+void jw_key_string(JsonWriter *w, const char *key, const char *value);
+void jw_key_int(JsonWriter *w, const char *key, int64_t value);
+void jw_key_bool(JsonWriter *w, const char *key, bool value);
+
+// Array elements
+void jw_string(JsonWriter *w, const char *value);
+void jw_int(JsonWriter *w, int64_t value);
+void jw_bool(JsonWriter *w, bool value);
+
+#endif // JSON_WRITER_H
@@ -0,0 +1,16 @@
+#ifndef PAYLOAD_FORMAT_H
+#define PAYLOAD_FORMAT_H
+
+/**
+ * @brief Wire encoding of a payload
+ *
+ * JSON is the default. CBOR (RFC 8949) is selected per topic with
+ * the "/cbor" suffix and uses the integer key dictionary from
+ * cbor_codec.h.
+ */
+typedef enum {
+    PAYLOAD_JSON = 0,
+    PAYLOAD_CBOR
+} PayloadFormat;
+
+#endif // PAYLOAD_FORMAT_H
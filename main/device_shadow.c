@@ -0,0 +1,196 @@
+/**
+ * @file device_shadow.c
+ * @brief Versioned desired state (device shadow) for server commands
+ *
+ * Commands from MQTT and WebSocket no longer overwrite serverData /
+ * serverControl as whole structures. They are turned into sparse
+ * ShadowPatch objects and merged field by field:
+ *
+ *   patch (only changed fields) ---> desired state (+1 version)
+ *                                       ↓
+ *                          serverData / serverControl
+ *
+ * A patch may carry the version it was based on. If another patch
+ * was applied in the meantime the versions differ and the patch is
+ * rejected, so concurrent operators get a deterministic result
+ * instead of last-writer-wins.
+ *
+ * The shadow lives next to the data it mirrors and is protected by
+ * serverMutex. The version restarts at 0 after boot; every shadow
+ * report carries it so the server can resynchronise.
+ */
+
+#include <string.h>
+#include "esp_log.h"
+
+#include "device_shadow.h"
+
+
+static const char *TAG = "DEVICE_SHADOW";
+
+// Guarded by serverMutex
+static ShadowState shadow;
+
+
+
+/* ======================================================================== */
+/* ================================ MERGE ================================= */
+/* ======================================================================== */
+
+/**
+ * @brief Merge patch into the desired state and the server globals
+ *
+ * @note Caller holds serverMutex.
+ */
+static void merge_patch(const ShadowPatch *patch)
+{
+    ShadowPatch *d = &shadow.desired;
+
+    if (patch->fields & SHADOW_F_SCHEDULE_CONTROL) {
+        d->schedule_control = patch->schedule_control;
+        serverData.schedule_control = patch->schedule_control;
+        serverControl.schedule_control = patch->schedule_control;
+    }
+
+    if (patch->fields & SHADOW_F_SENSOR_CONTROL) {
+        d->sensor_control = patch->sensor_control;
+        serverData.sensor_control = patch->sensor_control;
+        serverControl.sensor_control = patch->sensor_control;
+    }
+
+    if (patch->fields & SHADOW_F_ANGLE) {
+        d->set_angle = patch->set_angle;
+        d->angle = patch->angle;
+        serverData.set_angle = patch->set_angle;
+        serverData.angle = patch->angle;
+    }
+
+    // Schedule list is replaced as a whole, like a JSON merge patch array
+    if (patch->fields & SHADOW_F_SCHEDULE) {
+        d->set_schedule = patch->set_schedule;
+        d->schedule_count = patch->schedule_count;
+        memcpy(d->schedule_info, patch->schedule_info, sizeof(d->schedule_info));
+
+        memset(serverControl.schedule_info, 0, sizeof(serverControl.schedule_info));
+        memcpy(serverControl.schedule_info, patch->schedule_info,
+               patch->schedule_count * sizeof(ScheduleInfo));
+        serverControl.set_schedule = patch->set_schedule;
+    }
+
+    if (patch->fields & SHADOW_F_SENSOR_LIMITS) {
+        d->sensor_upper_limit = patch->sensor_upper_limit;
+        d->sensor_lower_limit = patch->sensor_lower_limit;
+        serverControl.sensor_upper_limit = patch->sensor_upper_limit;
+        serverControl.sensor_lower_limit = patch->sensor_lower_limit;
+    }
+
+    d->fields |= patch->fields;
+}
+
+
+
+/* ======================================================================== */
+/* ============================== PUBLIC API ============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Apply a sparse patch to the desired state
+ *
+ * @param patch             Fields to change
+ * @param expected_version  Version the sender based the patch on,
+ *                          or NULL to apply unconditionally
+ * @param version           Out (optional): version after the call
+ *
+ * @return SHADOW_APPLIED or SHADOW_CONFLICT
+ */
+shadow_result_t shadow_apply(const ShadowPatch *patch, const uint32_t *expected_version,
+                             uint32_t *version)
+{
+    shadow_result_t result = SHADOW_APPLIED;
+
+    xSemaphoreTake(serverMutex, portMAX_DELAY);
+
+    if (expected_version != NULL && *expected_version != shadow.version) {
+        shadow.conflicts++;
+        result = SHADOW_CONFLICT;
+    } else {
+        merge_patch(patch);
+        shadow.version++;
+    }
+
+    uint32_t current = shadow.version;
+
+    xSemaphoreGive(serverMutex);
+
+    if (version != NULL) {
+        *version = current;
+    }
+
+    if (result == SHADOW_CONFLICT) {
+        ESP_LOGW(TAG, "Patch for version %lu rejected, current %lu",
+                 (unsigned long)*expected_version, (unsigned long)current);
+    }
+
+    return result;
+}
+
+
+/**
+ * @brief Count a patch rejected before shadow_apply() (stale version)
+ */
+void shadow_note_conflict(void)
+{
+    xSemaphoreTake(serverMutex, portMAX_DELAY);
+    shadow.conflicts++;
+    xSemaphoreGive(serverMutex);
+}
+
+
+/**
+ * @brief Check whether a patch will make the valve move
+ *
+ * Fields missing from the patch are taken from the current desired
+ * state, mirroring valve_sync_process(): a set_angle request only
+ * moves the motor while schedule and sensor control are both off.
+ */
+bool shadow_patch_moves(const ShadowPatch *patch)
+{
+    if (!(patch->fields & SHADOW_F_ANGLE) || !patch->set_angle) {
+        return false;
+    }
+
+    xSemaphoreTake(serverMutex, portMAX_DELAY);
+    bool schedule = (patch->fields & SHADOW_F_SCHEDULE_CONTROL) ?
+                    patch->schedule_control : shadow.desired.schedule_control;
+    bool sensor = (patch->fields & SHADOW_F_SENSOR_CONTROL) ?
+                  patch->sensor_control : shadow.desired.sensor_control;
+    xSemaphoreGive(serverMutex);
+
+    return !schedule && !sensor;
+}
+
+
+/**
+ * @brief Current desired-state version
+ */
+uint32_t shadow_get_version(void)
+{
+    xSemaphoreTake(serverMutex, portMAX_DELAY);
+    uint32_t version = shadow.version;
+    xSemaphoreGive(serverMutex);
+
+    return version;
+}
+
+
+/**
+ * @brief Copy the desired state
+ */
+void shadow_get(ShadowState *state)
+{
+    if (state == NULL) return;
+
+    xSemaphoreTake(serverMutex, portMAX_DELAY);
+    *state = shadow;
+    xSemaphoreGive(serverMutex);
+}
@@ -0,0 +1,29 @@
+#ifndef DEVICE_SHADOW_H
+#define DEVICE_SHADOW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "global_var.h"
+#include "codec_fn/command_decoder.h"
+
+typedef enum {
+    SHADOW_APPLIED = 0,         // Patch merged, version incremented
+    SHADOW_CONFLICT             // Expected version was stale, nothing changed
+} shadow_result_t;
+
+// Desired state and its version
+typedef struct {
+    uint32_t version;           // Incremented by every applied patch (0 after boot)
+    uint32_t conflicts;         // Patches rejected for a stale version
+    ShadowPatch desired;        // Full desired state; fields = bits ever set
+} ShadowState;
+
+shadow_result_t shadow_apply(const ShadowPatch *patch, const uint32_t *expected_version,
+                             uint32_t *version);
+void shadow_note_conflict(void);
+bool shadow_patch_moves(const ShadowPatch *patch);
+uint32_t shadow_get_version(void);
+void shadow_get(ShadowState *state);
+
+#endif // DEVICE_SHADOW_H
@@ -0,0 +1,124 @@
+/**
+ * @file group_storage.c
+ * @brief NVS-based command group membership storage
+ *
+ * This module:
+ *  - Loads the group list and stagger offset from NVS at boot
+ *  - Saves them when the backend assigns new groups over MQTT
+ *
+ * Membership is stored as a binary blob (GroupConfig structure).
+ */
+
+#include <string.h>
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "esp_log.h"
+
+#include "group_storage.h"
+
+/* ======================================================================== */
+/* ========================== NVS CONFIGURATION =========================== */
+/* ======================================================================== */
+
+/**
+ * @brief NVS namespace and key of the group blob
+ */
+#define GROUP_NVS_NAMESPACE    "group_cfg"
+#define GROUP_NVS_KEY          "groups"
+
+/**
+ * @brief Logging tag
+ */
+static const char *TAG_GROUP = "group_storage";
+
+
+/* ======================================================================== */
+/* ============================ LOAD GROUPS =============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Load group membership from NVS
+ *
+ * A blob of another size (CONFIG_MQTT_GROUP_MAX changed) is
+ * treated as not stored, so the device starts without groups.
+ *
+ * @param cfg  Output; cleared if nothing valid is stored
+ *
+ * @return
+ *   - ESP_OK if successful
+ *   - ESP_ERR_NVS_NOT_FOUND if no groups stored
+ *   - Other NVS error codes on failure
+ */
+esp_err_t group_storage_load(GroupConfig *cfg)
+{
+    nvs_handle_t handle;
+    esp_err_t err;
+    size_t size = sizeof(GroupConfig);
+
+    memset(cfg, 0, sizeof(*cfg));
+
+    err = nvs_open(GROUP_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGI(TAG_GROUP, "No stored groups");
+        return err;
+    }
+
+    err = nvs_get_blob(handle, GROUP_NVS_KEY, cfg, &size);
+    nvs_close(handle);
+
+    if (err == ESP_OK && (size != sizeof(GroupConfig) || cfg->count > GROUP_MAX)) {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG_GROUP, "Failed to read groups (%s)", esp_err_to_name(err));
+        memset(cfg, 0, sizeof(*cfg));
+        return err;
+    }
+
+    // Names are used as topic levels: never trust a missing terminator
+    for (int i = 0; i < GROUP_MAX; i++) {
+        cfg->names[i][GROUP_NAME_SIZE - 1] = '\0';
+    }
+
+    ESP_LOGI(TAG_GROUP, "Loaded %d groups (stagger %u ms)", cfg->count, cfg->stagger_ms);
+    return ESP_OK;
+}
+
+
+/* ======================================================================== */
+/* ============================ SAVE GROUPS =============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Save group membership to NVS
+ *
+ * @return
+ *   - ESP_OK if successful
+ *   - Other NVS error codes on failure
+ */
+esp_err_t group_storage_save(const GroupConfig *cfg)
+{
+    nvs_handle_t handle;
+    esp_err_t err;
+
+    err = nvs_open(GROUP_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_GROUP, "Failed to open NVS (%s)", esp_err_to_name(err));
+        return err;
+    }
+
+    err = nvs_set_blob(handle, GROUP_NVS_KEY, cfg, sizeof(GroupConfig));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_GROUP, "Failed to write groups (%s)", esp_err_to_name(err));
+    } else {
+        ESP_LOGI(TAG_GROUP, "Groups saved to NVS");
+    }
+
+    nvs_close(handle);
+    return err;
+}
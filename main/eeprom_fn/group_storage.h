@@ -0,0 +1,23 @@
+#ifndef GROUP_STORAGE_H
+#define GROUP_STORAGE_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#define GROUP_MAX           CONFIG_MQTT_GROUP_MAX
+#define GROUP_NAME_SIZE     24
+
+/**
+ * @brief Command groups this device belongs to
+ */
+typedef struct {
+    uint8_t count;
+    uint16_t stagger_ms;                    // Delay before applying a group command
+    char names[GROUP_MAX][GROUP_NAME_SIZE];
+} GroupConfig;
+
+esp_err_t group_storage_load(GroupConfig *cfg);
+esp_err_t group_storage_save(const GroupConfig *cfg);
+
+#endif /* GROUP_STORAGE_H */
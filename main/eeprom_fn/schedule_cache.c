@@ -0,0 +1,381 @@
+/**
+ * @file schedule_cache.c
+ * @brief NVS cache of schedule programs, addressed by content hash
+ *
+ * This module:
+ *  - Computes the SHA-256 of a schedule list (its "schedule_hash")
+ *  - Keeps up to SCHEDULE_CACHE_SLOTS programs in NVS, one blob each
+ *  - Evicts the least recently used program when the cache is full
+ *
+ * The hash covers the canonical text of the list, one line per entry:
+ *
+ *   "<day>,<open>,<close>\n"      e.g. "Mon,08:00,17:00\n"
+ *
+ * so it is the same for a JSON or CBOR body and the backend can
+ * compute it without knowing the device's structures.
+ *
+ * Only the hashes and use stamps are kept in RAM; a program is read
+ * from NVS when it is applied. Called from the MQTT rx worker only.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+
+#include "schedule_cache.h"
+
+/* ======================================================================== */
+/* ========================== NVS CONFIGURATION =========================== */
+/* ======================================================================== */
+
+/**
+ * @brief NVS namespace; programs are "prog<slot>", use stamps "lru"
+ */
+#define CACHE_NVS_NAMESPACE    "sched_cache"
+#define CACHE_NVS_LRU_KEY      "lru"
+
+/**
+ * @brief One cached program (NVS blob)
+ */
+typedef struct {
+    uint8_t hash[SCHEDULE_HASH_SIZE];
+    uint8_t count;
+    ScheduleInfo info[SCHEDULE_CACHE_ENTRIES];
+} CachedProgram;
+
+/**
+ * @brief Logging tag
+ */
+static const char *TAG_CACHE = "schedule_cache";
+
+// RAM index of the NVS slots
+static struct {
+    bool valid;
+    uint8_t hash[SCHEDULE_HASH_SIZE];
+} slots[SCHEDULE_CACHE_SLOTS];
+
+static uint32_t slot_used[SCHEDULE_CACHE_SLOTS];   // Use stamps (LRU)
+static uint32_t use_clock;
+
+
+/* ======================================================================== */
+/* ============================ HASH HELPERS ============================== */
+/* ======================================================================== */
+
+/**
+ * @brief SHA-256 of the canonical text of a schedule list
+ */
+void schedule_cache_hash(const ScheduleInfo *info, size_t count,
+                         uint8_t hash[SCHEDULE_HASH_SIZE])
+{
+    mbedtls_sha256_context ctx;
+    char line[DAY_SIZE + 2 * TIME_SIZE + 4];
+
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+
+    for (size_t i = 0; i < count; i++) {
+        int len = snprintf(line, sizeof(line), "%.*s,%.*s,%.*s\n",
+                           DAY_SIZE, info[i].day, TIME_SIZE, info[i].open,
+                           TIME_SIZE, info[i].close);
+        mbedtls_sha256_update(&ctx, (const unsigned char *)line, (size_t)len);
+    }
+
+    mbedtls_sha256_finish(&ctx, hash);
+    mbedtls_sha256_free(&ctx);
+}
+
+
+/**
+ * @brief Parse 64 hex digits (either case)
+ *
+ * @return false if hex is not exactly one SHA-256 in hex
+ */
+bool schedule_hash_from_hex(const char *hex, uint8_t hash[SCHEDULE_HASH_SIZE])
+{
+    if (strlen(hex) != SCHEDULE_HASH_SIZE * 2) return false;
+
+    for (int i = 0; i < SCHEDULE_HASH_SIZE * 2; i++) {
+        char c = hex[i];
+        uint8_t v;
+
+        if (c >= '0' && c <= '9')      v = (uint8_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') v = (uint8_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') v = (uint8_t)(c - 'A' + 10);
+        else return false;
+
+        if (i % 2 == 0) hash[i / 2] = (uint8_t)(v << 4);
+        else            hash[i / 2] |= v;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Format a hash as 64 lowercase hex digits
+ */
+void schedule_hash_to_hex(const uint8_t hash[SCHEDULE_HASH_SIZE], char hex[SCHEDULE_HASH_HEX_SIZE])
+{
+    static const char digits[] = "0123456789abcdef";
+
+    for (int i = 0; i < SCHEDULE_HASH_SIZE; i++) {
+        hex[2 * i] = digits[hash[i] >> 4];
+        hex[2 * i + 1] = digits[hash[i] & 0x0F];
+    }
+    hex[SCHEDULE_HASH_SIZE * 2] = '\0';
+}
+
+
+/* ======================================================================== */
+/* ============================ INTERNAL HELPERS ========================== */
+/* ======================================================================== */
+
+static void slot_key(int slot, char *key, size_t size)
+{
+    snprintf(key, size, "prog%d", slot);
+}
+
+
+static int slot_find(const uint8_t hash[SCHEDULE_HASH_SIZE])
+{
+    for (int i = 0; i < SCHEDULE_CACHE_SLOTS; i++) {
+        if (slots[i].valid && memcmp(slots[i].hash, hash, SCHEDULE_HASH_SIZE) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * @brief Read and verify the program of a slot
+ *
+ * A blob of another size or whose content no longer matches its
+ * hash is treated as empty.
+ */
+static esp_err_t slot_read(nvs_handle_t handle, int slot, CachedProgram *prog)
+{
+    char key[16];
+    size_t size = sizeof(*prog);
+    uint8_t hash[SCHEDULE_HASH_SIZE];
+
+    slot_key(slot, key, sizeof(key));
+    esp_err_t err = nvs_get_blob(handle, key, prog, &size);
+    if (err != ESP_OK) return err;
+
+    if (size != sizeof(*prog) || prog->count > SCHEDULE_CACHE_ENTRIES) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (int i = 0; i < SCHEDULE_CACHE_ENTRIES; i++) {
+        prog->info[i].day[DAY_SIZE - 1] = '\0';
+        prog->info[i].open[TIME_SIZE - 1] = '\0';
+        prog->info[i].close[TIME_SIZE - 1] = '\0';
+    }
+
+    schedule_cache_hash(prog->info, prog->count, hash);
+    if (memcmp(hash, prog->hash, SCHEDULE_HASH_SIZE) != 0) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Mark a slot as just used and store the use stamps
+ */
+static esp_err_t slot_touch(nvs_handle_t handle, int slot)
+{
+    slot_used[slot] = ++use_clock;
+
+    esp_err_t err = nvs_set_blob(handle, CACHE_NVS_LRU_KEY, slot_used, sizeof(slot_used));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    return err;
+}
+
+
+/* ======================================================================== */
+/* ============================== PUBLIC API ============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Build the RAM index from NVS (once, before the client starts)
+ *
+ * @return
+ *   - ESP_OK (also with an empty cache)
+ *   - Other NVS error codes on failure
+ */
+esp_err_t schedule_cache_init(void)
+{
+    nvs_handle_t handle;
+    CachedProgram prog;
+    size_t loaded = 0;
+
+    memset(slots, 0, sizeof(slots));
+    memset(slot_used, 0, sizeof(slot_used));
+    use_clock = 0;
+
+    esp_err_t err = nvs_open(CACHE_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGI(TAG_CACHE, "Schedule cache empty");
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG_CACHE, "Failed to open NVS (%s)", esp_err_to_name(err));
+        return err;
+    }
+
+    // Stamps of another size (slot count changed) are dropped
+    size_t size = sizeof(slot_used);
+    if (nvs_get_blob(handle, CACHE_NVS_LRU_KEY, slot_used, &size) != ESP_OK ||
+        size != sizeof(slot_used)) {
+        memset(slot_used, 0, sizeof(slot_used));
+    }
+
+    for (int i = 0; i < SCHEDULE_CACHE_SLOTS; i++) {
+        if (slot_read(handle, i, &prog) != ESP_OK) continue;
+
+        slots[i].valid = true;
+        memcpy(slots[i].hash, prog.hash, SCHEDULE_HASH_SIZE);
+        if (slot_used[i] > use_clock) {
+            use_clock = slot_used[i];
+        }
+        loaded++;
+    }
+
+    nvs_close(handle);
+
+    ESP_LOGI(TAG_CACHE, "Loaded %u cached schedule programs", (unsigned)loaded);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Read the program with this hash
+ *
+ * @param info   Output, SCHEDULE_CACHE_ENTRIES entries (unused ones cleared)
+ * @param count  Output, entries in the program
+ *
+ * @return
+ *   - ESP_OK on a hit
+ *   - ESP_ERR_NOT_FOUND if the program is not cached
+ *   - Other NVS error codes on failure (the slot is dropped)
+ */
+esp_err_t schedule_cache_get(const uint8_t hash[SCHEDULE_HASH_SIZE],
+                             ScheduleInfo *info, size_t *count)
+{
+    int slot = slot_find(hash);
+    if (slot < 0) return ESP_ERR_NOT_FOUND;
+
+    nvs_handle_t handle;
+    CachedProgram prog;
+
+    esp_err_t err = nvs_open(CACHE_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) return err;
+
+    err = slot_read(handle, slot, &prog);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG_CACHE, "Cached program %d unreadable (%s)", slot, esp_err_to_name(err));
+        slots[slot].valid = false;
+        nvs_close(handle);
+        return err;
+    }
+
+    memcpy(info, prog.info, sizeof(prog.info));
+    *count = prog.count;
+
+    // A failed stamp only makes the program an earlier eviction candidate
+    slot_touch(handle, slot);
+    nvs_close(handle);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Store a program (no-op if it is already cached)
+ *
+ * @param hash  Output, hash of the program
+ *
+ * @return
+ *   - ESP_OK if successful
+ *   - ESP_ERR_INVALID_SIZE if count exceeds SCHEDULE_CACHE_ENTRIES
+ *   - Other NVS error codes on failure
+ */
+esp_err_t schedule_cache_put(const ScheduleInfo *info, size_t count,
+                             uint8_t hash[SCHEDULE_HASH_SIZE])
+{
+    if (count > SCHEDULE_CACHE_ENTRIES) return ESP_ERR_INVALID_SIZE;
+
+    schedule_cache_hash(info, count, hash);
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(CACHE_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_CACHE, "Failed to open NVS (%s)", esp_err_to_name(err));
+        return err;
+    }
+
+    int slot = slot_find(hash);
+    if (slot >= 0) {
+        err = slot_touch(handle, slot);
+        nvs_close(handle);
+        return err;
+    }
+
+    // Free slot first, else the least recently used program
+    slot = 0;
+    for (int i = 0; i < SCHEDULE_CACHE_SLOTS; i++) {
+        if (!slots[i].valid) {
+            slot = i;
+            break;
+        }
+        if (slot_used[i] < slot_used[slot]) {
+            slot = i;
+        }
+    }
+
+    CachedProgram prog;
+    memset(&prog, 0, sizeof(prog));
+    memcpy(prog.hash, hash, SCHEDULE_HASH_SIZE);
+    prog.count = (uint8_t)count;
+    memcpy(prog.info, info, count * sizeof(ScheduleInfo));
+
+    char key[16];
+    slot_key(slot, key, sizeof(key));
+
+    slots[slot].valid = false;
+    err = nvs_set_blob(handle, key, &prog, sizeof(prog));
+    if (err == ESP_OK) {
+        slots[slot].valid = true;
+        memcpy(slots[slot].hash, hash, SCHEDULE_HASH_SIZE);
+        err = slot_touch(handle, slot);
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_CACHE, "Failed to cache program (%s)", esp_err_to_name(err));
+    } else {
+        ESP_LOGI(TAG_CACHE, "Program cached in slot %d", slot);
+    }
+
+    nvs_close(handle);
+    return err;
+}
+
+
+/**
+ * @brief Number of cached programs
+ */
+size_t schedule_cache_count(void)
+{
+    size_t n = 0;
+
+    for (int i = 0; i < SCHEDULE_CACHE_SLOTS; i++) {
+        if (slots[i].valid) n++;
+    }
+    return n;
+}
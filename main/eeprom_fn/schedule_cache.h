@@ -0,0 +1,30 @@
+#ifndef SCHEDULE_CACHE_H
+#define SCHEDULE_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#include "global_var.h"
+
+#define SCHEDULE_CACHE_SLOTS    CONFIG_MQTT_SCHEDULE_CACHE_SLOTS
+#define SCHEDULE_CACHE_ENTRIES  10      // Entries per program (CMD_MAX_SCHEDULES)
+
+#define SCHEDULE_HASH_SIZE      32      // SHA-256
+#define SCHEDULE_HASH_HEX_SIZE  (SCHEDULE_HASH_SIZE * 2 + 1)
+
+void schedule_cache_hash(const ScheduleInfo *info, size_t count,
+                         uint8_t hash[SCHEDULE_HASH_SIZE]);
+bool schedule_hash_from_hex(const char *hex, uint8_t hash[SCHEDULE_HASH_SIZE]);
+void schedule_hash_to_hex(const uint8_t hash[SCHEDULE_HASH_SIZE], char hex[SCHEDULE_HASH_HEX_SIZE]);
+
+esp_err_t schedule_cache_init(void);
+esp_err_t schedule_cache_get(const uint8_t hash[SCHEDULE_HASH_SIZE],
+                             ScheduleInfo *info, size_t *count);
+esp_err_t schedule_cache_put(const ScheduleInfo *info, size_t count,
+                             uint8_t hash[SCHEDULE_HASH_SIZE]);
+size_t schedule_cache_count(void);
+
+#endif /* SCHEDULE_CACHE_H */
@@ -0,0 +1,65 @@
+/**
+ * @file error_history.c
+ * @brief Last few valve errors, for on-demand diagnostics
+ *
+ * valveData.error_msg only holds the current error and is cleared by
+ * the next successful move, so an error between two telemetry
+ * messages is never seen by the backend. Every error written there
+ * is also kept here (ring of ERROR_HISTORY_SIZE entries) and can be
+ * fetched with the "get_errors" RPC.
+ *
+ * Guarded by valveMutex, like valveData.error_msg itself.
+ */
+
+#include <string.h>
+#include "esp_timer.h"
+
+#include "global_var.h"
+#include "time_func.h"
+#include "error_history.h"
+
+
+static ErrorEntry history[ERROR_HISTORY_SIZE];
+static size_t history_next;
+static size_t history_count;
+
+
+/**
+ * @brief Keep a copy of a new error message
+ *
+ * Call right after writing valveData.error_msg, with valveMutex held.
+ */
+void error_history_record(const char *msg)
+{
+    ErrorEntry *e = &history[history_next];
+
+    get_current_timestamp(e->timestamp, sizeof(e->timestamp));
+    e->uptime_s = (uint32_t)(esp_timer_get_time() / 1000000);
+    strncpy(e->msg, msg, sizeof(e->msg) - 1);
+    e->msg[sizeof(e->msg) - 1] = '\0';
+
+    history_next = (history_next + 1) % ERROR_HISTORY_SIZE;
+    if (history_count < ERROR_HISTORY_SIZE) {
+        history_count++;
+    }
+}
+
+
+/**
+ * @brief Copy the recorded errors, newest first
+ *
+ * @return Number of entries written to out
+ */
+size_t error_history_get(ErrorEntry *out, size_t max)
+{
+    size_t n = 0;
+
+    xSemaphoreTake(valveMutex, portMAX_DELAY);
+    for (; n < history_count && n < max; n++) {
+        size_t idx = (history_next + ERROR_HISTORY_SIZE - 1 - n) % ERROR_HISTORY_SIZE;
+        out[n] = history[idx];
+    }
+    xSemaphoreGive(valveMutex);
+
+    return n;
+}
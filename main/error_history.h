@@ -0,0 +1,19 @@
+#ifndef ERROR_HISTORY_H
+#define ERROR_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ERROR_HISTORY_SIZE      5
+
+// One valve error as it was written to valveData.error_msg
+typedef struct {
+    char timestamp[25];         // Wall clock (ISO 8601, 1970 before SNTP)
+    uint32_t uptime_s;
+    char msg[100];
+} ErrorEntry;
+
+void error_history_record(const char *msg);
+size_t error_history_get(ErrorEntry *out, size_t max);
+
+#endif // ERROR_HISTORY_H
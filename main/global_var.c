@@ -104,6 +104,8 @@ GetData valveData = {
     .open_limit_click       = false,
     .close_limit_available  = false,
     .close_limit_click      = false,
+    .is_moving              = false,
+    .motion_start_us        = 0,
     .error_msg         = ""
 };
 
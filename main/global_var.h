@@ -2,6 +2,7 @@
 #define GLOBAL_VAR_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 
@@ -54,6 +55,8 @@ typedef struct {
     bool open_limit_click;
     bool close_limit_available;
     bool close_limit_click;
+    bool is_moving;                 // Motor running (set by motor_open / motor_close)
+    int64_t motion_start_us;        // esp_timer time the current motion started
     char error_msg[100];
 } GetData;
 
@@ -24,6 +24,9 @@
 #include "time_func.h"
 #include "valve_fn/valve_process.h"
 #include "eeprom_fn/schedule_storage.h" 
+#include "mqtt_fn/mqtt_cmd_tracker.h"
+#include "mqtt_fn/mqtt_cadence.h"
+#include "error_history.h"
 
 #include "main_process.h"
 
@@ -43,6 +46,32 @@ static bool valve_busy = false;
 
 static const char *TAG_SCHEDULE = "SCHEDULE";
 
+/**
+ * @brief Angle and error before a motor command
+ *
+ * set_angle stays latched and the schedule retries a failed move, so a
+ * command runs every loop; only a changed result wakes the publisher
+ * and goes to the error history.
+ */
+typedef struct {
+    int angle;
+    char error_msg[sizeof(valveData.error_msg)];
+} ValveResult;
+
+// Caller holds valveMutex
+static void valve_result_save(ValveResult *prev)
+{
+    prev->angle = valveData.angle;
+    memcpy(prev->error_msg, valveData.error_msg, sizeof(prev->error_msg));
+}
+
+// Caller holds valveMutex
+static bool valve_result_changed(const ValveResult *prev)
+{
+    return valveData.angle != prev->angle ||
+           strcmp(valveData.error_msg, prev->error_msg) != 0;
+}
+
 
 int parse_time_str(const char *str) {
     int h, m;
@@ -106,10 +135,16 @@ void valve_sync_process(void *pvParameters)
          * (Schedule or Sensor mode status)
          */
         xSemaphoreTake(valveMutex, portMAX_DELAY);
+        bool mode_changed = valveData.schedule_control != localServerData.schedule_control ||
+                            valveData.sensor_control   != localServerData.sensor_control;
         valveData.schedule_control = localServerData.schedule_control;
         valveData.sensor_control   = localServerData.sensor_control;
         xSemaphoreGive(valveMutex);
 
+        if (mode_changed) {
+            mqtt_cadence_notify();
+        }
+
 
         // localServerData.schedule_control = true;
 
@@ -137,6 +172,14 @@ void valve_sync_process(void *pvParameters)
 
                 int err_code = 0;
 
+                ValveResult prev;
+                xSemaphoreTake(valveMutex, portMAX_DELAY);
+                valve_result_save(&prev);
+                xSemaphoreGive(valveMutex);
+
+                // Actuation timing for commands with a cmd_id
+                cmd_tracker_motion_start();
+
                 /**
                  * Execute motor movement based on requested angle
                  * (Assumes 0° = Closed, 90° = Open)
@@ -173,7 +216,17 @@ void valve_sync_process(void *pvParameters)
                             err_code);
                 }
 
+                bool changed = valve_result_changed(&prev);
+                if (changed && err_code != 0) {
+                    error_history_record(valveData.error_msg);
+                }
+
                 xSemaphoreGive(valveMutex);
+                if (changed) {
+                    mqtt_cadence_notify();
+                }
+
+                cmd_tracker_motion_done(err_code);
 
                 valve_busy = false;
             }
@@ -228,6 +281,11 @@ void valve_sync_process(void *pvParameters)
                 valve_busy = true;
                 int err_code = 0;
 
+                ValveResult prev;
+                xSemaphoreTake(valveMutex, portMAX_DELAY);
+                valve_result_save(&prev);
+                xSemaphoreGive(valveMutex);
+
                 if (target_angle == 90) {
                     err_code = motor_open();
                 }
@@ -247,7 +305,15 @@ void valve_sync_process(void *pvParameters)
                                 err_code);
                     }
 
+                    bool changed = valve_result_changed(&prev);
+                    if (changed && err_code != 0) {
+                        error_history_record(valveData.error_msg);
+                    }
+
                     xSemaphoreGive(valveMutex);
+                    if (changed) {
+                        mqtt_cadence_notify();
+                    }
                 }
    
 
@@ -0,0 +1,440 @@
+/**
+ * @file mqtt_broker_select.c
+ * @brief Broker failover list with TCP connect RTT ranking
+ *
+ * The broker list is CONFIG_MQTT_BROKER_URI followed by the comma
+ * separated CONFIG_MQTT_BROKER_URI_FALLBACKS, in order of preference.
+ * All entries share the scheme (and the CA) of the primary.
+ *
+ * Ranking: every broker is probed with a plain TCP connect; the
+ * preferred broker is the first one in list order whose RTT is within
+ * CONFIG_MQTT_BROKER_RTT_MARGIN_MS of the fastest healthy one.
+ *
+ *   connect / keepalive fails N times ──► next broker by rank (failover)
+ *   every CONFIG_MQTT_BROKER_REEVAL_S  ──► probe, move to the preferred
+ *                                          broker if it is not in use
+ *
+ * A switch only sets the pending broker; the URI is applied by the
+ * reconnect path (mqtt_broker_take_switch()) while the client waits
+ * to reconnect.
+ *
+ * State is shared by the MQTT task (connect events), the esp_timer
+ * task (reconnect) and the probe task, under broker_mutex.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "sdkconfig.h"
+
+#include "mqtt_broker_select.h"
+#include "mqtt_client_fn.h"
+
+
+/* ======================================================================== */
+/* ============================ CONFIGURATION ============================= */
+/* ======================================================================== */
+
+#define BROKER_URI_SIZE         96
+#define BROKER_HOST_SIZE        64
+#define BROKER_PROBE_TIMEOUT_MS 3000
+#define BROKER_FIRST_PROBE_MS   10000
+#define BROKER_REEVAL_MS        (CONFIG_MQTT_BROKER_REEVAL_S * 1000u)
+#define BROKER_RTT_MARGIN_MS    CONFIG_MQTT_BROKER_RTT_MARGIN_MS
+#define BROKER_FAILOVER_AFTER   CONFIG_MQTT_BROKER_FAILOVER_AFTER
+
+typedef struct {
+    char uri[BROKER_URI_SIZE];
+    char host[BROKER_HOST_SIZE];
+    uint16_t port;
+    uint32_t rtt_ms;            // Last probe, 0 = not probed yet
+    bool healthy;               // Last probe (or no probe yet) succeeded
+    uint8_t failures;           // Consecutive failed connects / drops
+} BrokerEntry;
+
+static const char *TAG = "MQTT_BROKER";
+
+static BrokerEntry brokers[MQTT_BROKER_MAX];
+static int broker_count;
+static int active;
+static int pending = -1;        // Broker to use on the next connect
+static int64_t lost_us;         // Link to the active broker lost (0 = up)
+
+static MqttBrokerStats broker_stats;
+static SemaphoreHandle_t broker_mutex;
+static TaskHandle_t probe_task;
+static broker_switch_fn switch_cb;
+
+
+
+/* ======================================================================== */
+/* ============================ INTERNAL HELPERS ========================== */
+/* ======================================================================== */
+
+/**
+ * @brief Split "scheme://host[:port][/path]" into host and port
+ */
+static bool parse_uri(BrokerEntry *b, const char *uri, size_t len)
+{
+    if (len == 0 || len >= sizeof(b->uri)) return false;
+
+    memcpy(b->uri, uri, len);
+    b->uri[len] = '\0';
+
+    const char *host = strstr(b->uri, "://");
+    if (host == NULL) return false;
+    host += 3;
+
+    if (strncmp(b->uri, "mqtts", 5) == 0)      b->port = 8883;
+    else if (strncmp(b->uri, "wss", 3) == 0)   b->port = 443;
+    else if (strncmp(b->uri, "ws", 2) == 0)    b->port = 80;
+    else                                       b->port = 1883;
+
+    size_t host_len = strcspn(host, ":/");
+    if (host_len == 0 || host_len >= sizeof(b->host)) return false;
+
+    memcpy(b->host, host, host_len);
+    b->host[host_len] = '\0';
+
+    if (host[host_len] == ':') {
+        b->port = (uint16_t)atoi(&host[host_len + 1]);
+    }
+
+    b->healthy = true;
+    return b->port != 0;
+}
+
+
+/**
+ * @brief TCP connect round trip to a broker
+ *
+ * @return RTT in ms (at least 1), 0 if unreachable
+ */
+static uint32_t probe_rtt(const BrokerEntry *b)
+{
+    char port[8];
+    snprintf(port, sizeof(port), "%u", b->port);
+
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+
+    if (getaddrinfo(b->host, port, &hints, &res) != 0 || res == NULL) {
+        return 0;
+    }
+
+    uint32_t rtt = 0;
+    int sock = socket(res->ai_family, res->ai_socktype, 0);
+
+    if (sock >= 0) {
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+        int64_t t0 = esp_timer_get_time();
+        int ret = connect(sock, res->ai_addr, res->ai_addrlen);
+
+        if (ret == 0 || errno == EINPROGRESS) {
+            fd_set set;
+            struct timeval tv = {
+                .tv_sec = BROKER_PROBE_TIMEOUT_MS / 1000,
+                .tv_usec = (BROKER_PROBE_TIMEOUT_MS % 1000) * 1000,
+            };
+            FD_ZERO(&set);
+            FD_SET(sock, &set);
+
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+
+            if (ret == 0 ||
+                (select(sock + 1, NULL, &set, NULL, &tv) > 0 &&
+                 getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 && err == 0)) {
+                rtt = (uint32_t)((esp_timer_get_time() - t0) / 1000);
+                if (rtt == 0) rtt = 1;
+            }
+        }
+        close(sock);
+    }
+
+    freeaddrinfo(res);
+    return rtt;
+}
+
+
+/**
+ * @brief Preferred broker: first in list order within the RTT margin
+ *        of the fastest healthy one
+ *
+ * @param exclude  Broker to skip (-1 = none)
+ *
+ * @return Index, or -1 if no other broker is healthy
+ *
+ * @note Caller holds broker_mutex.
+ */
+static int rank_best(int exclude)
+{
+    uint32_t fastest = UINT32_MAX;
+
+    for (int i = 0; i < broker_count; i++) {
+        if (i == exclude || !brokers[i].healthy || brokers[i].rtt_ms == 0) continue;
+        if (brokers[i].rtt_ms < fastest) fastest = brokers[i].rtt_ms;
+    }
+
+    for (int i = 0; i < broker_count; i++) {
+        if (i == exclude || !brokers[i].healthy) continue;
+
+        // Not probed yet: list order decides
+        if (fastest == UINT32_MAX || brokers[i].rtt_ms == 0 ||
+            brokers[i].rtt_ms <= fastest + BROKER_RTT_MARGIN_MS) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+/**
+ * @brief Probe every broker, then move to the preferred one if needed
+ */
+static void probe_round(void)
+{
+    uint32_t rtt[MQTT_BROKER_MAX];
+
+    // Blocking probes without the lock
+    for (int i = 0; i < broker_count; i++) {
+        rtt[i] = probe_rtt(&brokers[i]);
+        ESP_LOGI(TAG, "Probe %s: %lu ms%s", brokers[i].uri, (unsigned long)rtt[i],
+                 rtt[i] ? "" : " (unreachable)");
+    }
+
+    bool request = false;
+
+    xSemaphoreTake(broker_mutex, portMAX_DELAY);
+
+    broker_stats.probes++;
+    for (int i = 0; i < broker_count; i++) {
+        brokers[i].rtt_ms = rtt[i];
+        brokers[i].healthy = (rtt[i] != 0);
+    }
+    broker_stats.rtt_ms = brokers[active].rtt_ms;
+
+    int best = rank_best(-1);
+    if (best >= 0 && best != active && pending < 0 && mqtt_is_connected()) {
+        ESP_LOGI(TAG, "Preferred broker %s (%lu ms) is not in use, switching",
+                 brokers[best].uri, (unsigned long)brokers[best].rtt_ms);
+        pending = best;
+        broker_stats.returns++;
+        request = true;
+    }
+
+    xSemaphoreGive(broker_mutex);
+
+    if (request && switch_cb != NULL) {
+        switch_cb();
+    }
+}
+
+
+/**
+ * @brief Probe task: first round shortly after start, then periodically
+ */
+static void broker_probe_task(void *pvParameters)
+{
+    vTaskDelay(pdMS_TO_TICKS(BROKER_FIRST_PROBE_MS));
+
+    while (1) {
+        // Probing without a network only marks everything unhealthy
+        if (mqtt_is_connected()) {
+            probe_round();
+        }
+
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(BROKER_REEVAL_MS));
+    }
+}
+
+
+
+/* ======================================================================== */
+/* ============================== PUBLIC API ============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Build the broker list from menuconfig (once)
+ *
+ * @return Number of brokers
+ */
+int mqtt_broker_init(void)
+{
+    if (broker_count > 0) return broker_count;
+
+    broker_mutex = xSemaphoreCreateMutex();
+
+    const char *primary = CONFIG_MQTT_BROKER_URI;
+    if (parse_uri(&brokers[0], primary, strlen(primary))) {
+        broker_count = 1;
+    } else {
+        ESP_LOGE(TAG, "Invalid primary broker URI %s", primary);
+        strncpy(brokers[0].uri, primary, sizeof(brokers[0].uri) - 1);
+        broker_count = 1;
+    }
+
+    const char *list = CONFIG_MQTT_BROKER_URI_FALLBACKS;
+    while (*list != '\0' && broker_count < MQTT_BROKER_MAX) {
+        while (*list == ' ' || *list == ',') list++;
+
+        size_t len = strcspn(list, ", ");
+        if (len == 0) break;
+
+        // Same scheme ("mqtts://" ...) as the primary: one transport for all
+        const char *sep = strstr(brokers[0].uri, "://");
+        size_t scheme_len = (sep != NULL) ? (size_t)(sep - brokers[0].uri) + 3 : 0;
+
+        if (scheme_len == 0 || len < scheme_len || strncmp(list, brokers[0].uri, scheme_len) != 0) {
+            ESP_LOGW(TAG, "Fallback %.*s ignored: scheme differs from primary", (int)len, list);
+        } else if (parse_uri(&brokers[broker_count], list, len)) {
+            broker_count++;
+        } else {
+            ESP_LOGW(TAG, "Invalid fallback broker URI %.*s", (int)len, list);
+        }
+        list += len;
+    }
+
+    broker_stats.count = (uint8_t)broker_count;
+    ESP_LOGI(TAG, "%d broker(s) configured", broker_count);
+
+    return broker_count;
+}
+
+
+/**
+ * @brief URI of the broker in use
+ */
+const char *mqtt_broker_uri(void)
+{
+    return brokers[active].uri;
+}
+
+
+/**
+ * @brief Start RTT probing and re-evaluation (only with fallbacks)
+ *
+ * @param request_switch  Called when the preferred broker is not in use
+ */
+void mqtt_broker_start(broker_switch_fn request_switch)
+{
+    switch_cb = request_switch;
+
+    if (broker_count < 2 || probe_task != NULL) return;
+
+    if (xTaskCreate(broker_probe_task, "mqtt_broker_probe", 3072, NULL,
+                    tskIDLE_PRIORITY + 1, &probe_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create broker probe task");
+        probe_task = NULL;
+    }
+}
+
+
+/**
+ * @brief MQTT_EVENT_CONNECTED: the active broker is healthy
+ */
+void mqtt_broker_connected(void)
+{
+    if (broker_mutex == NULL) return;
+
+    xSemaphoreTake(broker_mutex, portMAX_DELAY);
+
+    brokers[active].failures = 0;
+    brokers[active].healthy = true;
+
+    if (lost_us != 0) {
+        if (broker_stats.failovers > 0 && broker_stats.active != active) {
+            broker_stats.last_failover_ms = (uint32_t)((esp_timer_get_time() - lost_us) / 1000);
+            ESP_LOGI(TAG, "Failover to %s took %lu ms", brokers[active].uri,
+                     (unsigned long)broker_stats.last_failover_ms);
+        }
+        lost_us = 0;
+    }
+    broker_stats.active = (uint8_t)active;
+    broker_stats.rtt_ms = brokers[active].rtt_ms;
+
+    xSemaphoreGive(broker_mutex);
+}
+
+
+/**
+ * @brief MQTT_EVENT_DISCONNECTED: count a failure, fail over after N
+ *
+ * Covers failed connects as well as dropped sessions (missed keepalive).
+ */
+void mqtt_broker_disconnected(void)
+{
+    if (broker_mutex == NULL || broker_count < 2) return;
+
+    xSemaphoreTake(broker_mutex, portMAX_DELAY);
+
+    // Planned switch: not a failure of the current broker
+    if (pending < 0) {
+        if (lost_us == 0) {
+            lost_us = esp_timer_get_time();
+        }
+
+        BrokerEntry *b = &brokers[active];
+        if (++b->failures >= BROKER_FAILOVER_AFTER) {
+            b->healthy = false;
+            b->failures = 0;
+
+            int next = rank_best(active);
+            if (next < 0) {
+                // Nothing known healthy: walk the list
+                next = (active + 1) % broker_count;
+            }
+
+            ESP_LOGW(TAG, "%s failed %d times, failing over to %s", b->uri,
+                     BROKER_FAILOVER_AFTER, brokers[next].uri);
+            pending = next;
+            broker_stats.failovers++;
+        }
+    }
+
+    xSemaphoreGive(broker_mutex);
+}
+
+
+/**
+ * @brief Apply a pending switch before a reconnect attempt
+ *
+ * @return URI to set on the client, or NULL to keep the current one
+ */
+const char *mqtt_broker_take_switch(void)
+{
+    if (broker_mutex == NULL) return NULL;
+
+    const char *uri = NULL;
+
+    xSemaphoreTake(broker_mutex, portMAX_DELAY);
+
+    if (pending >= 0 && pending != active) {
+        active = pending;
+        uri = brokers[active].uri;
+    }
+    pending = -1;
+
+    xSemaphoreGive(broker_mutex);
+
+    return uri;
+}
+
+
+/**
+ * @brief Copy the selection counters
+ */
+void mqtt_broker_get_stats(MqttBrokerStats *stats)
+{
+    if (stats == NULL) return;
+    *stats = broker_stats;
+}
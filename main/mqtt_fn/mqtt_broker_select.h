@@ -0,0 +1,34 @@
+#ifndef MQTT_BROKER_SELECT_H
+#define MQTT_BROKER_SELECT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Primary (CONFIG_MQTT_BROKER_URI) + CONFIG_MQTT_BROKER_URI_FALLBACKS
+#define MQTT_BROKER_MAX         4
+
+// Broker selection counters
+typedef struct {
+    uint8_t count;              // Configured brokers
+    uint8_t active;             // Index of the broker in use (0 = primary)
+    uint32_t rtt_ms;            // Last probe RTT of the active broker (0 = not probed)
+    uint32_t probes;            // Probe rounds
+    uint32_t failovers;         // Switches after failed connects / keepalives
+    uint32_t returns;           // Switches back to a preferred broker
+    uint32_t last_failover_ms;  // Link lost → connected to the next broker
+} MqttBrokerStats;
+
+// Drops the current connection so the pending broker is used (any task)
+typedef void (*broker_switch_fn)(void);
+
+int mqtt_broker_init(void);
+const char *mqtt_broker_uri(void);
+void mqtt_broker_start(broker_switch_fn request_switch);
+
+void mqtt_broker_connected(void);
+void mqtt_broker_disconnected(void);
+const char *mqtt_broker_take_switch(void);
+
+void mqtt_broker_get_stats(MqttBrokerStats *stats);
+
+#endif // MQTT_BROKER_SELECT_H
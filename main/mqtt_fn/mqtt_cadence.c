@@ -0,0 +1,270 @@
+/**
+ * @file mqtt_cadence.c
+ * @brief Adaptive publish scheduler for the MQTT publish task
+ *
+ * The publish task no longer wakes on a fixed delay. It sleeps on a
+ * task notification until either:
+ *  - a producer calls mqtt_cadence_notify() (valve moved, error set,
+ *    command report queued, reconnect), or
+ *  - the period of the current activity expires.
+ *
+ * Period per activity:
+ *  - MOVING : CONFIG_MQTT_CADENCE_MOVING_MS (progress during travel)
+ *  - FAULT  : CONFIG_MQTT_CADENCE_FAULT_S
+ *  - IDLE   : CONFIG_MQTT_HEARTBEAT_PERIOD_S, doubled after every
+ *             unchanged heartbeat up to CONFIG_MQTT_CADENCE_IDLE_MAX_S
+ *
+ * A weak link (RSSI below CONFIG_MQTT_CADENCE_WEAK_RSSI) doubles the
+ * period. Every telemetry cycle costs one token from a bucket refilled
+ * at CONFIG_MQTT_PUBLISH_BUDGET_PER_HOUR; when it is empty, publishes
+ * are held back (changes are coalesced) until a token is available.
+ *
+ * Used by the publish task only, except mqtt_cadence_notify().
+ */
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "mqtt_cadence.h"
+
+
+/* ======================================================================== */
+/* ============================ CONFIGURATION ============================= */
+/* ======================================================================== */
+
+#define CADENCE_MOVING_MS       CONFIG_MQTT_CADENCE_MOVING_MS
+#define CADENCE_FAULT_MS        (CONFIG_MQTT_CADENCE_FAULT_S * 1000u)
+#define CADENCE_IDLE_BASE_MS    (CONFIG_MQTT_HEARTBEAT_PERIOD_S * 1000u)
+#define CADENCE_IDLE_MAX_MS     (CONFIG_MQTT_CADENCE_IDLE_MAX_S * 1000u)
+#define CADENCE_WEAK_RSSI       CONFIG_MQTT_CADENCE_WEAK_RSSI
+#define CADENCE_RSSI_SAMPLE_US  (30 * 1000000LL)
+
+// Token bucket: one message = one hour of refill at 1 msg/h, in µs
+#define BUDGET_PER_HOUR         CONFIG_MQTT_PUBLISH_BUDGET_PER_HOUR
+#define BUDGET_MSG_COST         3600000000ULL
+#define BUDGET_BURST            ((BUDGET_PER_HOUR + 5) / 6)     // Ten minutes' worth
+#define BUDGET_CAPACITY         ((uint64_t)BUDGET_BURST * BUDGET_MSG_COST)
+
+static const char *TAG = "MQTT_CADENCE";
+
+// Publish task, target of notifications (NULL until it runs)
+static TaskHandle_t volatile cadence_task = NULL;
+
+static uint32_t idle_level;             // Unchanged heartbeats since last change
+static int64_t rssi_sampled_us;
+static uint64_t budget_tokens = BUDGET_CAPACITY;
+static int64_t budget_refill_us;
+static CadenceStats cadence_stats;
+
+
+
+/* ======================================================================== */
+/* ============================ INTERNAL HELPERS ========================== */
+/* ======================================================================== */
+
+/**
+ * @brief Refresh the RSSI sample at most every 30 s
+ */
+static int8_t sample_rssi(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (rssi_sampled_us == 0 || now - rssi_sampled_us >= CADENCE_RSSI_SAMPLE_US) {
+        wifi_ap_record_t ap;
+        cadence_stats.rssi = (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) ? ap.rssi : 0;
+        rssi_sampled_us = now;
+    }
+
+    return cadence_stats.rssi;
+}
+
+
+/**
+ * @brief Add tokens for the time since the last refill
+ */
+static void budget_refill(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (budget_refill_us != 0 && now > budget_refill_us) {
+        budget_tokens += (uint64_t)(now - budget_refill_us) * BUDGET_PER_HOUR;
+        if (budget_tokens > BUDGET_CAPACITY) {
+            budget_tokens = BUDGET_CAPACITY;
+        }
+    }
+    budget_refill_us = now;
+
+    cadence_stats.budget_left = (uint32_t)(budget_tokens / BUDGET_MSG_COST);
+}
+
+
+
+/* ======================================================================== */
+/* ============================== PUBLIC API ============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Register the calling task as the publish task
+ */
+void mqtt_cadence_init(void)
+{
+    budget_refill_us = esp_timer_get_time();
+    cadence_task = xTaskGetCurrentTaskHandle();
+}
+
+
+/**
+ * @brief Wake the publish task now (callable from any task)
+ */
+void mqtt_cadence_notify(void)
+{
+    TaskHandle_t task = cadence_task;
+
+    if (task != NULL) {
+        xTaskNotifyGive(task);
+    }
+}
+
+
+/**
+ * @brief Sleep until notified or timeout_ms elapsed
+ *
+ * @return true if woken by a notification
+ */
+bool mqtt_cadence_wait(uint32_t timeout_ms)
+{
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout_ms)) > 0) {
+        cadence_stats.wake_notify++;
+        return true;
+    }
+
+    cadence_stats.wake_timeout++;
+    return false;
+}
+
+
+/**
+ * @brief Classify the valve state
+ */
+CadenceActivity mqtt_cadence_classify(const GetData *data)
+{
+    if (data->is_moving) return CADENCE_MOVING;
+    if (data->error_msg[0] != '\0') return CADENCE_FAULT;
+    return CADENCE_IDLE;
+}
+
+
+/**
+ * @brief Publish period for the activity and the current link
+ *
+ * @param connected  RSSI is only sampled while connected
+ */
+uint32_t mqtt_cadence_period_ms(CadenceActivity activity, bool connected)
+{
+    uint32_t period;
+
+    switch (activity) {
+        case CADENCE_MOVING:
+            period = CADENCE_MOVING_MS;
+            break;
+
+        case CADENCE_FAULT:
+            period = CADENCE_FAULT_MS;
+            break;
+
+        case CADENCE_IDLE:
+        default:
+            period = CADENCE_IDLE_BASE_MS;
+            for (uint32_t i = 0; i < idle_level && period < CADENCE_IDLE_MAX_MS; i++) {
+                period *= 2;
+            }
+            if (period > CADENCE_IDLE_MAX_MS) {
+                period = CADENCE_IDLE_MAX_MS;
+            }
+            break;
+    }
+
+    // Weak link: every message costs more airtime and retries
+    if (connected) {
+        int8_t rssi = sample_rssi();
+        if (rssi != 0 && rssi < CADENCE_WEAK_RSSI && period < CADENCE_IDLE_MAX_MS) {
+            period *= 2;
+            if (activity == CADENCE_IDLE && period > CADENCE_IDLE_MAX_MS) {
+                period = CADENCE_IDLE_MAX_MS;
+            }
+        }
+    }
+
+    if (activity != cadence_stats.activity) {
+        ESP_LOGI(TAG, "Activity %d -> %d, period %lu ms", cadence_stats.activity, activity,
+                 (unsigned long)period);
+    }
+    cadence_stats.activity = activity;
+    cadence_stats.period_ms = period;
+
+    return period;
+}
+
+
+/**
+ * @brief Record a telemetry cycle
+ *
+ * @param changed  false for a heartbeat: the idle period backs off
+ */
+void mqtt_cadence_published(bool changed)
+{
+    if (changed) {
+        idle_level = 0;
+    } else if (cadence_stats.activity == CADENCE_IDLE && idle_level < 16) {
+        idle_level++;
+    }
+}
+
+
+/**
+ * @brief Take one message from the hourly budget
+ *
+ * @return false if the budget is exhausted
+ */
+bool mqtt_cadence_budget_take(void)
+{
+    budget_refill();
+
+    if (budget_tokens < BUDGET_MSG_COST) {
+        cadence_stats.budget_deferred++;
+        return false;
+    }
+
+    budget_tokens -= BUDGET_MSG_COST;
+    cadence_stats.budget_left = (uint32_t)(budget_tokens / BUDGET_MSG_COST);
+    return true;
+}
+
+
+/**
+ * @brief Time until the next message fits the budget
+ */
+uint32_t mqtt_cadence_budget_wait_ms(void)
+{
+    budget_refill();
+
+    if (budget_tokens >= BUDGET_MSG_COST) return 0;
+
+    uint64_t missing = BUDGET_MSG_COST - budget_tokens;
+    return (uint32_t)(missing / BUDGET_PER_HOUR / 1000) + 1;
+}
+
+
+/**
+ * @brief Copy the scheduler counters
+ */
+void mqtt_cadence_get_stats(CadenceStats *stats)
+{
+    if (stats == NULL) return;
+    *stats = cadence_stats;
+}
@@ -0,0 +1,40 @@
+#ifndef MQTT_CADENCE_H
+#define MQTT_CADENCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "global_var.h"
+
+// Valve activity driving the publish period
+typedef enum {
+    CADENCE_IDLE = 0,           // Nothing happening; period backs off
+    CADENCE_MOVING,             // Motor running: sub-second progress
+    CADENCE_FAULT               // error_msg set: steady fault period
+} CadenceActivity;
+
+// Publish scheduler counters
+typedef struct {
+    CadenceActivity activity;
+    uint32_t period_ms;         // Current publish period
+    int8_t rssi;                // Last sampled RSSI in dBm (0 = unknown)
+    uint32_t wake_notify;       // Wake-ups by state-change notification
+    uint32_t wake_timeout;      // Wake-ups by period / pacing timeout
+    uint32_t budget_deferred;   // Publishes held back by the hourly budget
+    uint32_t budget_left;       // Whole messages available now
+} CadenceStats;
+
+void mqtt_cadence_init(void);
+void mqtt_cadence_notify(void);
+bool mqtt_cadence_wait(uint32_t timeout_ms);
+
+CadenceActivity mqtt_cadence_classify(const GetData *data);
+uint32_t mqtt_cadence_period_ms(CadenceActivity activity, bool connected);
+void mqtt_cadence_published(bool changed);
+
+bool mqtt_cadence_budget_take(void);
+uint32_t mqtt_cadence_budget_wait_ms(void);
+
+void mqtt_cadence_get_stats(CadenceStats *stats);
+
+#endif // MQTT_CADENCE_H
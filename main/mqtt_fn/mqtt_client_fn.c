@@ -1,32 +1,114 @@
+#include <string.h>
 #include "sdkconfig.h" 
 #include "esp_log.h"
-#include "cJSON.h"
+#include "esp_timer.h"
 #include "mqtt_client.h"
 
+#include "global_var.h"
+#include "reconnect_policy.h"
 #include "mqtt_client_fn.h"
 #include "mqtt_state_fn.h"
+#include "mqtt_rx_arena.h"
+#include "mqtt_sf_queue.h"
+#include "mqtt_cmd_tracker.h"
+#include "mqtt_cadence.h"
+#include "mqtt_tls_session.h"
+#include "mqtt_topics.h"
+#include "mqtt_broker_select.h"
+#include "mqtt_groups.h"
+#include "mqtt_schedule_ref.h"
 
 
 /*---------------------------------------------------------------
  * Configuration Macros
  *--------------------------------------------------------------*/
 
-// MQTT Broker URI (set in menuconfig)
-#define MQTT_BROKER_URI CONFIG_MQTT_BROKER_URI
-// #define MQTT_BROKER_URI  "mqtts://82.29.161.52:8883"
+// MQTT Broker URI(s): CONFIG_MQTT_BROKER_URI + fallbacks, see mqtt_broker_select.c
+// "mqtts://82.29.161.52:8883"
 #define DEVICE_ID CONFIG_WIFI_VALVE_ID
 
 // Base topic structure:
 // vortex_device/wifi_valve/<DEVICE_ID>
-#define BASE_TOPIC "vortex_device/wifi_valve/" DEVICE_ID
+#define BASE_TOPIC MQTT_BASE_TOPIC
 
-// Maximum allowed MQTT payload size
-#define MAX_MQTT_PAYLOAD 4096
+// Presence: retained birth message + Last Will on the status topic
+#define LWT_TOPIC       BASE_TOPIC "/status"
+#define LWT_MESSAGE     "{\"event\":\"valve_status\",\"device_id\":\"" DEVICE_ID "\",\"status\":\"offline\"}"
+#define PRESENCE_QOS    1
+
+// Topic suffix selecting CBOR payloads (publish and commands)
+#define CBOR_TOPIC_SUFFIX   "/cbor"
+
+// Pacing of the publish task while it has work queued (set in menuconfig);
+// otherwise it sleeps until notified or the adaptive period expires
+#define MQTT_CHANGE_POLL_MS         CONFIG_MQTT_CHANGE_POLL_MS
+
+// Store-and-forward backlog: messages sent per poll after reconnect
+#define MQTT_SF_DRAIN_PER_POLL \
+    ((CONFIG_MQTT_SF_DRAIN_RATE * MQTT_CHANGE_POLL_MS + 999) / 1000)
+#define MQTT_SF_QOS                 1
+
+// Commands and their acks must not be lost silently
+#define CMD_QOS                     1
+#define CMD_ACK_BUFFER_SIZE         320
+
+// Diagnostics responses (get_stats with large counters is ~1.7 KB)
+#define RPC_QOS                     1
+#define RPC_BUFFER_SIZE             2048
+
+// Inbound worker: below the esp-mqtt task (keepalives first), above publishing
+#define MQTT_RX_TASK_STACK          4096
+#define MQTT_RX_TASK_PRIORITY       (tskIDLE_PRIORITY + 2)
+
+// Reconnect backoff (jittered, see reconnect_policy.c)
+#define MQTT_RECONNECT_BASE_MS      CONFIG_MQTT_RECONNECT_BASE_MS
+#define MQTT_RECONNECT_MAX_MS       (CONFIG_MQTT_RECONNECT_MAX_S * 1000u)
+
+// Outbox cap: telemetry is admitted up to the limit, acks / errors
+// may use the reserve on top of it
+#define MQTT_OUTBOX_LIMIT           CONFIG_MQTT_OUTBOX_LIMIT_BYTES
+#define MQTT_OUTBOX_RESERVE         CONFIG_MQTT_OUTBOX_RESERVE_BYTES
 
 static const char *TAG = "MQTT_CLIENT";
 static esp_mqtt_client_handle_t mqtt_client;
 static bool mqtt_connected = false;
+static bool mqtt_paused = false;
 static TaskHandle_t mqtt_pub_task_handle = NULL;
+static TaskHandle_t mqtt_rx_task_handle = NULL;
+
+// Link flaps: the client is paused, not destroyed
+static MqttLinkStats link_stats;
+static int64_t paused_at_us;
+
+// Publishes come from several tasks; alias state and the MQTT 5
+// publish property must go out together with their message
+static SemaphoreHandle_t publish_mutex = NULL;
+
+static MqttOutboxStats outbox_stats;
+
+// Static outbound buffer used by the publish task
+static char mqtt_tx_buf[MQTT_TX_BUFFER_SIZE];
+
+// Publish-on-change state
+static volatile bool force_publish = true;
+static volatile bool birth_pending = false;     // Set on CONNECTED, sent by the publish task
+static PublishStats publish_stats;
+
+// Telemetry format (default from menuconfig, can be changed at runtime)
+#if CONFIG_MQTT_TELEMETRY_LEGACY
+static volatile TelemetryMode telemetry_mode = TELEMETRY_LEGACY;
+#elif CONFIG_MQTT_TELEMETRY_BOTH
+static volatile TelemetryMode telemetry_mode = TELEMETRY_BOTH;
+#else
+static volatile TelemetryMode telemetry_mode = TELEMETRY_CONSOLIDATED;
+#endif
+
+// Telemetry encoding (default from menuconfig, can be changed at runtime)
+#if CONFIG_MQTT_PAYLOAD_CBOR
+static volatile PayloadFormat payload_format = PAYLOAD_CBOR;
+#else
+static volatile PayloadFormat payload_format = PAYLOAD_JSON;
+#endif
 
 /*---------------------------------------------------------------
  * TLS Certificate (Embedded in binary)
@@ -40,113 +122,783 @@ extern const uint8_t _binary_ca_cert_pem_end[];
 
 
 /**
- * @brief Publish a JSON message to a given sub-topic
+ * @brief Check whether a message fits the outbox cap
+ *
+ * Telemetry-class topics stop at MQTT_OUTBOX_LIMIT; acks, errors and
+ * presence may use MQTT_OUTBOX_RESERVE on top of it.
+ */
+static bool mqtt_outbox_admit(const MqttTopic *topic, int len)
+{
+    int size = esp_mqtt_client_get_outbox_size(mqtt_client);
+    int limit = MQTT_OUTBOX_LIMIT;
+
+    if (size < 0) size = 0;
+    outbox_stats.bytes = (uint32_t)size;
+
+    if (mqtt_topic_is_priority(topic)) {
+        limit += MQTT_OUTBOX_RESERVE;
+    }
+
+    // Header + topic + packet id, roughly
+    return size + len + topic->full_len + 8 <= limit;
+}
+
+
+/**
+ * @brief Publish a raw payload to a precomputed topic
+ *
+ * The message is queued in the esp-mqtt outbox and written by the
+ * MQTT task, so the caller never waits for the socket. Presence
+ * ("status") is the exception: the "offline" message must be on the
+ * wire before the client is stopped.
+ *
+ * When the outbox is over its cap the message is refused (false) and
+ * the caller falls back to the store-and-forward queue, which drops
+ * its oldest entries first.
  *
- * @param sub_topic  Sub-topic (e.g., "status", "state_data")
- * @param message    cJSON object to publish
+ * With MQTT 5 topic aliases, QoS 0 messages on a topic the broker
+ * already knows go out with an empty topic and the alias only.
+ *
+ * @param topic      Topic from mqtt_topic() / mqtt_topic_find()
+ * @param data       Payload bytes (JSON text or binary block)
+ * @param len        Payload length in bytes (0 = strlen(data))
+ * @param qos        MQTT QoS level
+ * @param retain     Broker keeps the message as last known value
+ *
+ * @return true if the message was handed to the MQTT client
  */
-static void mqtt_publish_message(const char *sub_topic, cJSON *message)
+static bool mqtt_publish_payload(const MqttTopic *topic, const char *data, int len, int qos, int retain)
 {
     if (mqtt_client == NULL) {
         ESP_LOGE(TAG, "MQTT client not initialized");
-        return;
+        return false;
     }
 
     if (!mqtt_connected) {
         ESP_LOGW(TAG, "MQTT not connected, skipping publish");
-        return;
+        return false;
     }
 
-    if (message == NULL || sub_topic == NULL) {
+    if (data == NULL || topic == NULL) {
         ESP_LOGE(TAG, "Invalid publish arguments");
-        return;
+        return false;
     }
 
-    char *json_str = cJSON_PrintUnformatted(message);
-    if (json_str == NULL) {
-        ESP_LOGE(TAG, "Failed to serialize JSON");
-        return;
+    if (len == 0) {
+        len = strlen(data);
+    }
+
+    xSemaphoreTake(publish_mutex, portMAX_DELAY);
+
+    if (!mqtt_outbox_admit(topic, len)) {
+        outbox_stats.diverted++;
+        xSemaphoreGive(publish_mutex);
+        ESP_LOGW(TAG, "Outbox full (%lu bytes), %s deferred",
+                 (unsigned long)outbox_stats.bytes, topic->sub);
+        return false;
     }
 
-    // Construct full topic:
-    // vortex_device/wifi_valve/<DEVICE_ID>/<sub_topic>
-    char full_topic[128];
-    snprintf(full_topic, sizeof(full_topic), "%s/%s", BASE_TOPIC, sub_topic);
+    const char *wire_topic = topic->full;
+    size_t wire_topic_len = topic->full_len;
+    uint16_t alias = mqtt_topic_alias(topic);
+
+#if CONFIG_MQTT_TOPIC_ALIAS
+    // Property is sticky in the client: set it for every publish (0 = none)
+    esp_mqtt5_publish_property_config_t property = { .topic_alias = alias };
+    esp_mqtt5_client_set_publish_property(mqtt_client, &property);
+
+    // QoS 1 keeps the topic: outbox resends may land in a new session.
+    // A QoS 0 entry still queued at a disconnect can do the same; the
+    // broker then drops the link once and the aliases start over.
+    if (alias != 0 && qos == 0 && mqtt_topic_alias_known(topic)) {
+        wire_topic = "";
+        wire_topic_len = 0;
+    }
+#endif
+
+    int64_t t0 = esp_timer_get_time();
+    int msg_id;
 
-    // ESP_LOGI(TAG, "Publishing to %s", full_topic);
-    ESP_LOGI(TAG, "Payload: %s", json_str);
+    if (topic == mqtt_topic(MQTT_TOPIC_STATUS, PAYLOAD_JSON)) {
+        msg_id = esp_mqtt_client_publish( mqtt_client, wire_topic, data, len, qos, retain );
+    } else {
+        msg_id = esp_mqtt_client_enqueue( mqtt_client, wire_topic, data, len, qos, retain, true );
+    }
 
-    int msg_id = esp_mqtt_client_publish( mqtt_client, full_topic, json_str, 0, 0, 0 );
+    uint32_t enqueue_us = (uint32_t)(esp_timer_get_time() - t0);
+    outbox_stats.enqueue_last_us = enqueue_us;
+    if (enqueue_us > outbox_stats.enqueue_max_us) {
+        outbox_stats.enqueue_max_us = enqueue_us;
+    }
+
+    if (msg_id >= 0) {
+        outbox_stats.enqueued++;
+        if (alias != 0) {
+            mqtt_topic_alias_mark(topic);
+        }
+        mqtt_topic_account(wire_topic_len, alias, len, qos);
+    }
+
+    xSemaphoreGive(publish_mutex);
 
     if (msg_id < 0) {
         ESP_LOGE(TAG, "Publish failed");
+        return false;
     }
 
-    free(json_str);
+    return true;
+}
+
+
+/**
+ * @brief Publish a payload built in mqtt_tx_buf, or queue it
+ *
+ * While the broker is unreachable, or older messages are still
+ * queued, the message goes to the store-and-forward queue instead
+ * so the backend receives every state in order.
+ *
+ * @note Only called from the publish task (mqtt_tx_buf is not shared).
+ */
+static void mqtt_send_or_queue(MqttTopicId id, int len, PayloadFormat format, int qos)
+{
+    const MqttTopic *topic = mqtt_topic(id, format);
+
+    if (format == PAYLOAD_CBOR) {
+        ESP_LOGI(TAG, "CBOR payload: %d bytes to %s", len, topic->sub);
+    } else {
+        // ESP_LOGI(TAG, "Publishing to %s", topic->sub);
+        ESP_LOGI(TAG, "Payload: %s", mqtt_tx_buf);
+    }
+
+    // Keep order: nothing goes out live while a backlog exists
+    if (!mqtt_is_connected() || !mqtt_sf_is_empty() ||
+        !mqtt_publish_payload(topic, mqtt_tx_buf, len, qos, 0)) {
+        mqtt_sf_push(topic->sub, mqtt_tx_buf, len);
+    }
+}
+
+
+/**
+ * @brief Build a message in the static TX buffer and publish it
+ *
+ * The builder writes straight into mqtt_tx_buf with the streaming
+ * writer, so no heap is used on the publish path.
+ *
+ * @note Only called from the publish task (mqtt_tx_buf is not shared).
+ *
+ * @param id       Topic (e.g., MQTT_TOPIC_TELEMETRY)
+ * @param builder  Payload builder (e.g., create_valve_state_data)
+ */
+static void mqtt_publish_message(MqttTopicId id, payload_builder_t builder)
+{
+    if (builder == NULL) {
+        ESP_LOGE(TAG, "Invalid publish arguments");
+        return;
+    }
+
+    PayloadFormat format = payload_format;
+
+    int len = builder(mqtt_tx_buf, sizeof(mqtt_tx_buf), format);
+    if (len < 0) {
+        ESP_LOGE(TAG, "Failed to build payload for %s", mqtt_topic(id, format)->sub);
+        return;
+    }
+
+    mqtt_send_or_queue(id, len, format, 0);
+}
+
+
+/**
+ * @brief Send one store-and-forward entry (QoS 1, delivery confirmed by broker)
+ */
+static bool mqtt_sf_send(const char *sub_topic, const char *data, size_t len)
+{
+    const MqttTopic *topic = mqtt_topic_find(sub_topic);
+
+    // Entry for a topic this firmware no longer publishes: drop it
+    if (topic == NULL) return true;
+
+    return mqtt_publish_payload(topic, data, (int)len, MQTT_SF_QOS, 0);
+}
+
+
+/**
+ * @brief Publish a binary block (e.g. encoded sensor series)
+ *
+ * @param sub_topic  Sub-topic under the device base topic
+ * @param data       Block bytes
+ * @param len        Block length in bytes
+ *
+ * @return true if the block was handed to the MQTT client
+ */
+bool mqtt_publish_binary(const char *sub_topic, const uint8_t *data, size_t len)
+{
+    if (len == 0) {
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Binary payload: %u bytes to %s", (unsigned)len, sub_topic);
+
+    return mqtt_publish_payload(mqtt_topic_find(sub_topic), (const char *)data, (int)len, 0, 0);
+}
+
+
+/**
+ * @brief Check whether the MQTT session is currently up
+ */
+bool mqtt_is_connected(void)
+{
+    return mqtt_client != NULL && mqtt_connected;
 }
 
 
+
+/*===============================================================
+ *                COMMAND ACKS (cmd_id)
+ *==============================================================*/
+
+/**
+ * @brief Publish an ack (accepted / duplicate) on cmd_ack
+ *
+ * Called from the rx worker while a command is handled, so the
+ * session is normally up and the ack goes out live on its own buffer.
+ * Acks may use the outbox reserve, so telemetry cannot crowd them out.
+ *
+ * @param report  Ack from cmd_tracker_accept()
+ */
+void mqtt_publish_cmd_ack(const CmdReport *report)
+{
+    // Rx worker context: own buffer, mqtt_tx_buf belongs to the publish task
+    static char ack_buf[CMD_ACK_BUFFER_SIZE];
+
+    int len = create_cmd_report(ack_buf, sizeof(ack_buf), report->format, report);
+    if (len < 0) {
+        ESP_LOGE(TAG, "Failed to build ack for %s", report->cmd_id);
+        return;
+    }
+
+    mqtt_publish_payload(mqtt_topic(MQTT_TOPIC_CMD_ACK, report->format), ack_buf, len, CMD_QOS, 0);
+}
+
+
+/**
+ * @brief Answer an rpc_request on rpc_response
+ *
+ * Called from the rx worker like mqtt_publish_cmd_ack(). A
+ * response that does not fit the outbox is dropped, not queued: the
+ * backend asks again instead of getting stale diagnostics later.
+ *
+ * @param req     Decoded request (method, correlation_id)
+ * @param format  Encoding of the request, used for the response
+ */
+void mqtt_publish_rpc_response(const ValveCommand *req, PayloadFormat format)
+{
+    static char rpc_buf[RPC_BUFFER_SIZE];
+
+    int len = create_rpc_response(rpc_buf, sizeof(rpc_buf), format, req);
+    if (len < 0) {
+        ESP_LOGE(TAG, "RPC response for %s does not fit", req->method);
+        return;
+    }
+
+    if (!mqtt_publish_payload(mqtt_topic(MQTT_TOPIC_RPC_RESPONSE, format), rpc_buf, len, RPC_QOS, 0)) {
+        ESP_LOGW(TAG, "RPC response %s dropped", req->correlation_id);
+    }
+}
+
+
+/**
+ * @brief Publish completion reports (done / failed / superseded)
+ *
+ * Runs in the publish task; reports produced while offline go to
+ * the store-and-forward queue like telemetry.
+ */
+static void mqtt_publish_cmd_reports(void)
+{
+    CmdReport report;
+
+    while (cmd_tracker_pop_report(&report)) {
+        int len = create_cmd_report(mqtt_tx_buf, sizeof(mqtt_tx_buf), report.format, &report);
+        if (len < 0) {
+            ESP_LOGE(TAG, "Failed to build report for %s", report.cmd_id);
+            continue;
+        }
+
+        mqtt_send_or_queue(MQTT_TOPIC_CMD_ACK, len, report.format, CMD_QOS);
+    }
+}
+
+
+
+/*===============================================================
+ *                TELEMETRY FORMAT SELECTION
+ *==============================================================*/
+
+/**
+ * @brief Select the telemetry format at runtime
+ *
+ * @param mode  TELEMETRY_LEGACY, TELEMETRY_CONSOLIDATED or TELEMETRY_BOTH
+ */
+void mqtt_set_telemetry_mode(TelemetryMode mode)
+{
+    if (mode != TELEMETRY_LEGACY &&
+        mode != TELEMETRY_CONSOLIDATED &&
+        mode != TELEMETRY_BOTH) {
+        ESP_LOGW(TAG, "Invalid telemetry mode: %d", mode);
+        return;
+    }
+
+    if (mode != telemetry_mode) {
+        ESP_LOGI(TAG, "Telemetry mode changed: %d -> %d", telemetry_mode, mode);
+        telemetry_mode = mode;
+        force_publish = true;
+    }
+}
+
+TelemetryMode mqtt_get_telemetry_mode(void)
+{
+    return telemetry_mode;
+}
+
+
+/**
+ * @brief Select the telemetry encoding at runtime
+ *
+ * @param format  PAYLOAD_JSON (base topics) or PAYLOAD_CBOR ("/cbor" topics)
+ */
+void mqtt_set_payload_format(PayloadFormat format)
+{
+    if (format != PAYLOAD_JSON && format != PAYLOAD_CBOR) {
+        ESP_LOGW(TAG, "Invalid payload format: %d", format);
+        return;
+    }
+
+    if (format != payload_format) {
+        ESP_LOGI(TAG, "Payload format changed: %s", (format == PAYLOAD_CBOR) ? "cbor" : "json");
+        payload_format = format;
+        force_publish = true;
+    }
+}
+
+PayloadFormat mqtt_get_payload_format(void)
+{
+    return payload_format;
+}
+
+
+
 /*===============================================================
  *                PUBLISH VALVE DATA (MAIN DATA SET)
  *==============================================================*/
 
 /**
- * @brief Publish all valve-related data:
+ * @brief Publish legacy per-topic data:
  *        - state_data
- *        - status
  *        - error
+ *
+ * Online/offline status is no longer polled; it is carried by the
+ * retained birth message and the Last Will (see PRESENCE below).
+ */
+static void mqtt_publish_legacy_data(void)
+{
+    mqtt_publish_message(MQTT_TOPIC_STATE_DATA, create_valve_state_data);
+    mqtt_publish_message(MQTT_TOPIC_ERROR, create_valve_error);
+}
+
+
+/**
+ * @brief Publish state and error as one message on "telemetry"
+ */
+static void mqtt_publish_consolidated_data(void)
+{
+    mqtt_publish_message(MQTT_TOPIC_TELEMETRY, create_valve_telemetry);
+}
+
+
+/**
+ * @brief Publish all valve-related data in the selected telemetry format
  */
 void mqtt_publish_valve_data( void) 
 {
-    // Create and publish state data
-    cJSON *valve_state_data = create_valve_state_data();
-    if (valve_state_data == NULL) {
-        ESP_LOGE(TAG, "Failed to create valve state data");
-    } else {
-        mqtt_publish_message("state_data", valve_state_data);
-        // ESP_LOGI(TAG, "Valve state data published");
+    TelemetryMode mode = telemetry_mode;
+
+    if (mode == TELEMETRY_CONSOLIDATED || mode == TELEMETRY_BOTH) {
+        mqtt_publish_consolidated_data();
     }
-    
-    // Create and publish status data
-    cJSON *valve_status = create_valve_status();
-    if (valve_status == NULL) {
-        ESP_LOGE(TAG, "Failed to create valve status");
-    } else {
-        mqtt_publish_message("status", valve_status);
-        // ESP_LOGI(TAG, "Valve status published");
+
+    if (mode == TELEMETRY_LEGACY || mode == TELEMETRY_BOTH) {
+        mqtt_publish_legacy_data();
     }
+}
 
-    // Create and publish error data
-    cJSON *valve_error = create_valve_error();
-    if (valve_error == NULL) {
-        ESP_LOGE(TAG, "Failed to create valve error");
-    } else {
-        mqtt_publish_message("error", valve_error);
-        // ESP_LOGI(TAG, "Valve error published");
+
+
+/*===============================================================
+ *                  PRESENCE (BIRTH / LAST WILL)
+ *==============================================================*/
+
+/**
+ * @brief Publish the retained birth message ("online") on status
+ *
+ * Sent once per connection. Together with the Last Will
+ * configured in start_mqtt_client() the broker always holds the
+ * current presence of the valve, without periodic publishes.
+ *
+ * Publish task only: MQTT_EVENT_CONNECTED runs with the esp-mqtt API
+ * lock held, so taking publish_mutex there would invert the lock
+ * order of mqtt_publish_payload(). The handler sets birth_pending.
+ *
+ * @return true if the message was handed to the MQTT client
+ */
+static bool mqtt_publish_birth(void)
+{
+    // Own buffer: mqtt_tx_buf still holds a telemetry message being retried
+    static char birth_buf[256];
+
+    // Presence stays JSON so it matches the Last Will
+    int len = create_valve_status(birth_buf, sizeof(birth_buf), PAYLOAD_JSON);
+    if (len < 0) {
+        ESP_LOGE(TAG, "Failed to create valve status");
+        return false;
     }
 
-    cJSON_Delete(valve_state_data);
-    cJSON_Delete(valve_status);
-    cJSON_Delete(valve_error);
+    return mqtt_publish_payload(mqtt_topic(MQTT_TOPIC_STATUS, PAYLOAD_JSON), birth_buf, len, PRESENCE_QOS, 1);
+}
+
+
+/**
+ * @brief Publish the retained "offline" status before a graceful stop
+ *
+ * The broker only sends the Last Will on an unexpected disconnect,
+ * so a clean shutdown has to clear the presence itself.
+ *
+ * QoS 0: the outbox survives a pause, and a QoS 1 "offline" still
+ * waiting for its PUBACK would be resent after the next birth.
+ */
+static void mqtt_publish_offline(void)
+{
+    mqtt_publish_payload(mqtt_topic(MQTT_TOPIC_STATUS, PAYLOAD_JSON), LWT_MESSAGE, 0, 0, 1);
 }
 
 
 
 /*===============================================================
- *            PERIODIC PUBLISH TASK (FreeRTOS)
+ *            PUBLISH-ON-CHANGE TASK (FreeRTOS)
  *==============================================================*/
 
 /**
- * @brief FreeRTOS task that publishes valve data
- *        every 5 seconds.
+ * @brief Compare two valve snapshots field by field
+ *
+ * @return true if anything reported to the server differs
+ */
+static bool valve_data_changed(const GetData *a, const GetData *b)
+{
+    return a->schedule_control      != b->schedule_control      ||
+           a->sensor_control        != b->sensor_control        ||
+           a->angle                 != b->angle                 ||
+           a->is_open               != b->is_open               ||
+           a->is_close              != b->is_close              ||
+           a->is_moving             != b->is_moving             ||
+           a->open_limit_available  != b->open_limit_available  ||
+           a->open_limit_click      != b->open_limit_click      ||
+           a->close_limit_available != b->close_limit_available ||
+           a->close_limit_click     != b->close_limit_click     ||
+           strcmp(a->error_msg, b->error_msg) != 0;
+}
+
+
+/**
+ * @brief Copy publish-on-change counters
+ */
+void mqtt_get_publish_stats(PublishStats *stats)
+{
+    if (stats == NULL) return;
+    *stats = publish_stats;
+}
+
+
+/**
+ * @brief Copy the outbox counters
+ */
+void mqtt_get_outbox_stats(MqttOutboxStats *stats)
+{
+    if (stats == NULL) return;
+
+    if (mqtt_client != NULL) {
+        int size = esp_mqtt_client_get_outbox_size(mqtt_client);
+        outbox_stats.bytes = (size > 0) ? (uint32_t)size : 0;
+    }
+    *stats = outbox_stats;
+}
+
+
+/**
+ * @brief Copy the pause / resume counters
+ */
+void mqtt_get_link_stats(MqttLinkStats *stats)
+{
+    if (stats == NULL) return;
+    *stats = link_stats;
+}
+
+
+/**
+ * @brief FreeRTOS task that publishes valve data on change
+ *
+ * The task sleeps until a producer notifies it (mqtt_cadence_notify)
+ * or the adaptive period of the current activity expires, then
+ * compares valveData with the last published snapshot:
+ *  - Any difference → publish immediately (queued while offline)
+ *  - Period due     → publish (progress while moving, liveness when
+ *                     idle; online only)
+ *  - Otherwise      → suppress (publish_stats.suppressed; wake-ups
+ *                     that only pace the backlog drain are not counted)
+ *
+ * Every cycle costs one message of the hourly budget; when it is
+ * exhausted the cycle is retried once a message is available, with
+ * the latest state.
+ *
+ * A full publish is also forced after every (re)connect so the
+ * server always starts from a fresh state. After a reconnect the
+ * store-and-forward backlog is drained first, MQTT_SF_DRAIN_PER_POLL
+ * messages every MQTT_CHANGE_POLL_MS.
+ *
+ * The task outlives pause_mqtt_client() and stop_mqtt_client() so
+ * state changes during Wi-Fi outages are still captured.
  */
 void mqtt_publish_valve_data_task(void *pvParameters) {
+    GetData last_published;
+    GetData current;
+    int64_t last_publish_us = 0;
+    bool have_snapshot = false;
+    bool triggered = true;      // Woken by a producer or the period, not a drain poll
+
+    mqtt_cadence_init();
+
     while (1) {
-        // Publish valve data
-        mqtt_publish_valve_data();
+        bool connected = mqtt_is_connected();
+
+        /*----------------- Presence first after a (re)connect -----------------*/
+        if (connected && birth_pending && mqtt_publish_birth()) {
+            birth_pending = false;
+            mqtt_tls_mark_ready();
+        }
+
+        /*----------------- Drain backlog at a controlled rate -----------------*/
+        if (connected && !mqtt_sf_is_empty()) {
+            mqtt_sf_drain(MQTT_SF_DRAIN_PER_POLL, mqtt_sf_send);
+        }
+
+        /*----------------- Command completion reports -----------------*/
+        mqtt_publish_cmd_reports();
+
+        xSemaphoreTake(valveMutex, portMAX_DELAY);
+        current = valveData;
+        xSemaphoreGive(valveMutex);
+
+        CadenceActivity activity = mqtt_cadence_classify(&current);
+        uint32_t period_ms = mqtt_cadence_period_ms(activity, connected);
+        int64_t now_us = esp_timer_get_time();
+        uint32_t elapsed_ms = (uint32_t)((now_us - last_publish_us) / 1000);
+        bool period_due = elapsed_ms >= period_ms;
+        bool changed = !have_snapshot || valve_data_changed(&current, &last_published);
+        bool full = connected && force_publish;
+        uint32_t wait_ms = period_due ? period_ms : period_ms - elapsed_ms;
+
+        // Offline, only changes are worth storing
+        if (changed || (connected && (period_due || force_publish))) {
+            if (!full && !mqtt_cadence_budget_take()) {
+                // Over budget: keep the snapshot, retry with the latest state
+                wait_ms = mqtt_cadence_budget_wait_ms();
+            } else {
+                if (connected) {
+                    force_publish = false;
+                }
 
-        // Wait for a certain period before publishing again (e.g., 5 seconds)
-        vTaskDelay(pdMS_TO_TICKS(5000));  // 5 seconds delay
+                publish_stats.sent++;
+                if (changed) {
+                    publish_stats.sent_on_change++;
+                }
+
+                mqtt_publish_valve_data();
+                mqtt_cadence_published(changed);
+
+                last_published = current;
+                have_snapshot = true;
+                last_publish_us = now_us;
+                wait_ms = mqtt_cadence_period_ms(activity, connected);
+
+                if (period_due && !changed && activity == CADENCE_IDLE) {
+                    ESP_LOGI(TAG, "Heartbeat (sent %lu, suppressed %lu, next in %lu s)",
+                             (unsigned long)publish_stats.sent,
+                             (unsigned long)publish_stats.suppressed,
+                             (unsigned long)(wait_ms / 1000));
+                }
+            }
+        } else if (triggered) {
+            publish_stats.suppressed++;
+        }
+
+        /*----------------- Shadow: reported-state diff -----------------*/
+        if (full) {
+            // Server may have missed diffs while offline: resend everything
+            mqtt_shadow_report_reset();
+        }
+        if (mqtt_shadow_report_due()) {
+            mqtt_publish_message(MQTT_TOPIC_SHADOW_REPORTED, create_shadow_report);
+        }
+
+        // Backlog still draining or birth refused: come back at the pacing interval
+        bool drain_poll = false;
+        if (connected && (birth_pending || !mqtt_sf_is_empty()) && wait_ms > MQTT_CHANGE_POLL_MS) {
+            wait_ms = MQTT_CHANGE_POLL_MS;
+            drain_poll = true;
+        }
+
+        triggered = mqtt_cadence_wait(wait_ms) || !drain_poll;
+    }
+}
+
+
+
+
+/*===============================================================
+ *                  RECONNECT
+ *==============================================================*/
+
+/**
+ * @brief Retry the broker connection (esp_timer task, from reconnect_policy)
+ *
+ * Auto reconnect of esp-mqtt is disabled; its fixed interval made a
+ * whole fleet reconnect in lockstep after a broker restart.
+ */
+static void mqtt_reconnect_now(void)
+{
+    if (mqtt_client != NULL && !mqtt_paused) {
+        const char *uri = mqtt_broker_take_switch();
+        if (uri != NULL) {
+            ESP_LOGI(TAG, "Switching broker to %s", uri);
+            esp_mqtt_client_set_uri(mqtt_client, uri);
+        }
+
+        esp_mqtt_client_reconnect(mqtt_client);
+    }
+}
+
+
+/**
+ * @brief Drop the session so the next reconnect uses the preferred broker
+ *
+ * Called from the broker probe task (mqtt_broker_select.c).
+ */
+static void mqtt_switch_broker(void)
+{
+    if (mqtt_client != NULL && !mqtt_paused) {
+        esp_mqtt_client_disconnect(mqtt_client);
+    }
+}
+
+
+/**
+ * @brief Subscribe / unsubscribe a group command or schedule body topic (JSON + CBOR)
+ *
+ * Called from the MQTT task (connect) and the rx worker (assign);
+ * while disconnected the topics are subscribed on the next
+ * MQTT_EVENT_CONNECTED instead.
+ */
+static void mqtt_group_subscription(const char *topic, bool subscribe)
+{
+    if (mqtt_client == NULL || !mqtt_connected) return;
+
+    char cbor_topic[128];
+    snprintf(cbor_topic, sizeof(cbor_topic), "%s" CBOR_TOPIC_SUFFIX, topic);
+
+    if (subscribe) {
+        esp_mqtt_client_subscribe(mqtt_client, topic, CMD_QOS);
+        esp_mqtt_client_subscribe(mqtt_client, cbor_topic, CMD_QOS);
+    } else {
+        esp_mqtt_client_unsubscribe(mqtt_client, topic);
+        esp_mqtt_client_unsubscribe(mqtt_client, cbor_topic);
+    }
+}
+
+
+/**
+ * @brief Check whether a refused connect asks the device to back off
+ */
+static bool mqtt_broker_busy(const esp_mqtt_error_codes_t *error)
+{
+    if (error == NULL || error->error_type != MQTT_ERROR_TYPE_CONNECTION_REFUSED) {
+        return false;
+    }
+
+#if CONFIG_MQTT_TOPIC_ALIAS
+    // MQTT 5 session (set up for topic aliases): CONNACK reason code
+    switch ((int)error->connect_return_code) {
+        case MQTT5_SERVER_UNAVAILABLE:
+        case MQTT5_SERVER_BUSY:
+        case MQTT5_QUOTA_EXCEEDED:
+        case MQTT5_CONNECTION_RATE_EXCEEDED:
+            return true;
+        default:
+            return false;
+    }
+#else
+    return error->connect_return_code == MQTT_CONNECTION_REFUSE_SERVER_UNAVAILABLE;
+#endif
+}
+
+
+
+/*===============================================================
+ *                  INBOUND WORKER
+ *==============================================================*/
+
+/**
+ * @brief Decode and dispatch inbound messages off the MQTT task
+ *
+ * The event handler only copies fragments into an arena slot; this
+ * task takes complete slots, handles them in place and returns them.
+ * Slow handling (parsing, logging, serverMutex, NVS writes) therefore
+ * never delays keepalives or the reception of the next message.
+ *
+ * The receive stage covers first fragment → picked up here, so time
+ * spent waiting in the queue shows up in the pipeline stats.
+ */
+static void mqtt_rx_worker_task(void *pvParameters)
+{
+    RxMessage rx_msg;
+
+    while (1) {
+        if (!mqtt_rx_arena_take(&rx_msg, portMAX_DELAY)) {
+            continue;
+        }
+
+        uint32_t receive_us = (uint32_t)(esp_timer_get_time() - rx_msg.first_us);
+
+        // Encoding is negotiated by topic suffix
+        size_t topic_len = strlen(rx_msg.topic);
+        size_t suffix_len = strlen(CBOR_TOPIC_SUFFIX);
+        PayloadFormat rx_format = PAYLOAD_JSON;
+
+        if (topic_len > suffix_len &&
+            strcmp(rx_msg.topic + topic_len - suffix_len, CBOR_TOPIC_SUFFIX) == 0) {
+            rx_format = PAYLOAD_CBOR;
+            topic_len -= suffix_len;
+        }
+
+        ESP_LOGI(TAG, "RX topic: %s", rx_msg.topic);
+        if (rx_format == PAYLOAD_JSON) {
+            ESP_LOGI(TAG, "RX data : %s", rx_msg.data);
+        } else {
+            ESP_LOGI(TAG, "RX data : %u bytes CBOR", (unsigned)rx_msg.len);
+        }
+
+        // Routed by topic suffix / event through the dispatch tables
+        mqtt_handle_message(rx_msg.topic, topic_len, rx_msg.data, rx_msg.len, rx_format,
+                            receive_us);
+
+        mqtt_rx_arena_release(&rx_msg);
     }
 }
 
@@ -167,12 +919,6 @@ void mqtt_publish_valve_data_task(void *pvParameters) {
  */
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
-    char topic[128];
-    static char *rx_data = NULL;
-    static int rx_data_len = 0;
-    static int rx_bytes_received = 0;
-
-
     esp_mqtt_event_handle_t event = event_data;
     esp_mqtt_client_handle_t client = event->client;
 
@@ -181,26 +927,81 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
         case MQTT_EVENT_CONNECTED:
             ESP_LOGI(TAG, "MQTT connected");
             mqtt_connected = true;
+            reconnect_policy_connected(RECONNECT_MQTT);
+            mqtt_broker_connected();
+            force_publish = true;
+            birth_pending = true;
+
+            if (paused_at_us != 0) {
+                link_stats.last_offline_ms = (uint32_t)((esp_timer_get_time() - paused_at_us) / 1000);
+                paused_at_us = 0;
+            }
+
+            // New session: the broker has no topic aliases yet
+            mqtt_topic_session_reset();
+
+            // Retained birth message replaces periodic status. Sent by
+            // the publish task: no publish_mutex under the API lock
+            mqtt_cadence_notify();
 
             // subscribe process init
             char topic_cmd_data[128];
             char topic_control_data[128];
+            char topic_shadow_update[128];
+            char topic_rpc_request[128];
 
             snprintf(topic_cmd_data, sizeof(topic_cmd_data), "%s/cmd_data", BASE_TOPIC);
             snprintf(topic_control_data, sizeof(topic_control_data), "%s/control_data", BASE_TOPIC);
+            snprintf(topic_shadow_update, sizeof(topic_shadow_update), "%s/shadow_update", BASE_TOPIC);
+            snprintf(topic_rpc_request, sizeof(topic_rpc_request), "%s/rpc_request", BASE_TOPIC);
 
-            esp_mqtt_client_subscribe(client, topic_cmd_data, 0);
-            esp_mqtt_client_subscribe(client, topic_control_data, 0);
+            esp_mqtt_client_subscribe(client, topic_cmd_data, CMD_QOS);
+            esp_mqtt_client_subscribe(client, topic_control_data, CMD_QOS);
+            esp_mqtt_client_subscribe(client, topic_shadow_update, CMD_QOS);
+            esp_mqtt_client_subscribe(client, topic_rpc_request, RPC_QOS);
 
             ESP_LOGI(TAG, "Subscribed to:");
             ESP_LOGI(TAG, "  %s", topic_cmd_data);
             ESP_LOGI(TAG, "  %s", topic_control_data);
+            ESP_LOGI(TAG, "  %s", topic_shadow_update);
+            ESP_LOGI(TAG, "  %s", topic_rpc_request);
+
+            // CBOR variants of the command topics
+            snprintf(topic_cmd_data, sizeof(topic_cmd_data), "%s/cmd_data" CBOR_TOPIC_SUFFIX, BASE_TOPIC);
+            snprintf(topic_control_data, sizeof(topic_control_data), "%s/control_data" CBOR_TOPIC_SUFFIX, BASE_TOPIC);
+            snprintf(topic_shadow_update, sizeof(topic_shadow_update), "%s/shadow_update" CBOR_TOPIC_SUFFIX, BASE_TOPIC);
+            snprintf(topic_rpc_request, sizeof(topic_rpc_request), "%s/rpc_request" CBOR_TOPIC_SUFFIX, BASE_TOPIC);
+
+            esp_mqtt_client_subscribe(client, topic_cmd_data, CMD_QOS);
+            esp_mqtt_client_subscribe(client, topic_control_data, CMD_QOS);
+            esp_mqtt_client_subscribe(client, topic_shadow_update, CMD_QOS);
+            esp_mqtt_client_subscribe(client, topic_rpc_request, RPC_QOS);
+
+            ESP_LOGI(TAG, "  %s", topic_cmd_data);
+            ESP_LOGI(TAG, "  %s", topic_control_data);
+            ESP_LOGI(TAG, "  %s", topic_shadow_update);
+            ESP_LOGI(TAG, "  %s", topic_rpc_request);
+
+            // Fan-out: fleet and group command topics
+            mqtt_groups_subscribe();
+
+            // Body of a schedule program still being fetched
+            mqtt_schedule_ref_subscribe();
 
             break;
 
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
             mqtt_connected = false;
+
+            // Fragments of an interrupted message never complete
+            mqtt_rx_arena_reset();
+
+            // Also sent for every failed connect attempt
+            if (!mqtt_paused) {
+                mqtt_broker_disconnected();
+                reconnect_policy_schedule(RECONNECT_MQTT);
+            }
             break;
 
         case MQTT_EVENT_SUBSCRIBED:
@@ -212,63 +1013,22 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
             break;
 
         case MQTT_EVENT_DATA:
-            ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-
-            if (event->current_data_offset == 0) {
-                // Copy topic
-                if (event->topic_len < sizeof(topic)) {
-                    memcpy(topic, event->topic, event->topic_len);
-                    topic[event->topic_len] = '\0';
-                } else {
-                    ESP_LOGE(TAG, "Topic too long");
-                    break;
-                }
-                // Copy data
-                rx_data_len = event->total_data_len;
-                rx_bytes_received = 0;
-                if (rx_data_len > MAX_MQTT_PAYLOAD) {
-                    ESP_LOGE(TAG, "Payload too large");
-                    break;
-                }
-                rx_data = malloc(rx_data_len + 1);
-                if (!rx_data) {
-                    ESP_LOGE(TAG, "Payload memory allocation failed");
-                    break;
-                }
-            }
-
-            
-            if (event->data_len > 0){
-                memcpy(rx_data + event->current_data_offset, event->data, event->data_len);
-                rx_bytes_received += event->data_len;
-            }
-            
-            if(rx_bytes_received < rx_data_len) {
-                break;
-            }
-            
-            rx_data[rx_data_len] = '\0'; 
-                
-            ESP_LOGI(TAG, "RX topic: %s", topic);
-            ESP_LOGI(TAG, "RX data : %s", rx_data);
-
-            if (strstr(topic, "/cmd_data")) {
-                mqtt_handle_cmd_data(rx_data);
-            } else if (strstr(topic, "/control_data")) {
-                mqtt_handle_control_data(rx_data);
-            } else {
-                mqtt_handle_topic(rx_data);
-            }
-
-            free(rx_data);
-            rx_data = NULL;
-            rx_data_len = 0;
-            rx_bytes_received = 0;
+            ESP_LOGD(TAG, "MQTT_EVENT_DATA");
 
+            // Copy only: the rx worker decodes and dispatches. No free
+            // slot → the message is shed (rx_stats), the task never blocks
+            mqtt_rx_arena_feed(event->topic, event->topic_len,
+                               event->data, event->data_len,
+                               event->current_data_offset, event->total_data_len);
             break;
 
         case MQTT_EVENT_ERROR:
             ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+
+            if (mqtt_broker_busy(event->error_handle)) {
+                ESP_LOGW(TAG, "Broker is shedding load, backing off");
+                reconnect_policy_hint(RECONNECT_MQTT, MQTT_RECONNECT_MAX_MS / 2);
+            }
             break;
 
         default:
@@ -286,27 +1046,89 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
  *==============================================================*/
 
 /**
- * @brief Initialize and start MQTT client
+ * @brief Initialize and start MQTT client, or resume a paused one
+ *
+ * The client is created once. After pause_mqtt_client() only its task
+ * is restarted: buffers, outbox, TLS transport (and cached session)
+ * and the publish task are kept.
  */
 void start_mqtt_client(void)
 {
+    // Called on IP_EVENT_STA_GOT_IP: start of Wi-Fi up → first publish
+    mqtt_tls_mark_link_up();
+
     if (mqtt_client != NULL) {
-        ESP_LOGE(TAG, "MQTT client already initialized. Reconnecting...");
-        // esp_mqtt_client_reconnect(mqtt_client);
+        if (!mqtt_paused) {
+            ESP_LOGW(TAG, "MQTT client already running");
+            return;
+        }
+
+        ESP_LOGI(TAG, "Resuming MQTT client...");
+
+        const char *uri = mqtt_broker_take_switch();
+        if (uri != NULL) {
+            esp_mqtt_client_set_uri(mqtt_client, uri);
+        }
+
+        // Cleared first: a failed first attempt must arm a retry
+        mqtt_paused = false;
+
+        if (esp_mqtt_client_start(mqtt_client) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to resume MQTT client");
+            mqtt_paused = true;
+            return;
+        }
+
+        link_stats.resumes++;
         return;
     }
 
     ESP_LOGI(TAG, "Starting MQTT client...");
+
+    mqtt_state_init();
+    mqtt_rx_arena_init();
+    reconnect_policy_init(RECONNECT_MQTT, MQTT_RECONNECT_BASE_MS, MQTT_RECONNECT_MAX_MS,
+                          mqtt_reconnect_now);
+    mqtt_broker_init();
+    mqtt_groups_init(mqtt_group_subscription);
+    mqtt_schedule_ref_init(mqtt_group_subscription);
+
+    // Before the first message can arrive: a redelivered command must
+    // already be deduplicated, and its ack may fall back to the queue
+    mqtt_sf_init();
+    cmd_tracker_init();
+
+    const char *broker_uri = mqtt_broker_uri();
+
+    if (publish_mutex == NULL) {
+        publish_mutex = xSemaphoreCreateMutex();
+    }
     
     esp_mqtt_client_config_t mqtt_cfg = {
-        .broker.address.uri = MQTT_BROKER_URI,
+        .broker.address.uri = broker_uri,
         .credentials.client_id = DEVICE_ID,
         .broker.verification.certificate = (const char *)_binary_ca_cert_pem_start,
-        .network.disable_auto_reconnect = false,
+        .network.disable_auto_reconnect = true,     // reconnect_policy.c
         .session.keepalive = 60,
+        .session.last_will.topic = LWT_TOPIC,
+        .session.last_will.msg = LWT_MESSAGE,
+        .session.last_will.qos = PRESENCE_QOS,
+        .session.last_will.retain = 1,
+        // Hard ceiling; mqtt_outbox_admit() applies the per-class cap
+        .outbox.limit = MQTT_OUTBOX_LIMIT + MQTT_OUTBOX_RESERVE,
+#if CONFIG_MQTT_TOPIC_ALIAS
+        .session.protocol_ver = MQTT_PROTOCOL_V_5,
+#endif
     };
 
-    ESP_LOGI("MQTT", "Broker URI = %s", MQTT_BROKER_URI);
+    // TLS through our own esp-tls transport: session resumption + timing
+    if (strncmp(broker_uri, "mqtts://", 8) == 0) {
+        mqtt_cfg.network.transport = mqtt_tls_transport_create(
+            (const char *)_binary_ca_cert_pem_start,
+            _binary_ca_cert_pem_end - _binary_ca_cert_pem_start);
+    }
+
+    ESP_LOGI("MQTT", "Broker URI = %s", broker_uri);
     ESP_LOGI("TLS", "CA cert first byte: %02X", _binary_ca_cert_pem_start[0]);
     mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
 
@@ -315,22 +1137,37 @@ void start_mqtt_client(void)
         return;
     }
 
+    // Inbound worker exists before the first message can arrive
+    if (mqtt_rx_task_handle == NULL &&
+        xTaskCreate(mqtt_rx_worker_task, "mqtt_rx_worker", MQTT_RX_TASK_STACK, NULL,
+                    MQTT_RX_TASK_PRIORITY, &mqtt_rx_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create inbound worker task");
+        mqtt_rx_task_handle = NULL;
+    }
+
     esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     esp_mqtt_client_start(mqtt_client);
 
-
-    // Create the valve data publishing task
-    BaseType_t xReturned = xTaskCreate(
-        mqtt_publish_valve_data_task,
-        "mqtt_publish_valve_data",
-        4096,
-        NULL,
-        tskIDLE_PRIORITY + 1,
-        &mqtt_pub_task_handle
-    );
-
-    if (xReturned != pdPASS) {
-        ESP_LOGE(TAG, "Failed to create valve data publishing task");
+    // RTT probing / return to the preferred broker (fallbacks only)
+    mqtt_broker_start(mqtt_switch_broker);
+
+
+    // Create the valve data publishing task once; it keeps queueing
+    // state changes while the client is stopped
+    if (mqtt_pub_task_handle == NULL) {
+        BaseType_t xReturned = xTaskCreate(
+            mqtt_publish_valve_data_task,
+            "mqtt_publish_valve_data",
+            4096,
+            NULL,
+            tskIDLE_PRIORITY + 1,
+            &mqtt_pub_task_handle
+        );
+
+        if (xReturned != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create valve data publishing task");
+            mqtt_pub_task_handle = NULL;
+        }
     }
 
 }
@@ -338,25 +1175,57 @@ void start_mqtt_client(void)
 
 
 /*===============================================================
- *                  STOP MQTT CLIENT
+ *                  PAUSE / STOP MQTT CLIENT
  *==============================================================*/
 
 /**
- * @brief Stop MQTT client and delete publish task
+ * @brief Pause the MQTT client on a link flap
+ *
+ * Only the client task and its connection are stopped; the client
+ * itself stays allocated and start_mqtt_client() resumes it. The
+ * publish task keeps running and queues state changes in the
+ * store-and-forward queue meanwhile.
+ *
+ * @note Not callable from the MQTT event handler.
+ */
+void pause_mqtt_client(void)
+{
+    if (mqtt_client == NULL || mqtt_paused) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Pausing MQTT Client...");
+
+    if (mqtt_connected) {
+        mqtt_publish_offline();
+    }
+    mqtt_connected = false;
+
+    // Before stopping: the DISCONNECTED event must not arm a retry
+    mqtt_paused = true;
+    esp_mqtt_client_stop(mqtt_client);
+    reconnect_policy_cancel(RECONNECT_MQTT);
+
+    paused_at_us = esp_timer_get_time();
+    link_stats.pauses++;
+}
+
+
+/**
+ * @brief Stop and destroy the MQTT client
+ *
+ * The publish task keeps running and queues state changes in the
+ * store-and-forward queue until the client is started again.
  */
 void stop_mqtt_client(void)
 {
     if (mqtt_client != NULL) {
         ESP_LOGI(TAG, "Stopping MQTT Client...");
-        esp_mqtt_client_stop(mqtt_client);
+
+        pause_mqtt_client();
         esp_mqtt_client_destroy(mqtt_client); 
 
         mqtt_client = NULL;  
-    }
-
-    // Delete the valve data publishing task
-    if (mqtt_pub_task_handle != NULL) {
-        vTaskDelete(mqtt_pub_task_handle);
-        mqtt_pub_task_handle = NULL;
+        mqtt_paused = false;
     }
 }
\ No newline at end of file
@@ -1,9 +1,66 @@
 #ifndef MQTT_CLIENT_FN_H
 #define MQTT_CLIENT_FN_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "codec_fn/payload_format.h"
+#include "codec_fn/command_decoder.h"
+#include "mqtt_cmd_tracker.h"
+
+// Outbound JSON buffer (telemetry or a shadow report with a full schedule)
+#define MQTT_TX_BUFFER_SIZE 1280
+
+// Publish-on-change counters (one unit = one publish cycle)
+typedef struct {
+    uint32_t sent;              // Cycles published (change or heartbeat)
+    uint32_t sent_on_change;    // Cycles published because state changed
+    uint32_t suppressed;        // Wake-ups (notify / period) with nothing to send;
+                                // drain polls and budget deferrals not counted
+} PublishStats;
+
+// Link flap counters (client paused / resumed, not recreated)
+typedef struct {
+    uint32_t pauses;            // Wi-Fi loss or AP client join
+    uint32_t resumes;           // Restarts of the paused client
+    uint32_t last_offline_ms;   // Pause → next MQTT_EVENT_CONNECTED
+} MqttLinkStats;
+
+// esp-mqtt outbox (non-blocking publish path)
+typedef struct {
+    uint32_t bytes;             // Outbox size at the last publish / read
+    uint32_t enqueued;          // Messages handed to the outbox
+    uint32_t enqueue_last_us;   // Time spent in the last enqueue call
+    uint32_t enqueue_max_us;
+    uint32_t diverted;          // Refused at the cap → store-and-forward
+} MqttOutboxStats;
+
+// Writes a JSON or CBOR payload into buf; returns length or -1 on overflow
+typedef int (*payload_builder_t)(char *buf, size_t size, PayloadFormat format);
+
+// Outbound telemetry format
+typedef enum {
+    TELEMETRY_LEGACY = 0,       // state_data + status + error topics
+    TELEMETRY_CONSOLIDATED,     // single telemetry topic
+    TELEMETRY_BOTH              // both, for backend migration
+} TelemetryMode;
+
 void mqtt_publish_valve_data(void);
+void mqtt_set_telemetry_mode(TelemetryMode mode);
+TelemetryMode mqtt_get_telemetry_mode(void);
+void mqtt_set_payload_format(PayloadFormat format);
+PayloadFormat mqtt_get_payload_format(void);
+void mqtt_get_publish_stats(PublishStats *stats);
+void mqtt_get_link_stats(MqttLinkStats *stats);
+void mqtt_get_outbox_stats(MqttOutboxStats *stats);
+bool mqtt_publish_binary(const char *sub_topic, const uint8_t *data, size_t len);
+bool mqtt_is_connected(void);
+void mqtt_publish_cmd_ack(const CmdReport *report);
+void mqtt_publish_rpc_response(const ValveCommand *req, PayloadFormat format);
 
 void start_mqtt_client(void);
+void pause_mqtt_client(void);
 void stop_mqtt_client(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,290 @@
+/**
+ * @file mqtt_cmd_tracker.c
+ * @brief Idempotency keys, acks and actuation timing for MQTT commands
+ *
+ * Commands may carry an optional "cmd_id". For those the device:
+ *  - remembers the last CONFIG_MQTT_CMD_DEDUP_SIZE IDs (LRU), so a
+ *    redelivered command is acknowledged as a duplicate and not
+ *    executed twice
+ *  - acknowledges the command as soon as it is applied
+ *  - reports completion when the motion finishes, with
+ *    receive → start → complete timing
+ *
+ * Only one motion can be pending at a time (serverData holds one
+ * angle request); a newer motion command supersedes the older one.
+ *
+ * Called from three tasks: the MQTT rx worker (accept), the valve
+ * task (motion hooks) and the MQTT publish task (reports), so all
+ * state is guarded by one mutex.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+
+#include "mqtt_cmd_tracker.h"
+#include "mqtt_cadence.h"
+
+
+/* ======================================================================== */
+/* ============================ CONFIGURATION ============================= */
+/* ======================================================================== */
+
+#define CMD_DEDUP_SIZE      CONFIG_MQTT_CMD_DEDUP_SIZE
+#define CMD_REPORT_SLOTS    8       // Completion reports waiting for the publish task
+
+static const char *TAG = "MQTT_CMD_TRACKER";
+
+typedef struct {
+    char id[CMD_REQUEST_ID_SIZE];
+    uint32_t last_use;          // LRU stamp, 0 = slot unused
+} CmdIdEntry;
+
+// Recently seen command IDs
+static CmdIdEntry recent_ids[CMD_DEDUP_SIZE];
+static uint32_t lru_clock;
+
+// Motion command waiting for the valve task
+static CmdReport pending;
+static bool pending_active = false;
+
+// Completion reports (ring)
+static CmdReport reports[CMD_REPORT_SLOTS];
+static int report_head;
+static int report_count;
+
+static CmdTrackerStats tracker_stats;
+static SemaphoreHandle_t tracker_mutex = NULL;
+
+
+
+/* ======================================================================== */
+/* ============================ INTERNAL HELPERS ========================== */
+/* ======================================================================== */
+
+/**
+ * @brief Remember cmd_id; returns true if it was already known
+ */
+static bool lru_check_and_insert(const char *cmd_id)
+{
+    int victim = 0;
+
+    lru_clock++;
+
+    for (int i = 0; i < CMD_DEDUP_SIZE; i++) {
+        if (recent_ids[i].last_use != 0 && strcmp(recent_ids[i].id, cmd_id) == 0) {
+            recent_ids[i].last_use = lru_clock;
+            return true;
+        }
+        if (recent_ids[i].last_use < recent_ids[victim].last_use) {
+            victim = i;
+        }
+    }
+
+    snprintf(recent_ids[victim].id, sizeof(recent_ids[victim].id), "%s", cmd_id);
+    recent_ids[victim].last_use = lru_clock;
+    return false;
+}
+
+
+/**
+ * @brief Queue a finished command for the publish task
+ *
+ * When the ring is full the oldest report is dropped; the command
+ * itself has already been executed.
+ */
+static void push_report(const CmdReport *report)
+{
+    if (report_count == CMD_REPORT_SLOTS) {
+        ESP_LOGW(TAG, "Report ring full, dropping %s", reports[report_head].cmd_id);
+        report_head = (report_head + 1) % CMD_REPORT_SLOTS;
+        report_count--;
+    }
+
+    reports[(report_head + report_count) % CMD_REPORT_SLOTS] = *report;
+    report_count++;
+
+    // Publish task sends it on its next wake-up
+    mqtt_cadence_notify();
+
+    uint32_t total_ms = (uint32_t)((report->done_us - report->rx_us) / 1000);
+    tracker_stats.completed++;
+    tracker_stats.last_total_ms = total_ms;
+    if (total_ms > tracker_stats.max_total_ms) {
+        tracker_stats.max_total_ms = total_ms;
+    }
+}
+
+
+/**
+ * @brief Complete a command with the given status
+ */
+static void finish(CmdReport *report, CmdStatus status, int err_code)
+{
+    report->status = status;
+    report->err_code = err_code;
+    report->done_us = esp_timer_get_time();
+    if (report->start_us == 0) {
+        report->start_us = report->done_us;
+    }
+
+    if (status == CMD_STATUS_FAILED) {
+        tracker_stats.failed++;
+    }
+
+    push_report(report);
+}
+
+
+
+/* ======================================================================== */
+/* ============================== PUBLIC API ============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Create the tracker mutex (call once before the first command)
+ */
+void cmd_tracker_init(void)
+{
+    if (tracker_mutex == NULL) {
+        tracker_mutex = xSemaphoreCreateMutex();
+    }
+}
+
+
+/**
+ * @brief Register a command that carries a cmd_id
+ *
+ * Call before applying the command. Non-motion commands are
+ * completed immediately; motion commands stay pending until the
+ * valve task reports the motor result.
+ *
+ * @param cmd_id  Idempotency key from the command
+ * @param format  Encoding of the command (reports use the same)
+ * @param motion  true if the command will move the valve
+ * @param ack     Filled with the ack to publish right away
+ *
+ * @return CMD_STATUS_DUPLICATE if the command must not be executed,
+ *         CMD_STATUS_ACCEPTED otherwise
+ */
+CmdStatus cmd_tracker_accept(const char *cmd_id, PayloadFormat format, bool motion, CmdReport *ack)
+{
+    memset(ack, 0, sizeof(*ack));
+    snprintf(ack->cmd_id, sizeof(ack->cmd_id), "%s", cmd_id);
+    ack->format = format;
+    ack->rx_us = esp_timer_get_time();
+    ack->status = CMD_STATUS_ACCEPTED;
+
+    if (tracker_mutex == NULL) {
+        return CMD_STATUS_ACCEPTED;
+    }
+
+    xSemaphoreTake(tracker_mutex, portMAX_DELAY);
+
+    tracker_stats.received++;
+
+    if (lru_check_and_insert(cmd_id)) {
+        tracker_stats.duplicates++;
+        ack->status = CMD_STATUS_DUPLICATE;
+        xSemaphoreGive(tracker_mutex);
+
+        ESP_LOGW(TAG, "Duplicate command %s ignored", cmd_id);
+        return CMD_STATUS_DUPLICATE;
+    }
+
+    if (motion) {
+        if (pending_active) {
+            finish(&pending, CMD_STATUS_SUPERSEDED, 0);
+        }
+        pending = *ack;
+        pending_active = true;
+    } else {
+        CmdReport done = *ack;
+        finish(&done, CMD_STATUS_DONE, 0);
+    }
+
+    xSemaphoreGive(tracker_mutex);
+    return CMD_STATUS_ACCEPTED;
+}
+
+
+/**
+ * @brief Valve task hook: motor movement is about to start
+ */
+void cmd_tracker_motion_start(void)
+{
+    if (tracker_mutex == NULL) return;
+
+    xSemaphoreTake(tracker_mutex, portMAX_DELAY);
+    if (pending_active && pending.start_us == 0) {
+        pending.start_us = esp_timer_get_time();
+    }
+    xSemaphoreGive(tracker_mutex);
+}
+
+
+/**
+ * @brief Valve task hook: motor movement finished
+ *
+ * Only completes a command whose motion was started, so a move
+ * that began before the command arrived is not credited to it.
+ *
+ * @param err_code  0 on success, motor error otherwise
+ */
+void cmd_tracker_motion_done(int err_code)
+{
+    if (tracker_mutex == NULL) return;
+
+    xSemaphoreTake(tracker_mutex, portMAX_DELAY);
+    if (pending_active && pending.start_us != 0) {
+        finish(&pending, (err_code == 0) ? CMD_STATUS_DONE : CMD_STATUS_FAILED, err_code);
+        pending_active = false;
+    }
+    xSemaphoreGive(tracker_mutex);
+}
+
+
+/**
+ * @brief Take the oldest completion report
+ *
+ * @return true if report was filled
+ */
+bool cmd_tracker_pop_report(CmdReport *report)
+{
+    bool found = false;
+
+    if (tracker_mutex == NULL) return false;
+
+    xSemaphoreTake(tracker_mutex, portMAX_DELAY);
+    if (report_count > 0) {
+        *report = reports[report_head];
+        report_head = (report_head + 1) % CMD_REPORT_SLOTS;
+        report_count--;
+        found = true;
+    }
+    xSemaphoreGive(tracker_mutex);
+
+    return found;
+}
+
+
+/**
+ * @brief Copy command tracking counters
+ */
+void cmd_tracker_get_stats(CmdTrackerStats *stats)
+{
+    if (stats == NULL) return;
+
+    if (tracker_mutex == NULL) {
+        *stats = tracker_stats;
+        return;
+    }
+
+    xSemaphoreTake(tracker_mutex, portMAX_DELAY);
+    *stats = tracker_stats;
+    xSemaphoreGive(tracker_mutex);
+}
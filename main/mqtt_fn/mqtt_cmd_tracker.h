@@ -0,0 +1,47 @@
+#ifndef MQTT_CMD_TRACKER_H
+#define MQTT_CMD_TRACKER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "codec_fn/command_decoder.h"
+#include "codec_fn/payload_format.h"
+
+// Command life cycle as reported on "cmd_ack"
+typedef enum {
+    CMD_STATUS_ACCEPTED = 0,    // Executed (motion may still be running)
+    CMD_STATUS_DUPLICATE,       // cmd_id seen before, not executed again
+    CMD_STATUS_DONE,            // Completed successfully
+    CMD_STATUS_FAILED,          // Motor reported an error
+    CMD_STATUS_SUPERSEDED       // Replaced by a newer motion command
+} CmdStatus;
+
+// One ack / completion report
+typedef struct {
+    char cmd_id[CMD_REQUEST_ID_SIZE];
+    CmdStatus status;
+    PayloadFormat format;       // Reply in the encoding of the command
+    int64_t rx_us;              // Command received
+    int64_t start_us;           // Motion started (0 if none yet)
+    int64_t done_us;            // Completed (0 if not yet)
+    int err_code;               // Motor error for CMD_STATUS_FAILED
+} CmdReport;
+
+// Command tracking counters
+typedef struct {
+    uint32_t received;          // Commands with a cmd_id
+    uint32_t duplicates;        // Redeliveries not executed
+    uint32_t completed;         // Reached done / failed / superseded
+    uint32_t failed;            // Motion failed
+    uint32_t last_total_ms;     // Receive → complete of the latest command
+    uint32_t max_total_ms;      // Slowest receive → complete seen
+} CmdTrackerStats;
+
+void cmd_tracker_init(void);
+CmdStatus cmd_tracker_accept(const char *cmd_id, PayloadFormat format, bool motion, CmdReport *ack);
+void cmd_tracker_motion_start(void);
+void cmd_tracker_motion_done(int err_code);
+bool cmd_tracker_pop_report(CmdReport *report);
+void cmd_tracker_get_stats(CmdTrackerStats *stats);
+
+#endif // MQTT_CMD_TRACKER_H
@@ -0,0 +1,377 @@
+/**
+ * @file mqtt_groups.c
+ * @brief Group and fleet command topics (one publish, many valves)
+ *
+ * Besides its own topics every device listens on
+ *
+ *   vortex_device/wifi_valve/fleet/<cmd>             all devices
+ *   vortex_device/wifi_valve/group/<name>/<cmd>      members of <name>
+ *
+ * for <cmd> = cmd_data and control_data (JSON and "/cbor"), so the
+ * backend closes a whole zone with one publish instead of one per
+ * valve. Membership (up to CONFIG_MQTT_GROUP_MAX names) is assigned
+ * with a "set_groups" block on the device's control_data topic and
+ * kept in NVS (eeprom_fn/group_storage.c).
+ *
+ * Stagger: all members receive a group command within milliseconds,
+ * so their motors would start together. A device with a stagger
+ * offset applies group / fleet commands that move the valve only
+ * after stagger_ms (esp_timer); commands on its own topics are never
+ * delayed, and a newer motion command drops a pending staggered one.
+ *
+ * Membership is changed by the rx worker and read there and in the
+ * MQTT task (subscribe on connect); the pending staggered patch is
+ * shared with the esp_timer task. Both are guarded by groups_mutex,
+ * which is never held across an esp-mqtt call.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "device_shadow.h"
+#include "mqtt_groups.h"
+#include "mqtt_cadence.h"
+
+
+/* ======================================================================== */
+/* ============================ CONFIGURATION ============================= */
+/* ======================================================================== */
+
+#define GROUP_TOPIC_SIZE    96
+
+_Static_assert(GROUP_MAX <= CMD_MAX_GROUPS, "CONFIG_MQTT_GROUP_MAX exceeds CMD_MAX_GROUPS");
+_Static_assert(GROUP_NAME_SIZE == CMD_GROUP_NAME_SIZE, "group name sizes differ");
+
+// Command topics accepted on group / fleet topics (no shadow_update:
+// shadow versions are per device)
+static const char *const group_cmd_topics[] = {
+    "cmd_data",
+    "control_data",
+};
+
+static const char *TAG = "MQTT_GROUPS";
+
+static GroupConfig groups;
+static group_subscribe_fn subscribe_fn;
+static MqttGroupStats group_stats;
+
+static SemaphoreHandle_t groups_mutex;
+static esp_timer_handle_t stagger_timer;
+static ShadowPatch pending_patch;
+static bool pending;
+
+
+
+/* ======================================================================== */
+/* ============================ INTERNAL HELPERS ========================== */
+/* ======================================================================== */
+
+/**
+ * @brief A group name is one topic level: [A-Za-z0-9_-], no wildcards
+ */
+static bool group_name_valid(const char *name)
+{
+    size_t len = strlen(name);
+    if (len == 0 || len >= GROUP_NAME_SIZE) return false;
+
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                  (c >= '0' && c <= '9') || c == '_' || c == '-';
+        if (!ok) return false;
+    }
+    return true;
+}
+
+
+static int group_find(const GroupConfig *cfg, const char *name, size_t len)
+{
+    for (int i = 0; i < cfg->count; i++) {
+        if (strlen(cfg->names[i]) == len && strncmp(cfg->names[i], name, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * @brief (Un)subscribe every command topic below prefix
+ *
+ * @param prefix  MQTT_FLEET_TOPIC, or MQTT_GROUP_TOPIC "<name>"
+ */
+static void subscribe_level(const char *prefix, bool subscribe)
+{
+    char topic[GROUP_TOPIC_SIZE];
+
+    for (size_t i = 0; i < sizeof(group_cmd_topics) / sizeof(group_cmd_topics[0]); i++) {
+        snprintf(topic, sizeof(topic), "%s/%s", prefix, group_cmd_topics[i]);
+        subscribe_fn(topic, subscribe);
+    }
+}
+
+
+static void subscribe_group(const char *name, bool subscribe)
+{
+    char prefix[GROUP_TOPIC_SIZE];
+
+    snprintf(prefix, sizeof(prefix), MQTT_GROUP_TOPIC "%s", name);
+    subscribe_level(prefix, subscribe);
+}
+
+
+static void stagger_timer_cb(void *arg)
+{
+    ShadowPatch patch;
+    bool due;
+
+    xSemaphoreTake(groups_mutex, portMAX_DELAY);
+    due = pending;
+    if (due) {
+        patch = pending_patch;
+        pending = false;
+    }
+    xSemaphoreGive(groups_mutex);
+
+    if (!due) return;
+
+    ESP_LOGI(TAG, "Applying staggered group command");
+    shadow_apply(&patch, NULL, NULL);
+    group_stats.staggered++;
+
+    mqtt_cadence_notify();
+}
+
+
+
+/* ======================================================================== */
+/* ============================== PUBLIC API ============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Load the stored membership (once, before the client starts)
+ *
+ * @param subscribe  Subscribes / unsubscribes a command topic; a no-op
+ *                   while disconnected (mqtt_groups_subscribe() runs
+ *                   again on the next connect)
+ */
+void mqtt_groups_init(group_subscribe_fn subscribe)
+{
+    if (subscribe_fn != NULL) return;
+
+    groups_mutex = xSemaphoreCreateMutex();
+
+    const esp_timer_create_args_t args = {
+        .callback = stagger_timer_cb,
+        .name = "group_stagger",
+    };
+    if (esp_timer_create(&args, &stagger_timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Stagger timer create failed");
+        stagger_timer = NULL;
+    }
+
+    group_storage_load(&groups);
+    subscribe_fn = subscribe;
+}
+
+
+/**
+ * @brief Subscribe the fleet and all group topics (MQTT_EVENT_CONNECTED)
+ */
+void mqtt_groups_subscribe(void)
+{
+    if (subscribe_fn == NULL) return;
+
+    GroupConfig current;
+    mqtt_groups_get(&current);
+
+    subscribe_level(MQTT_FLEET_TOPIC, true);
+    ESP_LOGI(TAG, "  %s/...", MQTT_FLEET_TOPIC);
+
+    for (int i = 0; i < current.count; i++) {
+        subscribe_group(current.names[i], true);
+        ESP_LOGI(TAG, "  " MQTT_GROUP_TOPIC "%s/...", current.names[i]);
+    }
+}
+
+
+/**
+ * @brief Replace the membership with the "set_groups" block of cmd
+ *
+ * Left groups are unsubscribed and new ones subscribed right away;
+ * the list is saved to NVS only if it changed. Without "stagger_ms"
+ * the stored offset is kept.
+ *
+ * @return ESP_ERR_INVALID_ARG for too many / unusable names or an
+ *         offset above MQTT_GROUP_STAGGER_MAX_MS, else the NVS result
+ */
+esp_err_t mqtt_groups_assign(const ValveCommand *cmd)
+{
+    if (!cmd->has_groups || subscribe_fn == NULL) return ESP_ERR_INVALID_STATE;
+
+    if (cmd->group_count > GROUP_MAX) {
+        ESP_LOGW(TAG, "%u groups, at most %d", (unsigned)cmd->group_count, GROUP_MAX);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (cmd->has_stagger && cmd->stagger_ms > MQTT_GROUP_STAGGER_MAX_MS) {
+        ESP_LOGW(TAG, "Stagger %d ms too long", cmd->stagger_ms);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Only the rx worker assigns, so prev stays current until the swap
+    GroupConfig prev;
+    mqtt_groups_get(&prev);
+
+    GroupConfig next;
+    memset(&next, 0, sizeof(next));
+    next.stagger_ms = cmd->has_stagger ? (uint16_t)cmd->stagger_ms : prev.stagger_ms;
+
+    for (size_t i = 0; i < cmd->group_count; i++) {
+        const char *name = cmd->groups[i];
+
+        if (!group_name_valid(name)) {
+            ESP_LOGW(TAG, "Invalid group name \"%s\"", name);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (group_find(&next, name, strlen(name)) >= 0) continue;
+
+        strcpy(next.names[next.count++], name);
+    }
+
+    if (memcmp(&next, &prev, sizeof(next)) == 0) {
+        return ESP_OK;
+    }
+
+    // Swap first: messages of a left group are dropped from now on
+    xSemaphoreTake(groups_mutex, portMAX_DELAY);
+    groups = next;
+    xSemaphoreGive(groups_mutex);
+
+    for (int i = 0; i < prev.count; i++) {
+        if (group_find(&next, prev.names[i], strlen(prev.names[i])) < 0) {
+            subscribe_group(prev.names[i], false);
+        }
+    }
+    for (int i = 0; i < next.count; i++) {
+        if (group_find(&prev, next.names[i], strlen(next.names[i])) < 0) {
+            subscribe_group(next.names[i], true);
+        }
+    }
+
+    ESP_LOGI(TAG, "Member of %d groups, stagger %u ms", next.count, next.stagger_ms);
+
+    return group_storage_save(&next);
+}
+
+
+/**
+ * @brief Classify an inbound topic (without "/cbor")
+ */
+MqttCmdScope mqtt_groups_scope(const char *topic, size_t len)
+{
+    const size_t fleet_len = sizeof(MQTT_FLEET_TOPIC) - 1;
+    const size_t group_len = sizeof(MQTT_GROUP_TOPIC) - 1;
+
+    if (len > fleet_len && strncmp(topic, MQTT_FLEET_TOPIC, fleet_len) == 0 &&
+        topic[fleet_len] == '/') {
+        group_stats.received++;
+        return MQTT_SCOPE_FLEET;
+    }
+
+    if (len > group_len && strncmp(topic, MQTT_GROUP_TOPIC, group_len) == 0) {
+        const char *name = topic + group_len;
+        const char *end = memchr(name, '/', len - group_len);
+        if (end == NULL) return MQTT_SCOPE_NONE;
+
+        xSemaphoreTake(groups_mutex, portMAX_DELAY);
+        int member = group_find(&groups, name, (size_t)(end - name));
+        xSemaphoreGive(groups_mutex);
+
+        if (member < 0) return MQTT_SCOPE_NONE;
+        group_stats.received++;
+        return MQTT_SCOPE_GROUP;
+    }
+
+    return MQTT_SCOPE_DEVICE;
+}
+
+
+/**
+ * @brief Hold a group / fleet motion patch for the stagger offset
+ *
+ * @return false if there is no offset: the caller applies patch now
+ */
+bool mqtt_groups_defer(const ShadowPatch *patch)
+{
+    if (stagger_timer == NULL) return false;
+
+    xSemaphoreTake(groups_mutex, portMAX_DELAY);
+    uint16_t stagger_ms = groups.stagger_ms;
+    if (stagger_ms == 0) {
+        xSemaphoreGive(groups_mutex);
+        return false;
+    }
+    if (pending) {
+        group_stats.cancelled++;
+    }
+    pending_patch = *patch;
+    pending = true;
+    xSemaphoreGive(groups_mutex);
+
+    esp_timer_stop(stagger_timer);
+    esp_timer_start_once(stagger_timer, (uint64_t)stagger_ms * 1000);
+
+    ESP_LOGI(TAG, "Group command staggered by %u ms", stagger_ms);
+    return true;
+}
+
+
+/**
+ * @brief Drop a pending staggered patch (a newer motion command won)
+ */
+void mqtt_groups_cancel_deferred(void)
+{
+    if (groups_mutex == NULL) return;
+
+    xSemaphoreTake(groups_mutex, portMAX_DELAY);
+    if (pending) {
+        pending = false;
+        group_stats.cancelled++;
+    }
+    xSemaphoreGive(groups_mutex);
+}
+
+
+/**
+ * @brief Copy the current membership
+ */
+void mqtt_groups_get(GroupConfig *cfg)
+{
+    if (cfg == NULL) return;
+
+    if (groups_mutex == NULL) {
+        memset(cfg, 0, sizeof(*cfg));
+        return;
+    }
+
+    xSemaphoreTake(groups_mutex, portMAX_DELAY);
+    *cfg = groups;
+    xSemaphoreGive(groups_mutex);
+}
+
+
+/**
+ * @brief Copy membership and fan-out counters
+ */
+void mqtt_groups_get_stats(MqttGroupStats *stats)
+{
+    if (stats == NULL) return;
+
+    *stats = group_stats;
+    stats->count = groups.count;
+    stats->stagger_ms = groups.stagger_ms;
+}
@@ -0,0 +1,51 @@
+#ifndef MQTT_GROUPS_H
+#define MQTT_GROUPS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#include "codec_fn/command_decoder.h"
+#include "eeprom_fn/group_storage.h"
+#include "mqtt_topics.h"
+
+// vortex_device/wifi_valve/group/<name>/<cmd topic>, .../fleet/<cmd topic>
+#define MQTT_GROUP_TOPIC        MQTT_ROOT_TOPIC "group/"
+#define MQTT_FLEET_TOPIC        MQTT_ROOT_TOPIC "fleet"
+
+// Largest per-device stagger offset accepted from the backend
+#define MQTT_GROUP_STAGGER_MAX_MS   60000
+
+// Who an inbound command was addressed to
+typedef enum {
+    MQTT_SCOPE_DEVICE = 0,      // Device topic
+    MQTT_SCOPE_GROUP,           // A group this device is a member of
+    MQTT_SCOPE_FLEET,           // Every device
+    MQTT_SCOPE_NONE             // Group this device has left (in flight)
+} MqttCmdScope;
+
+// Group membership and fan-out counters
+typedef struct {
+    uint8_t count;              // Groups this device is a member of
+    uint16_t stagger_ms;        // Configured stagger offset
+    uint32_t received;          // Commands on group / fleet topics
+    uint32_t staggered;         // Motion commands applied after the offset
+    uint32_t cancelled;         // Pending staggered commands replaced
+} MqttGroupStats;
+
+// Subscribes (or unsubscribes) one command topic and its CBOR variant
+typedef void (*group_subscribe_fn)(const char *topic, bool subscribe);
+
+void mqtt_groups_init(group_subscribe_fn subscribe);
+void mqtt_groups_subscribe(void);
+esp_err_t mqtt_groups_assign(const ValveCommand *cmd);
+MqttCmdScope mqtt_groups_scope(const char *topic, size_t len);
+
+bool mqtt_groups_defer(const ShadowPatch *patch);
+void mqtt_groups_cancel_deferred(void);
+
+void mqtt_groups_get(GroupConfig *cfg);
+void mqtt_groups_get_stats(MqttGroupStats *stats);
+
+#endif // MQTT_GROUPS_H
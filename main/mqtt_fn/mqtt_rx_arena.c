@@ -0,0 +1,314 @@
+/**
+ * @file mqtt_rx_arena.c
+ * @brief Fixed reassembly slots between the MQTT task and the rx worker
+ *
+ * esp-mqtt delivers payloads larger than its RX buffer as several
+ * MQTT_EVENT_DATA events. Fragments are copied into one of
+ * MQTT_RX_SLOTS static slots instead of a per-message malloc, so the
+ * receive path has no heap churn.
+ *
+ * The MQTT task only copies bytes: a complete slot is handed to the
+ * rx worker by index (ready queue) and decoded there in place, then
+ * returned (free queue). Decoding, logging and serverMutex never run
+ * in the task that also sends keepalives.
+ *
+ *   MQTT task:  free_q ──► slot ──► fragments ──► ready_q
+ *   rx worker:  ready_q ──► decode / dispatch in place ──► free_q
+ *
+ * Overload: if no slot is free when a new message starts, the
+ * message is shed (counted) instead of blocking the MQTT task.
+ *
+ * Only one message is being reassembled at a time (esp-mqtt delivers
+ * the fragments of a message back to back). Anything that does not
+ * fit that model is dropped and counted:
+ *   - oversize payload or topic  → remaining fragments are skipped
+ *   - offset/length mismatch     → message is discarded
+ *   - new message before the end → partial message is aborted
+ *
+ * @note mqtt_rx_arena_feed() / _reset() are called only from the MQTT
+ *       event task, _take() / _release() only from the rx worker.
+ */
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "mqtt_rx_arena.h"
+
+
+static const char *TAG = "MQTT_RX_ARENA";
+
+typedef enum {
+    ARENA_IDLE = 0,
+    ARENA_RECEIVING,
+    ARENA_DISCARDING
+} arena_state_t;
+
+typedef struct {
+    size_t len;
+    int64_t first_us;
+    char topic[MQTT_RX_TOPIC_SIZE];
+    char data[MAX_MQTT_PAYLOAD + 1];
+} RxSlot;
+
+static RxSlot slots[MQTT_RX_SLOTS];
+
+static QueueHandle_t free_q;        // Slot indexes ready to receive
+static QueueHandle_t ready_q;       // Complete messages for the worker
+
+// Reassembly state (MQTT task)
+static struct {
+    arena_state_t state;
+    int slot;                   // Slot being filled, -1 = none held
+    size_t total;               // Expected payload length
+    size_t received;            // Bytes copied (== next expected offset)
+    bool fragmented;
+} arena = { .slot = -1 };
+
+static RxArenaStats arena_stats;
+
+
+
+/**
+ * @brief Give the slot being filled back to the free list
+ */
+static void slot_drop(void)
+{
+    if (arena.slot >= 0) {
+        uint8_t idx = (uint8_t)arena.slot;
+        xQueueSend(free_q, &idx, 0);
+        arena.slot = -1;
+    }
+}
+
+
+/**
+ * @brief Skip the rest of the current message
+ *
+ * Remaining fragments are dropped until the one that ends at total.
+ */
+static rx_arena_result_t arena_discard(size_t end)
+{
+    slot_drop();
+    arena.state = (end >= arena.total) ? ARENA_IDLE : ARENA_DISCARDING;
+    return RX_ARENA_DROPPED;
+}
+
+
+/**
+ * @brief Create the slot queues (once, before the client starts)
+ */
+void mqtt_rx_arena_init(void)
+{
+    if (free_q != NULL) return;
+
+    free_q = xQueueCreate(MQTT_RX_SLOTS, sizeof(uint8_t));
+    ready_q = xQueueCreate(MQTT_RX_SLOTS, sizeof(uint8_t));
+    if (free_q == NULL || ready_q == NULL) {
+        ESP_LOGE(TAG, "Failed to create slot queues");
+        return;
+    }
+
+    for (uint8_t i = 0; i < MQTT_RX_SLOTS; i++) {
+        xQueueSend(free_q, &i, 0);
+    }
+}
+
+
+/**
+ * @brief Feed one MQTT_EVENT_DATA fragment
+ *
+ * @param topic      Topic (only present on the first fragment)
+ * @param topic_len  Topic length
+ * @param data       Fragment bytes
+ * @param data_len   Fragment length
+ * @param offset     Offset of this fragment in the message
+ * @param total_len  Total payload length
+ *
+ * @return RX_ARENA_COMPLETE once the last fragment is queued for the worker
+ */
+rx_arena_result_t mqtt_rx_arena_feed(const char *topic, int topic_len,
+                                     const char *data, int data_len,
+                                     int offset, int total_len)
+{
+    if (free_q == NULL) return RX_ARENA_DROPPED;
+
+    if (data_len < 0 || offset < 0 || total_len < 0) {
+        arena_stats.out_of_order++;
+        slot_drop();
+        arena.state = ARENA_IDLE;
+        return RX_ARENA_DROPPED;
+    }
+
+    size_t end = (size_t)offset + (size_t)data_len;
+
+    /*----------------- First fragment -----------------*/
+    if (offset == 0) {
+        if (arena.state == ARENA_RECEIVING) {
+            ESP_LOGW(TAG, "Partial message aborted (%u/%u bytes)",
+                     (unsigned)arena.received, (unsigned)arena.total);
+            arena_stats.aborted++;
+        }
+
+        arena.total = (size_t)total_len;
+        arena.received = 0;
+        arena.fragmented = false;
+
+        if (topic == NULL || topic_len <= 0 || topic_len >= MQTT_RX_TOPIC_SIZE) {
+            ESP_LOGE(TAG, "Topic too long");
+            arena_stats.rejected_topic++;
+            return arena_discard(end);
+        }
+
+        if (total_len > MAX_MQTT_PAYLOAD) {
+            ESP_LOGE(TAG, "Payload too large (%d bytes)", total_len);
+            arena_stats.rejected_size++;
+            return arena_discard(end);
+        }
+
+        // An aborted message leaves its slot to the new one
+        if (arena.slot < 0) {
+            uint8_t idx;
+            if (xQueueReceive(free_q, &idx, 0) != pdTRUE) {
+                arena_stats.shed++;
+                return arena_discard(end);
+            }
+            arena.slot = idx;
+        }
+
+        RxSlot *slot = &slots[arena.slot];
+        memcpy(slot->topic, topic, topic_len);
+        slot->topic[topic_len] = '\0';
+        slot->first_us = esp_timer_get_time();
+        arena.state = ARENA_RECEIVING;
+
+    /*----------------- Continuation -----------------*/
+    } else {
+        arena.fragmented = true;
+
+        if (arena.state == ARENA_DISCARDING) {
+            return arena_discard(end);
+        }
+
+        if (arena.state != ARENA_RECEIVING ||
+            (size_t)offset != arena.received ||
+            (size_t)total_len != arena.total) {
+            ESP_LOGW(TAG, "Unexpected fragment (offset %d, expected %u)",
+                     offset, (unsigned)arena.received);
+            arena_stats.out_of_order++;
+            if (arena.state == ARENA_RECEIVING) {
+                return arena_discard(end);
+            }
+            return RX_ARENA_DROPPED;
+        }
+    }
+
+    if (end > arena.total) {
+        ESP_LOGW(TAG, "Fragment overruns message (%u > %u)", (unsigned)end, (unsigned)arena.total);
+        arena_stats.out_of_order++;
+        slot_drop();
+        arena.state = ARENA_IDLE;
+        return RX_ARENA_DROPPED;
+    }
+
+    RxSlot *slot = &slots[arena.slot];
+
+    /*----------------- Store fragment -----------------*/
+    if (data_len > 0) {
+        memcpy(slot->data + offset, data, data_len);
+        arena.received = end;
+        arena_stats.fragments++;
+    }
+
+    if (arena.received < arena.total) {
+        return RX_ARENA_PENDING;
+    }
+
+    /*----------------- Message complete -----------------*/
+    slot->data[arena.total] = '\0';
+    slot->len = arena.total;
+    arena.state = ARENA_IDLE;
+
+    arena_stats.messages++;
+    if (arena.fragmented) {
+        arena_stats.fragmented++;
+    }
+    if (arena.total > arena_stats.max_len) {
+        arena_stats.max_len = arena.total;
+    }
+
+    uint32_t in_use = MQTT_RX_SLOTS - uxQueueMessagesWaiting(free_q);
+    if (in_use > arena_stats.high_water) {
+        arena_stats.high_water = in_use;
+    }
+
+    // Never blocks: ready_q has room for every slot
+    uint8_t idx = (uint8_t)arena.slot;
+    arena.slot = -1;
+    xQueueSend(ready_q, &idx, 0);
+
+    return RX_ARENA_COMPLETE;
+}
+
+
+/**
+ * @brief Wait for the next complete message (rx worker)
+ *
+ * @return false on timeout
+ */
+bool mqtt_rx_arena_take(RxMessage *msg, uint32_t timeout_ms)
+{
+    uint8_t idx;
+
+    if (ready_q == NULL ||
+        xQueueReceive(ready_q, &idx, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+        return false;
+    }
+
+    const RxSlot *slot = &slots[idx];
+    msg->topic = slot->topic;
+    msg->data = slot->data;
+    msg->len = slot->len;
+    msg->first_us = slot->first_us;
+    msg->slot = idx;
+    return true;
+}
+
+
+/**
+ * @brief Hand a message's slot back for reception (rx worker)
+ */
+void mqtt_rx_arena_release(const RxMessage *msg)
+{
+    uint8_t idx = msg->slot;
+    xQueueSend(free_q, &idx, 0);
+}
+
+
+/**
+ * @brief Drop any partial message (e.g. after a disconnect)
+ *
+ * Complete messages already queued are still handled.
+ */
+void mqtt_rx_arena_reset(void)
+{
+    if (arena.state == ARENA_RECEIVING) {
+        arena_stats.aborted++;
+    }
+    slot_drop();
+    arena.state = ARENA_IDLE;
+    arena.received = 0;
+    arena.total = 0;
+}
+
+
+/**
+ * @brief Copy reassembly and queue counters
+ */
+void mqtt_rx_arena_get_stats(RxArenaStats *stats)
+{
+    if (stats == NULL) return;
+    *stats = arena_stats;
+}
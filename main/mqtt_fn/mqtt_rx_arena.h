@@ -0,0 +1,54 @@
+#ifndef MQTT_RX_ARENA_H
+#define MQTT_RX_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+// Maximum allowed MQTT payload size (size of one arena slot)
+#define MAX_MQTT_PAYLOAD        4096
+#define MQTT_RX_TOPIC_SIZE      128
+
+// Messages that can be received or waiting for the worker at once
+#define MQTT_RX_SLOTS           CONFIG_MQTT_RX_SLOTS
+
+// Reassembly counters
+typedef struct {
+    uint32_t messages;          // Complete messages delivered
+    uint32_t fragmented;        // Delivered messages that arrived in >1 fragment
+    uint32_t fragments;         // Fragments copied into the arena
+    uint32_t rejected_size;     // Payload larger than MAX_MQTT_PAYLOAD
+    uint32_t rejected_topic;    // Topic missing or longer than MQTT_RX_TOPIC_SIZE
+    uint32_t out_of_order;      // Fragment offset/length did not match the message
+    uint32_t aborted;           // Message replaced before all fragments arrived
+    uint32_t max_len;           // Largest message delivered
+    uint32_t shed;              // New messages dropped: all slots busy
+    uint32_t high_water;        // Most slots in use (queued + in the worker)
+} RxArenaStats;
+
+// One complete message, valid until mqtt_rx_arena_release()
+typedef struct {
+    const char *topic;          // NUL-terminated
+    const char *data;           // NUL-terminated (binary payloads may contain NULs)
+    size_t len;
+    int64_t first_us;           // esp_timer time of the first fragment
+    uint8_t slot;
+} RxMessage;
+
+typedef enum {
+    RX_ARENA_PENDING = 0,       // Fragment stored, more to come
+    RX_ARENA_COMPLETE,          // Message complete and queued for the worker
+    RX_ARENA_DROPPED            // Fragment rejected, discarded or shed
+} rx_arena_result_t;
+
+void mqtt_rx_arena_init(void);
+rx_arena_result_t mqtt_rx_arena_feed(const char *topic, int topic_len,
+                                     const char *data, int data_len,
+                                     int offset, int total_len);
+bool mqtt_rx_arena_take(RxMessage *msg, uint32_t timeout_ms);
+void mqtt_rx_arena_release(const RxMessage *msg);
+void mqtt_rx_arena_reset(void);
+void mqtt_rx_arena_get_stats(RxArenaStats *stats);
+
+#endif // MQTT_RX_ARENA_H
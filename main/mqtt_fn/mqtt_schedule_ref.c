@@ -0,0 +1,323 @@
+/**
+ * @file mqtt_schedule_ref.c
+ * @brief Schedule programs assigned by content hash
+ *
+ * Most valves of a fleet run one of a few irrigation programs, so
+ * the backend can assign a program by its hash instead of sending
+ * the full list to every device:
+ *
+ *   control_data:  "set_scheduledata": { "set_schedule": true,
+ *                                        "schedule_hash": "<sha-256 hex>" }
+ *
+ * A device that holds the program in its NVS cache
+ * (eeprom_fn/schedule_cache.c) applies it right away. Otherwise it
+ * subscribes to the retained body of the program
+ *
+ *   vortex_device/wifi_valve/schedule/<hash>[/cbor]
+ *   { "event": "schedule_body", "set_scheduledata": { "schedule_info": [...] } }
+ *
+ * checks that the body hashes to <hash>, caches and applies it and
+ * unsubscribes again. A fleet rollout is therefore one group publish
+ * plus one retained body per program, not one full list per device.
+ *
+ * Full lists (with or without a hash) are cached as well, and the
+ * latest assignment always wins over a fetch still in progress.
+ *
+ * Assignments and bodies are handled in the rx worker; the pending
+ * fetch is also read by the MQTT task (resubscribe on connect) under
+ * pending_mutex, which is never held across an esp-mqtt call.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "device_shadow.h"
+#include "eeprom_fn/schedule_cache.h"
+#include "mqtt_schedule_ref.h"
+
+
+/* ======================================================================== */
+/* ============================ CONFIGURATION ============================= */
+/* ======================================================================== */
+
+#define SCHEDULE_TOPIC_SIZE     (sizeof(MQTT_SCHEDULE_TOPIC) + SCHEDULE_HASH_HEX_SIZE)
+
+_Static_assert(SCHEDULE_CACHE_ENTRIES == CMD_MAX_SCHEDULES, "schedule program sizes differ");
+_Static_assert(CMD_SCHEDULE_HASH_SIZE == SCHEDULE_HASH_HEX_SIZE, "schedule hash sizes differ");
+
+static const char *TAG = "MQTT_SCHEDULE_REF";
+
+static schedule_subscribe_fn subscribe_fn;
+static MqttScheduleStats ref_stats;
+
+// Program being fetched (at most one: the latest assignment)
+static SemaphoreHandle_t pending_mutex;
+static bool pending;
+static bool pending_set;
+static uint8_t pending_hash[SCHEDULE_HASH_SIZE];
+
+
+
+/* ======================================================================== */
+/* ============================ INTERNAL HELPERS ========================== */
+/* ======================================================================== */
+
+static void body_topic(const uint8_t hash[SCHEDULE_HASH_SIZE], char *topic, size_t size)
+{
+    char hex[SCHEDULE_HASH_HEX_SIZE];
+
+    schedule_hash_to_hex(hash, hex);
+    snprintf(topic, size, MQTT_SCHEDULE_TOPIC "%s", hex);
+}
+
+
+/**
+ * @brief Replace the pending fetch (hash NULL = none) and move the subscription
+ */
+static void fetch_replace(const uint8_t *hash, bool set_schedule)
+{
+    bool had;
+    uint8_t old_hash[SCHEDULE_HASH_SIZE];
+
+    xSemaphoreTake(pending_mutex, portMAX_DELAY);
+    had = pending;
+    memcpy(old_hash, pending_hash, sizeof(old_hash));
+
+    pending = (hash != NULL);
+    pending_set = set_schedule;
+    if (hash != NULL) {
+        memcpy(pending_hash, hash, SCHEDULE_HASH_SIZE);
+    }
+    xSemaphoreGive(pending_mutex);
+
+    bool same = had && hash != NULL && memcmp(old_hash, hash, SCHEDULE_HASH_SIZE) == 0;
+    if (same) return;
+
+    char topic[SCHEDULE_TOPIC_SIZE];
+
+    if (had) {
+        body_topic(old_hash, topic, sizeof(topic));
+        subscribe_fn(topic, false);
+    }
+    if (hash != NULL) {
+        body_topic(hash, topic, sizeof(topic));
+        subscribe_fn(topic, true);
+        ESP_LOGI(TAG, "Fetching %s", topic);
+    }
+}
+
+
+static void schedule_apply(const ScheduleInfo *info, size_t count, bool set_schedule)
+{
+    static ShadowPatch patch;       // Rx worker only; too large for its stack
+
+    memset(&patch, 0, sizeof(patch));
+    patch.fields = SHADOW_F_SCHEDULE;
+    patch.set_schedule = set_schedule;
+    patch.schedule_count = count;
+    memcpy(patch.schedule_info, info, count * sizeof(ScheduleInfo));
+
+    shadow_apply(&patch, NULL, NULL);
+}
+
+
+
+/* ======================================================================== */
+/* ============================== PUBLIC API ============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Index the NVS cache (once, before the client starts)
+ *
+ * @param subscribe  Subscribes / unsubscribes a body topic; a no-op
+ *                   while disconnected (mqtt_schedule_ref_subscribe()
+ *                   runs again on the next connect)
+ */
+void mqtt_schedule_ref_init(schedule_subscribe_fn subscribe)
+{
+    if (subscribe_fn != NULL) return;
+
+    pending_mutex = xSemaphoreCreateMutex();
+    schedule_cache_init();
+    subscribe_fn = subscribe;
+}
+
+
+/**
+ * @brief Subscribe the body of a pending fetch (MQTT_EVENT_CONNECTED)
+ */
+void mqtt_schedule_ref_subscribe(void)
+{
+    if (subscribe_fn == NULL) return;
+
+    uint8_t hash[SCHEDULE_HASH_SIZE];
+
+    xSemaphoreTake(pending_mutex, portMAX_DELAY);
+    bool waiting = pending;
+    memcpy(hash, pending_hash, sizeof(hash));
+    xSemaphoreGive(pending_mutex);
+
+    if (!waiting) return;
+
+    char topic[SCHEDULE_TOPIC_SIZE];
+    body_topic(hash, topic, sizeof(topic));
+    subscribe_fn(topic, true);
+    ESP_LOGI(TAG, "  %s", topic);
+}
+
+
+/**
+ * @brief Apply the program named by "schedule_hash"
+ *
+ * From the cache if possible, else the body is fetched. A list sent
+ * along with the hash must match it and is used as the body.
+ *
+ * @return ESP_ERR_INVALID_ARG for a malformed hash, ESP_ERR_INVALID_CRC
+ *         if the list does not match it, else ESP_OK
+ */
+esp_err_t mqtt_schedule_ref_assign(const ValveCommand *cmd)
+{
+    static ScheduleInfo program[SCHEDULE_CACHE_ENTRIES];     // Rx worker only
+
+    if (!cmd->has_schedule_hash || subscribe_fn == NULL) return ESP_ERR_INVALID_STATE;
+
+    bool set_schedule = cmd->has_set_schedule && cmd->set_schedule;
+    uint8_t hash[SCHEDULE_HASH_SIZE];
+
+    if (!schedule_hash_from_hex(cmd->schedule_hash, hash)) {
+        ESP_LOGW(TAG, "Invalid schedule_hash \"%s\"", cmd->schedule_hash);
+        ref_stats.rejected++;
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Body sent along (first rollout of a program)
+    if (cmd->has_schedule_info) {
+        uint8_t actual[SCHEDULE_HASH_SIZE];
+
+        schedule_cache_hash(cmd->schedule_info, cmd->schedule_count, actual);
+        if (memcmp(actual, hash, SCHEDULE_HASH_SIZE) != 0) {
+            ESP_LOGW(TAG, "schedule_info does not match schedule_hash");
+            ref_stats.rejected++;
+            return ESP_ERR_INVALID_CRC;
+        }
+
+        schedule_cache_put(cmd->schedule_info, cmd->schedule_count, actual);
+        fetch_replace(NULL, false);
+        schedule_apply(cmd->schedule_info, cmd->schedule_count, set_schedule);
+        return ESP_OK;
+    }
+
+    size_t count = 0;
+    if (schedule_cache_get(hash, program, &count) == ESP_OK) {
+        ESP_LOGI(TAG, "Program %.12s... applied from cache", cmd->schedule_hash);
+        ref_stats.hits++;
+
+        fetch_replace(NULL, false);
+        schedule_apply(program, count, set_schedule);
+        return ESP_OK;
+    }
+
+    ref_stats.misses++;
+    fetch_replace(hash, set_schedule);
+    return ESP_OK;
+}
+
+
+/**
+ * @brief Cache a full schedule_info list sent without a hash
+ *
+ * The list itself is applied by the caller; a fetch still in
+ * progress is dropped because this assignment is newer.
+ */
+void mqtt_schedule_ref_store(const ValveCommand *cmd)
+{
+    if (!cmd->has_schedule_info || subscribe_fn == NULL) return;
+
+    uint8_t hash[SCHEDULE_HASH_SIZE];
+
+    schedule_cache_put(cmd->schedule_info, cmd->schedule_count, hash);
+    fetch_replace(NULL, false);
+}
+
+
+/**
+ * @brief Check whether a topic is a schedule body topic
+ *
+ * @param len  Topic length without the "/cbor" suffix
+ */
+bool mqtt_schedule_ref_is_body_topic(const char *topic, size_t len)
+{
+    const size_t prefix_len = sizeof(MQTT_SCHEDULE_TOPIC) - 1;
+
+    return len > prefix_len && strncmp(topic, MQTT_SCHEDULE_TOPIC, prefix_len) == 0;
+}
+
+
+/**
+ * @brief Handle a message on a schedule body topic
+ *
+ * Only a "schedule_body" event that is the body of the pending fetch
+ * is used; anything else (another event, an old retained body, a body
+ * that does not hash to its topic) is counted as rejected and the
+ * fetch keeps waiting.
+ */
+void mqtt_schedule_ref_body(const ValveCommand *cmd)
+{
+    if (subscribe_fn == NULL) return;
+
+    if (strcmp(cmd->event, "schedule_body") != 0) {
+        ESP_LOGW(TAG, "Event \"%s\" on a schedule topic dropped", cmd->event);
+        ref_stats.rejected++;
+        return;
+    }
+
+    if (!cmd->has_schedule_info) {
+        ESP_LOGW(TAG, "schedule_body without schedule_info");
+        ref_stats.rejected++;
+        return;
+    }
+
+    uint8_t hash[SCHEDULE_HASH_SIZE];
+    bool set_schedule;
+
+    xSemaphoreTake(pending_mutex, portMAX_DELAY);
+    bool waiting = pending;
+    memcpy(hash, pending_hash, sizeof(hash));
+    set_schedule = pending_set;
+    xSemaphoreGive(pending_mutex);
+
+    if (!waiting) {
+        ESP_LOGD(TAG, "No fetch pending, body ignored");
+        return;
+    }
+
+    uint8_t actual[SCHEDULE_HASH_SIZE];
+    schedule_cache_hash(cmd->schedule_info, cmd->schedule_count, actual);
+    if (memcmp(actual, hash, SCHEDULE_HASH_SIZE) != 0) {
+        ESP_LOGW(TAG, "Body does not match the pending hash");
+        ref_stats.rejected++;
+        return;
+    }
+
+    schedule_cache_put(cmd->schedule_info, cmd->schedule_count, actual);
+    ref_stats.fetched++;
+    ESP_LOGI(TAG, "Program fetched (%u entries)", (unsigned)cmd->schedule_count);
+
+    fetch_replace(NULL, false);
+    schedule_apply(cmd->schedule_info, cmd->schedule_count, set_schedule);
+}
+
+
+/**
+ * @brief Copy cache counters
+ */
+void mqtt_schedule_ref_get_stats(MqttScheduleStats *stats)
+{
+    if (stats == NULL) return;
+
+    *stats = ref_stats;
+    stats->count = (uint8_t)schedule_cache_count();
+}
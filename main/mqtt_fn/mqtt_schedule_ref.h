@@ -0,0 +1,38 @@
+#ifndef MQTT_SCHEDULE_REF_H
+#define MQTT_SCHEDULE_REF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#include "codec_fn/command_decoder.h"
+#include "mqtt_topics.h"
+
+// vortex_device/wifi_valve/schedule/<hash> (retained program bodies)
+#define MQTT_SCHEDULE_TOPIC     MQTT_ROOT_TOPIC "schedule/"
+
+// Schedule cache counters
+typedef struct {
+    uint8_t count;              // Programs in the NVS cache
+    uint32_t hits;              // Hash assignments applied from the cache
+    uint32_t misses;            // Hash assignments that needed the body
+    uint32_t fetched;           // Bodies received and verified
+    uint32_t rejected;          // Bad hashes, bodies that did not match, other
+                                // events on a body topic
+} MqttScheduleStats;
+
+// Subscribes (or unsubscribes) one body topic and its CBOR variant
+typedef void (*schedule_subscribe_fn)(const char *topic, bool subscribe);
+
+void mqtt_schedule_ref_init(schedule_subscribe_fn subscribe);
+void mqtt_schedule_ref_subscribe(void);
+
+esp_err_t mqtt_schedule_ref_assign(const ValveCommand *cmd);
+void mqtt_schedule_ref_store(const ValveCommand *cmd);
+bool mqtt_schedule_ref_is_body_topic(const char *topic, size_t len);
+void mqtt_schedule_ref_body(const ValveCommand *cmd);
+
+void mqtt_schedule_ref_get_stats(MqttScheduleStats *stats);
+
+#endif // MQTT_SCHEDULE_REF_H
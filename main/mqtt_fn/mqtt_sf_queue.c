@@ -0,0 +1,373 @@
+/**
+ * @file mqtt_sf_queue.c
+ * @brief Store-and-forward queue for outbound MQTT messages
+ *
+ * Messages built while the broker is unreachable are kept in a
+ * fixed RAM byte ring instead of being dropped. On reconnect the
+ * publish task drains them in order at CONFIG_MQTT_SF_DRAIN_RATE,
+ * so the backend gets the full history without a burst.
+ *
+ * When the ring is full the oldest message is either spilled to
+ * NVS (CONFIG_MQTT_SF_FLASH_SPILL) or dropped. Flash holds the
+ * oldest part of the backlog and is drained first; when it is full
+ * too, its oldest entry is dropped. Flash entries survive a reboot.
+ *
+ * Entry layout (RAM ring and NVS blob):
+ *   [len:2][topic_len:1][topic][payload]
+ *
+ * @note Push and drain are only called from the MQTT publish task.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include "esp_log.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#include "mqtt_sf_queue.h"
+
+
+/* ======================================================================== */
+/* ============================ CONFIGURATION ============================= */
+/* ======================================================================== */
+
+#define SF_RAM_BYTES        CONFIG_MQTT_SF_RAM_BYTES
+#define SF_HDR_SIZE         3
+#define SF_MAX_ENTRY        (SF_HDR_SIZE + MQTT_SF_TOPIC_SIZE + MQTT_SF_MAX_PAYLOAD)
+
+#if CONFIG_MQTT_SF_FLASH_SPILL
+#define SF_NVS_NAMESPACE    "mqtt_sf"
+#define SF_FLASH_MAX        CONFIG_MQTT_SF_FLASH_MAX_ENTRIES
+#endif
+
+static const char *TAG = "MQTT_SF_QUEUE";
+
+// RAM byte ring
+static uint8_t sf_ring[SF_RAM_BYTES];
+static size_t sf_head;          // Offset of the oldest entry
+static size_t sf_used;          // Bytes in use
+
+// Scratch entry for spill / drain
+static uint8_t sf_entry[SF_MAX_ENTRY];
+
+static SfQueueStats sf_stats;
+static bool sf_initialized = false;
+
+#if CONFIG_MQTT_SF_FLASH_SPILL
+static nvs_handle_t sf_nvs;
+static bool sf_nvs_ok = false;
+static uint32_t sf_flash_head;  // Sequence number of the oldest flash entry
+static uint32_t sf_flash_tail;  // Sequence number of the next flash entry
+#endif
+
+
+
+/* ======================================================================== */
+/* =============================== RAM RING =============================== */
+/* ======================================================================== */
+
+static void ring_write(size_t pos, const void *src, size_t n)
+{
+    size_t first = SF_RAM_BYTES - pos;
+    if (first > n) first = n;
+
+    memcpy(&sf_ring[pos], src, first);
+    memcpy(&sf_ring[0], (const uint8_t *)src + first, n - first);
+}
+
+static void ring_read(size_t pos, void *dst, size_t n)
+{
+    size_t first = SF_RAM_BYTES - pos;
+    if (first > n) first = n;
+
+    memcpy(dst, &sf_ring[pos], first);
+    memcpy((uint8_t *)dst + first, &sf_ring[0], n - first);
+}
+
+/**
+ * @brief Copy the oldest RAM entry into sf_entry
+ *
+ * @return Entry size in bytes, or 0 if the ring is empty
+ */
+static size_t ring_peek(void)
+{
+    if (sf_stats.ram_entries == 0) return 0;
+
+    uint8_t hdr[SF_HDR_SIZE];
+    ring_read(sf_head, hdr, SF_HDR_SIZE);
+
+    size_t size = SF_HDR_SIZE + hdr[2] + (hdr[0] | (hdr[1] << 8));
+    ring_read(sf_head, sf_entry, size);
+    return size;
+}
+
+static void ring_pop(size_t size)
+{
+    sf_head = (sf_head + size) % SF_RAM_BYTES;
+    sf_used -= size;
+    sf_stats.ram_entries--;
+}
+
+
+
+/* ======================================================================== */
+/* ============================= FLASH SPILL ============================== */
+/* ======================================================================== */
+
+#if CONFIG_MQTT_SF_FLASH_SPILL
+
+static void flash_key(char *key, size_t size, uint32_t seq)
+{
+    snprintf(key, size, "m%08lx", (unsigned long)seq);
+}
+
+static void flash_save_index(void)
+{
+    nvs_set_u32(sf_nvs, "head", sf_flash_head);
+    nvs_set_u32(sf_nvs, "tail", sf_flash_tail);
+    nvs_commit(sf_nvs);
+}
+
+static void flash_drop_oldest(void)
+{
+    char key[16];
+    flash_key(key, sizeof(key), sf_flash_head);
+    nvs_erase_key(sf_nvs, key);
+
+    sf_flash_head++;
+    sf_stats.flash_entries--;
+}
+
+/**
+ * @brief Append the entry in sf_entry to flash
+ */
+static bool flash_push(size_t size)
+{
+    if (sf_stats.flash_entries >= SF_FLASH_MAX) {
+        flash_drop_oldest();
+        sf_stats.dropped++;
+    }
+
+    char key[16];
+    flash_key(key, sizeof(key), sf_flash_tail);
+
+    if (nvs_set_blob(sf_nvs, key, sf_entry, size) != ESP_OK) {
+        ESP_LOGE(TAG, "Flash spill failed");
+        flash_save_index();
+        return false;
+    }
+
+    sf_flash_tail++;
+    sf_stats.flash_entries++;
+    flash_save_index();
+    return true;
+}
+
+/**
+ * @brief Load the oldest flash entry into sf_entry
+ *
+ * @return Entry size in bytes, or 0 if flash is empty
+ */
+static size_t flash_peek(void)
+{
+    while (sf_stats.flash_entries > 0) {
+        char key[16];
+        size_t size = sizeof(sf_entry);
+        flash_key(key, sizeof(key), sf_flash_head);
+
+        if (nvs_get_blob(sf_nvs, key, sf_entry, &size) == ESP_OK && size >= SF_HDR_SIZE) {
+            return size;
+        }
+
+        // Missing or corrupt entry: skip it
+        ESP_LOGW(TAG, "Skipping unreadable flash entry %s", key);
+        flash_drop_oldest();
+        flash_save_index();
+    }
+    return 0;
+}
+
+static void flash_pop(void)
+{
+    flash_drop_oldest();
+    flash_save_index();
+}
+
+#endif // CONFIG_MQTT_SF_FLASH_SPILL
+
+
+
+/* ======================================================================== */
+/* ============================== PUBLIC API ============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Initialize the queue (restores the flash backlog)
+ *
+ * Safe to call more than once. NVS must already be initialized.
+ */
+void mqtt_sf_init(void)
+{
+    if (sf_initialized) return;
+    sf_initialized = true;
+
+#if CONFIG_MQTT_SF_FLASH_SPILL
+    if (nvs_open(SF_NVS_NAMESPACE, NVS_READWRITE, &sf_nvs) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS, flash spill disabled");
+        return;
+    }
+    sf_nvs_ok = true;
+
+    if (nvs_get_u32(sf_nvs, "head", &sf_flash_head) != ESP_OK ||
+        nvs_get_u32(sf_nvs, "tail", &sf_flash_tail) != ESP_OK ||
+        sf_flash_tail - sf_flash_head > SF_FLASH_MAX) {
+        sf_flash_head = 0;
+        sf_flash_tail = 0;
+    }
+
+    sf_stats.flash_entries = sf_flash_tail - sf_flash_head;
+    sf_stats.max_depth = sf_stats.flash_entries;
+
+    if (sf_stats.flash_entries > 0) {
+        ESP_LOGI(TAG, "Restored %lu queued messages from flash",
+                 (unsigned long)sf_stats.flash_entries);
+    }
+#endif
+}
+
+
+/**
+ * @brief Queue a message for later delivery
+ *
+ * Evicts the oldest entries (spill or drop) until the new one fits.
+ *
+ * @return false if the message is too large to queue
+ */
+bool mqtt_sf_push(const char *sub_topic, const char *data, size_t len)
+{
+    size_t topic_len = strlen(sub_topic);
+
+    if (len > MQTT_SF_MAX_PAYLOAD || topic_len >= MQTT_SF_TOPIC_SIZE) {
+        ESP_LOGE(TAG, "Message too large to queue (%u bytes)", (unsigned)len);
+        sf_stats.dropped++;
+        return false;
+    }
+
+    size_t size = SF_HDR_SIZE + topic_len + len;
+    if (size > SF_RAM_BYTES) {
+        sf_stats.dropped++;
+        return false;
+    }
+
+    /*----------------- Make room (oldest first) -----------------*/
+    while (SF_RAM_BYTES - sf_used < size) {
+        size_t old = ring_peek();
+
+#if CONFIG_MQTT_SF_FLASH_SPILL
+        if (sf_nvs_ok && flash_push(old)) {
+            sf_stats.spilled++;
+        } else {
+            sf_stats.dropped++;
+        }
+#else
+        sf_stats.dropped++;
+#endif
+        ring_pop(old);
+    }
+
+    /*----------------- Append -----------------*/
+    uint8_t hdr[SF_HDR_SIZE] = { (uint8_t)(len & 0xFF), (uint8_t)(len >> 8), (uint8_t)topic_len };
+    size_t tail = (sf_head + sf_used) % SF_RAM_BYTES;
+
+    ring_write(tail, hdr, SF_HDR_SIZE);
+    ring_write((tail + SF_HDR_SIZE) % SF_RAM_BYTES, sub_topic, topic_len);
+    ring_write((tail + SF_HDR_SIZE + topic_len) % SF_RAM_BYTES, data, len);
+
+    sf_used += size;
+    sf_stats.ram_entries++;
+    sf_stats.queued++;
+
+    uint32_t depth = sf_stats.ram_entries + sf_stats.flash_entries;
+    if (depth > sf_stats.max_depth) {
+        sf_stats.max_depth = depth;
+    }
+
+    return true;
+}
+
+
+bool mqtt_sf_is_empty(void)
+{
+    return sf_stats.ram_entries == 0 && sf_stats.flash_entries == 0;
+}
+
+
+/**
+ * @brief Send up to budget queued messages, oldest first
+ *
+ * An entry is removed only after send() accepted it, so a failed
+ * send leaves the backlog intact for the next attempt.
+ *
+ * @return Number of messages sent
+ */
+int mqtt_sf_drain(int budget, sf_send_fn send)
+{
+    // Topic + NUL for send()
+    char topic[MQTT_SF_TOPIC_SIZE];
+    int sent = 0;
+
+    while (sent < budget) {
+        size_t size = 0;
+        bool from_flash = false;
+
+#if CONFIG_MQTT_SF_FLASH_SPILL
+        size = flash_peek();
+        from_flash = (size > 0);
+#endif
+        if (size == 0) {
+            size = ring_peek();
+        }
+        if (size == 0) {
+            break;
+        }
+
+        size_t len = sf_entry[0] | (sf_entry[1] << 8);
+        size_t topic_len = sf_entry[2];
+        memcpy(topic, &sf_entry[SF_HDR_SIZE], topic_len);
+        topic[topic_len] = '\0';
+
+        if (!send(topic, (const char *)&sf_entry[SF_HDR_SIZE + topic_len], len)) {
+            break;
+        }
+
+#if CONFIG_MQTT_SF_FLASH_SPILL
+        if (from_flash) {
+            flash_pop();
+        } else
+#endif
+        {
+            ring_pop(size);
+        }
+        (void)from_flash;
+
+        sf_stats.sent++;
+        sent++;
+    }
+
+    if (sent > 0 && mqtt_sf_is_empty()) {
+        ESP_LOGI(TAG, "Backlog drained (%lu sent, %lu dropped)",
+                 (unsigned long)sf_stats.sent, (unsigned long)sf_stats.dropped);
+    }
+
+    return sent;
+}
+
+
+/**
+ * @brief Copy store-and-forward counters
+ */
+void mqtt_sf_get_stats(SfQueueStats *stats)
+{
+    if (stats == NULL) return;
+    *stats = sf_stats;
+}
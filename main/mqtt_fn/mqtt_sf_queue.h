@@ -0,0 +1,32 @@
+#ifndef MQTT_SF_QUEUE_H
+#define MQTT_SF_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest queued payload (matches the publish task TX buffer)
+#define MQTT_SF_MAX_PAYLOAD     1280
+#define MQTT_SF_TOPIC_SIZE      32
+
+// Store-and-forward counters
+typedef struct {
+    uint32_t queued;            // Messages accepted into the queue
+    uint32_t sent;              // Messages drained to the broker
+    uint32_t dropped;           // Oldest messages discarded (queue full)
+    uint32_t spilled;           // Messages moved from RAM to flash
+    uint32_t ram_entries;       // Current RAM depth
+    uint32_t flash_entries;     // Current flash depth
+    uint32_t max_depth;         // Highest total depth seen
+} SfQueueStats;
+
+// Sends one queued message; returns false to stop draining
+typedef bool (*sf_send_fn)(const char *sub_topic, const char *data, size_t len);
+
+void mqtt_sf_init(void);
+bool mqtt_sf_push(const char *sub_topic, const char *data, size_t len);
+bool mqtt_sf_is_empty(void);
+int  mqtt_sf_drain(int budget, sf_send_fn send);
+void mqtt_sf_get_stats(SfQueueStats *stats);
+
+#endif // MQTT_SF_QUEUE_H
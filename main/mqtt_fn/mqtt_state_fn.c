@@ -1,12 +1,33 @@
 #include <string.h>
+#include <stdio.h>
 #include <stdbool.h>
-#include "cJSON.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_app_desc.h"
+#include "freertos/task.h"
 #include "sdkconfig.h"
 
 #include "time_func.h"
 #include "global_var.h"
+#include "device_shadow.h"
+#include "error_history.h"
+#include "msg_stamp.h"
+#include "reconnect_policy.h"
+#include "codec_fn/json_writer.h"
+#include "codec_fn/command_decoder.h"
+#include "codec_fn/cmd_dispatch.h"
+#include "codec_fn/cmd_pipeline.h"
 #include "mqtt_state_fn.h"
+#include "mqtt_rx_arena.h"
+#include "mqtt_sf_queue.h"
+#include "mqtt_cmd_tracker.h"
+#include "mqtt_cadence.h"
+#include "mqtt_tls_session.h"
+#include "mqtt_topics.h"
+#include "mqtt_broker_select.h"
+#include "mqtt_groups.h"
+#include "mqtt_schedule_ref.h"
 
 
 /*---------------------------------------------------------------
@@ -18,6 +39,44 @@
 
 static const char *TAG = "MQTT_STATE";
 
+// Scope of the message being handled (rx worker only)
+static MqttCmdScope rx_scope;
+
+
+
+
+/*===============================================================
+ *              COMMAND TRACKING (cmd_id)
+ *==============================================================*/
+
+/**
+ * @brief Register cmd with the tracker before it is applied
+ *
+ * Commands without a cmd_id are not tracked and always run.
+ *
+ * @return false if cmd is a redelivery and must not run again
+ */
+static bool track_command(const ValveCommand *cmd, PayloadFormat format,
+                          bool motion, CmdReport *ack) {
+    if (!cmd->has_cmd_id) return true;
+
+    if (cmd_tracker_accept(cmd->cmd_id, format, motion, ack) == CMD_STATUS_DUPLICATE) {
+        mqtt_publish_cmd_ack(ack);
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Acknowledge a tracked command after it was applied
+ */
+static void ack_command(const ValveCommand *cmd, const CmdReport *ack) {
+    if (cmd->has_cmd_id) {
+        mqtt_publish_cmd_ack(ack);
+    }
+}
+
 
 
 
@@ -26,7 +85,7 @@ static const char *TAG = "MQTT_STATE";
  *==============================================================*/
 
 /**
- * @brief Handle incoming MQTT message from topic: cmd_data
+ * @brief Turn a cmd_data command into a shadow patch
  * 
  * Expected structure:
  * {
@@ -35,54 +94,52 @@ static const char *TAG = "MQTT_STATE";
  *   "set_controller": {...},
  *   "valve_data": {...}
  * }
+ *
+ * Blocks that are missing leave the current state unchanged.
  */
-void mqtt_handle_cmd_data(const char *data) {
-    cJSON *json_cmd_data = cJSON_Parse(data);
-    SetData localCopy;
-
-    if (json_cmd_data == NULL) {
-        ESP_LOGE(TAG, "Invalid JSON received");
-        return;
-    }
-
-    // Extract top-level fields
-    cJSON *event = cJSON_GetObjectItem(json_cmd_data, "event");
-    cJSON *device_id = cJSON_GetObjectItem(json_cmd_data, "device_id");
-    cJSON *ota_update = cJSON_GetObjectItem(json_cmd_data, "ota_update");
+static void cmd_data_patch(const ValveCommand *cmd, ShadowPatch *patch) {
+    memset(patch, 0, sizeof(*patch));
 
     /*----------------- Controller Settings -----------------*/
-    cJSON *set_controller = cJSON_GetObjectItem(json_cmd_data, "set_controller");
-    if (cJSON_IsObject(set_controller)) {
-        cJSON *schedule = cJSON_GetObjectItem(set_controller, "schedule");
-        cJSON *sensor = cJSON_GetObjectItem(set_controller, "sensor");
-
-        if (cJSON_IsBool(schedule) && cJSON_IsBool(sensor)) {
-            localCopy.schedule_control = cJSON_IsTrue(schedule);
-            localCopy.sensor_control = cJSON_IsTrue(sensor);
-        }
+    if (cmd->has_controller) {
+        patch->fields |= SHADOW_F_SCHEDULE_CONTROL | SHADOW_F_SENSOR_CONTROL;
+        patch->schedule_control = cmd->schedule_control;
+        patch->sensor_control = cmd->sensor_control;
     }
 
     /*----------------- Valve Angle Data -----------------*/
-    cJSON *valve_data = cJSON_GetObjectItem(json_cmd_data, "valve_data");
-    if (cJSON_IsObject(valve_data)) {
-        cJSON *name = cJSON_GetObjectItem(valve_data, "name");
-        cJSON *set_angle = cJSON_GetObjectItem(valve_data, "set_angle");
-        cJSON *angle = cJSON_GetObjectItem(valve_data, "angle");
-
-        if (cJSON_IsBool(set_angle) && cJSON_IsNumber(angle)) {
-            localCopy.set_angle = cJSON_IsTrue(set_angle);
-            localCopy.angle = angle->valueint;
-        }
-
+    if (cmd->has_set_angle && cmd->has_angle) {
+        patch->fields |= SHADOW_F_ANGLE;
+        patch->set_angle = cmd->set_angle;
+        patch->angle = cmd->angle;
     }
+}
 
-    /*----------------- Update Shared Data Safely -----------------*/
-    // Protect shared serverData using mutex
-    xSemaphoreTake(serverMutex, portMAX_DELAY);
-    serverData = localCopy;
-    xSemaphoreGive(serverMutex);
+/**
+ * @brief Route handler: cmd_data topic / set_valve_basic event
+ *
+ * @param arg  PayloadFormat of the message
+ */
+static void on_cmd_data(const ValveCommand *cmd, void *arg) {
+    PayloadFormat format = *(const PayloadFormat *)arg;
+    ShadowPatch patch;
+    CmdReport ack;
+
+    cmd_data_patch(cmd, &patch);
+    bool moves = shadow_patch_moves(&patch);
+    if (!track_command(cmd, format, moves, &ack)) return;
+
+    // Group / fleet motion: wait for this device's stagger offset
+    if (moves && rx_scope != MQTT_SCOPE_DEVICE && mqtt_groups_defer(&patch)) {
+        ack_command(cmd, &ack);
+        return;
+    }
+    if (moves) {
+        mqtt_groups_cancel_deferred();
+    }
 
-    cJSON_Delete(json_cmd_data);
+    shadow_apply(&patch, NULL, NULL);
+    ack_command(cmd, &ack);
 }
 
 
@@ -93,148 +150,631 @@ void mqtt_handle_cmd_data(const char *data) {
  *==============================================================*/
 
 /**
- * @brief Handle incoming MQTT message from topic: control_data
+ * @brief Turn a control_data command into a shadow patch
  *
  * Used for:
  *  - Controller enable/disable
  *  - Schedule configuration
  *  - Sensor threshold configuration
  */
-void mqtt_handle_control_data(const char *data) {
-    cJSON *json_control_data = cJSON_Parse(data);
-    SetControl localCopy;
+static void control_data_patch(const ValveCommand *cmd, ShadowPatch *patch) {
+    memset(patch, 0, sizeof(*patch));
 
-    if (json_control_data == NULL) {
-        ESP_LOGE(TAG, "Invalid JSON received");
-        return;
-    }
-
-    cJSON *event = cJSON_GetObjectItem(json_control_data, "event");
-    cJSON *device_id = cJSON_GetObjectItem(json_control_data, "device_id");
-    
     /*----------------- Controller Enable Settings -----------------*/
-    cJSON *set_controllerdata = cJSON_GetObjectItem(json_control_data, "set_controllerdata");
-    if (cJSON_IsObject(set_controllerdata)) {
-        
-        cJSON *schedule = cJSON_GetObjectItem(set_controllerdata, "schedule");
-        cJSON *sensor = cJSON_GetObjectItem(set_controllerdata, "sensor");
-
-        if (cJSON_IsBool(schedule) && cJSON_IsBool(sensor)) {
-            localCopy.schedule_control = cJSON_IsTrue(schedule);
-            localCopy.sensor_control = cJSON_IsTrue(sensor);
-        }
+    if (cmd->has_controller) {
+        patch->fields |= SHADOW_F_SCHEDULE_CONTROL | SHADOW_F_SENSOR_CONTROL;
+        patch->schedule_control = cmd->schedule_control;
+        patch->sensor_control = cmd->sensor_control;
     }
 
     /*----------------- Schedule Configuration -----------------*/
-    cJSON *set_scheduledata = cJSON_GetObjectItem(json_control_data, "set_scheduledata");
-    if (cJSON_IsObject(set_scheduledata)) {
-        
-        memset(localCopy.schedule_info, 0, sizeof(localCopy.schedule_info));
-        
-        cJSON *set_schedule = cJSON_GetObjectItem(set_scheduledata, "set_schedule");
-        if (cJSON_IsBool(set_schedule)) {
-            localCopy.set_schedule = cJSON_IsTrue(set_schedule);
-        }
-
-        cJSON *schedule_info = cJSON_GetObjectItem(set_scheduledata, "schedule_info");
-        if (cJSON_IsArray(schedule_info)) {
-            int schedule_count = cJSON_GetArraySize(schedule_info);
-            for (int i = 0; i < schedule_count && i < 10; i++) {
-
-                cJSON *schedule_item = cJSON_GetArrayItem(schedule_info, i);
-                if (cJSON_IsObject(schedule_item)) {
-
-                    cJSON *day = cJSON_GetObjectItem(schedule_item, "day");
-                    cJSON *open = cJSON_GetObjectItem(schedule_item, "open");
-                    cJSON *close = cJSON_GetObjectItem(schedule_item, "close");
-                    if (cJSON_IsString(day) && cJSON_IsString(open) && cJSON_IsString(close)) {
-                        snprintf(localCopy.schedule_info[i].day, sizeof(localCopy.schedule_info[i].day), "%s", day->valuestring);
-                        snprintf(localCopy.schedule_info[i].open, sizeof(localCopy.schedule_info[i].open), "%s", open->valuestring);
-                        snprintf(localCopy.schedule_info[i].close, sizeof(localCopy.schedule_info[i].close), "%s", close->valuestring);
-                    }
-                }
-            }
-        }
+    // A program by hash is applied by mqtt_schedule_ref.c (cache or fetch)
+    if (cmd->has_schedule && !cmd->has_schedule_hash) {
+        patch->fields |= SHADOW_F_SCHEDULE;
+        patch->set_schedule = cmd->has_set_schedule && cmd->set_schedule;
+        patch->schedule_count = cmd->schedule_count;
+        memcpy(patch->schedule_info, cmd->schedule_info, sizeof(patch->schedule_info));
     }
 
     /*----------------- Sensor Limits -----------------*/
-    cJSON *set_sensordata = cJSON_GetObjectItem(json_control_data, "set_sensordata");
-    if (cJSON_IsObject(set_sensordata)) {
-
-        cJSON *upper_limit = cJSON_GetObjectItem(set_sensordata, "upper_limit");
-        cJSON *lower_limit = cJSON_GetObjectItem(set_sensordata, "lower_limit");
-        if (cJSON_IsNumber(upper_limit) && cJSON_IsNumber(lower_limit)) {
-            localCopy.sensor_upper_limit = upper_limit->valueint;
-            localCopy.sensor_lower_limit = lower_limit->valueint;
+    if (cmd->has_sensor_limits) {
+        patch->fields |= SHADOW_F_SENSOR_LIMITS;
+        patch->sensor_upper_limit = cmd->sensor_upper_limit;
+        patch->sensor_lower_limit = cmd->sensor_lower_limit;
+    }
+}
+
+/**
+ * @brief Apply telemetry format (legacy / consolidated / both) and encoding (json / cbor)
+ */
+static void apply_telemetry_settings(const ValveCommand *cmd) {
+    switch (cmd->telemetry_format) {
+        case CMD_TELEMETRY_LEGACY:       mqtt_set_telemetry_mode(TELEMETRY_LEGACY); break;
+        case CMD_TELEMETRY_CONSOLIDATED: mqtt_set_telemetry_mode(TELEMETRY_CONSOLIDATED); break;
+        case CMD_TELEMETRY_BOTH:         mqtt_set_telemetry_mode(TELEMETRY_BOTH); break;
+        case CMD_TELEMETRY_UNKNOWN:      ESP_LOGW(TAG, "Unknown telemetry format"); break;
+        default: break;
+    }
+
+    if (cmd->has_encoding) {
+        mqtt_set_payload_format(cmd->encoding);
+    }
+}
+
+/**
+ * @brief Route handler: control_data topic / set_valve_control event
+ *
+ * @param arg  PayloadFormat of the message
+ */
+static void on_control_data(const ValveCommand *cmd, void *arg) {
+    PayloadFormat format = *(const PayloadFormat *)arg;
+    ShadowPatch patch;
+    CmdReport ack;
+
+    if (!track_command(cmd, format, false, &ack)) return;
+
+    control_data_patch(cmd, &patch);
+    if (patch.fields != 0) {
+        shadow_apply(&patch, NULL, NULL);
+    }
+    apply_telemetry_settings(cmd);
+
+    if (cmd->has_schedule_hash) {
+        mqtt_schedule_ref_assign(cmd);
+    } else if (cmd->has_schedule) {
+        mqtt_schedule_ref_store(cmd);
+    }
+
+    // Membership is only assigned per device
+    if (cmd->has_groups) {
+        if (rx_scope == MQTT_SCOPE_DEVICE) {
+            mqtt_groups_assign(cmd);
+        } else {
+            ESP_LOGW(TAG, "set_groups on a group topic ignored");
         }
     }
 
-    /*----------------- Update Shared Control Data -----------------*/
-    xSemaphoreTake(serverMutex, portMAX_DELAY);
-    serverControl = localCopy;
-    xSemaphoreGive(serverMutex);
+    ack_command(cmd, &ack);
+}
+
 
-    cJSON_Delete(json_control_data);
-    
+
+
+/*===============================================================
+ *              HANDLE SHADOW PATCH (shadow_update)
+ *==============================================================*/
+
+/**
+ * @brief Route handler: shadow_update topic / shadow_patch event
+ *
+ * Expected structure (every "desired" key optional):
+ * {
+ *   "event": "shadow_patch",
+ *   "version": 12,
+ *   "desired": { "angle": 90, "schedule": false, ... }
+ * }
+ *
+ * With "version" the patch is only applied if it matches the
+ * current desired version; the result is reported on
+ * shadow_reported.
+ *
+ * @param arg  PayloadFormat of the message
+ */
+static void on_shadow_update(const ValveCommand *cmd, void *arg) {
+    PayloadFormat format = *(const PayloadFormat *)arg;
+    CmdReport ack;
+
+    if (!cmd->has_desired) {
+        ESP_LOGW(TAG, "\"desired\" missing");
+        return;
+    }
+
+    bool moves = shadow_patch_moves(&cmd->desired);
+    if (!track_command(cmd, format, moves, &ack)) return;
+
+    if (moves) {
+        mqtt_groups_cancel_deferred();
+    }
+
+    uint32_t version;
+    shadow_apply(&cmd->desired, cmd->has_version ? &cmd->version : NULL, &version);
+    ESP_LOGI(TAG, "Shadow version %lu", (unsigned long)version);
+
+    ack_command(cmd, &ack);
 }
 
 
+
 /*===============================================================
- *                 GENERIC TOPIC ROUTER
+ *              HANDLE SCHEDULE BODY (schedule/<hash>)
  *==============================================================*/
 
 /**
- * @brief Routes MQTT messages based on "event" field
+ * @brief Route handler: schedule body topic
+ *
+ * Expected structure (retained on vortex_device/wifi_valve/schedule/<hash>):
+ * {
+ *   "event": "schedule_body",
+ *   "set_scheduledata": { "schedule_info": [...] }
+ * }
+ *
+ * The only handler for that topic. Used only if it is the body of
+ * the program being fetched; any other event there is dropped.
  */
-void mqtt_handle_topic(const char *data) {
-    cJSON *json_data = cJSON_Parse(data);
+static void on_schedule_body(const ValveCommand *cmd, void *arg) {
+    mqtt_schedule_ref_body(cmd);
+}
+
+
 
-    if (json_data == NULL) {
-        ESP_LOGE(TAG, "Invalid JSON received");
+/*===============================================================
+ *              HANDLE DIAGNOSTICS REQUEST (rpc_request)
+ *==============================================================*/
+
+/**
+ * @brief Route handler: rpc_request topic
+ *
+ * Expected structure:
+ * {
+ *   "method": "get_schedule",
+ *   "correlation_id": "4f1c..."
+ * }
+ *
+ * Read-only: answered once on rpc_response with the same
+ * correlation_id, nothing is changed or tracked. A redelivered
+ * request is simply answered again.
+ *
+ * @param arg  PayloadFormat of the message (used for the response)
+ */
+static void on_rpc_request(const ValveCommand *cmd, void *arg) {
+    PayloadFormat format = *(const PayloadFormat *)arg;
+
+    if (!cmd->has_correlation_id || cmd->method[0] == '\0') {
+        ESP_LOGW(TAG, "RPC request without method / correlation_id");
         return;
     }
 
-    cJSON *event = cJSON_GetObjectItem(json_data, "event");
-    if (cJSON_IsString(event)) {
-        ESP_LOGI(TAG, "Received event: %s", event->valuestring);
-    } else {
-        ESP_LOGW(TAG, "Event field missing or not a string");
+    mqtt_publish_rpc_response(cmd, format);
+}
+
+
+
+/*===============================================================
+ *                 DISPATCH TABLES
+ *==============================================================*/
+
+// Topic suffix → handler (vortex_device/wifi_valve/<DEVICE_ID>/<suffix>[/cbor],
+// cmd_data and control_data also on the group / fleet topics)
+static const CmdRoute topic_routes[] = {
+    { "cmd_data",       on_cmd_data },
+    { "control_data",   on_control_data },
+    { "shadow_update",  on_shadow_update },
+    { "rpc_request",    on_rpc_request },
+};
+
+// "event" → handler, for messages on any other topic
+static const CmdRoute event_routes[] = {
+    { "set_valve_basic",    on_cmd_data },
+    { "set_valve_control",  on_control_data },
+    { "shadow_patch",       on_shadow_update },
+};
+
+static CmdDispatchTable topic_table;
+static CmdDispatchTable event_table;
+
+
+
+/*===============================================================
+ *                 INBOUND PIPELINE
+ *==============================================================*/
+
+// Valid manual angle range (0° = closed, 90° = open)
+#define VALVE_ANGLE_MIN     0
+#define VALVE_ANGLE_MAX     90
+
+// Messages are handled only in the rx worker task, so one static
+// decode context is enough and inbound messages never touch the heap.
+static JsonToken rx_tokens[JSON_DECODER_MAX_TOKENS];
+static ValveCommand rx_cmd;
+
+
+/**
+ * @brief Semantic checks for MQTT commands
+ *
+ * Runs after decoding and before any handler, so a rejected
+ * command never reaches serverData / serverControl.
+ */
+static esp_err_t validate_mqtt_command(const ValveCommand *cmd) {
+    if (cmd->device_id[0] != '\0' && strcmp(cmd->device_id, DEVICE_ID) != 0) {
+        ESP_LOGW(TAG, "Command for device %s ignored", cmd->device_id);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (cmd->has_angle && (cmd->angle < VALVE_ANGLE_MIN || cmd->angle > VALVE_ANGLE_MAX)) {
+        ESP_LOGW(TAG, "Angle out of range: %d", cmd->angle);
+        return ESP_ERR_INVALID_ARG;
     }
 
-    if (strcmp(event->valuestring, "set_valve_control") == 0) {
-        mqtt_handle_control_data(data);
+    if (cmd->has_sensor_limits && cmd->sensor_lower_limit > cmd->sensor_upper_limit) {
+        ESP_LOGW(TAG, "Sensor limits inverted: %d > %d",
+                 cmd->sensor_lower_limit, cmd->sensor_upper_limit);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const ShadowPatch *desired = &cmd->desired;
+    if (cmd->has_desired) {
+        if ((desired->fields & SHADOW_F_ANGLE) &&
+            (desired->angle < VALVE_ANGLE_MIN || desired->angle > VALVE_ANGLE_MAX)) {
+            ESP_LOGW(TAG, "Desired angle out of range: %d", desired->angle);
+            return ESP_ERR_INVALID_ARG;
+        }
 
-    } else if (strcmp(event->valuestring, "set_valve_basic") == 0) {
-        mqtt_handle_cmd_data(data);
+        if ((desired->fields & SHADOW_F_SENSOR_LIMITS) &&
+            desired->sensor_lower_limit > desired->sensor_upper_limit) {
+            ESP_LOGW(TAG, "Desired sensor limits inverted");
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        // Stale patch: reject before cmd_id dedup and ack
+        if (cmd->has_version && cmd->version != shadow_get_version()) {
+            ESP_LOGW(TAG, "Shadow patch for version %lu is stale", (unsigned long)cmd->version);
+            shadow_note_conflict();
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    return ESP_OK;
+}
 
+static CmdPipeline rx_pipeline = {
+    .label      = "mqtt",
+    .tokens     = rx_tokens,
+    .max_tokens = JSON_DECODER_MAX_TOKENS,
+    .cmd        = &rx_cmd,
+    .validate   = validate_mqtt_command,
+    .events     = &event_table,
+};
+
+
+/**
+ * @brief Build the MQTT dispatch tables (call once before the first message)
+ */
+void mqtt_state_init(void) {
+    static bool initialized = false;
+    if (initialized) return;
+
+    cmd_dispatch_init(&topic_table, "mqtt topics", topic_routes,
+                      sizeof(topic_routes) / sizeof(topic_routes[0]));
+    cmd_dispatch_init(&event_table, "mqtt events", event_routes,
+                      sizeof(event_routes) / sizeof(event_routes[0]));
+    initialized = true;
+}
+
+
+/**
+ * @brief Run one inbound message through receive → decode → validate → dispatch
+ *
+ * The last topic segment selects the handler; unknown segments
+ * are routed by "event" inside the pipeline, except schedule bodies,
+ * which only reach on_schedule_body(). Messages on a group this
+ * device has just left are dropped.
+ *
+ * @param topic       Full topic
+ * @param topic_len   Topic length without the "/cbor" suffix
+ * @param data        Payload (used in place)
+ * @param len         Payload length
+ * @param format      PAYLOAD_JSON or PAYLOAD_CBOR (from the topic suffix)
+ * @param receive_us  Time from first fragment to complete message
+ */
+void mqtt_handle_message(const char *topic, size_t topic_len,
+                         const char *data, size_t len, PayloadFormat format,
+                         uint32_t receive_us) {
+    const char *suffix = topic;
+    for (size_t i = 0; i < topic_len; i++) {
+        if (topic[i] == '/') suffix = &topic[i + 1];
+    }
+
+    rx_scope = mqtt_groups_scope(topic, topic_len);
+    if (rx_scope == MQTT_SCOPE_NONE) {
+        ESP_LOGW(TAG, "Not a member, dropped: %.*s", (int)topic_len, topic);
+        return;
+    }
+
+    // Retained program bodies sit on a fleet-wide topic: never route
+    // them by "event", or any command there would reach every valve
+    cmd_handler_t handler;
+    if (mqtt_schedule_ref_is_body_topic(topic, topic_len)) {
+        handler = on_schedule_body;
     } else {
-        ESP_LOGW(TAG, "Unknown event type: %s", event->valuestring);
+        const CmdRoute *route = cmd_dispatch_find(&topic_table, suffix, topic_len - (size_t)(suffix - topic));
+        handler = (route != NULL) ? route->handler : NULL;
     }
 
-    cJSON_Delete(json_data);
+    CmdMessage msg = {
+        .data = data,
+        .len = len,
+        .format = format,
+        .receive_us = receive_us,
+    };
+
+    cmd_pipeline_run(&rx_pipeline, &msg, handler, &format);
+
+    // Shadow version or conflict count may have moved
+    mqtt_cadence_notify();
+}
+
+
+/**
+ * @brief Copy per-stage inbound counters and timing
+ */
+void mqtt_get_pipeline_stats(CmdPipelineStats *stats) {
+    cmd_pipeline_get_stats(&rx_pipeline, stats);
 }
 
 
 
 /*===============================================================
- *              CREATE JSON: VALVE STATUS
+ *              SHARED JSON BLOCKS
  *==============================================================*/
 
 /**
- * @brief Create JSON object for valve online status
+ * @brief Write event, timestamp and device_id header fields
  */
-cJSON* create_valve_status() {
-    cJSON *json = cJSON_CreateObject();
-
-    char timestamp[20];
+static void write_header(JsonWriter *w, const char *event)
+{
+    char timestamp[25];
     get_current_timestamp(timestamp, sizeof(timestamp));
 
-    cJSON_AddStringToObject(json, "event", "valve_status");
-    cJSON_AddStringToObject(json, "timestamp", timestamp);
-    cJSON_AddStringToObject(json, "device_id", DEVICE_ID);
-    cJSON_AddStringToObject(json, "status", "online");
+    jw_key_string(w, "event", event);
+    jw_key_string(w, "timestamp", timestamp);
+    jw_key_string(w, "device_id", DEVICE_ID);
+    msg_stamp_write(w, MSG_CHANNEL_MQTT);
+}
+
+
+/**
+ * @brief Write get_controller, get_valvedata and get_limitdata objects
+ */
+static void write_valve_state(JsonWriter *w, const GetData *data)
+{
+    jw_key_object_begin(w, "get_controller");
+    jw_key_bool(w, "schedule", data->schedule_control);
+    jw_key_bool(w, "sensor", data->sensor_control);
+    jw_object_end(w);
+
+    jw_key_object_begin(w, "get_valvedata");
+    jw_key_int(w, "angle", data->angle);
+    jw_key_bool(w, "is_open", data->is_open);
+    jw_key_bool(w, "is_close", data->is_close);
+    jw_key_bool(w, "is_moving", data->is_moving);
+    if (data->is_moving) {
+        jw_key_int(w, "motion_ms", (int)((esp_timer_get_time() - data->motion_start_us) / 1000));
+    }
+    jw_object_end(w);
+
+    jw_key_object_begin(w, "get_limitdata");
+    jw_key_bool(w, "is_open_limit", data->open_limit_available);
+    jw_key_bool(w, "open_limit", data->open_limit_click);
+    jw_key_bool(w, "is_close_limit", data->close_limit_available);
+    jw_key_bool(w, "close_limit", data->close_limit_click);
+    jw_object_end(w);
+}
+
+
+/**
+ * @brief Write publish-on-change, cadence and wire size counters
+ */
+static void write_publish_stats(JsonWriter *w)
+{
+    PublishStats stats;
+    CadenceStats cadence;
+    MqttWireStats wire;
+    mqtt_get_publish_stats(&stats);
+    mqtt_cadence_get_stats(&cadence);
+    mqtt_topic_get_wire_stats(&wire);
+
+    jw_key_object_begin(w, "publish_stats");
+    jw_key_int(w, "sent", stats.sent);
+    jw_key_int(w, "sent_on_change", stats.sent_on_change);
+    jw_key_int(w, "suppressed", stats.suppressed);
+    jw_key_int(w, "period_ms", cadence.period_ms);
+    jw_key_int(w, "deferred", cadence.budget_deferred);
+    jw_key_int(w, "rssi", cadence.rssi);
+    jw_key_int(w, "bytes_per_msg", wire.publishes ? (int)(wire.wire_bytes / wire.publishes) : 0);
+    jw_object_end(w);
+}
+
+
+/**
+ * @brief Write inbound reassembly counters
+ */
+static void write_rx_stats(JsonWriter *w)
+{
+    RxArenaStats stats;
+    mqtt_rx_arena_get_stats(&stats);
+
+    jw_key_object_begin(w, "rx_stats");
+    jw_key_int(w, "messages", stats.messages);
+    jw_key_int(w, "fragmented", stats.fragmented);
+    jw_key_int(w, "dropped", stats.rejected_size + stats.rejected_topic +
+                             stats.out_of_order + stats.aborted);
+    jw_key_int(w, "shed", stats.shed);
+    jw_key_int(w, "queue_hw", stats.high_water);
+    jw_object_end(w);
+}
+
+
+/**
+ * @brief Write TLS handshake and Wi-Fi → first publish timing
+ */
+static void write_tls_stats(JsonWriter *w)
+{
+    MqttTlsStats stats;
+    mqtt_tls_get_stats(&stats);
+
+    jw_key_object_begin(w, "tls");
+    jw_key_int(w, "handshake_ms", stats.last_handshake_ms);
+    jw_key_bool(w, "resumed", stats.last_resumed);
+    jw_key_int(w, "resumptions", stats.resumptions);
+    jw_key_int(w, "ready_ms", stats.ready_ms);
+    jw_object_end(w);
+}
+
+
+/**
+ * @brief Write outbox depth, enqueue latency and cap counters
+ */
+static void write_outbox_stats(JsonWriter *w)
+{
+    MqttOutboxStats stats;
+    mqtt_get_outbox_stats(&stats);
+
+    jw_key_object_begin(w, "outbox");
+    jw_key_int(w, "bytes", stats.bytes);
+    jw_key_int(w, "enq_us", stats.enqueue_last_us);
+    jw_key_int(w, "enq_max_us", stats.enqueue_max_us);
+    jw_key_int(w, "diverted", stats.diverted);
+    jw_object_end(w);
+}
+
+
+/**
+ * @brief Write reconnect backoff timing of one link
+ */
+static void write_reconnect_link(JsonWriter *w, const char *key, ReconnectLink link)
+{
+    ReconnectStats stats;
+    reconnect_policy_get_stats(link, &stats);
+
+    jw_key_object_begin(w, key);
+    jw_key_int(w, "attempts", stats.attempts);
+    jw_key_int(w, "max_streak", stats.max_streak);
+    jw_key_int(w, "delay_ms", stats.last_delay_ms);
+    jw_key_int(w, "outage_ms", stats.last_outage_ms);
+    jw_key_int(w, "hints", stats.hints);
+    jw_object_end(w);
+}
+
+
+/**
+ * @brief Write Wi-Fi and broker reconnect timing
+ */
+static void write_reconnect_stats(JsonWriter *w)
+{
+    jw_key_object_begin(w, "reconnect");
+    write_reconnect_link(w, "wifi", RECONNECT_WIFI);
+    write_reconnect_link(w, "mqtt", RECONNECT_MQTT);
+    jw_object_end(w);
+}
+
+
+/**
+ * @brief Write broker selection and failover timing
+ */
+static void write_broker_stats(JsonWriter *w)
+{
+    MqttBrokerStats stats;
+    mqtt_broker_get_stats(&stats);
+
+    jw_key_object_begin(w, "broker");
+    jw_key_int(w, "active", stats.active);
+    jw_key_int(w, "rtt_ms", stats.rtt_ms);
+    jw_key_int(w, "failovers", stats.failovers);
+    jw_key_int(w, "returns", stats.returns);
+    jw_key_int(w, "failover_ms", stats.last_failover_ms);
+    jw_object_end(w);
+}
+
+
+/**
+ * @brief Write group membership and fan-out counters
+ */
+static void write_group_stats(JsonWriter *w)
+{
+    MqttGroupStats stats;
+    mqtt_groups_get_stats(&stats);
+
+    jw_key_object_begin(w, "groups");
+    jw_key_int(w, "count", stats.count);
+    jw_key_int(w, "stagger_ms", stats.stagger_ms);
+    jw_key_int(w, "group_cmds", stats.received);
+    jw_key_int(w, "staggered", stats.staggered);
+    jw_object_end(w);
+}
+
+
+/**
+ * @brief Write schedule cache counters (programs by hash)
+ */
+static void write_schedule_cache_stats(JsonWriter *w)
+{
+    MqttScheduleStats stats;
+    mqtt_schedule_ref_get_stats(&stats);
+
+    jw_key_object_begin(w, "sched_cache");
+    jw_key_int(w, "count", stats.count);
+    jw_key_int(w, "hits", stats.hits);
+    jw_key_int(w, "misses", stats.misses);
+    jw_key_int(w, "fetched", stats.fetched);
+    jw_key_int(w, "rejected", stats.rejected);
+    jw_object_end(w);
+}
+
 
-    return json;
+/**
+ * @brief Write link flap counters (client pause / resume)
+ */
+static void write_link_stats(JsonWriter *w)
+{
+    MqttLinkStats stats;
+    mqtt_get_link_stats(&stats);
+
+    jw_key_object_begin(w, "link");
+    jw_key_int(w, "pauses", stats.pauses);
+    jw_key_int(w, "offline_ms", stats.last_offline_ms);
+    jw_object_end(w);
+}
+
+
+/**
+ * @brief Write store-and-forward backlog counters
+ */
+static void write_queue_stats(JsonWriter *w)
+{
+    SfQueueStats stats;
+    mqtt_sf_get_stats(&stats);
+
+    jw_key_object_begin(w, "queue");
+    jw_key_int(w, "depth", stats.ram_entries + stats.flash_entries);
+    jw_key_int(w, "sent", stats.sent);
+    jw_key_int(w, "dropped", stats.dropped);
+    jw_object_end(w);
+}
+
+
+
+/*===============================================================
+ *              CREATE JSON: VALVE STATUS
+ *==============================================================*/
+
+/**
+ * @brief Write JSON for valve online status into buf
+ *
+ * Published once per connection as a retained birth message.
+ * The matching "offline" payload is the MQTT Last Will.
+ *
+ * @return Payload length, or -1 if buf is too small
+ */
+int create_valve_status(char *buf, size_t size, PayloadFormat format) {
+    JsonWriter w;
+    jw_init_format(&w, buf, size, format);
+
+    jw_object_begin(&w);
+    write_header(&w, "valve_status");
+    jw_key_string(&w, "status", "online");
+    jw_object_end(&w);
+
+    return jw_finish(&w);
 }
 
 
@@ -244,12 +784,14 @@ cJSON* create_valve_status() {
  *==============================================================*/
 
 /**
- * @brief Create JSON object containing:
+ * @brief Write JSON containing:
  *        - controller state
  *        - valve state
  *        - limit switch data
+ *
+ * @return Payload length, or -1 if buf is too small
  */
-cJSON* create_valve_state_data() {
+int create_valve_state_data(char *buf, size_t size, PayloadFormat format) {
 
     // Lock data
     GetData localCopy;
@@ -257,59 +799,514 @@ cJSON* create_valve_state_data() {
     localCopy = valveData;
     xSemaphoreGive(valveMutex);
 
-    cJSON *json = cJSON_CreateObject();
+    JsonWriter w;
+    jw_init_format(&w, buf, size, format);
 
-    char timestamp[20];
-    get_current_timestamp(timestamp, sizeof(timestamp));
+    jw_object_begin(&w);
+    write_header(&w, "valve_basic_data");
+    write_valve_state(&w, &localCopy);
+    jw_object_end(&w);
+
+    return jw_finish(&w);
+}
+
+
+
+/*===============================================================
+ *              CREATE JSON: VALVE ERROR
+ *==============================================================*/
+
+/**
+ * @brief Write JSON for error reporting
+ *
+ * @return Payload length, or -1 if buf is too small
+ */
+int create_valve_error(char *buf, size_t size, PayloadFormat format) {
+    char error_msg[sizeof(valveData.error_msg)];
 
-    cJSON_AddStringToObject(json, "event", "valve_basic_data");
-    cJSON_AddStringToObject(json, "timestamp", timestamp);
-    cJSON_AddStringToObject(json, "device_id", DEVICE_ID);
+    xSemaphoreTake(valveMutex, portMAX_DELAY);
+    memcpy(error_msg, valveData.error_msg, sizeof(error_msg));
+    xSemaphoreGive(valveMutex);
+
+    JsonWriter w;
+    jw_init_format(&w, buf, size, format);
+
+    jw_object_begin(&w);
+    write_header(&w, "valve_error");
+    jw_key_string(&w, "error", error_msg);
+    jw_object_end(&w);
+
+    return jw_finish(&w);
+}
+
+
+
+/*===============================================================
+ *              CREATE JSON: CONSOLIDATED TELEMETRY
+ *==============================================================*/
+
+/**
+ * @brief Write one JSON object carrying header, state and error
+ *
+ * Replaces the legacy state_data and error messages with a single
+ * payload that shares timestamp and device_id. Presence is not
+ * repeated here; it lives in the retained status topic, and the
+ * diagnostics counters are answered by the get_stats RPC.
+ *
+ * @return Payload length, or -1 if buf is too small
+ */
+int create_valve_telemetry(char *buf, size_t size, PayloadFormat format) {
 
-    cJSON *controller_data = cJSON_CreateObject();
-    cJSON_AddBoolToObject(controller_data, "schedule", localCopy.schedule_control);
-    cJSON_AddBoolToObject(controller_data, "sensor", localCopy.sensor_control);
-    cJSON_AddItemToObject(json, "get_controller", controller_data);
+    // Lock data
+    GetData localCopy;
+    xSemaphoreTake(valveMutex, portMAX_DELAY);
+    localCopy = valveData;
+    xSemaphoreGive(valveMutex);
 
-    cJSON *valve_data = cJSON_CreateObject();
-    cJSON_AddNumberToObject(valve_data, "angle", localCopy.angle);
-    cJSON_AddBoolToObject(valve_data, "is_open", localCopy.is_open);
-    cJSON_AddBoolToObject(valve_data, "is_close", localCopy.is_close);
-    cJSON_AddItemToObject(json, "get_valvedata", valve_data);
+    JsonWriter w;
+    jw_init_format(&w, buf, size, format);
 
-    cJSON *limit_data = cJSON_CreateObject();
-    cJSON_AddBoolToObject(limit_data, "is_open_limit", localCopy.open_limit_available);
-    cJSON_AddBoolToObject(limit_data, "open_limit", localCopy.open_limit_click);
-    cJSON_AddBoolToObject(limit_data, "is_close_limit", localCopy.close_limit_available);
-    cJSON_AddBoolToObject(limit_data, "close_limit", localCopy.close_limit_click);
-    cJSON_AddItemToObject(json, "get_limitdata", limit_data);
+    jw_object_begin(&w);
+    write_header(&w, "valve_telemetry");
+    write_valve_state(&w, &localCopy);
+    jw_key_string(&w, "error", localCopy.error_msg);
+    jw_object_end(&w);
 
-    return json;
+    return jw_finish(&w);
 }
 
 
 
 /*===============================================================
- *              CREATE JSON: VALVE ERROR
+ *              CREATE JSON: COMMAND ACK / COMPLETION
  *==============================================================*/
 
+static const char *cmd_status_name(CmdStatus status)
+{
+    switch (status) {
+        case CMD_STATUS_ACCEPTED:   return "accepted";
+        case CMD_STATUS_DUPLICATE:  return "duplicate";
+        case CMD_STATUS_DONE:       return "done";
+        case CMD_STATUS_FAILED:     return "failed";
+        case CMD_STATUS_SUPERSEDED: return "superseded";
+        default:                    return "unknown";
+    }
+}
+
+
 /**
- * @brief Create JSON object for error reporting
+ * @brief Write an ack (accepted / duplicate) or completion report
+ *
+ * Completion reports carry the actuation timing:
+ *  - start_ms : receive → motor start
+ *  - run_ms   : motor start → complete
+ *  - total_ms : receive → complete
+ *
+ * @return Payload length, or -1 if buf is too small
  */
-cJSON* create_valve_error() {
-    cJSON *json = cJSON_CreateObject();
+int create_cmd_report(char *buf, size_t size, PayloadFormat format, const CmdReport *report) {
+    bool completed = report->done_us != 0;
 
-    char timestamp[20];
-    get_current_timestamp(timestamp, sizeof(timestamp));
+    JsonWriter w;
+    jw_init_format(&w, buf, size, format);
+
+    jw_object_begin(&w);
+    write_header(&w, completed ? "cmd_done" : "cmd_ack");
+    jw_key_string(&w, "cmd_id", report->cmd_id);
+    jw_key_string(&w, "status", cmd_status_name(report->status));
 
-    cJSON_AddStringToObject(json, "event", "valve_error");
-    cJSON_AddStringToObject(json, "timestamp", timestamp);
-    cJSON_AddStringToObject(json, "device_id", DEVICE_ID);
+    if (report->status == CMD_STATUS_FAILED) {
+        char error_msg[32];
+        snprintf(error_msg, sizeof(error_msg), "motor error %d", report->err_code);
+        jw_key_string(&w, "error", error_msg);
+    }
+
+    if (completed) {
+        jw_key_object_begin(&w, "timing");
+        jw_key_int(&w, "start_ms", (int)((report->start_us - report->rx_us) / 1000));
+        jw_key_int(&w, "run_ms", (int)((report->done_us - report->start_us) / 1000));
+        jw_key_int(&w, "total_ms", (int)((report->done_us - report->rx_us) / 1000));
+        jw_object_end(&w);
+    }
 
+    jw_object_end(&w);
+
+    return jw_finish(&w);
+}
+
+
+
+/*===============================================================
+ *              CREATE JSON: SHADOW REPORTED STATE
+ *==============================================================*/
+
+// Last reported snapshot (publish task only)
+static GetData reported_last;
+static bool reported_valid = false;
+static uint32_t reported_version;
+static uint32_t reported_conflicts;
+
+
+/**
+ * @brief Compare the fields carried in "reported"
+ */
+static bool reported_changed(const GetData *a, const GetData *b) {
+    return a->schedule_control  != b->schedule_control  ||
+           a->sensor_control    != b->sensor_control    ||
+           a->angle             != b->angle             ||
+           a->is_open           != b->is_open           ||
+           a->is_close          != b->is_close          ||
+           a->open_limit_click  != b->open_limit_click  ||
+           a->close_limit_click != b->close_limit_click ||
+           strcmp(a->error_msg, b->error_msg) != 0;
+}
+
+
+/**
+ * @brief Check whether the server needs a new shadow report
+ *
+ * Due when the desired version moved, a patch was rejected, or the
+ * reported valve state differs from the last report.
+ */
+bool mqtt_shadow_report_due(void) {
+    ShadowState shadow;
+    shadow_get(&shadow);
+
+    if (!reported_valid) return true;
+    if (shadow.version != reported_version || shadow.conflicts != reported_conflicts) return true;
+
+    GetData current;
     xSemaphoreTake(valveMutex, portMAX_DELAY);
-    cJSON_AddStringToObject(json, "error", valveData.error_msg);
+    current = valveData;
     xSemaphoreGive(valveMutex);
 
-    return json;
+    return reported_changed(&current, &reported_last);
+}
+
+
+/**
+ * @brief Forget the last report so the next one carries every field
+ */
+void mqtt_shadow_report_reset(void) {
+    reported_valid = false;
 }
 
+
+/**
+ * @brief Write the reported-state diff with the applied version
+ *
+ * Only fields that changed since the last report are included; the
+ * first report after boot or reconnect carries all of them.
+ * "status": "conflict" tells the server a patch was rejected and it
+ * should re-read the version before retrying.
+ *
+ * @return Payload length, or -1 if buf is too small
+ */
+int create_shadow_report(char *buf, size_t size, PayloadFormat format) {
+    ShadowState shadow;
+    shadow_get(&shadow);
+
+    GetData current;
+    xSemaphoreTake(valveMutex, portMAX_DELAY);
+    current = valveData;
+    xSemaphoreGive(valveMutex);
+
+    const GetData *last = &reported_last;
+    bool all = !reported_valid;
+
+    JsonWriter w;
+    jw_init_format(&w, buf, size, format);
+
+    jw_object_begin(&w);
+    write_header(&w, "shadow_reported");
+    jw_key_int(&w, "version", (int)shadow.version);
+    if (reported_valid && shadow.conflicts != reported_conflicts) {
+        jw_key_string(&w, "status", "conflict");
+    }
+
+    jw_key_object_begin(&w, "reported");
+    if (all || current.schedule_control != last->schedule_control) {
+        jw_key_bool(&w, "schedule", current.schedule_control);
+    }
+    if (all || current.sensor_control != last->sensor_control) {
+        jw_key_bool(&w, "sensor", current.sensor_control);
+    }
+    if (all || current.angle != last->angle) {
+        jw_key_int(&w, "angle", current.angle);
+    }
+    if (all || current.is_open != last->is_open) {
+        jw_key_bool(&w, "is_open", current.is_open);
+    }
+    if (all || current.is_close != last->is_close) {
+        jw_key_bool(&w, "is_close", current.is_close);
+    }
+    if (all || current.open_limit_click != last->open_limit_click) {
+        jw_key_bool(&w, "open_limit", current.open_limit_click);
+    }
+    if (all || current.close_limit_click != last->close_limit_click) {
+        jw_key_bool(&w, "close_limit", current.close_limit_click);
+    }
+    if (all || strcmp(current.error_msg, last->error_msg) != 0) {
+        jw_key_string(&w, "error", current.error_msg);
+    }
+    jw_object_end(&w);
+
+    jw_object_end(&w);
+
+    int len = jw_finish(&w);
+    if (len < 0) return len;
+
+    reported_last = current;
+    reported_version = shadow.version;
+    reported_conflicts = shadow.conflicts;
+    reported_valid = true;
+
+    return len;
+}
+
+
+
+/*===============================================================
+ *              CREATE JSON: RPC RESPONSE
+ *==============================================================*/
+
+// Tasks whose stack headroom get_tasks reports (created by this firmware
+// and esp-mqtt); tasks that are not running are skipped
+static const char *const rpc_task_names[] = {
+    "mqtt_task",
+    "mqtt_rx_worker",
+    "mqtt_publish_valve_data",
+    "mqtt_broker_probe",
+    "valve_sync_process",
+    "schedule_save_task",
+    "sensor_series_task",
+    "led_task",
+};
+
+/**
+ * @brief get_schedule: controller flags, schedule list and sensor limits in use
+ */
+static void rpc_get_schedule(JsonWriter *w)
+{
+    static SetControl control;      // Rx worker only; too large for its stack
+
+    xSemaphoreTake(serverMutex, portMAX_DELAY);
+    control = serverControl;
+    xSemaphoreGive(serverMutex);
+
+    jw_key_bool(w, "schedule", control.schedule_control);
+    jw_key_bool(w, "sensor", control.sensor_control);
+    jw_key_bool(w, "set_schedule", control.set_schedule);
+
+    jw_key_array_begin(w, "schedule_info");
+    for (size_t i = 0; i < sizeof(control.schedule_info) / sizeof(control.schedule_info[0]); i++) {
+        const ScheduleInfo *s = &control.schedule_info[i];
+        if (s->day[0] == '\0') continue;
+
+        jw_object_begin(w);
+        jw_key_string(w, "day", s->day);
+        jw_key_string(w, "open", s->open);
+        jw_key_string(w, "close", s->close);
+        jw_object_end(w);
+    }
+    jw_array_end(w);
+
+    jw_key_int(w, "upper_limit", control.sensor_upper_limit);
+    jw_key_int(w, "lower_limit", control.sensor_lower_limit);
+}
+
+/**
+ * @brief get_config: connection and publishing settings (no secrets)
+ */
+static void rpc_get_config(JsonWriter *w)
+{
+    static const char *const mode_names[] = {
+        [TELEMETRY_LEGACY] = "legacy",
+        [TELEMETRY_CONSOLIDATED] = "consolidated",
+        [TELEMETRY_BOTH] = "both",
+    };
+    GroupConfig groups;
+    mqtt_groups_get(&groups);
+
+    jw_key_string(w, "ssid", wifiStaData.ssid);
+    jw_key_string(w, "broker", mqtt_broker_uri());
+    jw_key_string(w, "format", mode_names[mqtt_get_telemetry_mode()]);
+    jw_key_string(w, "encoding", (mqtt_get_payload_format() == PAYLOAD_CBOR) ? "cbor" : "json");
+
+    jw_key_array_begin(w, "groups");
+    for (int i = 0; i < groups.count; i++) {
+        jw_string(w, groups.names[i]);
+    }
+    jw_array_end(w);
+    jw_key_int(w, "stagger_ms", groups.stagger_ms);
+}
+
+/**
+ * @brief get_version: firmware image description
+ */
+static void rpc_get_version(JsonWriter *w)
+{
+    const esp_app_desc_t *app = esp_app_get_description();
+
+    jw_key_string(w, "project", app->project_name);
+    jw_key_string(w, "version", app->version);
+    jw_key_string(w, "idf", app->idf_ver);
+    jw_key_string(w, "built", app->date);
+    jw_key_int(w, "uptime_s", esp_timer_get_time() / 1000000);
+}
+
+/**
+ * @brief get_tasks: heap and per-task stack headroom
+ *
+ * Works without CONFIG_FREERTOS_USE_TRACE_FACILITY: tasks are
+ * looked up by name instead of listing the scheduler state.
+ */
+static void rpc_get_tasks(JsonWriter *w)
+{
+    jw_key_int(w, "heap_free", esp_get_free_heap_size());
+    jw_key_int(w, "heap_min", esp_get_minimum_free_heap_size());
+    jw_key_int(w, "task_count", uxTaskGetNumberOfTasks());
+
+    jw_key_array_begin(w, "tasks");
+    for (size_t i = 0; i < sizeof(rpc_task_names) / sizeof(rpc_task_names[0]); i++) {
+        TaskHandle_t task = xTaskGetHandle(rpc_task_names[i]);
+        if (task == NULL) continue;
+
+        jw_object_begin(w);
+        jw_key_string(w, "name", rpc_task_names[i]);
+        jw_key_int(w, "stack_free", uxTaskGetStackHighWaterMark(task));
+        jw_object_end(w);
+    }
+    jw_array_end(w);
+}
+
+/**
+ * @brief get_errors: last valve errors, newest first
+ */
+static void rpc_get_errors(JsonWriter *w)
+{
+    static ErrorEntry errors[ERROR_HISTORY_SIZE];      // Rx worker only
+    size_t count = error_history_get(errors, ERROR_HISTORY_SIZE);
+
+    jw_key_array_begin(w, "errors");
+    for (size_t i = 0; i < count; i++) {
+        jw_object_begin(w);
+        jw_key_string(w, "timestamp", errors[i].timestamp);
+        jw_key_int(w, "uptime_s", errors[i].uptime_s);
+        jw_key_string(w, "error", errors[i].msg);
+        jw_object_end(w);
+    }
+    jw_array_end(w);
+}
+
+/**
+ * @brief get_pipeline: inbound command counters and per-stage timing
+ */
+static void rpc_get_pipeline(JsonWriter *w)
+{
+    static const char *const stage_names[CMD_STAGE_COUNT] = {
+        [CMD_STAGE_RECEIVE] = "receive",
+        [CMD_STAGE_DECODE] = "decode",
+        [CMD_STAGE_VALIDATE] = "validate",
+        [CMD_STAGE_DISPATCH] = "dispatch",
+    };
+    static CmdPipelineStats stats;      // Rx worker only
+
+    mqtt_get_pipeline_stats(&stats);
+
+    jw_key_int(w, "runs", stats.runs);
+
+    jw_key_array_begin(w, "stages");
+    for (int i = 0; i < CMD_STAGE_COUNT; i++) {
+        jw_object_begin(w);
+        jw_key_string(w, "stage", stage_names[i]);
+        jw_key_int(w, "passed", stats.passed[i]);
+        jw_key_int(w, "rejected", stats.rejected[i]);
+        jw_key_int(w, "last_us", stats.last_us[i]);
+        jw_key_int(w, "max_us", stats.max_us[i]);
+        jw_key_int(w, "avg_us", (stats.passed[i] > 0) ? stats.total_us[i] / stats.passed[i] : 0);
+        jw_object_end(w);
+    }
+    jw_array_end(w);
+}
+
+/**
+ * @brief get_stats: transport, publish and fan-out counters
+ *
+ * Kept out of the periodic telemetry so every state message stays small.
+ */
+static void rpc_get_stats(JsonWriter *w)
+{
+    write_publish_stats(w);
+    write_rx_stats(w);
+    write_queue_stats(w);
+    write_tls_stats(w);
+    write_link_stats(w);
+    write_outbox_stats(w);
+    write_reconnect_stats(w);
+    write_broker_stats(w);
+    write_group_stats(w);
+    write_schedule_cache_stats(w);
+}
+
+typedef struct {
+    const char *method;
+    void (*write)(JsonWriter *w);
+} RpcMethod;
+
+static const RpcMethod rpc_methods[] = {
+    { "get_schedule",   rpc_get_schedule },
+    { "get_config",     rpc_get_config },
+    { "get_version",    rpc_get_version },
+    { "get_tasks",      rpc_get_tasks },
+    { "get_errors",     rpc_get_errors },
+    { "get_pipeline",   rpc_get_pipeline },
+    { "get_stats",      rpc_get_stats },
+};
+
+
+/**
+ * @brief Write the response to an rpc_request
+ *
+ * {
+ *   "event": "rpc_response", "timestamp", "device_id",
+ *   "correlation_id": "<as sent>",
+ *   "method": "get_schedule",
+ *   "status": "ok" | "error",
+ *   "result": { ... }            (ok)
+ *   "error": "unknown method"    (error)
+ * }
+ *
+ * @return Payload length, or -1 if buf is too small
+ */
+int create_rpc_response(char *buf, size_t size, PayloadFormat format, const ValveCommand *req) {
+    const RpcMethod *method = NULL;
+    for (size_t i = 0; i < sizeof(rpc_methods) / sizeof(rpc_methods[0]); i++) {
+        if (strcmp(req->method, rpc_methods[i].method) == 0) {
+            method = &rpc_methods[i];
+            break;
+        }
+    }
+
+    JsonWriter w;
+    jw_init_format(&w, buf, size, format);
+
+    jw_object_begin(&w);
+    write_header(&w, "rpc_response");
+    jw_key_string(&w, "correlation_id", req->correlation_id);
+    jw_key_string(&w, "method", req->method);
+
+    if (method != NULL) {
+        jw_key_string(&w, "status", "ok");
+        jw_key_object_begin(&w, "result");
+        method->write(&w);
+        jw_object_end(&w);
+    } else {
+        jw_key_string(&w, "status", "error");
+        jw_key_string(&w, "error", "unknown method");
+    }
+
+    jw_object_end(&w);
+
+    return jw_finish(&w);
+}
@@ -2,13 +2,24 @@
 #define MQTT_STATE_FN_H
 
 #include "mqtt_client_fn.h"
+#include "mqtt_cmd_tracker.h"
+#include "codec_fn/cmd_pipeline.h"
 
-void mqtt_handle_cmd_data(const char *data);
-void mqtt_handle_control_data(const char *data);
-void mqtt_handle_topic(const char *data);
+void mqtt_state_init(void);
+void mqtt_handle_message(const char *topic, size_t topic_len,
+                         const char *data, size_t len, PayloadFormat format,
+                         uint32_t receive_us);
+void mqtt_get_pipeline_stats(CmdPipelineStats *stats);
 
-cJSON* create_valve_status();
-cJSON* create_valve_state_data();
-cJSON* create_valve_error();
+int create_valve_status(char *buf, size_t size, PayloadFormat format);
+int create_valve_state_data(char *buf, size_t size, PayloadFormat format);
+int create_valve_error(char *buf, size_t size, PayloadFormat format);
+int create_valve_telemetry(char *buf, size_t size, PayloadFormat format);
+int create_cmd_report(char *buf, size_t size, PayloadFormat format, const CmdReport *report);
+int create_rpc_response(char *buf, size_t size, PayloadFormat format, const ValveCommand *req);
+
+bool mqtt_shadow_report_due(void);
+void mqtt_shadow_report_reset(void);
+int create_shadow_report(char *buf, size_t size, PayloadFormat format);
 
 #endif
\ No newline at end of file
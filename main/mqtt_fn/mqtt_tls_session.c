@@ -0,0 +1,388 @@
+/**
+ * @file mqtt_tls_session.c
+ * @brief MQTT TLS transport with session resumption and connect timing
+ *
+ * The stock esp-mqtt SSL transport does a full handshake (certificate
+ * chain, ECDHE) on every reconnect. This transport is built on esp-tls
+ * directly and keeps the client session (ticket) of the last
+ * successful handshake in RAM:
+ *
+ *   first connect:   full handshake  ──► session cached
+ *   reconnect:       session offered ──► abbreviated handshake
+ *
+ * If the broker refuses the ticket it falls back to a full handshake
+ * on its own; a failed handshake drops the cached session so the next
+ * attempt starts clean.
+ *
+ * Whether the broker actually resumed is read back from mbedTLS: a
+ * resumed TLS 1.2 handshake keeps the master secret of the cached
+ * session, a full one derives a new one. TLS 1.3 connections are
+ * counted as full.
+ *
+ * The session lives in RAM only. It survives pause_mqtt_client() /
+ * start_mqtt_client() (Wi-Fi blips) but not a reboot; the device
+ * never deep-sleeps, so RTC retention would not buy anything.
+ *
+ * Also measured:
+ *  - handshake time (TCP connect + TLS) per connect
+ *  - Wi-Fi up → first publish
+ *
+ * Connect, read, write and close run in the esp-mqtt task; the stats
+ * are read elsewhere without a lock (diagnostics only).
+ */
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_tls.h"
+#include "lwip/sockets.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/platform_util.h"
+#include "sdkconfig.h"
+
+#include "mqtt_tls_session.h"
+
+
+/* ======================================================================== */
+/* ============================ CONFIGURATION ============================= */
+/* ======================================================================== */
+
+#define MQTT_TLS_DEFAULT_PORT   8883
+
+static const char *TAG = "MQTT_TLS";
+
+typedef struct {
+    esp_tls_t *tls;
+    int sockfd;
+    const char *ca_pem;
+    size_t ca_len;
+} TlsTransport;
+
+// One MQTT client, one transport at a time
+static TlsTransport transport_ctx;
+
+#if CONFIG_MQTT_TLS_SESSION_RESUME
+// Session of the last successful handshake (esp-mqtt task only)
+static esp_tls_client_session_t *cached_session = NULL;
+
+// Master secret of cached_session, to tell a resumed handshake from a full one
+static unsigned char cached_master[48];
+#endif
+
+static MqttTlsStats tls_stats;
+static int64_t link_up_us;
+
+
+
+/* ======================================================================== */
+/* ============================ TRANSPORT I/O ============================= */
+/* ======================================================================== */
+
+static int tls_poll(TlsTransport *ctx, int timeout_ms, bool for_read)
+{
+    fd_set set, errset;
+    struct timeval tv = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+
+    FD_ZERO(&set);
+    FD_ZERO(&errset);
+    FD_SET(ctx->sockfd, &set);
+    FD_SET(ctx->sockfd, &errset);
+
+    int ret = select(ctx->sockfd + 1, for_read ? &set : NULL, for_read ? NULL : &set,
+                     &errset, (timeout_ms < 0) ? NULL : &tv);
+
+    if (ret > 0 && FD_ISSET(ctx->sockfd, &errset)) {
+        int sock_errno = 0;
+        socklen_t len = sizeof(sock_errno);
+        getsockopt(ctx->sockfd, SOL_SOCKET, SO_ERROR, &sock_errno, &len);
+        ESP_LOGE(TAG, "Socket error %d", sock_errno);
+        return -1;
+    }
+
+    return ret;
+}
+
+
+static int tls_poll_read(esp_transport_handle_t t, int timeout_ms)
+{
+    TlsTransport *ctx = esp_transport_get_context_data(t);
+
+    if (ctx->tls == NULL) return -1;
+
+    // Decrypted bytes already buffered by mbedTLS
+    if (esp_tls_get_bytes_avail(ctx->tls) > 0) return 1;
+
+    return tls_poll(ctx, timeout_ms, true);
+}
+
+
+static int tls_poll_write(esp_transport_handle_t t, int timeout_ms)
+{
+    TlsTransport *ctx = esp_transport_get_context_data(t);
+
+    if (ctx->tls == NULL) return -1;
+
+    return tls_poll(ctx, timeout_ms, false);
+}
+
+
+#if CONFIG_MQTT_TLS_SESSION_RESUME
+/**
+ * @brief Master secret of an established TLS 1.2 connection
+ *
+ * @return Pointer into the mbedTLS context, or NULL (TLS 1.3 / no session)
+ */
+static const unsigned char *tls_session_master(esp_tls_t *tls)
+{
+#if defined(MBEDTLS_SSL_PROTO_TLS1_2)
+    mbedtls_ssl_context *ssl = esp_tls_get_ssl_context(tls);
+    if (ssl == NULL || mbedtls_ssl_get_version_number(ssl) != MBEDTLS_SSL_VERSION_TLS1_2) {
+        return NULL;
+    }
+
+    const mbedtls_ssl_session *session = ssl->MBEDTLS_PRIVATE(session);
+    return (session != NULL) ? session->MBEDTLS_PRIVATE(master) : NULL;
+#else
+    (void)tls;
+    return NULL;
+#endif
+}
+#endif
+
+
+/**
+ * @brief TCP connect + TLS handshake, offering the cached session
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int tls_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    TlsTransport *ctx = esp_transport_get_context_data(t);
+
+    esp_tls_cfg_t cfg = {
+        .cacert_buf = (const unsigned char *)ctx->ca_pem,
+        .cacert_bytes = ctx->ca_len,
+        .timeout_ms = timeout_ms,
+    };
+
+    bool offered = false;
+#if CONFIG_MQTT_TLS_SESSION_RESUME
+    cfg.client_session = cached_session;
+    offered = (cached_session != NULL);
+#endif
+
+    ctx->tls = esp_tls_init();
+    if (ctx->tls == NULL) {
+        ESP_LOGE(TAG, "esp_tls_init failed");
+        return -1;
+    }
+
+    int64_t t0 = esp_timer_get_time();
+    int ret = esp_tls_conn_new_sync(host, strlen(host), port, &cfg, ctx->tls);
+    uint32_t elapsed_ms = (uint32_t)((esp_timer_get_time() - t0) / 1000);
+
+    if (ret != 1) {
+        tls_stats.failures++;
+        ESP_LOGE(TAG, "Handshake with %s:%d failed after %lu ms", host, port, (unsigned long)elapsed_ms);
+
+        esp_tls_conn_destroy(ctx->tls);
+        ctx->tls = NULL;
+
+        // Broker may have restarted or rotated its ticket key
+        mqtt_tls_session_clear();
+        return -1;
+    }
+
+    esp_tls_get_conn_sockfd(ctx->tls, &ctx->sockfd);
+
+    // An offered session may still be refused: only a kept master secret is a resumption
+    bool resumed = false;
+#if CONFIG_MQTT_TLS_SESSION_RESUME
+    const unsigned char *master = tls_session_master(ctx->tls);
+    resumed = offered && master != NULL &&
+              memcmp(master, cached_master, sizeof(cached_master)) == 0;
+#endif
+
+    tls_stats.handshakes++;
+    tls_stats.last_handshake_ms = elapsed_ms;
+    tls_stats.last_resumed = resumed;
+    if (resumed) {
+        tls_stats.resumptions++;
+        tls_stats.last_resume_ms = elapsed_ms;
+    } else {
+        tls_stats.last_full_ms = elapsed_ms;
+    }
+
+    ESP_LOGI(TAG, "Handshake %lu ms (%s)", (unsigned long)elapsed_ms,
+             resumed ? "resumed" : (offered ? "full, session refused" : "full"));
+
+#if CONFIG_MQTT_TLS_SESSION_RESUME
+    // Keep the freshest ticket for the next reconnect
+    esp_tls_client_session_t *session = esp_tls_get_client_session(ctx->tls);
+    if (session != NULL) {
+        mqtt_tls_session_clear();
+        cached_session = session;
+        if (master != NULL) {
+            memcpy(cached_master, master, sizeof(cached_master));
+        }
+    }
+#endif
+
+    return 0;
+}
+
+
+static int tls_read(esp_transport_handle_t t, char *buffer, int len, int timeout_ms)
+{
+    TlsTransport *ctx = esp_transport_get_context_data(t);
+
+    int poll = tls_poll_read(t, timeout_ms);
+    if (poll < 0) return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    if (poll == 0) return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+
+    int ret = esp_tls_conn_read(ctx->tls, buffer, len);
+    if (ret < 0) {
+        if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_TIMEOUT) {
+            return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+        }
+        ESP_LOGE(TAG, "Read error -0x%x", -ret);
+        return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    }
+    if (ret == 0) {
+        // Readable but nothing to read: peer closed the connection
+        return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+    }
+
+    return ret;
+}
+
+
+static int tls_write(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms)
+{
+    TlsTransport *ctx = esp_transport_get_context_data(t);
+
+    int poll = tls_poll_write(t, timeout_ms);
+    if (poll <= 0) {
+        ESP_LOGW(TAG, "Write poll timeout or error");
+        return poll;
+    }
+
+    int ret = esp_tls_conn_write(ctx->tls, buffer, len);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Write error -0x%x", -ret);
+        return -1;
+    }
+
+    return ret;
+}
+
+
+static int tls_close(esp_transport_handle_t t)
+{
+    TlsTransport *ctx = esp_transport_get_context_data(t);
+
+    if (ctx->tls != NULL) {
+        esp_tls_conn_destroy(ctx->tls);
+        ctx->tls = NULL;
+    }
+    ctx->sockfd = -1;
+
+    return 0;
+}
+
+
+static int tls_destroy(esp_transport_handle_t t)
+{
+    // Context is static; the cached session outlives the transport
+    return tls_close(t);
+}
+
+
+
+/* ======================================================================== */
+/* ============================== PUBLIC API ============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Create the TLS transport for esp_mqtt_client_config_t.network.transport
+ *
+ * esp-mqtt destroys the transport with the client, so call this for
+ * every esp_mqtt_client_init().
+ *
+ * @param ca_pem  CA certificate (PEM, NUL-terminated)
+ * @param ca_len  Length including the terminating NUL
+ *
+ * @return Transport handle, or NULL on allocation failure
+ */
+esp_transport_handle_t mqtt_tls_transport_create(const char *ca_pem, size_t ca_len)
+{
+    esp_transport_handle_t t = esp_transport_init();
+    if (t == NULL) {
+        ESP_LOGE(TAG, "esp_transport_init failed");
+        return NULL;
+    }
+
+    memset(&transport_ctx, 0, sizeof(transport_ctx));
+    transport_ctx.sockfd = -1;
+    transport_ctx.ca_pem = ca_pem;
+    transport_ctx.ca_len = ca_len;
+
+    esp_transport_set_context_data(t, &transport_ctx);
+    esp_transport_set_func(t, tls_connect, tls_read, tls_write, tls_close,
+                           tls_poll_read, tls_poll_write, tls_destroy);
+    esp_transport_set_default_port(t, MQTT_TLS_DEFAULT_PORT);
+
+    return t;
+}
+
+
+/**
+ * @brief Forget the cached session; the next connect does a full handshake
+ */
+void mqtt_tls_session_clear(void)
+{
+#if CONFIG_MQTT_TLS_SESSION_RESUME
+    if (cached_session != NULL) {
+        esp_tls_free_client_session(cached_session);
+        cached_session = NULL;
+    }
+    mbedtls_platform_zeroize(cached_master, sizeof(cached_master));
+#endif
+}
+
+
+/**
+ * @brief Start of the Wi-Fi → first publish measurement (IP obtained)
+ */
+void mqtt_tls_mark_link_up(void)
+{
+    link_up_us = esp_timer_get_time();
+}
+
+
+/**
+ * @brief End of the measurement: first message handed to the broker
+ */
+void mqtt_tls_mark_ready(void)
+{
+    if (link_up_us == 0) return;
+
+    tls_stats.ready_ms = (uint32_t)((esp_timer_get_time() - link_up_us) / 1000);
+    link_up_us = 0;
+
+    ESP_LOGI(TAG, "Wi-Fi up -> first publish: %lu ms (handshake %lu ms)",
+             (unsigned long)tls_stats.ready_ms, (unsigned long)tls_stats.last_handshake_ms);
+}
+
+
+/**
+ * @brief Copy the connection setup counters
+ */
+void mqtt_tls_get_stats(MqttTlsStats *stats)
+{
+    if (stats == NULL) return;
+    *stats = tls_stats;
+}
@@ -0,0 +1,28 @@
+#ifndef MQTT_TLS_SESSION_H
+#define MQTT_TLS_SESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_transport.h"
+
+// Connection setup timing (milliseconds)
+typedef struct {
+    uint32_t handshakes;        // Successful TLS handshakes
+    uint32_t resumptions;       // ... of which resumed the cached session
+    uint32_t failures;          // Failed handshakes (cached session dropped)
+    uint32_t last_handshake_ms; // TCP connect + TLS handshake
+    uint32_t last_full_ms;      // Last full handshake (also a refused session)
+    uint32_t last_resume_ms;    // Last resumed handshake
+    bool last_resumed;          // Last handshake resumed the cached session
+    uint32_t ready_ms;          // Wi-Fi up → first publish of the last connect
+} MqttTlsStats;
+
+esp_transport_handle_t mqtt_tls_transport_create(const char *ca_pem, size_t ca_len);
+void mqtt_tls_session_clear(void);
+
+void mqtt_tls_mark_link_up(void);
+void mqtt_tls_mark_ready(void);
+void mqtt_tls_get_stats(MqttTlsStats *stats);
+
+#endif // MQTT_TLS_SESSION_H
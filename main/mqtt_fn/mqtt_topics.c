@@ -0,0 +1,229 @@
+/**
+ * @file mqtt_topics.c
+ * @brief Precomputed outbound topics and MQTT 5 topic aliases
+ *
+ * Every outbound topic is a string literal built by the compiler
+ * (MQTT_BASE_TOPIC "/" sub), so the publish path does no snprintf
+ * and no 128-byte stack buffer.
+ *
+ * With CONFIG_MQTT_TOPIC_ALIAS (MQTT 5) each topic also owns a fixed
+ * alias number (table index + 1, up to CONFIG_MQTT_TOPIC_ALIAS_MAX).
+ * The first publish of a session sends topic + alias; later QoS 0
+ * publishes send an empty topic and the alias only:
+ *
+ *   "vortex_device/wifi_valve/<ID>/telemetry" (46 B)  ──►  alias 1 (3 B)
+ *
+ * QoS 1 publishes always carry the full topic: esp-mqtt may resend
+ * them from its outbox after a reconnect, when the broker has
+ * forgotten the aliases of the old session.
+ *
+ * Alias state is guarded by the caller's publish lock.
+ */
+
+#include <string.h>
+#include "esp_log.h"
+
+#include "mqtt_topics.h"
+
+
+/* ======================================================================== */
+/* ============================ TOPIC TABLE =============================== */
+/* ======================================================================== */
+
+#define TOPIC(sub)  { sub, MQTT_BASE_TOPIC "/" sub, sizeof(MQTT_BASE_TOPIC "/" sub) - 1 }
+
+#define TOPIC_PAIR(sub)  { TOPIC(sub), TOPIC(sub "/cbor") }
+
+// [id][PAYLOAD_JSON / PAYLOAD_CBOR]
+static const MqttTopic topics[MQTT_TOPIC_COUNT][2] = {
+    [MQTT_TOPIC_TELEMETRY]        = TOPIC_PAIR("telemetry"),
+    [MQTT_TOPIC_STATE_DATA]       = TOPIC_PAIR("state_data"),
+    [MQTT_TOPIC_ERROR]            = TOPIC_PAIR("error"),
+    [MQTT_TOPIC_SHADOW_REPORTED]  = TOPIC_PAIR("shadow_reported"),
+    [MQTT_TOPIC_CMD_ACK]          = TOPIC_PAIR("cmd_ack"),
+    [MQTT_TOPIC_SENSOR_SERIES]    = { TOPIC("sensor_series"), TOPIC("sensor_series") },
+    [MQTT_TOPIC_STATUS]           = { TOPIC("status"), TOPIC("status") },
+    [MQTT_TOPIC_RPC_RESPONSE]     = TOPIC_PAIR("rpc_response"),
+};
+
+#define TOPIC_SLOTS     (MQTT_TOPIC_COUNT * 2)
+
+static const char *TAG = "MQTT_TOPICS";
+
+#if CONFIG_MQTT_TOPIC_ALIAS
+// Aliases the broker knows in the current session
+static bool alias_known[TOPIC_SLOTS];
+#endif
+
+static MqttWireStats wire_stats;
+
+
+
+/* ======================================================================== */
+/* ============================ INTERNAL HELPERS ========================== */
+/* ======================================================================== */
+
+static inline int slot_of(const MqttTopic *topic)
+{
+    return (int)(topic - &topics[0][0]);
+}
+
+
+static inline MqttTopicId id_of(const MqttTopic *topic)
+{
+    return (MqttTopicId)(slot_of(topic) / 2);
+}
+
+
+/**
+ * @brief Length of an MQTT variable byte integer
+ */
+static size_t varint_len(size_t value)
+{
+    size_t n = 1;
+    while (value >= 128) {
+        value /= 128;
+        n++;
+    }
+    return n;
+}
+
+
+
+/* ======================================================================== */
+/* ============================== PUBLIC API ============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Precomputed topic for an outbound message
+ *
+ * @param format  PAYLOAD_CBOR selects the "/cbor" variant
+ */
+const MqttTopic *mqtt_topic(MqttTopicId id, PayloadFormat format)
+{
+    if (id >= MQTT_TOPIC_COUNT) return NULL;
+    return &topics[id][(format == PAYLOAD_CBOR) ? 1 : 0];
+}
+
+
+/**
+ * @brief Look up a topic by sub-topic (store-and-forward entries, binary blocks)
+ *
+ * @return Topic, or NULL if the sub-topic is not in the table
+ */
+const MqttTopic *mqtt_topic_find(const char *sub_topic)
+{
+    if (sub_topic == NULL) return NULL;
+
+    for (int i = 0; i < TOPIC_SLOTS; i++) {
+        const MqttTopic *topic = &topics[0][0] + i;
+        if (strcmp(topic->sub, sub_topic) == 0) {
+            return topic;
+        }
+    }
+
+    ESP_LOGW(TAG, "Unknown sub-topic %s", sub_topic);
+    return NULL;
+}
+
+
+/**
+ * @brief Messages that must not be dropped for newer telemetry
+ *
+ * Command acks / reports, errors and presence.
+ */
+bool mqtt_topic_is_priority(const MqttTopic *topic)
+{
+    MqttTopicId id = id_of(topic);
+    return id == MQTT_TOPIC_CMD_ACK || id == MQTT_TOPIC_ERROR || id == MQTT_TOPIC_STATUS;
+}
+
+
+/**
+ * @brief Alias number of a topic, 0 if it has none
+ */
+uint16_t mqtt_topic_alias(const MqttTopic *topic)
+{
+#if CONFIG_MQTT_TOPIC_ALIAS
+    int alias = slot_of(topic) + 1;
+    return (alias <= CONFIG_MQTT_TOPIC_ALIAS_MAX) ? (uint16_t)alias : 0;
+#else
+    (void)topic;
+    return 0;
+#endif
+}
+
+
+/**
+ * @brief Check whether the broker already maps the alias of topic
+ */
+bool mqtt_topic_alias_known(const MqttTopic *topic)
+{
+#if CONFIG_MQTT_TOPIC_ALIAS
+    return alias_known[slot_of(topic)];
+#else
+    (void)topic;
+    return false;
+#endif
+}
+
+
+/**
+ * @brief Record that topic + alias was sent in this session
+ */
+void mqtt_topic_alias_mark(const MqttTopic *topic)
+{
+#if CONFIG_MQTT_TOPIC_ALIAS
+    alias_known[slot_of(topic)] = true;
+#else
+    (void)topic;
+#endif
+}
+
+
+/**
+ * @brief Forget all aliases (new MQTT session)
+ */
+void mqtt_topic_session_reset(void)
+{
+#if CONFIG_MQTT_TOPIC_ALIAS
+    memset(alias_known, 0, sizeof(alias_known));
+#endif
+}
+
+
+/**
+ * @brief Count the size of one PUBLISH packet
+ *
+ * @param topic_len    Topic bytes actually sent (0 when aliased)
+ * @param alias        Topic alias property, 0 = none
+ * @param payload_len  Payload bytes
+ * @param qos          0 or 1 (packet identifier)
+ */
+void mqtt_topic_account(size_t topic_len, uint16_t alias, size_t payload_len, int qos)
+{
+    size_t remaining = 2 + topic_len + ((qos > 0) ? 2 : 0) + payload_len;
+
+#if CONFIG_MQTT_TOPIC_ALIAS
+    // MQTT 5: property length + optional Topic Alias (id + uint16)
+    size_t props = (alias != 0) ? 3 : 0;
+    remaining += varint_len(props) + props;
+#endif
+
+    wire_stats.publishes++;
+    if (topic_len == 0 && alias != 0) {
+        wire_stats.aliased++;
+    }
+    wire_stats.topic_bytes += topic_len;
+    wire_stats.wire_bytes += 1 + varint_len(remaining) + remaining;
+}
+
+
+/**
+ * @brief Copy the wire byte counters
+ */
+void mqtt_topic_get_wire_stats(MqttWireStats *stats)
+{
+    if (stats == NULL) return;
+    *stats = wire_stats;
+}
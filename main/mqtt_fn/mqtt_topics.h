@@ -0,0 +1,57 @@
+#ifndef MQTT_TOPICS_H
+#define MQTT_TOPICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+#include "codec_fn/payload_format.h"
+
+// vortex_device/wifi_valve/ (device, group and fleet topics)
+#define MQTT_ROOT_TOPIC "vortex_device/wifi_valve/"
+
+// vortex_device/wifi_valve/<DEVICE_ID>
+#define MQTT_BASE_TOPIC MQTT_ROOT_TOPIC CONFIG_WIFI_VALVE_ID
+
+// Outbound topics (each has a JSON and a "/cbor" variant)
+typedef enum {
+    MQTT_TOPIC_TELEMETRY = 0,       // Most frequent first: low alias numbers
+    MQTT_TOPIC_STATE_DATA,
+    MQTT_TOPIC_ERROR,
+    MQTT_TOPIC_SHADOW_REPORTED,
+    MQTT_TOPIC_CMD_ACK,
+    MQTT_TOPIC_SENSOR_SERIES,
+    MQTT_TOPIC_STATUS,
+    MQTT_TOPIC_RPC_RESPONSE,
+    MQTT_TOPIC_COUNT
+} MqttTopicId;
+
+// Precomputed topic (compile time)
+typedef struct {
+    const char *sub;                // Sub-topic, e.g. "telemetry/cbor"
+    const char *full;               // MQTT_BASE_TOPIC "/" sub
+    uint16_t full_len;
+} MqttTopic;
+
+// Bytes on the wire (PUBLISH packets handed to the client)
+typedef struct {
+    uint32_t publishes;
+    uint32_t aliased;               // Sent with an empty topic + alias
+    uint64_t topic_bytes;           // Topic strings only
+    uint64_t wire_bytes;            // Whole PUBLISH packets
+} MqttWireStats;
+
+const MqttTopic *mqtt_topic(MqttTopicId id, PayloadFormat format);
+const MqttTopic *mqtt_topic_find(const char *sub_topic);
+bool mqtt_topic_is_priority(const MqttTopic *topic);
+
+uint16_t mqtt_topic_alias(const MqttTopic *topic);
+bool mqtt_topic_alias_known(const MqttTopic *topic);
+void mqtt_topic_alias_mark(const MqttTopic *topic);
+void mqtt_topic_session_reset(void);
+
+void mqtt_topic_account(size_t topic_len, uint16_t alias, size_t payload_len, int qos);
+void mqtt_topic_get_wire_stats(MqttWireStats *stats);
+
+#endif // MQTT_TOPICS_H
@@ -0,0 +1,69 @@
+/**
+ * @file msg_stamp.c
+ * @brief Sequence number, boot ID and monotonic time of outbound messages
+ *
+ * The wall-clock "timestamp" has one second resolution and jumps
+ * with SNTP, so the backend cannot tell a lost message from a quiet
+ * device or measure delivery delay. Every outbound message also gets
+ *
+ *   "seq"      +1 per message on its channel (MQTT / WebSocket)
+ *   "boot_id"  random per boot: a reset restarts seq and mono_us
+ *   "mono_us"  esp_timer_get_time() when the message was built
+ *
+ * A gap in seq within one boot_id is a lost message; a lower seq is
+ * a reordered one. (receive time - mono_us) is constant for a device
+ * up to the delivery delay, so its increase over the minimum of the
+ * boot is the latency of that message.
+ *
+ * Messages are stamped when built: a store-and-forward replay keeps
+ * its original seq and mono_us. seq and mono_us are taken together
+ * under a spinlock, so a higher seq never has an older mono_us.
+ */
+
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "msg_stamp.h"
+
+
+static portMUX_TYPE stamp_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t boot_id;
+static uint32_t channel_seq[MSG_CHANNEL_COUNT];
+
+
+
+/**
+ * @brief Stamp the next message of a channel (any task)
+ *
+ * The boot ID is drawn on first use: by then Wi-Fi is running and
+ * esp_random() is backed by RF noise.
+ */
+void msg_stamp_next(MsgChannel channel, MsgStamp *stamp)
+{
+    if (channel >= MSG_CHANNEL_COUNT) channel = MSG_CHANNEL_MQTT;
+
+    portENTER_CRITICAL(&stamp_lock);
+    while (boot_id == 0) {
+        boot_id = esp_random();
+    }
+    stamp->seq = ++channel_seq[channel];
+    stamp->boot_id = boot_id;
+    stamp->mono_us = esp_timer_get_time();
+    portEXIT_CRITICAL(&stamp_lock);
+}
+
+
+/**
+ * @brief Write "seq", "boot_id" and "mono_us" of the next message
+ */
+void msg_stamp_write(JsonWriter *w, MsgChannel channel)
+{
+    MsgStamp stamp;
+    msg_stamp_next(channel, &stamp);
+
+    jw_key_int(w, "seq", stamp.seq);
+    jw_key_int(w, "boot_id", stamp.boot_id);
+    jw_key_int(w, "mono_us", stamp.mono_us);
+}
@@ -0,0 +1,25 @@
+#ifndef MSG_STAMP_H
+#define MSG_STAMP_H
+
+#include <stdint.h>
+
+#include "codec_fn/json_writer.h"
+
+// Outbound streams with their own sequence
+typedef enum {
+    MSG_CHANNEL_MQTT = 0,       // Every MQTT publish (all topics)
+    MSG_CHANNEL_WS,             // WebSocket messages (offline mode)
+    MSG_CHANNEL_COUNT
+} MsgChannel;
+
+// Identity of one outbound message
+typedef struct {
+    uint32_t seq;               // Per boot and channel, first message = 1
+    uint32_t boot_id;           // Random, fixed until the next reset
+    int64_t mono_us;            // esp_timer_get_time() when it was built
+} MsgStamp;
+
+void msg_stamp_next(MsgChannel channel, MsgStamp *stamp);
+void msg_stamp_write(JsonWriter *w, MsgChannel channel);
+
+#endif // MSG_STAMP_H
@@ -0,0 +1,239 @@
+/**
+ * @file reconnect_policy.c
+ * @brief Jittered exponential backoff for Wi-Fi and MQTT reconnects
+ *
+ * After a broker restart or an access point reboot every valve of a
+ * site loses its link at the same moment. Retrying on a fixed
+ * interval makes them all come back (and do a full TLS handshake)
+ * together. Each link therefore retries on its own schedule:
+ *
+ *   ceiling = min(max, base * 2^failures)
+ *   delay   = ceiling / 2 + random(0 .. ceiling / 2)
+ *
+ * The random generator is seeded from the station MAC and the
+ * hardware RNG, so two valves never share a sequence.
+ *
+ * A server that refuses a connection because it is overloaded
+ * ("server unavailable" / MQTT 5 "server busy", "quota exceeded")
+ * raises the floor of the next delay (reconnect_policy_hint()).
+ *
+ * Retries run from an esp_timer; a link's schedule is driven from a
+ * single event context (Wi-Fi event loop / MQTT task), the stats are
+ * read elsewhere without a lock (diagnostics only).
+ */
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+
+#include "reconnect_policy.h"
+
+
+typedef struct {
+    const char *name;
+    uint32_t base_ms;
+    uint32_t max_ms;
+    reconnect_fn retry;
+    esp_timer_handle_t timer;
+    uint32_t hint_ms;           // Floor for the next delay (0 = none)
+    int64_t down_us;            // First failure of the current outage
+    ReconnectStats stats;
+} ReconnectPolicy;
+
+static const char *TAG = "RECONNECT";
+
+static const char *const link_names[RECONNECT_COUNT] = {
+    [RECONNECT_WIFI] = "wifi",
+    [RECONNECT_MQTT] = "mqtt",
+};
+
+static ReconnectPolicy policies[RECONNECT_COUNT];
+static uint32_t rng_state;
+
+
+
+/* ======================================================================== */
+/* ============================ INTERNAL HELPERS ========================== */
+/* ======================================================================== */
+
+/**
+ * @brief xorshift32, seeded once per device
+ */
+static uint32_t jitter_random(void)
+{
+    if (rng_state == 0) {
+        uint8_t mac[6] = {0};
+        esp_read_mac(mac, ESP_MAC_WIFI_STA);
+
+        rng_state = esp_random() ^ ((uint32_t)mac[2] << 24 | (uint32_t)mac[3] << 16 |
+                                    (uint32_t)mac[4] << 8 | mac[5]);
+        if (rng_state == 0) rng_state = 0x9E3779B9u;
+    }
+
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+
+static void retry_timer_cb(void *arg)
+{
+    ReconnectPolicy *p = arg;
+
+    ESP_LOGI(TAG, "%s: retry %lu", p->name, (unsigned long)p->stats.streak);
+    p->retry();
+}
+
+
+static ReconnectPolicy *policy_of(ReconnectLink link)
+{
+    if (link >= RECONNECT_COUNT || policies[link].timer == NULL) return NULL;
+    return &policies[link];
+}
+
+
+
+/* ======================================================================== */
+/* ============================== PUBLIC API ============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Set up the schedule of a link (once)
+ *
+ * @param base_ms  Ceiling of the first retry
+ * @param max_ms   Largest ceiling
+ * @param retry    Starts a connect attempt (esp_timer task)
+ */
+void reconnect_policy_init(ReconnectLink link, uint32_t base_ms, uint32_t max_ms, reconnect_fn retry)
+{
+    if (link >= RECONNECT_COUNT || retry == NULL) return;
+
+    ReconnectPolicy *p = &policies[link];
+    if (p->timer != NULL) return;
+
+    p->name = link_names[link];
+    p->base_ms = (base_ms > 0) ? base_ms : 1;
+    p->max_ms = (max_ms > p->base_ms) ? max_ms : p->base_ms;
+    p->retry = retry;
+
+    const esp_timer_create_args_t args = {
+        .callback = retry_timer_cb,
+        .arg = p,
+        .name = p->name,
+    };
+
+    if (esp_timer_create(&args, &p->timer) != ESP_OK) {
+        ESP_LOGE(TAG, "%s: timer create failed", p->name);
+        p->timer = NULL;
+    }
+}
+
+
+/**
+ * @brief A connect attempt failed or the link dropped: arm the next retry
+ *
+ * @return Delay until the retry in ms (0 if the link is not set up)
+ */
+uint32_t reconnect_policy_schedule(ReconnectLink link)
+{
+    ReconnectPolicy *p = policy_of(link);
+    if (p == NULL) return 0;
+
+    if (p->stats.streak == 0) {
+        p->down_us = esp_timer_get_time();
+    }
+
+    uint32_t ceiling = p->base_ms;
+    for (uint32_t i = 0; i < p->stats.streak && ceiling < p->max_ms; i++) {
+        ceiling *= 2;
+    }
+    if (ceiling > p->max_ms) {
+        ceiling = p->max_ms;
+    }
+
+    uint32_t delay = ceiling / 2 + jitter_random() % (ceiling / 2 + 1);
+
+    // Load shedding: stay away at least as long as asked, spread out
+    if (p->hint_ms > delay) {
+        delay = p->hint_ms + jitter_random() % (p->hint_ms / 2 + 1);
+    }
+    p->hint_ms = 0;
+
+    p->stats.attempts++;
+    p->stats.streak++;
+    if (p->stats.streak > p->stats.max_streak) {
+        p->stats.max_streak = p->stats.streak;
+    }
+    p->stats.last_delay_ms = delay;
+
+    esp_timer_stop(p->timer);
+    esp_timer_start_once(p->timer, (uint64_t)delay * 1000);
+
+    ESP_LOGI(TAG, "%s: attempt %lu in %lu ms", p->name,
+             (unsigned long)p->stats.streak, (unsigned long)delay);
+
+    return delay;
+}
+
+
+/**
+ * @brief Drop a pending retry (link paused on purpose)
+ */
+void reconnect_policy_cancel(ReconnectLink link)
+{
+    ReconnectPolicy *p = policy_of(link);
+    if (p == NULL) return;
+
+    esp_timer_stop(p->timer);
+}
+
+
+/**
+ * @brief Link is up: end the outage and restart from base_ms
+ */
+void reconnect_policy_connected(ReconnectLink link)
+{
+    ReconnectPolicy *p = policy_of(link);
+    if (p == NULL) return;
+
+    esp_timer_stop(p->timer);
+
+    if (p->stats.streak > 0) {
+        p->stats.last_outage_ms = (uint32_t)((esp_timer_get_time() - p->down_us) / 1000);
+        ESP_LOGI(TAG, "%s: up after %lu attempts, %lu ms", p->name,
+                 (unsigned long)p->stats.streak, (unsigned long)p->stats.last_outage_ms);
+    }
+    p->stats.streak = 0;
+    p->hint_ms = 0;
+}
+
+
+/**
+ * @brief Server asked to back off: next delay is at least min_delay_ms
+ */
+void reconnect_policy_hint(ReconnectLink link, uint32_t min_delay_ms)
+{
+    ReconnectPolicy *p = policy_of(link);
+    if (p == NULL) return;
+
+    p->hint_ms = (min_delay_ms < p->max_ms) ? min_delay_ms : p->max_ms;
+    p->stats.hints++;
+}
+
+
+/**
+ * @brief Copy the attempt counters of a link
+ */
+void reconnect_policy_get_stats(ReconnectLink link, ReconnectStats *stats)
+{
+    if (stats == NULL) return;
+
+    if (link >= RECONNECT_COUNT) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    *stats = policies[link].stats;
+}
@@ -0,0 +1,34 @@
+#ifndef RECONNECT_POLICY_H
+#define RECONNECT_POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Links with their own retry schedule
+typedef enum {
+    RECONNECT_WIFI = 0,         // Router (STA) connection
+    RECONNECT_MQTT,             // Broker connection
+    RECONNECT_COUNT
+} ReconnectLink;
+
+// Called from the esp_timer task when a retry is due
+typedef void (*reconnect_fn)(void);
+
+// Attempt timing (milliseconds)
+typedef struct {
+    uint32_t attempts;          // Retries scheduled since boot
+    uint32_t streak;            // Failed attempts of the current outage
+    uint32_t max_streak;        // Longest outage in attempts
+    uint32_t last_delay_ms;     // Delay of the last scheduled retry
+    uint32_t last_outage_ms;    // First failure → connected, last outage
+    uint32_t hints;             // Load-shedding refusals from the server
+} ReconnectStats;
+
+void reconnect_policy_init(ReconnectLink link, uint32_t base_ms, uint32_t max_ms, reconnect_fn retry);
+uint32_t reconnect_policy_schedule(ReconnectLink link);
+void reconnect_policy_cancel(ReconnectLink link);
+void reconnect_policy_connected(ReconnectLink link);
+void reconnect_policy_hint(ReconnectLink link, uint32_t min_delay_ms);
+void reconnect_policy_get_stats(ReconnectLink link, ReconnectStats *stats);
+
+#endif // RECONNECT_POLICY_H
@@ -0,0 +1,399 @@
+/**
+ * @file sensor_series.c
+ * @brief Batched, delta-encoded sensor time-series uploader
+ *
+ * This module:
+ *  - Buffers sensor samples in a fixed RAM ring (no heap)
+ *  - Delta-encodes them into compact binary blocks
+ *  - Publishes a block on the "sensor_series" MQTT topic when:
+ *      - the flush period elapses
+ *      - the ring is full
+ *      - a sample crosses the configured sensor limits
+ *
+ * Block layout (little-endian):
+ *
+ *   [0]      format version (2)
+ *   [1]      flush reason (series_flush_reason_t)
+ *   [2..3]   sample count
+ *   [4..5]   samples dropped since previous block
+ *   [6..9]   epoch seconds of first sample
+ *   [10..13] value of first sample (int32)
+ *   [14..17] MQTT message seq (msg_stamp.c)
+ *   [18..21] boot ID
+ *   [22..29] mono_us when the block was encoded (int64)
+ *   then for every following sample:
+ *            uvarint  time delta in ms
+ *            svarint  value delta (zigzag)
+ */
+
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "global_var.h"
+#include "msg_stamp.h"
+#include "mqtt_fn/mqtt_client_fn.h"
+#include "sensor_series.h"
+
+
+/* ======================================================================== */
+/* ========================== CONFIGURATION =============================== */
+/* ======================================================================== */
+
+#define SERIES_CAPACITY         CONFIG_SENSOR_SERIES_CAPACITY
+#define SERIES_FLUSH_PERIOD_MS  (CONFIG_SENSOR_SERIES_FLUSH_PERIOD_S * 1000)
+#define SERIES_TOPIC            "sensor_series"
+
+#define SERIES_FORMAT_VERSION   2
+#define SERIES_HEADER_SIZE      30
+
+/**
+ * @brief Worst case block size: header + 5 byte uvarint + 5 byte svarint
+ *        for every sample after the first.
+ */
+#define SERIES_BLOCK_MAX        (SERIES_HEADER_SIZE + (SERIES_CAPACITY * 10))
+
+// A block over the outbox cap would be refused on every flush
+_Static_assert(SERIES_BLOCK_MAX <= CONFIG_MQTT_OUTBOX_LIMIT_BYTES,
+               "SENSOR_SERIES_CAPACITY too large for MQTT_OUTBOX_LIMIT_BYTES");
+
+static const char *TAG = "SENSOR_SERIES";
+
+
+typedef struct {
+    int64_t t_ms;       // Monotonic time (esp_timer) in ms
+    int32_t value;
+} SeriesSample;
+
+static SeriesSample ring[SERIES_CAPACITY];
+static size_t ring_head = 0;        // Index of oldest sample
+static size_t ring_count = 0;
+static uint32_t ring_head_seq = 0;  // Samples ever removed from the head
+static int64_t ring_epoch_ms = 0;   // Epoch ms - t_ms, taken when the ring was empty
+static uint16_t ring_dropped = 0;
+
+static bool have_last = false;
+static int32_t last_value = 0;
+
+static SeriesStats stats;
+
+static SemaphoreHandle_t seriesMutex = NULL;
+static SemaphoreHandle_t flushMutex = NULL;
+
+// Encoded block (only touched while holding flushMutex)
+static uint8_t block_buf[SERIES_BLOCK_MAX];
+
+
+
+/* ======================================================================== */
+/* ============================ ENCODING ================================== */
+/* ======================================================================== */
+
+static size_t put_uvarint(uint8_t *out, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static size_t put_svarint(uint8_t *out, int64_t v)
+{
+    // Zigzag: small negative deltas stay small. The difference of two
+    // int32 values needs 33 bits, still at most 5 varint bytes
+    uint64_t zz = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+    return put_uvarint(out, zz);
+}
+
+static void put_u16(uint8_t *out, uint16_t v)
+{
+    out[0] = (uint8_t)v;
+    out[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *out, uint32_t v)
+{
+    out[0] = (uint8_t)v;
+    out[1] = (uint8_t)(v >> 8);
+    out[2] = (uint8_t)(v >> 16);
+    out[3] = (uint8_t)(v >> 24);
+}
+
+static void put_u64(uint8_t *out, uint64_t v)
+{
+    put_u32(&out[0], (uint32_t)v);
+    put_u32(&out[4], (uint32_t)(v >> 32));
+}
+
+
+/**
+ * @brief Encode the current ring contents into block_buf
+ *
+ * Caller must hold both seriesMutex and flushMutex.
+ *
+ * @return Encoded block length in bytes (0 if ring is empty)
+ */
+static size_t series_encode_ring(uint8_t reason)
+{
+    if (ring_count == 0) {
+        return 0;
+    }
+
+    const SeriesSample *first = &ring[ring_head];
+
+    // The block is one MQTT message: same sequence as the JSON topics
+    MsgStamp stamp;
+    msg_stamp_next(MSG_CHANNEL_MQTT, &stamp);
+
+    block_buf[0] = SERIES_FORMAT_VERSION;
+    block_buf[1] = reason;
+    put_u16(&block_buf[2], (uint16_t)ring_count);
+    put_u16(&block_buf[4], ring_dropped);
+    put_u32(&block_buf[6], (uint32_t)((first->t_ms + ring_epoch_ms) / 1000));
+    put_u32(&block_buf[10], (uint32_t)first->value);
+    put_u32(&block_buf[14], stamp.seq);
+    put_u32(&block_buf[18], stamp.boot_id);
+    put_u64(&block_buf[22], (uint64_t)stamp.mono_us);
+
+    size_t len = SERIES_HEADER_SIZE;
+    const SeriesSample *prev = first;
+
+    for (size_t i = 1; i < ring_count; i++) {
+        const SeriesSample *cur = &ring[(ring_head + i) % SERIES_CAPACITY];
+
+        int64_t dt = cur->t_ms - prev->t_ms;
+        if (dt < 0) dt = 0;
+        if (dt > UINT32_MAX) dt = UINT32_MAX;
+
+        len += put_uvarint(&block_buf[len], (uint32_t)dt);
+        len += put_svarint(&block_buf[len], (int64_t)cur->value - prev->value);
+
+        prev = cur;
+    }
+
+    return len;
+}
+
+
+
+/* ======================================================================== */
+/* ============================== FLUSH =================================== */
+/* ======================================================================== */
+
+/**
+ * @brief Encode and publish all buffered samples as one block
+ *
+ * Samples are kept in the ring while MQTT is offline so that
+ * no data is lost during short outages; once the ring is full
+ * the oldest samples are overwritten and counted as dropped.
+ *
+ * The ring is not locked while publishing: samples pushed meanwhile
+ * stay for the next block. Only after the block was accepted are its
+ * samples removed; a refused block (outbox over its cap) leaves the
+ * ring as it was and the next flush sends them again.
+ */
+void sensor_series_flush(series_flush_reason_t reason)
+{
+    if (seriesMutex == NULL) return;
+
+    if (!mqtt_is_connected()) {
+        return;
+    }
+
+    xSemaphoreTake(flushMutex, portMAX_DELAY);
+
+    xSemaphoreTake(seriesMutex, portMAX_DELAY);
+    size_t len = series_encode_ring((uint8_t)reason);
+    size_t count = ring_count;
+    uint32_t first_seq = ring_head_seq;
+    uint16_t dropped = ring_dropped;
+    xSemaphoreGive(seriesMutex);
+
+    if (len > 0) {
+        bool sent = mqtt_publish_binary(SERIES_TOPIC, block_buf, len);
+
+        xSemaphoreTake(seriesMutex, portMAX_DELAY);
+        if (sent) {
+            // Overwrites during the publish may already have removed
+            // some samples of the block; they were delivered after all
+            uint32_t overwritten = ring_head_seq - first_seq;
+            if (overwritten > count) overwritten = count;
+
+            size_t remove = count - overwritten;
+            ring_head = (ring_head + remove) % SERIES_CAPACITY;
+            ring_count -= remove;
+            ring_head_seq += remove;
+
+            uint32_t reported = dropped + overwritten;
+            ring_dropped = (ring_dropped > reported) ? (uint16_t)(ring_dropped - reported) : 0;
+            stats.samples_dropped -= overwritten;
+
+            stats.blocks_sent++;
+            stats.bytes_sent += len;
+        }
+        xSemaphoreGive(seriesMutex);
+
+        if (sent) {
+            ESP_LOGI(TAG, "Block sent: %u samples in %u bytes (reason %d)",
+                     (unsigned)count, (unsigned)len, reason);
+        } else {
+            ESP_LOGW(TAG, "Block publish failed, %u samples kept", (unsigned)count);
+        }
+    }
+
+    xSemaphoreGive(flushMutex);
+}
+
+
+
+/* ======================================================================== */
+/* ============================== PUSH ==================================== */
+/* ======================================================================== */
+
+/**
+ * @brief Check whether a new sample crossed the sensor limits
+ *        configured by the server (control_data → set_sensordata).
+ */
+static bool series_crossed_limit(int32_t prev, int32_t cur)
+{
+    xSemaphoreTake(serverMutex, portMAX_DELAY);
+    int upper = serverControl.sensor_upper_limit;
+    int lower = serverControl.sensor_lower_limit;
+    xSemaphoreGive(serverMutex);
+
+    // Limits not configured
+    if (upper <= lower) {
+        return false;
+    }
+
+    bool crossed_upper = (prev <= upper) != (cur <= upper);
+    bool crossed_lower = (prev >= lower) != (cur >= lower);
+
+    return crossed_upper || crossed_lower;
+}
+
+
+/**
+ * @brief Append one sensor sample to the time-series buffer
+ *
+ * Called by the sensor driver at its native sampling rate.
+ * Triggers an immediate flush when the buffer is full or
+ * the sample crosses a configured sensor limit.
+ *
+ * @param value Raw sensor reading
+ */
+void sensor_series_push(int32_t value)
+{
+    if (seriesMutex == NULL) return;
+
+    xSemaphoreTake(seriesMutex, portMAX_DELAY);
+
+    bool had_last = have_last;
+    int32_t prev_value = last_value;
+    have_last = true;
+    last_value = value;
+
+    bool overwrite = (ring_count == SERIES_CAPACITY);
+    if (overwrite) {
+        // Offline (or refused) and full: overwrite oldest
+        ring_head = (ring_head + 1) % SERIES_CAPACITY;
+        ring_count--;
+        ring_head_seq++;
+        if (ring_dropped < UINT16_MAX) ring_dropped++;
+        stats.samples_dropped++;
+    }
+
+    int64_t now_ms = esp_timer_get_time() / 1000;
+
+    // Wall clock offset of the monotonic time base: stays valid for
+    // whichever sample is the oldest after an overflow
+    if (ring_count == 0) {
+        ring_epoch_ms = (int64_t)time(NULL) * 1000 - now_ms;
+    }
+
+    SeriesSample *slot = &ring[(ring_head + ring_count) % SERIES_CAPACITY];
+    slot->t_ms = now_ms;
+    slot->value = value;
+    ring_count++;
+
+    stats.samples_pushed++;
+
+    // Flush once when the ring fills up; while it keeps overflowing the
+    // periodic flush retries instead of one attempt per sample
+    bool full = (ring_count == SERIES_CAPACITY) && !overwrite;
+
+    xSemaphoreGive(seriesMutex);
+
+    // serverMutex is not taken under seriesMutex
+    bool crossed = had_last && series_crossed_limit(prev_value, value);
+
+    if (crossed) {
+        ESP_LOGI(TAG, "Sensor limit crossed (value %ld), flushing", (long)value);
+        sensor_series_flush(SERIES_FLUSH_THRESHOLD);
+    } else if (full) {
+        sensor_series_flush(SERIES_FLUSH_FULL);
+    }
+}
+
+
+/**
+ * @brief Copy uploader counters
+ */
+void sensor_series_get_stats(SeriesStats *out)
+{
+    if (out == NULL || seriesMutex == NULL) return;
+
+    xSemaphoreTake(seriesMutex, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(seriesMutex);
+}
+
+
+
+/* ======================================================================== */
+/* ============================ INIT / TASK =============================== */
+/* ======================================================================== */
+
+/**
+ * @brief Create the buffer mutexes. Must be called before pushing samples.
+ */
+void sensor_series_init(void)
+{
+    if (seriesMutex != NULL) return;
+
+    seriesMutex = xSemaphoreCreateMutex();
+    flushMutex = xSemaphoreCreateMutex();
+
+    if (seriesMutex == NULL || flushMutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create series mutex");
+        seriesMutex = NULL;
+        return;
+    }
+
+    ESP_LOGI(TAG, "Sensor series ready (capacity %d, flush every %d s)",
+             SERIES_CAPACITY, CONFIG_SENSOR_SERIES_FLUSH_PERIOD_S);
+}
+
+
+/**
+ * @brief FreeRTOS task that flushes the series on a fixed cadence
+ */
+void sensor_series_task(void *pvParameters)
+{
+    (void) pvParameters;
+
+    sensor_series_init();
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(SERIES_FLUSH_PERIOD_MS));
+        sensor_series_flush(SERIES_FLUSH_PERIOD);
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef SENSOR_SERIES_H
+#define SENSOR_SERIES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Reason a block was flushed (stored in the block header)
+typedef enum {
+    SERIES_FLUSH_PERIOD = 0,
+    SERIES_FLUSH_FULL,
+    SERIES_FLUSH_THRESHOLD
+} series_flush_reason_t;
+
+// Counters for monitoring the time-series uploader
+typedef struct {
+    uint32_t samples_pushed;
+    uint32_t samples_dropped;
+    uint32_t blocks_sent;
+    uint32_t bytes_sent;
+} SeriesStats;
+
+void sensor_series_init(void);
+void sensor_series_push(int32_t value);
+void sensor_series_flush(series_flush_reason_t reason);
+void sensor_series_get_stats(SeriesStats *stats);
+void sensor_series_task(void *pvParameters);
+
+#endif // SENSOR_SERIES_H
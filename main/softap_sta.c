@@ -38,12 +38,14 @@
 #include "lwip/sys.h"
 
 #include "global_var.h"
+#include "reconnect_policy.h"
 #include "eeprom_fn/wifi_storage.h"
 #include "eeprom_fn/schedule_storage.h"
 #include "time_func.h"
 #include "websocket_fn/websocket_server_fn.h"
 #include "mqtt_fn/mqtt_client_fn.h"
 #include "valve_fn/valve_process.h"
+#include "sensor_fn/sensor_series.h"
 #include "main_process.h"
 #include "test_process.h"
 
@@ -57,6 +59,8 @@
 #define ESP_WIFI_STA_PASSWD                 CONFIG_ESP_WIFI_STA_PASSWD  
 #define ESP_WIFI_STA_MAXIMUM_RETRY          CONFIG_ESP_WIFI_STA_MAXIMUM_RETRY
 #define ESP_WIFI_STA_MODE_RESET             CONFIG_ESP_WIFI_STA_MODE_RESET
+#define ESP_WIFI_STA_RETRY_BASE_MS          CONFIG_ESP_WIFI_STA_RETRY_BASE_MS
+#define ESP_WIFI_STA_RETRY_MAX_MS           (CONFIG_ESP_WIFI_STA_RETRY_MAX_S * 1000u)
 
 
 /* AP Configuration */
@@ -92,6 +96,17 @@ static bool web_running = false;
 /* ========================== WIFI EVENT HANDLER ========================== */
 /* ======================================================================== */
 
+/**
+ * @brief Retry the router connection (esp_timer task, from reconnect_policy)
+ */
+static void wifi_retry_connect(void)
+{
+    if (s_ap_client_count == 0) {
+        esp_wifi_connect();
+    }
+}
+
+
 /**
  * @brief Central WiFi event handler
  *
@@ -133,9 +148,9 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t e
         router_connected = false;
         ESP_LOGI(TAG_STA, "Router Disconnected/Not Found.");
 
-        /* Stop MQTT */
+        /* Pause MQTT (client, outbox and publish task are kept) */
         if (mqtt_running) {
-            stop_mqtt_client();
+            pause_mqtt_client();
             mqtt_running = false;
         }
 
@@ -155,12 +170,11 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t e
 
         /**
          * If no AP clients are connected,
-         * retry router connection.
+         * retry router connection (jittered backoff).
          */
         if (s_ap_client_count == 0) {
-            ESP_LOGI(TAG_STA, "Retrying Router connection...");
-            vTaskDelay(pdMS_TO_TICKS(1000));
-            esp_wifi_connect();
+            uint32_t delay_ms = reconnect_policy_schedule(RECONNECT_WIFI);
+            ESP_LOGI(TAG_STA, "Retrying Router connection in %lu ms...", (unsigned long)delay_ms);
 
             led_blink(&greenLED, 500);
         } else {
@@ -179,6 +193,8 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t e
         router_connected = true;
         ESP_LOGI(TAG_STA, "Connected to Router! IP: " IPSTR, IP2STR(&event->ip_info.ip));
 
+        reconnect_policy_connected(RECONNECT_WIFI);
+
         /**
          * Router connected → Disable AP
          */
@@ -211,9 +227,9 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t e
         wifi_event_ap_staconnected_t* event = (wifi_event_ap_staconnected_t*) event_data;
         ESP_LOGI(TAG_AP, "Client joined AP: "MACSTR, MAC2STR(event->mac));
         
-        /* Stop MQTT if running */
+        /* Pause MQTT if running */
         if (mqtt_running) {
-            stop_mqtt_client();
+            pause_mqtt_client();
             mqtt_running = false;
         }
 
@@ -231,6 +247,7 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t e
          * Stop router scanning while user configures device.
          */
         ESP_LOGI(TAG_AP, "Client connected. Stopping Router search (STA Idle).");
+        reconnect_policy_cancel(RECONNECT_WIFI);
         esp_wifi_disconnect(); 
     }
     
@@ -375,6 +392,9 @@ esp_netif_t *wifi_init_sta(void)
  */
 void wifi_init_smart_mode(void)
 {
+    reconnect_policy_init(RECONNECT_WIFI, ESP_WIFI_STA_RETRY_BASE_MS, ESP_WIFI_STA_RETRY_MAX_MS,
+                          wifi_retry_connect);
+
     // Register Event handler
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
                     ESP_EVENT_ANY_ID,
@@ -464,6 +484,9 @@ void app_main(void)
     // start_limit_test();
     // start_motor_test();
     // start_valve_toggle_test();
+    // start_json_benchmark();
+    // start_json_decode_benchmark();
+    // start_cbor_benchmark();
 
     init_valve_system();
 
@@ -475,4 +498,7 @@ void app_main(void)
 
     xTaskCreate(valve_sync_process, "valve_sync_process", 4096, NULL, 5, NULL);
 
+    sensor_series_init();
+    xTaskCreate(sensor_series_task, "sensor_series_task", 4096, NULL, 4, NULL);
+
 }
\ No newline at end of file
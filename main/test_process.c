@@ -1,8 +1,21 @@
+#include <string.h>
 #include "esp_log.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "cJSON.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-
-
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+
+#include "global_var.h"
+#include "msg_stamp.h"
+#include "time_func.h"
+#include "codec_fn/command_decoder.h"
+#include "codec_fn/json_writer.h"
+#include "mqtt_fn/mqtt_client_fn.h"
+#include "mqtt_fn/mqtt_state_fn.h"
 #include "valve_fn/valve_process.h"
 #include "test_process.h"
 
@@ -185,4 +198,343 @@ void start_valve_toggle_test(void)
         5,
         NULL
     );
-}
\ No newline at end of file
+}
+
+
+
+// json writer benchmark ----------------------------------------------
+
+static const char *JSON_BENCH_TAG = "JSON_BENCH";
+
+#define JSON_BENCH_ITERATIONS   200
+
+/**
+ * Reference cJSON builder (same payload as create_valve_state_data)
+ *
+ * Returns the DOM so the caller can sample the heap while both the
+ * tree and the printed string are alive.
+ */
+static cJSON *json_bench_cjson_state(const GetData *data)
+{
+    char timestamp[25];
+    get_current_timestamp(timestamp, sizeof(timestamp));
+
+    MsgStamp stamp;
+    msg_stamp_next(MSG_CHANNEL_MQTT, &stamp);
+
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "event", "valve_basic_data");
+    cJSON_AddStringToObject(json, "timestamp", timestamp);
+    cJSON_AddStringToObject(json, "device_id", CONFIG_WIFI_VALVE_ID);
+    cJSON_AddNumberToObject(json, "seq", stamp.seq);
+    cJSON_AddNumberToObject(json, "boot_id", stamp.boot_id);
+    cJSON_AddNumberToObject(json, "mono_us", (double)stamp.mono_us);
+
+    cJSON *controller_data = cJSON_CreateObject();
+    cJSON_AddBoolToObject(controller_data, "schedule", data->schedule_control);
+    cJSON_AddBoolToObject(controller_data, "sensor", data->sensor_control);
+    cJSON_AddItemToObject(json, "get_controller", controller_data);
+
+    cJSON *valve_data = cJSON_CreateObject();
+    cJSON_AddNumberToObject(valve_data, "angle", data->angle);
+    cJSON_AddBoolToObject(valve_data, "is_open", data->is_open);
+    cJSON_AddBoolToObject(valve_data, "is_close", data->is_close);
+    cJSON_AddBoolToObject(valve_data, "is_moving", data->is_moving);
+    if (data->is_moving) {
+        cJSON_AddNumberToObject(valve_data, "motion_ms",
+                                (int)((esp_timer_get_time() - data->motion_start_us) / 1000));
+    }
+    cJSON_AddItemToObject(json, "get_valvedata", valve_data);
+
+    cJSON *limit_data = cJSON_CreateObject();
+    cJSON_AddBoolToObject(limit_data, "is_open_limit", data->open_limit_available);
+    cJSON_AddBoolToObject(limit_data, "open_limit", data->open_limit_click);
+    cJSON_AddBoolToObject(limit_data, "is_close_limit", data->close_limit_available);
+    cJSON_AddBoolToObject(limit_data, "close_limit", data->close_limit_click);
+    cJSON_AddItemToObject(json, "get_limitdata", limit_data);
+
+    return json;
+}
+
+static void json_bench_task(void *arg)
+{
+    static char buf[768];
+
+    GetData data;
+    xSemaphoreTake(valveMutex, portMAX_DELAY);
+    data = valveData;
+    xSemaphoreGive(valveMutex);
+
+    uint32_t cjson_cycles = 0, writer_cycles = 0;
+    size_t cjson_peak = 0, writer_peak = 0;
+    int cjson_len = 0, writer_len = 0;
+
+    for (int i = 0; i < JSON_BENCH_ITERATIONS; i++) {
+
+        /* cJSON: DOM + print (heap) */
+        size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        uint32_t start = esp_cpu_get_cycle_count();
+
+        cJSON *json = json_bench_cjson_state(&data);
+        char *json_str = cJSON_PrintUnformatted(json);
+
+        cjson_cycles += esp_cpu_get_cycle_count() - start;
+
+        // Tree and string are both live here: this is the peak
+        size_t heap_during = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        if (heap_before > heap_during && heap_before - heap_during > cjson_peak) {
+            cjson_peak = heap_before - heap_during;
+        }
+
+        start = esp_cpu_get_cycle_count();
+        cJSON_Delete(json);
+        cjson_cycles += esp_cpu_get_cycle_count() - start;
+
+        if (json_str != NULL) {
+            cjson_len = strlen(json_str);
+            cJSON_free(json_str);
+        }
+
+        /* Streaming writer: static buffer */
+        heap_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        start = esp_cpu_get_cycle_count();
+
+        writer_len = create_valve_state_data(buf, sizeof(buf), PAYLOAD_JSON);
+
+        writer_cycles += esp_cpu_get_cycle_count() - start;
+        heap_during = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        if (heap_before > heap_during && heap_before - heap_during > writer_peak) {
+            writer_peak = heap_before - heap_during;
+        }
+    }
+
+    ESP_LOGI(JSON_BENCH_TAG, "cJSON : %lu cycles/msg, peak heap %u bytes, %d bytes out",
+             (unsigned long)(cjson_cycles / JSON_BENCH_ITERATIONS), (unsigned)cjson_peak, cjson_len);
+    ESP_LOGI(JSON_BENCH_TAG, "writer: %lu cycles/msg, peak heap %u bytes, %d bytes out",
+             (unsigned long)(writer_cycles / JSON_BENCH_ITERATIONS), (unsigned)writer_peak, writer_len);
+
+    vTaskDelete(NULL);
+}
+
+void start_json_benchmark(void)
+{
+    xTaskCreate(
+        json_bench_task,
+        "json_bench_task",
+        4096,
+        NULL,
+        5,
+        NULL
+    );
+}
+
+
+
+// json decoder benchmark ---------------------------------------------
+
+static const char *JSON_DECODE_TAG = "JSON_DECODE_BENCH";
+
+// Representative control_data message with a full schedule
+static const char json_decode_sample[] =
+    "{\"event\":\"set_valve_control\",\"device_id\":\"" CONFIG_WIFI_VALVE_ID "\","
+    "\"set_controllerdata\":{\"schedule\":true,\"sensor\":false},"
+    "\"set_scheduledata\":{\"set_schedule\":true,\"schedule_info\":["
+    "{\"day\":\"Monday\",\"open\":\"06:00\",\"close\":\"06:30\"},"
+    "{\"day\":\"Monday\",\"open\":\"18:00\",\"close\":\"18:30\"},"
+    "{\"day\":\"Tuesday\",\"open\":\"06:00\",\"close\":\"06:30\"},"
+    "{\"day\":\"Wednesday\",\"open\":\"06:00\",\"close\":\"06:30\"},"
+    "{\"day\":\"Thursday\",\"open\":\"06:00\",\"close\":\"06:30\"},"
+    "{\"day\":\"Friday\",\"open\":\"06:00\",\"close\":\"06:30\"},"
+    "{\"day\":\"Friday\",\"open\":\"18:00\",\"close\":\"18:30\"},"
+    "{\"day\":\"Saturday\",\"open\":\"07:00\",\"close\":\"07:45\"},"
+    "{\"day\":\"Sunday\",\"open\":\"07:00\",\"close\":\"07:45\"},"
+    "{\"day\":\"Sunday\",\"open\":\"19:00\",\"close\":\"19:15\"}]},"
+    "\"set_sensordata\":{\"upper_limit\":80,\"lower_limit\":20}}";
+
+/**
+ * Reference cJSON decode (same fields as command_decode)
+ */
+static int json_decode_cjson(const char *data, size_t *tree_bytes)
+{
+    size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+    cJSON *json = cJSON_Parse(data);
+    if (json == NULL) return -1;
+
+    size_t heap_after = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    *tree_bytes = (heap_before > heap_after) ? heap_before - heap_after : 0;
+
+    int count = 0;
+    cJSON *sched = cJSON_GetObjectItem(json, "set_scheduledata");
+    cJSON *info = cJSON_GetObjectItem(sched, "schedule_info");
+    int n = cJSON_GetArraySize(info);
+    for (int i = 0; i < n && i < 10; i++) {
+        cJSON *item = cJSON_GetArrayItem(info, i);
+        if (cJSON_IsString(cJSON_GetObjectItem(item, "day"))) count++;
+    }
+
+    cJSON_Delete(json);
+    return count;
+}
+
+static void json_decode_bench_task(void *arg)
+{
+    static JsonToken tokens[JSON_DECODER_MAX_TOKENS];
+    static ValveCommand cmd;
+    const size_t len = sizeof(json_decode_sample) - 1;
+
+    uint32_t cjson_cycles = 0, decoder_cycles = 0;
+    size_t cjson_peak = 0, decoder_peak = 0;
+    int cjson_items = 0;
+
+    for (int i = 0; i < JSON_BENCH_ITERATIONS; i++) {
+
+        /* cJSON: node per key/value (heap) */
+        size_t tree_bytes = 0;
+        uint32_t start = esp_cpu_get_cycle_count();
+
+        cjson_items = json_decode_cjson(json_decode_sample, &tree_bytes);
+
+        cjson_cycles += esp_cpu_get_cycle_count() - start;
+        if (tree_bytes > cjson_peak) cjson_peak = tree_bytes;
+
+        /* In-place decoder: static tokens + typed struct */
+        size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        start = esp_cpu_get_cycle_count();
+
+        command_decode(json_decode_sample, len, PAYLOAD_JSON, tokens, JSON_DECODER_MAX_TOKENS, &cmd);
+
+        decoder_cycles += esp_cpu_get_cycle_count() - start;
+        size_t heap_after = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        if (heap_before > heap_after && heap_before - heap_after > decoder_peak) {
+            decoder_peak = heap_before - heap_after;
+        }
+    }
+
+    ESP_LOGI(JSON_DECODE_TAG, "payload %u bytes", (unsigned)len);
+    ESP_LOGI(JSON_DECODE_TAG, "cJSON  : %lu cycles/msg, peak heap %u bytes, %d schedules",
+             (unsigned long)(cjson_cycles / JSON_BENCH_ITERATIONS), (unsigned)cjson_peak, cjson_items);
+    ESP_LOGI(JSON_DECODE_TAG, "decoder: %lu cycles/msg, peak heap %u bytes, %u schedules, %u token bytes (static)",
+             (unsigned long)(decoder_cycles / JSON_BENCH_ITERATIONS), (unsigned)decoder_peak,
+             (unsigned)cmd.schedule_count, (unsigned)sizeof(tokens));
+
+    vTaskDelete(NULL);
+}
+
+void start_json_decode_benchmark(void)
+{
+    xTaskCreate(
+        json_decode_bench_task,
+        "json_decode_bench",
+        4096,
+        NULL,
+        5,
+        NULL
+    );
+}
+
+
+
+// cbor benchmark ----------------------------------------------------
+
+static const char *CBOR_BENCH_TAG = "CBOR_BENCH";
+
+/**
+ * Re-encode a decoded control command (same writer, either format)
+ */
+static int cbor_bench_command(const ValveCommand *cmd, char *buf, size_t size, PayloadFormat format)
+{
+    JsonWriter w;
+    jw_init_format(&w, buf, size, format);
+
+    jw_object_begin(&w);
+    jw_key_string(&w, "event", cmd->event);
+    jw_key_string(&w, "device_id", cmd->device_id);
+
+    jw_key_object_begin(&w, "set_controllerdata");
+    jw_key_bool(&w, "schedule", cmd->schedule_control);
+    jw_key_bool(&w, "sensor", cmd->sensor_control);
+    jw_object_end(&w);
+
+    jw_key_object_begin(&w, "set_scheduledata");
+    jw_key_bool(&w, "set_schedule", cmd->set_schedule);
+    jw_key_array_begin(&w, "schedule_info");
+    for (size_t i = 0; i < cmd->schedule_count; i++) {
+        jw_object_begin(&w);
+        jw_key_string(&w, "day", cmd->schedule_info[i].day);
+        jw_key_string(&w, "open", cmd->schedule_info[i].open);
+        jw_key_string(&w, "close", cmd->schedule_info[i].close);
+        jw_object_end(&w);
+    }
+    jw_array_end(&w);
+    jw_object_end(&w);
+
+    jw_key_object_begin(&w, "set_sensordata");
+    jw_key_int(&w, "upper_limit", cmd->sensor_upper_limit);
+    jw_key_int(&w, "lower_limit", cmd->sensor_lower_limit);
+    jw_object_end(&w);
+    jw_object_end(&w);
+
+    return jw_finish(&w);
+}
+
+static void cbor_bench_task(void *arg)
+{
+    // Same size as the publish task buffer: telemetry must fit as sent
+    static char json_buf[MQTT_TX_BUFFER_SIZE];
+    static char cbor_buf[MQTT_TX_BUFFER_SIZE];
+    static JsonToken tokens[JSON_DECODER_MAX_TOKENS];
+    static ValveCommand cmd;
+
+    /* Outbound: consolidated telemetry */
+    uint32_t enc_cycles[2] = {0};
+    int enc_len[2] = {0};
+    char *enc_buf[2] = { json_buf, cbor_buf };
+
+    for (int i = 0; i < JSON_BENCH_ITERATIONS; i++) {
+        for (int f = PAYLOAD_JSON; f <= PAYLOAD_CBOR; f++) {
+            uint32_t start = esp_cpu_get_cycle_count();
+            enc_len[f] = create_valve_telemetry(enc_buf[f], sizeof(json_buf), (PayloadFormat)f);
+            enc_cycles[f] += esp_cpu_get_cycle_count() - start;
+        }
+    }
+
+    /* Inbound: full control_data command in both encodings */
+    command_decode(json_decode_sample, sizeof(json_decode_sample) - 1, PAYLOAD_JSON,
+                   tokens, JSON_DECODER_MAX_TOKENS, &cmd);
+
+    int dec_len[2];
+    dec_len[PAYLOAD_JSON] = cbor_bench_command(&cmd, json_buf, sizeof(json_buf), PAYLOAD_JSON);
+    dec_len[PAYLOAD_CBOR] = cbor_bench_command(&cmd, cbor_buf, sizeof(cbor_buf), PAYLOAD_CBOR);
+
+    uint32_t dec_cycles[2] = {0};
+    for (int i = 0; i < JSON_BENCH_ITERATIONS; i++) {
+        for (int f = PAYLOAD_JSON; f <= PAYLOAD_CBOR; f++) {
+            uint32_t start = esp_cpu_get_cycle_count();
+            command_decode(enc_buf[f], dec_len[f], (PayloadFormat)f,
+                           tokens, JSON_DECODER_MAX_TOKENS, &cmd);
+            dec_cycles[f] += esp_cpu_get_cycle_count() - start;
+        }
+    }
+
+    ESP_LOGI(CBOR_BENCH_TAG, "telemetry encode: JSON %d bytes %lu cycles, CBOR %d bytes %lu cycles",
+             enc_len[PAYLOAD_JSON], (unsigned long)(enc_cycles[PAYLOAD_JSON] / JSON_BENCH_ITERATIONS),
+             enc_len[PAYLOAD_CBOR], (unsigned long)(enc_cycles[PAYLOAD_CBOR] / JSON_BENCH_ITERATIONS));
+    ESP_LOGI(CBOR_BENCH_TAG, "command decode  : JSON %d bytes %lu cycles, CBOR %d bytes %lu cycles",
+             dec_len[PAYLOAD_JSON], (unsigned long)(dec_cycles[PAYLOAD_JSON] / JSON_BENCH_ITERATIONS),
+             dec_len[PAYLOAD_CBOR], (unsigned long)(dec_cycles[PAYLOAD_CBOR] / JSON_BENCH_ITERATIONS));
+
+    vTaskDelete(NULL);
+}
+
+void start_cbor_benchmark(void)
+{
+    xTaskCreate(
+        cbor_bench_task,
+        "cbor_bench_task",
+        4096,
+        NULL,
+        5,
+        NULL
+    );
+}
@@ -4,5 +4,8 @@
 void start_limit_test(void);
 void start_motor_test(void);
 void start_valve_toggle_test(void);
+void start_json_benchmark(void);
+void start_json_decode_benchmark(void);
+void start_cbor_benchmark(void);
 
 #endif
\ No newline at end of file
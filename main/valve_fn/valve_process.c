@@ -1,5 +1,6 @@
 #include "sdkconfig.h" 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
@@ -9,6 +10,7 @@
 #include "valve_motor.h"
 #include "limit_switch.h"
 #include "valve_process.h"
+#include "mqtt_fn/mqtt_cadence.h"
 
 
 // define Valve pins
@@ -107,6 +109,23 @@ int valve_test(void)
 }
 
 
+/**
+ * @brief Mark the start of a motion and wake the publisher
+ *
+ * The end of the motion is written together with the final valve
+ * state in motor_open() / motor_close().
+ */
+static void valve_motion_begin(void)
+{
+    xSemaphoreTake(valveMutex, portMAX_DELAY);
+    valveData.is_moving = true;
+    valveData.motion_start_us = esp_timer_get_time();
+    xSemaphoreGive(valveMutex);
+
+    mqtt_cadence_notify();
+}
+
+
 int motor_open(void) {
     unsigned long op_start = xTaskGetTickCount() * portTICK_PERIOD_MS;
     const unsigned long op_timeout = 10000;
@@ -114,8 +133,11 @@ int motor_open(void) {
 
     errorCode = valve_test();
 
+    bool moved = false;
     if (motor.state != 1 && errorCode == 0) {
         bool turn_state = true;
+        valve_motion_begin();
+        moved = true;
         
         while (turn_state) {
             if (limit_switch_click(&openLimit) == 1) {
@@ -150,6 +172,7 @@ int motor_open(void) {
         valveData.is_open = true;
         valveData.is_close = false;
         valveData.angle = 90;
+        valveData.is_moving = false;
         xSemaphoreGive(valveMutex);
     } else {
         led_on(&redLED);
@@ -157,9 +180,15 @@ int motor_open(void) {
 
         xSemaphoreTake(valveMutex, portMAX_DELAY);
         valveData.is_open = false;
+        valveData.is_moving = false;
         sprintf(valveData.error_msg, "Motor open error code: %d", errorCode);
         xSemaphoreGive(valveMutex);
     }
+
+    // End of travel; the caller publishes the final angle and error
+    if (moved) {
+        mqtt_cadence_notify();
+    }
     
     return errorCode;
 }
@@ -172,8 +201,11 @@ int motor_close(void) {
 
     errorCode = valve_test();
 
+    bool moved = false;
     if (motor.state != 10 && errorCode == 0) {
         bool turn_state = true;
+        valve_motion_begin();
+        moved = true;
 
         while (turn_state) {
             if (limit_switch_click(&closeLimit) == 1) {
@@ -208,6 +240,7 @@ int motor_close(void) {
         valveData.is_open = false;
         valveData.is_close = true;
         valveData.angle = 0;
+        valveData.is_moving = false;
         xSemaphoreGive(valveMutex);
     } else {
         led_on(&redLED);
@@ -215,9 +248,15 @@ int motor_close(void) {
 
         xSemaphoreTake(valveMutex, portMAX_DELAY);
         valveData.is_close = false;
+        valveData.is_moving = false;
         sprintf(valveData.error_msg, "Motor close error code: %d", errorCode);
         xSemaphoreGive(valveMutex);
     }
+
+    // End of travel; the caller publishes the final angle and error
+    if (moved) {
+        mqtt_cadence_notify();
+    }
     
     return errorCode;
 }
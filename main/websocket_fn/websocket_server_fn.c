@@ -1,5 +1,4 @@
 #include "esp_log.h"
-#include "cJSON.h"
 
 #include "websocket_server_fn.h"
 #include "websocket_state_fn.h"
@@ -13,6 +12,12 @@
 #define EXAMPLE_MAX_STA_CONN 5
 #define MAX_CLIENTS 10
 
+// Outbound WebSocket JSON buffer
+#define WS_TX_BUFFER_SIZE 768
+
+// Inbound WebSocket frame buffer (largest accepted command)
+#define WS_RX_BUFFER_SIZE 1024
+
 // Flag to indicate whether client is authorized
 bool connection_authorized = false;
 static const char *TAG_WEBSERVER = "WEB SERVER";
@@ -43,15 +48,28 @@ void stop_webserver(void)
  *==============================================================*/
 
 /**
- * @brief Send JSON message asynchronously to all connected
+ * @brief Build a JSON message and send it to all connected
  *        WebSocket clients.
+ *
+ * Runs in the httpd task. The payload is built directly into a
+ * static buffer by the job's builder, so no heap is used; the
+ * buffer is safe to reuse because httpd work items run one at a
+ * time and the frames are sent before this function returns.
  * 
- * @param arg Pointer to dynamically allocated JSON string.
- *            Memory will be freed inside this function.
+ * @param arg Pointer to a static WsPayloadJob.
  */
 void websocket_async_send(void *arg) 
 {
-    char *json_string = (char *)arg;
+    static char ws_tx_buf[WS_TX_BUFFER_SIZE];
+
+    const WsPayloadJob *job = (const WsPayloadJob *)arg;
+    if (job == NULL || job->build == NULL) return;
+
+    int len = job->build(ws_tx_buf, sizeof(ws_tx_buf));
+    if (len < 0) {
+        ESP_LOGE(TAG_WEBSERVER, "Failed to build websocket payload");
+        return;
+    }
     
     // Get list of connected clients
     size_t fds = EXAMPLE_MAX_STA_CONN;
@@ -68,17 +86,29 @@ void websocket_async_send(void *arg)
             if (httpd_ws_get_fd_info(esp_server, client_fd) == HTTPD_WS_CLIENT_WEBSOCKET) {
                 httpd_ws_frame_t ws_pkt;
                 memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-                ws_pkt.payload = (uint8_t *)json_string;
-                ws_pkt.len = strlen(json_string);
+                ws_pkt.payload = (uint8_t *)ws_tx_buf;
+                ws_pkt.len = (size_t)len;
                 ws_pkt.type = HTTPD_WS_TYPE_TEXT;
 
                 httpd_ws_send_frame_async(esp_server, client_fd, &ws_pkt);
             }
         }
     }
-    
-    // Free the memory allocated in send_device_info_json
-    free(json_string);
+}
+
+
+/**
+ * @brief Queue a payload job for broadcast from the httpd task
+ *
+ * @param job Static job describing how to build the payload
+ */
+esp_err_t websocket_queue_payload(const WsPayloadJob *job)
+{
+    if (esp_server == NULL || job == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    return httpd_queue_work(esp_server, websocket_async_send, (void *)job);
 }
 
 
@@ -106,8 +136,11 @@ static esp_err_t ws_handler(httpd_req_t *req)
 
     /*----------------- Receive WebSocket Frame -----------------*/
 
+    // Frames are handled one at a time in the httpd task, so a
+    // single static buffer replaces the per-frame calloc.
+    static uint8_t ws_rx_buf[WS_RX_BUFFER_SIZE + 1];
+
     httpd_ws_frame_t ws_pkt;
-    uint8_t *buf = NULL;
     memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
     ws_pkt.type = HTTPD_WS_TYPE_TEXT;
 
@@ -118,26 +151,25 @@ static esp_err_t ws_handler(httpd_req_t *req)
         return ret;
     }
 
-    // Allocate memory for the payload, if data available
+    // Receive the payload, if data available
     if (ws_pkt.len) {
-        buf = calloc(1, ws_pkt.len + 1);
-        if (buf == NULL) {
-            ESP_LOGE(TAG_WEBSERVER, "Failed to calloc memory for buf");
-            return ESP_ERR_NO_MEM;
+        if (ws_pkt.len > WS_RX_BUFFER_SIZE) {
+            ESP_LOGE(TAG_WEBSERVER, "Frame too large: %u bytes", (unsigned)ws_pkt.len);
+            return ESP_ERR_INVALID_SIZE;
         }
-        ws_pkt.payload = buf;
-        
+        ws_pkt.payload = ws_rx_buf;
+
         // Receive the actual data
         ret = httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len);
         if (ret == ESP_OK) {
+            ws_rx_buf[ws_pkt.len] = '\0';
+
             // json msg decode
-            process_message((char*)ws_pkt.payload, &connection_authorized);
+            process_message((const char *)ws_pkt.payload, ws_pkt.len, &connection_authorized);
+            ESP_LOGI(TAG_WEBSERVER, "Got packet with message: %s", ws_pkt.payload);
         }
-        
-        ESP_LOGI(TAG_WEBSERVER, "Got packet with message: %s", ws_pkt.payload);
     }
-    
-    if (buf) free(buf);
+
     return ret;
 }
 
@@ -162,6 +194,8 @@ httpd_handle_t start_webserver(void)
         return esp_server;
     }
 
+    websocket_state_init();
+
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.lru_purge_enable = true; // Auto close old connections if full
 
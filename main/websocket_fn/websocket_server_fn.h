@@ -10,6 +10,15 @@ extern bool connection_authorized;
 
 httpd_handle_t start_webserver(void);
 void stop_webserver(void);
+// Writes a JSON payload into buf; returns length or -1 on overflow
+typedef int (*ws_payload_builder_t)(char *buf, size_t size);
+
+// Payload job queued to the httpd task (must be static)
+typedef struct {
+    ws_payload_builder_t build;
+} WsPayloadJob;
+
 void websocket_async_send(void *arg);
+esp_err_t websocket_queue_payload(const WsPayloadJob *job);
 
 #endif
\ No newline at end of file
@@ -1,12 +1,16 @@
 #include <string.h>
 #include <stdbool.h>
 #include "esp_log.h"
-#include "cJSON.h"
 #include "sdkconfig.h" 
 
 #include "global_var.h"
+#include "device_shadow.h"
 #include "websocket_state_fn.h"
 #include "time_func.h"
+#include "msg_stamp.h"
+#include "codec_fn/json_writer.h"
+#include "codec_fn/command_decoder.h"
+#include "codec_fn/cmd_dispatch.h"
 #include "eeprom_fn/wifi_storage.h"
 
 
@@ -28,6 +32,31 @@ static const char *TAG = "STATE UPDATE OFFLINE";
  *                  SEND DEVICE BASIC INFO
  *==============================================================*/
 
+/**
+ * @brief Write device identification JSON into buf
+ *
+ * @return JSON length, or -1 if buf is too small
+ */
+static int build_device_info(char *buf, size_t size) {
+    char timestamp[25];
+    get_current_timestamp(timestamp, sizeof(timestamp));
+
+    JsonWriter w;
+    jw_init(&w, buf, size);
+
+    jw_object_begin(&w);
+    jw_key_string(&w, "event", "device_info");
+    jw_key_string(&w, "timestamp", timestamp);
+    jw_key_string(&w, "device_id", DEVICE_ID);
+    msg_stamp_write(&w, MSG_CHANNEL_WS);
+    jw_object_end(&w);
+
+    return jw_finish(&w);
+}
+
+static const WsPayloadJob device_info_job = { .build = build_device_info };
+
+
 /**
  * @brief Send device identification information via WebSocket.
  * 
@@ -36,23 +65,9 @@ static const char *TAG = "STATE UPDATE OFFLINE";
 void send_device_info(void) {
     if (esp_server == NULL) return;
 
-    char timestamp[20];
-    get_current_timestamp(timestamp, sizeof(timestamp));
-
-    // Create the JSON object
-    cJSON *json = cJSON_CreateObject();
-    cJSON_AddStringToObject(json, "event", "device_info");
-    cJSON_AddStringToObject(json, "timestamp", timestamp);
-    cJSON_AddStringToObject(json, "device_id", DEVICE_ID);
-
-    // Convert the JSON object to string (allocate memory)
-    char *json_string = cJSON_PrintUnformatted(json);
-    cJSON_Delete(json);
-
-    // Send via WebSocket
-    if (httpd_queue_work(esp_server, websocket_async_send, json_string) != ESP_OK) {
+    // Payload is built in the httpd task (no heap copy)
+    if (websocket_queue_payload(&device_info_job) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to queue work");
-        free(json_string);
     }
 }
 
@@ -63,16 +78,17 @@ void send_device_info(void) {
  *==============================================================*/
 
 /**
- * @brief Send complete valve state data via WebSocket.
+ * @brief Write complete valve state JSON into buf
  * 
  * Includes:
  *   - Controller state
  *   - Valve position
  *   - Limit switch state
  *   - Error message
+ *
+ * @return JSON length, or -1 if buf is too small
  */
-void send_device_data(void) {
-    if (esp_server == NULL) return;
+static int build_device_data(char *buf, size_t size) {
 
     /*----------------- Copy Shared Data Safely -----------------*/
     GetData localCopy;
@@ -83,231 +99,254 @@ void send_device_data(void) {
     char timestamp[25];
     get_current_timestamp(timestamp, sizeof(timestamp));
 
+    JsonWriter w;
+    jw_init(&w, buf, size);
 
-    /*----------------- Create Root JSON -----------------*/
-    cJSON *json = cJSON_CreateObject();
-    cJSON_AddStringToObject(json, "event", "valve_data");
-    cJSON_AddStringToObject(json, "timestamp", timestamp);
-    cJSON_AddStringToObject(json, "device_id", DEVICE_ID);
+    /*----------------- Root Object -----------------*/
+    jw_object_begin(&w);
+    jw_key_string(&w, "event", "valve_data");
+    jw_key_string(&w, "timestamp", timestamp);
+    jw_key_string(&w, "device_id", DEVICE_ID);
+    msg_stamp_write(&w, MSG_CHANNEL_WS);
 
     // get_controller object
-    cJSON *controller_data = cJSON_CreateObject();
-    cJSON_AddBoolToObject(controller_data, "schedule", localCopy.schedule_control);
-    cJSON_AddBoolToObject(controller_data, "sensor", localCopy.sensor_control);
-    cJSON_AddItemToObject(json, "get_controller", controller_data);
+    jw_key_object_begin(&w, "get_controller");
+    jw_key_bool(&w, "schedule", localCopy.schedule_control);
+    jw_key_bool(&w, "sensor", localCopy.sensor_control);
+    jw_object_end(&w);
 
     // get_valvedata object
-    cJSON *valve_data = cJSON_CreateObject();
-    cJSON_AddNumberToObject(valve_data, "angle", localCopy.angle);
-    cJSON_AddBoolToObject(valve_data, "is_open", localCopy.is_open);
-    cJSON_AddBoolToObject(valve_data, "is_close", localCopy.is_close);
-    cJSON_AddItemToObject(json, "get_valvedata", valve_data);
+    jw_key_object_begin(&w, "get_valvedata");
+    jw_key_int(&w, "angle", localCopy.angle);
+    jw_key_bool(&w, "is_open", localCopy.is_open);
+    jw_key_bool(&w, "is_close", localCopy.is_close);
+    jw_object_end(&w);
 
     // get_limitdata object
-    cJSON *limit_data = cJSON_CreateObject();
-    cJSON_AddBoolToObject(limit_data, "is_open_limit", localCopy.open_limit_available);
-    cJSON_AddBoolToObject(limit_data, "open_limit", localCopy.open_limit_click);
-    cJSON_AddBoolToObject(limit_data, "is_close_limit", localCopy.close_limit_available);
-    cJSON_AddBoolToObject(limit_data, "close_limit", localCopy.close_limit_click);
-    cJSON_AddItemToObject(json, "get_limitdata", limit_data);
+    jw_key_object_begin(&w, "get_limitdata");
+    jw_key_bool(&w, "is_open_limit", localCopy.open_limit_available);
+    jw_key_bool(&w, "open_limit", localCopy.open_limit_click);
+    jw_key_bool(&w, "is_close_limit", localCopy.close_limit_available);
+    jw_key_bool(&w, "close_limit", localCopy.close_limit_click);
+    jw_object_end(&w);
 
     // Error
-    cJSON_AddStringToObject(json, "Error", localCopy.error_msg);
+    jw_key_string(&w, "Error", localCopy.error_msg);
+    jw_object_end(&w);
 
-    /* Convert to string */
-    char *json_string = cJSON_PrintUnformatted(json);
-    cJSON_Delete(json);
+    return jw_finish(&w);
+}
+
+static const WsPayloadJob device_data_job = { .build = build_device_data };
 
-    if (json_string == NULL) {
-        ESP_LOGE(TAG, "Failed to create JSON string");
-        return;
-    }
 
-    /* Send asynchronously via WebSocket */
-    if (httpd_queue_work(esp_server, websocket_async_send, json_string) != ESP_OK) {
+/**
+ * @brief Send complete valve state data via WebSocket.
+ */
+void send_device_data(void) {
+    if (esp_server == NULL) return;
+
+    /* Built and sent asynchronously in the httpd task */
+    if (websocket_queue_payload(&device_data_job) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to queue websocket work");
-        free(json_string);
     }
 }
 
 
 
 /*===============================================================
- *                OFFLINE EVENT HANDLER
+ *                OFFLINE EVENT HANDLERS
  *==============================================================*/
 
 /**
- * @brief Handles WebSocket events after authentication.
- * 
- * Supported events:
- *   - device_basic_info
- *   - set_valve_basic
- *   - set_valve_wifi
+ * @brief device_basic_info: send the full valve state if device_id matches
  */
-void offline_data(cJSON *event, cJSON *json) {
-
-    /*----------------- DEVICE BASIC INFO REQUEST -----------------*/
-    if ( strcmp(event->valuestring, "device_basic_info") == 0) {
-        ESP_LOGI(TAG, "Event matched: device_basic_info");
-
-        cJSON *data = cJSON_GetObjectItem(json, "data");
-        if (data != NULL && cJSON_IsObject(data)) {
-
-            cJSON *user_id = cJSON_GetObjectItem(data, "user_id");
-            cJSON *device_id = cJSON_GetObjectItem(data, "device_id");
-            if (device_id != NULL && cJSON_IsString(device_id)) {
-                if (strcmp(device_id->valuestring, DEVICE_ID) == 0) {
-                    ESP_LOGW(TAG, "User send the correct device ID %s, user ID %s", device_id->valuestring, user_id->valuestring);
-                    send_device_data();
-                    ESP_LOGW(TAG, "Send valve data");
-                } else {
-                    ESP_LOGW(TAG, "User dont send the correct device ID");
-                }
+static void on_device_basic_info(const ValveCommand *cmd, void *arg) {
+    ESP_LOGI(TAG, "Event matched: device_basic_info");
+
+    if (cmd->has_data) {
+        if (cmd->data_device_id[0] != '\0') {
+            if (strcmp(cmd->data_device_id, DEVICE_ID) == 0) {
+                ESP_LOGW(TAG, "User send the correct device ID %s, user ID %s", cmd->data_device_id, cmd->data_user_id);
+                send_device_data();
+                ESP_LOGW(TAG, "Send valve data");
             } else {
-                ESP_LOGW(TAG, "\"device_id\" is false or missing");
+                ESP_LOGW(TAG, "User dont send the correct device ID");
             }
         } else {
-            ESP_LOGW(TAG, "\"data\" is false or missing");
+            ESP_LOGW(TAG, "\"device_id\" is false or missing");
         }
-    /*----------------- SET VALVE BASIC CONTROL -----------------*/
-    } else if ( strcmp(event->valuestring, "set_valve_basic") == 0) {
-        ESP_LOGI(TAG, "Event matched: set_valve_basic");
-        SetData localCopy;
-
-        cJSON *valve_data = cJSON_GetObjectItem(json, "valve_data");
-        if (valve_data != NULL && cJSON_IsObject(valve_data)) {
-            localCopy.schedule_control = false;
-            localCopy.sensor_control = false;
-
-            cJSON *set_angle = cJSON_GetObjectItem(valve_data, "set_angle");
-            if (set_angle != NULL && cJSON_IsBool(set_angle) && set_angle->valueint == 1) {
-                
-                cJSON *angle = cJSON_GetObjectItem(valve_data, "angle");
-                if (angle != NULL && cJSON_IsNumber(angle)) {
-                    localCopy.set_angle = true;
-                    localCopy.angle = angle->valueint;
-                    ESP_LOGI(TAG, "Angle: %d", angle->valueint);
-
-                } else {
-                    ESP_LOGW(TAG, "Angle field is missing or not a number");
-                }
-            } else {
-                ESP_LOGW(TAG, "\"set_angle\" is false or missing");
-                localCopy.set_angle = false;
-                localCopy.angle = 0;
-            }
+    } else {
+        ESP_LOGW(TAG, "\"data\" is false or missing");
+    }
+}
 
-            xSemaphoreTake(serverMutex, portMAX_DELAY);
-            serverData = localCopy;
-            xSemaphoreGive(serverMutex);
-            ESP_LOGI(TAG, "ESP global variable updated with new valve control data");
 
+/**
+ * @brief set_valve_basic: manual angle control
+ */
+static void on_set_valve_basic(const ValveCommand *cmd, void *arg) {
+    ESP_LOGI(TAG, "Event matched: set_valve_basic");
+
+    // Manual control: schedule and sensor off, angle only if requested
+    ShadowPatch patch = {0};
+    patch.fields = SHADOW_F_SCHEDULE_CONTROL | SHADOW_F_SENSOR_CONTROL | SHADOW_F_ANGLE;
+
+    if (cmd->has_valve_data) {
+        if (cmd->has_set_angle && cmd->set_angle) {
+            if (cmd->has_angle) {
+                patch.set_angle = true;
+                patch.angle = cmd->angle;
+                ESP_LOGI(TAG, "Angle: %d", cmd->angle);
+
+            } else {
+                ESP_LOGW(TAG, "Angle field is missing or not a number");
+            }
         } else {
-            ESP_LOGW(TAG, "\"valve_data\" field is missing or not an object");
+            ESP_LOGW(TAG, "\"set_angle\" is false or missing");
         }
 
+        shadow_apply(&patch, NULL, NULL);
+        ESP_LOGI(TAG, "ESP global variable updated with new valve control data");
+
+    } else {
+        ESP_LOGW(TAG, "\"valve_data\" field is missing or not an object");
     }
-    /*----------------- UPDATE WIFI CREDENTIALS -----------------*/
-    else if ( strcmp(event->valuestring, "set_valve_wifi") == 0) {
-        ESP_LOGI(TAG, "Event matched: set_valve_wifi");
-
-        cJSON *wifi_data = cJSON_GetObjectItem(json, "wifi_data");
-        if (wifi_data != NULL && cJSON_IsObject(wifi_data)) {
-            cJSON *ssid = cJSON_GetObjectItem(wifi_data, "ssid");
-            cJSON *password = cJSON_GetObjectItem(wifi_data, "password");
-            ESP_LOGI(TAG, "ssid: %s, password: %s", ssid->valuestring, password->valuestring);
-
-            if (!cJSON_IsString(ssid) || !cJSON_IsString(password)) {
-                ESP_LOGE(TAG, "Invalid WiFi JSON format");
-            }
+}
 
-            if (strcmp(wifiStaData.ssid, ssid->valuestring) != 0 || strcmp(wifiStaData.password, password->valuestring) != 0) {
-                memset(wifiStaData.ssid, 0, sizeof(wifiStaData.ssid));
-                memset(wifiStaData.password, 0, sizeof(wifiStaData.password));
 
-                strncpy(wifiStaData.ssid, ssid->valuestring, sizeof(wifiStaData.ssid) - 1);
-                strncpy(wifiStaData.password, password->valuestring, sizeof(wifiStaData.password) - 1);
+/**
+ * @brief set_valve_wifi: store new credentials and restart if they changed
+ */
+static void on_set_valve_wifi(const ValveCommand *cmd, void *arg) {
+    ESP_LOGI(TAG, "Event matched: set_valve_wifi");
 
-                wifiStaData.set_wifi = true;
+    if (!cmd->has_wifi) {
+        ESP_LOGW(TAG, "\"wifi_data\" is missing or has an invalid format");
+        return;
+    }
 
-                wifi_storage_save();
+    ESP_LOGI(TAG, "ssid: %s", cmd->ssid);
 
-                ESP_LOGI(TAG, "WiFi updated. Restarting...");
-                esp_restart();
+    if (strcmp(wifiStaData.ssid, cmd->ssid) != 0 || strcmp(wifiStaData.password, cmd->password) != 0) {
+        memset(wifiStaData.ssid, 0, sizeof(wifiStaData.ssid));
+        memset(wifiStaData.password, 0, sizeof(wifiStaData.password));
 
-            } else {
-                ESP_LOGI(TAG, "WiFi data unchanged. No action taken.");
-            }
-        
-            
+        strncpy(wifiStaData.ssid, cmd->ssid, sizeof(wifiStaData.ssid) - 1);
+        strncpy(wifiStaData.password, cmd->password, sizeof(wifiStaData.password) - 1);
 
-        } else {
-            ESP_LOGW(TAG, "\"wifi_data\" field is missing or not an object");
-        }
+        wifiStaData.set_wifi = true;
+
+        wifi_storage_save();
+
+        ESP_LOGI(TAG, "WiFi updated. Restarting...");
+        esp_restart();
+
+    } else {
+        ESP_LOGI(TAG, "WiFi data unchanged. No action taken.");
     }
-    else {
-        ESP_LOGW(TAG, "Event type does not match: %s", event->valuestring);
+}
+
+
+/**
+ * @brief request_device_info: passkey authentication
+ *
+ * @param arg  bool *connection_authorized of the client
+ */
+static void on_request_device_info(const ValveCommand *cmd, void *arg) {
+    bool *connection_authorized = arg;
+
+    ESP_LOGI(TAG, "Event matched: request_device_info");
+
+    if (cmd->has_passkey && (strcmp(cmd->passkey, PASSKEY_VALUE) == 0)) {
+        *connection_authorized = true;
+        ESP_LOGI(TAG, "Passkey accept");
+
+        send_device_info();
+        ESP_LOGI(TAG, "Send Device info");
+    } else {
+        *connection_authorized = false;
+        ESP_LOGI(TAG, "Passkey not accept");
     }
 }
 
 
 
 
+/*===============================================================
+ *                  DISPATCH TABLES
+ *==============================================================*/
+
+// Events accepted after authentication
+static const CmdRoute offline_routes[] = {
+    { "device_basic_info",  on_device_basic_info },
+    { "set_valve_basic",    on_set_valve_basic },
+    { "set_valve_wifi",     on_set_valve_wifi },
+};
+
+// Events accepted before authentication
+static const CmdRoute auth_routes[] = {
+    { "request_device_info", on_request_device_info },
+};
+
+static CmdDispatchTable offline_table;
+static CmdDispatchTable auth_table;
+
+
+/**
+ * @brief Build the WebSocket dispatch tables (call once before the first frame)
+ */
+void websocket_state_init(void) {
+    static bool initialized = false;
+    if (initialized) return;
+
+    cmd_dispatch_init(&offline_table, "ws events", offline_routes,
+                      sizeof(offline_routes) / sizeof(offline_routes[0]));
+    cmd_dispatch_init(&auth_table, "ws auth", auth_routes,
+                      sizeof(auth_routes) / sizeof(auth_routes[0]));
+    initialized = true;
+}
+
+
+
+
 /*===============================================================
  *                  PROCESS WEBSOCKET MESSAGE
  *==============================================================*/
 
+// Messages are processed in the httpd task only; static decode
+// storage keeps inbound frames off the heap.
+static JsonToken ws_tokens[JSON_DECODER_MAX_TOKENS];
+static ValveCommand ws_cmd;
+
+
 /**
  * @brief Entry point for WebSocket JSON message processing.
  * 
  * Handles:
  *   - Authentication (passkey validation)
- *   - Routing to offline_data after authorization
+ *   - Routing to the offline event handlers after authorization
  */
-void process_message(const char *payload, bool *connection_authorized) {
+void process_message(const char *payload, size_t len, bool *connection_authorized) {
 
-    // Parse the JSON string into a cJSON object
-    cJSON *json = cJSON_Parse(payload);
-    if (json == NULL) {
+    // Decode the frame in place into a typed command
+    if (command_decode(payload, len, PAYLOAD_JSON, ws_tokens, JSON_DECODER_MAX_TOKENS, &ws_cmd) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to parse JSON");
         return;
     }
 
-    // Extract the "event" field
-    cJSON *event = cJSON_GetObjectItem(json, "event");
-    if (event == NULL || !cJSON_IsString(event)) {
+    if (ws_cmd.event[0] == '\0') {
         ESP_LOGW(TAG, "\"event\" field is missing in the JSON message");
-        cJSON_Delete(json);
         return;
     }
 
 
     /*----------------- If Already Authorized -----------------*/
     if ( *connection_authorized) {
-        offline_data( event, json);
+        cmd_dispatch(&offline_table, ws_cmd.event, &ws_cmd, connection_authorized);
     } 
     /*----------------- Authentication Phase -----------------*/
-    else {
-        if (strcmp(event->valuestring, "request_device_info") == 0) {
-            ESP_LOGI(TAG, "Event matched: request_device_info");
-
-            cJSON *passkey   = cJSON_GetObjectItem(json, "passkey");
-            if ( cJSON_IsString(passkey) && (strcmp(passkey->valuestring, PASSKEY_VALUE) == 0)) {
-                *connection_authorized = true;
-                ESP_LOGI(TAG, "Passkey accept");
-
-                send_device_info();
-                ESP_LOGI(TAG, "Send Device info");
-            } else {
-                *connection_authorized = false;
-                ESP_LOGI(TAG, "Passkey not accept");
-            }
-        } else {
-            ESP_LOGW(TAG, "Connection not authorized");
-        }
+    else if (!cmd_dispatch(&auth_table, ws_cmd.event, &ws_cmd, connection_authorized)) {
+        ESP_LOGW(TAG, "Connection not authorized");
     }
-
-    // Free memory to prevent leaks
-    cJSON_Delete(json);
 }
-
@@ -3,7 +3,7 @@
 
 #include "websocket_server_fn.h"
 
-
-void process_message(const char *payload, bool *connection_authorized);
+void websocket_state_init(void);
+void process_message(const char *payload, size_t len, bool *connection_authorized);
 
 #endif
\ No newline at end of file